@@ -3,6 +3,12 @@
 #include <esp_ota_ops.h>
 #include <cJSON.h>
 #include "settings.h"
+#include "json_writer.h"
+#include "i2c_bus.h"
+#include "rules.h"
+#include "history.h"
+#include <time.h>
+#include <esp_timer.h>
 
 static esp_err_t respond_json(httpd_req_t *req, cJSON *resp)
 {
@@ -18,14 +24,33 @@ static esp_err_t respond_json(httpd_req_t *req, cJSON *resp)
     return res;
 }
 
+static esp_err_t respond_writer(httpd_req_t *req, json_writer_t *w)
+{
+    if (json_writer_finish(w) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Response too big");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    return httpd_resp_send(req, w->buf, (ssize_t)w->len);
+}
+
 static esp_err_t respond_api(httpd_req_t *req, esp_err_t err, const char *message)
 {
-    cJSON *resp = cJSON_CreateObject();
-    cJSON_AddNumberToObject(resp, "result", err);
-    cJSON_AddStringToObject(resp, "name", esp_err_to_name(err));
-    cJSON_AddStringToObject(resp, "message", message ? message : "");
+    char buf[API_RESPONSE_SIZE];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), true);
 
-    return respond_json(req, resp);
+    json_object_start(&w, NULL);
+    json_add_number(&w, "result", err);
+    json_add_string(&w, "name", esp_err_to_name(err));
+    json_add_string(&w, "message", message ? message : "");
+    json_object_end(&w);
+
+    return respond_writer(req, &w);
 }
 
 static esp_err_t parse_post_json(httpd_req_t *req, const char **msg, cJSON **json)
@@ -86,13 +111,18 @@ static esp_err_t get_info(httpd_req_t *req)
 {
     const esp_app_desc_t *app_desc = esp_app_get_description();
 
-    cJSON *res = cJSON_CreateObject();
-    cJSON_AddStringToObject(res, "app_name", app_desc->project_name);
-    cJSON_AddStringToObject(res, "app_version", app_desc->version);
-    cJSON_AddStringToObject(res, "build_date", app_desc->date);
-    cJSON_AddStringToObject(res, "idf_ver", app_desc->idf_ver);
+    char buf[API_RESPONSE_SIZE];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), true);
 
-    return respond_json(req, res);
+    json_object_start(&w, NULL);
+    json_add_string(&w, "app_name", app_desc->project_name);
+    json_add_string(&w, "app_version", app_desc->version);
+    json_add_string(&w, "build_date", app_desc->date);
+    json_add_string(&w, "idf_ver", app_desc->idf_ver);
+    json_object_end(&w);
+
+    return respond_writer(req, &w);
 }
 
 static const httpd_uri_t route_get_info = {
@@ -181,6 +211,156 @@ static const httpd_uri_t route_get_reboot = {
 
 ////////////////////////////////////////////////////////////////////////////////
 
+static const char *i2c_prio_names[I2C_BUS_PRIO_COUNT] = { "bulk", "normal", "urgent" };
+
+static esp_err_t get_i2c(httpd_req_t *req)
+{
+    char buf[API_RESPONSE_SIZE * I2C_BUS_PORTS];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), false);
+
+    int64_t uptime = esp_timer_get_time();
+    json_array_start(&w, NULL);
+    for (i2c_port_t p = 0; p < I2C_BUS_PORTS; p++)
+    {
+        i2c_bus_stats_t stats;
+        i2c_bus_get_stats(p, &stats);
+
+        json_object_start(&w, NULL);
+        json_add_number(&w, "port", p);
+        json_add_number(&w, "utilization", uptime ? 100.0 * (double)stats.busy_us / (double)uptime : 0);
+        json_add_number(&w, "max_hold_us", stats.max_hold_us);
+        json_add_number(&w, "timeouts", stats.timeouts);
+        for (size_t i = 0; i < I2C_BUS_PRIO_COUNT; i++)
+        {
+            json_object_start(&w, i2c_prio_names[i]);
+            json_add_number(&w, "sessions", stats.sessions[i]);
+            json_add_number(&w, "avg_wait_us",
+                stats.sessions[i] ? (double)stats.total_wait_us[i] / stats.sessions[i] : 0);
+            json_add_number(&w, "max_wait_us", stats.max_wait_us[i]);
+            json_object_end(&w);
+        }
+        json_object_end(&w);
+    }
+    json_array_end(&w);
+
+    return respond_writer(req, &w);
+}
+
+static const httpd_uri_t route_get_i2c = {
+    .uri = "/api/i2c",
+    .method = HTTP_GET,
+    .handler = get_i2c,
+    .user_ctx = NULL
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t get_rules(httpd_req_t *req)
+{
+    char *txt = rules_get();
+    if (!txt)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_sendstr(req, txt);
+    free(txt);
+
+    return res;
+}
+
+static const httpd_uri_t route_get_rules = {
+    .uri = "/api/rules",
+    .method = HTTP_GET,
+    .handler = get_rules,
+    .user_ctx = NULL
+};
+
+static esp_err_t post_rules(httpd_req_t *req)
+{
+    const char *msg = NULL;
+    cJSON *json = NULL;
+
+    esp_err_t err = parse_post_json(req, &msg, &json);
+    if (err == ESP_OK)
+        err = rules_set(json, &msg);
+
+    if (json) cJSON_Delete(json);
+    return respond_api(req, err, msg);
+}
+
+static const httpd_uri_t route_post_rules = {
+    .uri = "/api/rules",
+    .method = HTTP_POST,
+    .handler = post_rules,
+    .user_ctx = NULL
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t send_chunk(const char *data, size_t len, void *ctx)
+{
+    return httpd_resp_send_chunk((httpd_req_t *)ctx, data, (ssize_t)len);
+}
+
+// Unix time, zero or negative values are relative to now
+static uint32_t query_time(const char *query, const char *key, uint32_t now, uint32_t def)
+{
+    char param[16];
+    if (httpd_query_key_value(query, key, param, sizeof(param)) != ESP_OK)
+        return def;
+    long val = strtol(param, NULL, 10);
+    return val > 0 ? (uint32_t)val : now + val;
+}
+
+static esp_err_t get_history(httpd_req_t *req)
+{
+    char query[128];
+    char uid[DEVICE_UID_SIZE];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK
+        || httpd_query_key_value(query, "uid", uid, sizeof(uid)) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid query");
+        return ESP_FAIL;
+    }
+
+    uint32_t now = (uint32_t)time(NULL);
+    uint32_t from = query_time(query, "from", now, now - 3600);
+    uint32_t to = query_time(query, "to", now, now);
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    esp_err_t res = history_query(uid, from, to, send_chunk, req);
+    if (res == ESP_ERR_NOT_FOUND)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No history of device");
+        return ESP_FAIL;
+    }
+    if (res == ESP_ERR_NO_MEM || res == ESP_ERR_INVALID_STATE)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+    if (res != ESP_OK)
+        return res;
+
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static const httpd_uri_t route_get_history = {
+    .uri = "/api/history",
+    .method = HTTP_GET,
+    .handler = get_history,
+    .user_ctx = NULL
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
 esp_err_t api_init(httpd_handle_t server)
 {
     CHECK(httpd_register_uri_handler(server, &route_get_info));
@@ -188,6 +368,10 @@ esp_err_t api_init(httpd_handle_t server)
     CHECK(httpd_register_uri_handler(server, &route_get_settings));
     CHECK(httpd_register_uri_handler(server, &route_post_settings));
     CHECK(httpd_register_uri_handler(server, &route_get_reboot));
+    CHECK(httpd_register_uri_handler(server, &route_get_i2c));
+    CHECK(httpd_register_uri_handler(server, &route_get_rules));
+    CHECK(httpd_register_uri_handler(server, &route_post_rules));
+    CHECK(httpd_register_uri_handler(server, &route_get_history));
 
     return ESP_OK;
 }
@@ -10,6 +10,10 @@
  * GET  /api/settings/reset
  * GET  /api/settings
  * POST /api/settings
+ * GET  /api/i2c
+ * GET  /api/rules
+ * POST /api/rules
+ * GET  /api/history?uid=<uid>&from=<time>&to=<time>
  */
 
 esp_err_t api_init(httpd_handle_t server);
@@ -0,0 +1,335 @@
+#include "backlog.h"
+#include <math.h>
+#include <stddef.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <esp_rom_crc.h>
+#include "common.h"
+#include "cvector.h"
+#include "mqtt.h"
+#include "system.h"
+#include "system_clock.h"
+
+#define SECTOR_SIZE 4096 // flash erase unit
+#define SLOT_SIZE 32
+#define SLOTS (SECTOR_SIZE / SLOT_SIZE) // slot 0 holds sector header
+#define HEADER_MAGIC 0xB10C0001
+#define NOT_SENT 0xff
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t crc;
+    uint8_t reserved[SLOT_SIZE - 12];
+} header_t;
+
+typedef struct
+{
+    uint32_t time; // unix time, s
+    float value;
+    char uid[DEVICE_UID_SIZE];
+    uint8_t type;  // device_type_t
+    uint8_t sent;  // cleared on the last record of each forwarded batch
+    uint16_t crc;  // of the fields before `sent`
+} record_t;
+
+_Static_assert(sizeof(header_t) == SLOT_SIZE, "Invalid backlog header size");
+_Static_assert(sizeof(record_t) == SLOT_SIZE, "Invalid backlog record size");
+
+typedef struct
+{
+    size_t sector;
+    size_t slot;
+} pos_t;
+
+static const esp_partition_t *part = NULL;
+static size_t sectors = 0;
+static uint32_t head_seq = 0;
+static pos_t head;         // next free slot, SLOTS if head sector is full
+static pos_t tail;         // oldest unsent record, valid if pending > 0
+static size_t pending = 0; // slots from tail to head
+static int64_t next_batch = 0;
+static char payload[BACKLOG_BATCH * 64];
+static cvector_vector_type(record_t) staged = NULL; // appended, not written yet
+
+static inline size_t slot_offset(pos_t p)
+{
+    return p.sector * SECTOR_SIZE + p.slot * SLOT_SIZE;
+}
+
+static void advance(pos_t *p)
+{
+    if (++p->slot < SLOTS)
+        return;
+    p->sector = (p->sector + 1) % sectors;
+    p->slot = 1;
+}
+
+static bool is_blank(const void *data, size_t size)
+{
+    const uint8_t *b = data;
+    for (size_t i = 0; i < size; i++)
+        if (b[i] != 0xff)
+            return false;
+    return true;
+}
+
+static uint32_t header_crc(const header_t *h)
+{
+    return esp_rom_crc32_le(0, (const uint8_t *)h, offsetof(header_t, crc));
+}
+
+static uint16_t record_crc(const record_t *r)
+{
+    return esp_rom_crc16_le(0, (const uint8_t *)r, offsetof(record_t, sent));
+}
+
+static esp_err_t read_header(size_t sector, header_t *h, bool *valid)
+{
+    ESP_RETURN_ON_ERROR(esp_partition_read(part, sector * SECTOR_SIZE, h, sizeof(header_t)),
+        TAG, "Error reading backlog sector %u", sector);
+    *valid = h->magic == HEADER_MAGIC && h->crc == header_crc(h);
+    return ESP_OK;
+}
+
+static esp_err_t open_sector(size_t sector, uint32_t seq)
+{
+    ESP_RETURN_ON_ERROR(esp_partition_erase_range(part, sector * SECTOR_SIZE, SECTOR_SIZE),
+        TAG, "Error erasing backlog sector %u", sector);
+
+    // sector without valid header is ignored on recovery, so erase is safe to interrupt
+    header_t h;
+    memset(&h, 0xff, sizeof(h));
+    h.magic = HEADER_MAGIC;
+    h.seq = seq;
+    h.crc = header_crc(&h);
+    ESP_RETURN_ON_ERROR(esp_partition_write(part, sector * SECTOR_SIZE, &h, sizeof(h)),
+        TAG, "Error writing backlog sector %u", sector);
+
+    head_seq = seq;
+    head.sector = sector;
+    head.slot = 1;
+    return ESP_OK;
+}
+
+static esp_err_t open_next_sector()
+{
+    size_t sector = (head.sector + 1) % sectors;
+    if (pending && tail.sector == sector)
+    {
+        // log is full, oldest sector is overwritten
+        size_t lost = SLOTS - tail.slot;
+        ESP_LOGW(TAG, "Backlog is full, dropping %u oldest records", lost);
+        pending -= lost;
+        tail.sector = (sector + 1) % sectors;
+        tail.slot = 1;
+    }
+    return open_sector(sector, head_seq + 1);
+}
+
+static esp_err_t recover()
+{
+    header_t h;
+    bool valid, found = false;
+    for (size_t s = 0; s < sectors; s++)
+    {
+        CHECK(read_header(s, &h, &valid));
+        if (valid && (!found || (int32_t)(h.seq - head_seq) > 0))
+        {
+            found = true;
+            head_seq = h.seq;
+            head.sector = s;
+        }
+    }
+    if (!found)
+    {
+        ESP_LOGI(TAG, "Backlog is empty, formatting");
+        return open_sector(0, 1);
+    }
+
+    // log consists of sectors with consecutive sequence numbers before the head
+    size_t used = 1;
+    for (; used < sectors; used++)
+    {
+        CHECK(read_header((head.sector + sectors - used) % sectors, &h, &valid));
+        if (!valid || h.seq != head_seq - used)
+            break;
+    }
+
+    record_t *buf = malloc(SECTOR_SIZE);
+    if (!buf)
+        return ESP_ERR_NO_MEM;
+
+    esp_err_t res = ESP_OK;
+    pending = 0;
+    for (size_t i = used; i > 0; i--)
+    {
+        size_t s = (head.sector + sectors - (i - 1)) % sectors;
+        res = esp_partition_read(part, s * SECTOR_SIZE, buf, SECTOR_SIZE);
+        if (res != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Error reading backlog sector %u: %d (%s)", s, res, esp_err_to_name(res));
+            goto exit;
+        }
+
+        size_t end = SLOTS;
+        if (s == head.sector)
+        {
+            // records are appended in order, torn write counts as used slot
+            while (end > 1 && is_blank(&buf[end - 1], SLOT_SIZE))
+                end--;
+            head.slot = end;
+        }
+        for (size_t slot = 1; slot < end; slot++)
+        {
+            if (buf[slot].sent != NOT_SENT)
+            {
+                // everything up to here is forwarded
+                pending = 0;
+                continue;
+            }
+            if (!pending)
+            {
+                tail.sector = s;
+                tail.slot = slot;
+            }
+            pending++;
+        }
+    }
+
+exit:
+    free(buf);
+    return res;
+}
+
+esp_err_t backlog_init()
+{
+    cvector_set_size(staged, 0);
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, BACKLOG_PARTITION);
+    if (!part)
+    {
+        // partition table is not updated by OTA
+        ESP_LOGE(TAG, "Partition '%s' not found, backlog disabled. Reflash over serial to update partition table",
+            BACKLOG_PARTITION);
+        return ESP_OK;
+    }
+    sectors = part->size / SECTOR_SIZE;
+    if (sectors < 2)
+    {
+        ESP_LOGW(TAG, "Partition '%s' is too small, backlog disabled", BACKLOG_PARTITION);
+        part = NULL;
+        return ESP_OK;
+    }
+
+    esp_err_t r = recover();
+    if (r != ESP_OK)
+    {
+        part = NULL;
+        return r;
+    }
+
+    ESP_LOGI(TAG, "Backlog: %u sectors, %u records pending", sectors, pending);
+    return ESP_OK;
+}
+
+void backlog_append(const device_t *dev)
+{
+    if (!part || !system_clock_is_set())
+        return;
+
+    record_t r;
+    memset(&r, 0, sizeof(r));
+    r.time = (uint32_t)device_update_time(dev);
+    r.value = device_value(dev);
+    strncpy(r.uid, dev->uid, sizeof(r.uid) - 1);
+    r.type = dev->type;
+    r.sent = NOT_SENT;
+    r.crc = record_crc(&r);
+    cvector_push_back(staged, r);
+}
+
+static void write_record(const record_t *r)
+{
+    if (head.slot == SLOTS && open_next_sector() != ESP_OK)
+        return;
+    if (!pending)
+        tail = head;
+
+    esp_err_t res = esp_partition_write(part, slot_offset(head), r, sizeof(*r));
+    if (res != ESP_OK)
+        ESP_LOGE(TAG, "Error writing backlog record: %d (%s)", res, esp_err_to_name(res));
+    // slot may be partially written, never reuse it
+    head.slot++;
+    pending++;
+}
+
+TickType_t backlog_process()
+{
+    // staged records are written here, erasing a sector may take tens of ms
+    for (size_t i = 0; i < cvector_size(staged); i++)
+        write_record(&staged[i]);
+    cvector_set_size(staged, 0);
+
+    if (!pending)
+        return portMAX_DELAY;
+
+    int64_t now = esp_timer_get_time();
+    if (system_mode() != MODE_ONLINE)
+        return pdMS_TO_TICKS(BACKLOG_INTERVAL_MS);
+    if (now < next_batch)
+        return pdMS_TO_TICKS((next_batch - now) / 1000) + 1;
+    next_batch = now + BACKLOG_INTERVAL_MS * 1000;
+
+    record_t r;
+    char value[24];
+    pos_t p = tail, last = tail;
+    size_t slots = 0, count = 0, len = 0;
+    while (slots < pending && count < BACKLOG_BATCH)
+    {
+        if (esp_partition_read(part, slot_offset(p), &r, sizeof(r)) != ESP_OK)
+            break;
+        slots++;
+        last = p;
+        advance(&p);
+        if (r.crc != record_crc(&r))
+            continue;
+
+        r.uid[sizeof(r.uid) - 1] = 0;
+        if (r.type != DEV_SENSOR && r.type != DEV_NUMBER)
+            snprintf(value, sizeof(value), "%d", r.value != 0);
+        else if (!isfinite(r.value))
+            strcpy(value, "null");
+        else
+            snprintf(value, sizeof(value), "%.6g", r.value);
+        len += snprintf(payload + len, sizeof(payload) - len, "%c[\"%s\",%" PRIu32 ",%s]",
+            len ? ',' : '[', r.uid, r.time, value);
+        count++;
+    }
+    if (!slots)
+        return pdMS_TO_TICKS(BACKLOG_INTERVAL_MS);
+
+    if (count)
+    {
+        payload[len++] = ']';
+        if (mqtt_publish_subtopic(BACKLOG_TOPIC, payload, (int)len, BACKLOG_QOS, 0) < 0)
+        {
+            ESP_LOGW(TAG, "Error forwarding backlog, will retry");
+            return pdMS_TO_TICKS(BACKLOG_INTERVAL_MS);
+        }
+    }
+
+    // records are marked in place, bits are only cleared so no erase is needed
+    uint8_t sent = 0;
+    esp_err_t res = esp_partition_write(part, slot_offset(last) + offsetof(record_t, sent), &sent, sizeof(sent));
+    if (res != ESP_OK)
+        ESP_LOGW(TAG, "Error marking backlog records: %d (%s)", res, esp_err_to_name(res));
+
+    tail = p;
+    pending -= slots;
+    if (pending)
+        return pdMS_TO_TICKS(BACKLOG_INTERVAL_MS);
+
+    ESP_LOGI(TAG, "Backlog forwarded");
+    return portMAX_DELAY;
+}
@@ -0,0 +1,39 @@
+#ifndef ESP_IOT_NODE_PLUS_BACKLOG_H_
+#define ESP_IOT_NODE_PLUS_BACKLOG_H_
+
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include "device.h"
+
+/*
+ * Store-and-forward log of device states for offline periods.
+ *
+ * While node is offline, states which would have been published are appended
+ * to a ring of fixed size records in BACKLOG_PARTITION. After reconnect they
+ * are forwarded in batches to `<node>/backlog` topic with original timestamps:
+ *
+ * [["dht0_t",1760000000,21.5],["relay2",1760000012,1],...]
+ *
+ * Every sector begins with a header holding its sequence number, so the log
+ * is recovered by scanning the partition after reset. Records and headers
+ * are protected by CRC, torn writes are skipped. Sectors are erased one by
+ * one in a circle, so wear is spread over the whole partition. The oldest
+ * unsent records are dropped when the log is full.
+ *
+ * The partition table can't be changed by OTA, devices flashed before the
+ * backlog partition was added must be reflashed over serial to enable it.
+ */
+
+esp_err_t backlog_init();
+
+// Append device state, states are logged only if the clock is set.
+// Node appends every reported state while offline, from boot on, since drivers
+// start without waiting for the network.
+// Only copies the state, so it is safe to call with device locks held.
+void backlog_append(const device_t *dev);
+
+// Write appended states to flash and forward the next batch if online,
+// returns ticks until the next call is needed. Not to be called with device locks held.
+TickType_t backlog_process();
+
+#endif // ESP_IOT_NODE_PLUS_BACKLOG_H_
@@ -67,5 +67,7 @@
 #define DRIVER_GH_PH_METER_FREQUENCY 0 // default
 
 ////////////////////////////////////////////
+#define DRIVER_PID
+#define DRIVER_PID_STACK_SIZE 4096
 
 #endif /* BOARD_GH_3X_H_ */
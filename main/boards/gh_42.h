@@ -71,4 +71,8 @@
 #define DRIVER_GH_DIMMER_ZERO_GPIO 26
 #define DRIVER_GH_DIMMER_CTRL_GPIO 25
 
+////////////////////////////////////////////
+#define DRIVER_PID
+#define DRIVER_PID_STACK_SIZE 4096
+
 #endif /* BOARD_GH_42_H_ */
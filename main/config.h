@@ -23,6 +23,7 @@
 
 #define DEFAULT_TZ "UTC"
 #define DEFAULT_DT_FMT "%a %d.%m.%Y %H:%M:%S"
+#define SYSTEM_CLOCK_MIN_YEAR 2024 // earlier time means clock is not set
 #define DEFAULT_SNTP_INTERVAL (60 * 10)
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -48,6 +49,13 @@
 #define BUS_TIMEOUT_MS 500
 #define BUS_EVENT_DATA_SIZE 64
 
+////////////////////////////////////////////////////////////////////////////////
+/// I2C bus arbiter
+
+#define I2C_BUS_PORTS 2
+#define I2C_BUS_MAX_WAITERS 8 // per priority
+#define I2C_BUS_TIMEOUT_MS 1000
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Main task
 
@@ -65,18 +73,52 @@
 
 #define NODE_TASK_STACK_SIZE 8192
 #define NODE_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
-#define NODE_QUEUE_SIZE 20
+#define NODE_QUEUE_SIZE 4
+#define NODE_UPDATE_QUEUE_SIZE 64
+#define NODE_BATCH_STATE_SIZE 2048
 
 #define DRIVER_MAX_CONFIG_LEN 1024
 
+#define RULES_MAX 32
+#define RULES_NVS_KEY "rules"
+// Rules JSON shares about 12 KB of the nvs partition with settings, Wi-Fi data, driver configs
+// and ds18b20 registry, NVS keeps the old copy until the new one is written
+#define RULES_MAX_JSON_SIZE 3072
+#define RULES_TICK_MS 1000 // time windows check period
+
+#define BACKLOG_PARTITION "backlog"
+#define BACKLOG_TOPIC "backlog"
+#define BACKLOG_QOS 1
+#define BACKLOG_BATCH 32        // records per message
+#define BACKLOG_INTERVAL_MS 500 // between messages while forwarding
+
+// Shared workers running sample callbacks of periodic drivers, 0 to run each driver in own task
+#define DRIVER_SCHEDULER_WORKERS 2
+#define DRIVER_SCHEDULER_STACK_SIZE 4096
+#define DRIVER_SCHEDULER_PRIORITY (tskIDLE_PRIORITY + 1)
+#define DRIVER_SCHEDULER_MAX_DRIVERS 16
+#define DRIVER_SCHEDULER_STAGGER 100 // ms, default phase step between scheduled drivers
+#define DRIVER_SCHEDULER_BUDGET_MS 50  // max time of single sample callback
+
+#define DRIVER_CALIBRATION_LUT_SIZE 256 // entries of calibration tables
+
 #define DRIVER_CONFIG_TOPIC_FMT     "drivers/%s/config"
 #define DRIVER_SET_CONFIG_TOPIC_FMT "drivers/%s/set_config"
 
+////////////////////////////////////////////////////////////////////////////////
+/// History
+
+#define HISTORY_MAX_SERIES 32
+#define HISTORY_BLOCKS 96       // compressed blocks shared by all series, see history.h for retention
+#define HISTORY_BLOCK_SIZE 256  // bytes of compressed data in block
+#define HISTORY_CHUNK_SIZE 1024 // part of streamed query result
+
 ////////////////////////////////////////////////////////////////////////////////
 /// Webserver
 
 #define HTTPD_STACK_SIZE 16384
 #define MAX_POST_SIZE 4096
+#define API_RESPONSE_SIZE 512 // small responses built on stack
 
 ////////////////////////////////////////////////////////////////////////////////
 /// MQTT
@@ -85,6 +127,7 @@
 #define MQTT_OUT_BUFFER_SIZE 16384
 #define MQTT_TIMEOUT_MS 5000
 #define MQTT_MAX_TOPIC_LEN 256
+#define MQTT_TOPIC_TABLE_MIN_SIZE 16 // power of 2
 
 ////////////////////////////////////////////////////////////////////////////////
 /// Device
@@ -92,6 +135,11 @@
 #define DEVICE_STATE_TOPIC_FMT     "%s/%s/state"
 #define DEVICE_COMMAND_TOPIC_FMT   "%s/%s/command"
 #define DEVICE_DISCOVERY_TOPIC_FMT "homeassistant/%s/%s/%s/config"
+#define DEVICE_DISCOVERY_STATUS_TOPIC "homeassistant/status"
+
+#define DEVICE_UID_SIZE 20
+#define DEVICE_MAX_NAME_LEN 96 // without node name
+#define DEVICE_DEFAULT_MAX_SILENCE 60000 // ms
 
 #define DEVICE_SENSOR_STATE_QOS    0
 #define DEVICE_SENSOR_STATE_RETAIN 0
@@ -102,5 +150,10 @@
 #define DEVICE_DISCOVERY_QOS    1
 #define DEVICE_DISCOVERY_RETAIN 1
 
+#define DEVICE_DESCRIPTOR_SIZE 1024 // discovery payload buffer, on stack
+
+#define DEVICE_DISCOVERY_CACHE_SIZE 128 // descriptor hashes kept in RTC memory
+#define DEVICE_DISCOVERY_PENDING 16     // publications waiting for acknowledgement
+
 
 #endif /* MAIN_CONFIG_H_ */
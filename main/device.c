@@ -1,11 +1,49 @@
 #include "device.h"
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+#include <esp_timer.h>
+#include <esp_attr.h>
 #include <esp_ota_ops.h>
 #include "settings.h"
 #include "mqtt.h"
-#include "cJSON.h"
+#include "json_writer.h"
 #include "common.h"
 
 #define EXPIRES_AFTER_PERIODS 5
+#define EXPIRES_AFTER_HEARTBEATS 2
+
+#define BATCH_VALUE_TEMPLATE_FMT "{{ value_json.%s if '%s' in value_json else this.state }}"
+
+#define DISCOVERY_CACHE_MAGIC 0x64697363
+
+// Hashes of published discovery descriptors sorted by topic, survive reconnects and soft resets
+static RTC_NOINIT_ATTR struct
+{
+    uint32_t magic;
+    uint32_t count;
+    struct {
+        uint32_t topic;
+        uint32_t payload;
+    } items[DEVICE_DISCOVERY_CACHE_SIZE];
+    uint32_t checksum;
+} discovery_cache;
+
+// Publications waiting for broker acknowledgement, cached once acknowledged
+static struct
+{
+    int msg_id; // 0 if free
+    uint32_t topic;
+    uint32_t payload;
+} discovery_pending[DEVICE_DISCOVERY_PENDING];
+static size_t pending_next = 0;
+
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+_Static_assert(DEVICE_DISCOVERY_QOS > 0, "Discovery cache needs acknowledged publications");
+
+static device_info_t *infos = NULL;
+static portMUX_TYPE infos_lock = portMUX_INITIALIZER_UNLOCKED;
 
 static const char * const dev_type_names [] = {
     [DEV_SENSOR]        = "sensor",
@@ -14,12 +52,168 @@ static const char * const dev_type_names [] = {
     [DEV_BINARY_SWITCH] = "switch",
 };
 
+static uint32_t hash(const char *data, size_t len)
+{
+    // FNV-1a
+    uint32_t res = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        res = (res ^ (uint8_t)data[i]) * 16777619u;
+    return res;
+}
+
+// Checksum is XOR of entry hashes and count, kept up to date entry by entry
+static uint32_t cache_entry_hash(uint32_t topic, uint32_t payload)
+{
+    uint32_t item[2] = { topic, payload };
+    return hash((const char *)item, sizeof(item));
+}
+
+static uint32_t cache_checksum()
+{
+    uint32_t res = discovery_cache.count;
+    for (uint32_t i = 0; i < discovery_cache.count; i++)
+        res ^= cache_entry_hash(discovery_cache.items[i].topic, discovery_cache.items[i].payload);
+    return res;
+}
+
+static bool cache_valid()
+{
+    if (discovery_cache.magic != DISCOVERY_CACHE_MAGIC || discovery_cache.count > DEVICE_DISCOVERY_CACHE_SIZE
+        || discovery_cache.checksum != cache_checksum())
+        return false;
+    // items are kept sorted by topic
+    for (uint32_t i = 1; i < discovery_cache.count; i++)
+        if (discovery_cache.items[i - 1].topic >= discovery_cache.items[i].topic)
+            return false;
+    return true;
+}
+
+static void cache_clear()
+{
+    discovery_cache.magic = DISCOVERY_CACHE_MAGIC;
+    discovery_cache.count = 0;
+    discovery_cache.checksum = cache_checksum();
+    memset(discovery_pending, 0, sizeof(discovery_pending));
+}
+
+// Index of the first item with topic not less than `topic`
+static uint32_t cache_find(uint32_t topic)
+{
+    uint32_t lo = 0, hi = discovery_cache.count;
+    while (lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (discovery_cache.items[mid].topic < topic)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static bool cache_contains(uint32_t topic, uint32_t payload)
+{
+    portENTER_CRITICAL(&cache_lock);
+    uint32_t i = cache_find(topic);
+    bool res = i < discovery_cache.count && discovery_cache.items[i].topic == topic
+        && discovery_cache.items[i].payload == payload;
+    portEXIT_CRITICAL(&cache_lock);
+    return res;
+}
+
+static void cache_store(uint32_t topic, uint32_t payload)
+{
+    uint32_t i = cache_find(topic);
+    if (i < discovery_cache.count && discovery_cache.items[i].topic == topic)
+    {
+        discovery_cache.checksum ^= cache_entry_hash(topic, discovery_cache.items[i].payload)
+            ^ cache_entry_hash(topic, payload);
+        discovery_cache.items[i].payload = payload;
+        return;
+    }
+    if (discovery_cache.count == DEVICE_DISCOVERY_CACHE_SIZE)
+        return;
+    memmove(&discovery_cache.items[i + 1], &discovery_cache.items[i],
+        sizeof(discovery_cache.items[0]) * (discovery_cache.count - i));
+    discovery_cache.items[i].topic = topic;
+    discovery_cache.items[i].payload = payload;
+    discovery_cache.checksum ^= cache_entry_hash(topic, payload) ^ discovery_cache.count ^ (discovery_cache.count + 1);
+    discovery_cache.count++;
+}
+
+static void cache_remove_pending(uint32_t topic)
+{
+    for (size_t i = 0; i < DEVICE_DISCOVERY_PENDING; i++)
+        if (discovery_pending[i].msg_id && discovery_pending[i].topic == topic)
+            discovery_pending[i].msg_id = 0;
+}
+
+// Publication is cached when acknowledged, the oldest pending one is forgotten if there are too many
+static void cache_add_pending(int msg_id, uint32_t topic, uint32_t payload)
+{
+    portENTER_CRITICAL(&cache_lock);
+    cache_remove_pending(topic);
+    discovery_pending[pending_next].msg_id = msg_id;
+    discovery_pending[pending_next].topic = topic;
+    discovery_pending[pending_next].payload = payload;
+    pending_next = (pending_next + 1) % DEVICE_DISCOVERY_PENDING;
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+static void cache_remove(uint32_t topic)
+{
+    portENTER_CRITICAL(&cache_lock);
+    cache_remove_pending(topic);
+    uint32_t i = cache_find(topic);
+    if (i < discovery_cache.count && discovery_cache.items[i].topic == topic)
+    {
+        discovery_cache.checksum ^= cache_entry_hash(topic, discovery_cache.items[i].payload)
+            ^ discovery_cache.count ^ (discovery_cache.count - 1);
+        discovery_cache.count--;
+        memmove(&discovery_cache.items[i], &discovery_cache.items[i + 1],
+            sizeof(discovery_cache.items[0]) * (discovery_cache.count - i));
+    }
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+static void on_published(int msg_id)
+{
+    portENTER_CRITICAL(&cache_lock);
+    for (size_t i = 0; i < DEVICE_DISCOVERY_PENDING; i++)
+        if (discovery_pending[i].msg_id == msg_id)
+        {
+            cache_store(discovery_pending[i].topic, discovery_pending[i].payload);
+            discovery_pending[i].msg_id = 0;
+            break;
+        }
+    portEXIT_CRITICAL(&cache_lock);
+}
+
 static const char *device_state_topic(const device_t *dev, char *buf, size_t size)
 {
     snprintf(buf, size, DEVICE_STATE_TOPIC_FMT, settings.system.name, dev->uid);
     return buf;
 }
 
+static const char *device_batch_state_topic(const char *group, char *buf, size_t size)
+{
+    snprintf(buf, size, DEVICE_STATE_TOPIC_FMT, settings.system.name, group);
+    return buf;
+}
+
+static int device_expire_after(const device_t *dev)
+{
+    int res = dev->sensor.update_period * EXPIRES_AFTER_PERIODS;
+    if (dev->sensor.max_silence > 0)
+    {
+        // unchanged value is published once per max_silence, checked on each update
+        int heartbeat = (dev->sensor.max_silence + dev->sensor.update_period) * EXPIRES_AFTER_HEARTBEATS;
+        if (heartbeat > res)
+            res = heartbeat;
+    }
+    return res / 1000;
+}
+
 static const char *device_command_topic(const device_t *dev, char *buf, size_t size)
 {
     snprintf(buf, size, DEVICE_COMMAND_TOPIC_FMT, settings.system.name, dev->uid);
@@ -30,87 +224,108 @@ static const char *device_discovery_topic(const device_t *dev, char *buf, size_t
 {
     const char *type_name = dev_type_names[dev->type];
     if (!type_name)
-        type_name = dev->type_name;
-    if (!strlen(type_name))
         return NULL;
 
     snprintf(buf, size, DEVICE_DISCOVERY_TOPIC_FMT, type_name, settings.system.name, dev->uid);
     return buf;
 }
 
-static cJSON *device_descriptor(const device_t *dev)
+static esp_err_t device_descriptor(const device_t *dev, const char *group, char *data, size_t size)
 {
-    cJSON *res = cJSON_CreateObject();
+    json_writer_t w;
+    json_writer_init(&w, data, size, false);
+    json_object_start(&w, NULL);
 
-    if (strlen(dev->device_class))
-        cJSON_AddStringToObject(res, "device_class", dev->device_class);
+    if (strlen(device_class(dev)))
+        json_add_string(&w, "device_class", device_class(dev));
 
     char uid[sizeof(dev->uid) + sizeof(settings.system.name) + 1] = { 0 };
     snprintf(uid, sizeof(uid), "%s_%s", settings.system.name, dev->uid);
-    cJSON_AddStringToObject(res, "object_id", uid);
-    cJSON_AddStringToObject(res, "unique_id", uid);
-
-    cJSON_AddStringToObject(res, "name", strlen(dev->name) ? dev->name : uid);
+    json_add_string(&w, "object_id", uid);
+    json_add_string(&w, "unique_id", uid);
 
     char buf[128] = { 0 };
-    cJSON_AddStringToObject(res, "state_topic", device_state_topic(dev, buf, sizeof(buf)));
+    if (strlen(device_name(dev)))
+    {
+        snprintf(buf, sizeof(buf), "%s %s", settings.system.name, device_name(dev));
+        json_add_string(&w, "name", buf);
+    }
+    else
+        json_add_string(&w, "name", uid);
+
+    if (group && device_is_sensor(dev))
+    {
+        json_add_string(&w, "state_topic", device_batch_state_topic(group, buf, sizeof(buf)));
+        // batch contains only changed values
+        snprintf(buf, sizeof(buf), BATCH_VALUE_TEMPLATE_FMT, dev->uid, dev->uid);
+        json_add_string(&w, "value_template", buf);
+    }
+    else
+        json_add_string(&w, "state_topic", device_state_topic(dev, buf, sizeof(buf)));
 
     switch (dev->type)
     {
         case DEV_SENSOR:
-            cJSON_AddStringToObject(res, "unit_of_measurement", dev->sensor.measurement_unit);
+            json_add_string(&w, "unit_of_measurement", device_measurement_unit(dev));
             if (dev->sensor.update_period > 0)
-                cJSON_AddNumberToObject(res, "expire_after", dev->sensor.update_period * EXPIRES_AFTER_PERIODS / 1000);
+                json_add_number(&w, "expire_after", device_expire_after(dev));
             break;
         case DEV_BINARY_SENSOR:
-            cJSON_AddStringToObject(res, "payload_on", "1");
-            cJSON_AddStringToObject(res, "payload_off", "0");
+            json_add_string(&w, "payload_on", "1");
+            json_add_string(&w, "payload_off", "0");
             break;
         case DEV_BINARY_SWITCH:
-            cJSON_AddStringToObject(res, "command_topic", device_command_topic(dev, buf, sizeof(buf)));
-            cJSON_AddStringToObject(res, "payload_on", "1");
-            cJSON_AddStringToObject(res, "payload_off", "0");
-            cJSON_AddStringToObject(res, "state_on", "1");
-            cJSON_AddStringToObject(res, "state_off", "0");
-            cJSON_AddBoolToObject(res, "optimistic", false);
-            cJSON_AddNumberToObject(res, "qos", 2);
-            cJSON_AddBoolToObject(res, "retain", true);
+            json_add_string(&w, "command_topic", device_command_topic(dev, buf, sizeof(buf)));
+            json_add_string(&w, "payload_on", "1");
+            json_add_string(&w, "payload_off", "0");
+            json_add_string(&w, "state_on", "1");
+            json_add_string(&w, "state_off", "0");
+            json_add_bool(&w, "optimistic", false);
+            json_add_number(&w, "qos", 2);
+            json_add_bool(&w, "retain", true);
             break;
         case DEV_NUMBER:
-            cJSON_AddStringToObject(res, "command_topic", device_command_topic(dev, buf, sizeof(buf)));
-            cJSON_AddNumberToObject(res, "min", dev->number.min);
-            cJSON_AddNumberToObject(res, "max", dev->number.max);
-            cJSON_AddNumberToObject(res, "step", dev->number.step);
-            cJSON_AddStringToObject(res, "unit_of_measurement", dev->number.measurement_unit);
-            cJSON_AddBoolToObject(res, "optimistic", false);
-            cJSON_AddNumberToObject(res, "qos", 2);
-            cJSON_AddBoolToObject(res, "retain", true);
+            json_add_string(&w, "command_topic", device_command_topic(dev, buf, sizeof(buf)));
+            json_add_number(&w, "min", dev->number.min);
+            json_add_number(&w, "max", dev->number.max);
+            json_add_number(&w, "step", dev->number.step);
+            json_add_string(&w, "unit_of_measurement", device_measurement_unit(dev));
+            json_add_bool(&w, "optimistic", false);
+            json_add_number(&w, "qos", 2);
+            json_add_bool(&w, "retain", true);
             break;
     }
 
-    cJSON *device = cJSON_AddObjectToObject(res, "device");
+    json_object_start(&w, "device");
 
-    const char *ids[2] = {
-        settings.system.name,
-        SYSTEM_ID,
-    };
-    cJSON_AddItemToObject(device, "identifiers",
-        cJSON_CreateStringArray(ids, strncmp(settings.system.name, SYSTEM_ID, sizeof(settings.system.name)) == 0 ? 1 : 2));
+    json_array_start(&w, "identifiers");
+    json_add_string(&w, NULL, settings.system.name);
+    if (strncmp(settings.system.name, SYSTEM_ID, sizeof(settings.system.name)) != 0)
+        json_add_string(&w, NULL, SYSTEM_ID);
+    json_array_end(&w);
 
-    cJSON_AddStringToObject(device, "manufacturer", DEVICE_MANUFACTURER);
-    cJSON_AddStringToObject(device, "name", DEVICE_NAME);
-    cJSON_AddStringToObject(device, "model", DEVICE_MODEL);
+    json_add_string(&w, "manufacturer", DEVICE_MANUFACTURER);
+    json_add_string(&w, "name", DEVICE_NAME);
+    json_add_string(&w, "model", DEVICE_MODEL);
 
     const esp_app_desc_t *app_desc = esp_app_get_description();
     snprintf(buf, sizeof(buf), "%s (%s)", app_desc->version, app_desc->date);
-    cJSON_AddStringToObject(device, "sw_version", buf);
+    json_add_string(&w, "sw_version", buf);
 
-    return res;
+    json_object_end(&w);
+    json_object_end(&w);
+
+    return json_writer_finish(&w);
 }
 
 static void on_write_cb(const char *topic, const char *data, size_t data_len, void *ctx)
 {
     device_t *dev = (device_t *)ctx;
+    char value[32];
+
+    if (!data_len)
+        return;
+
     switch (dev->type)
     {
         case DEV_BINARY_SWITCH:
@@ -118,8 +333,15 @@ static void on_write_cb(const char *topic, const char *data, size_t data_len, vo
                 dev->binary_switch.on_write(dev, data[0] == '1');
             break;
         case DEV_NUMBER:
+            if (data_len >= sizeof(value))
+            {
+                ESP_LOGE(TAG, "Invalid value for %s", dev->uid);
+                break;
+            }
+            memcpy(value, data, data_len);
+            value[data_len] = 0;
             if (dev->number.on_write)
-                dev->number.on_write(dev, strtof(data, NULL));
+                dev->number.on_write(dev, strtof(value, NULL));
             break;
         default:
             break;
@@ -128,50 +350,191 @@ static void on_write_cb(const char *topic, const char *data, size_t data_len, vo
 
 ////////////////////////////////////////////////////////////////////////////////
 
-void device_publish_state(device_t *dev)
+static inline bool same_str(const char *a, const char *b)
+{
+    return a == b || (a && b && !strcmp(a, b));
+}
+
+// Entries are never unlinked and are complete before they are linked, walked without the lock
+static device_info_t *find_info(device_info_t *from, const device_info_t *to, uint32_t name_hash,
+    const char *device_class, const char *measurement_unit, const char *name)
+{
+    for (device_info_t *i = from; i != to; i = i->next)
+        if (i->hash == name_hash && same_str(i->device_class, device_class)
+            && same_str(i->measurement_unit, measurement_unit) && !strcmp(i->name, name))
+            return i;
+    return NULL;
+}
+
+const device_info_t *device_info(const char *device_class, const char *measurement_unit, const char *name_fmt, ...)
+{
+    char name[DEVICE_MAX_NAME_LEN];
+    va_list args;
+    va_start(args, name_fmt);
+    vsnprintf(name, sizeof(name), name_fmt, args);
+    va_end(args);
+
+    size_t len = strlen(name);
+    uint32_t name_hash = hash(name, len);
+
+    portENTER_CRITICAL(&infos_lock);
+    device_info_t *head = infos;
+    portEXIT_CRITICAL(&infos_lock);
+    device_info_t *res = find_info(head, NULL, name_hash, device_class, measurement_unit, name);
+    if (res)
+        return res;
+
+    device_info_t *info = malloc(sizeof(device_info_t) + len + 1);
+    if (!info)
+    {
+        ESP_LOGE(TAG, "Out of memory for device info '%s'", name);
+        return NULL;
+    }
+    info->hash = name_hash;
+    info->device_class = device_class;
+    info->measurement_unit = measurement_unit;
+    memcpy(info->name, name, len + 1);
+
+    while (true)
+    {
+        portENTER_CRITICAL(&infos_lock);
+        device_info_t *current = infos;
+        if (current == head)
+        {
+            info->next = head;
+            infos = info;
+        }
+        portEXIT_CRITICAL(&infos_lock);
+        if (current == head)
+            break;
+
+        // added by another task meanwhile, only the new entries are checked
+        res = find_info(current, head, name_hash, device_class, measurement_unit, name);
+        if (res)
+        {
+            free(info);
+            return res;
+        }
+        head = current;
+    }
+    ESP_LOGD(TAG, "Device info '%s' interned", name);
+
+    return info;
+}
+
+int device_format_state(const device_t *dev, char *buf, size_t size)
 {
-    char data[32] = { 0 };
-    int qos = 0;
-    int retain = 0;
     switch (dev->type)
     {
         case DEV_SENSOR:
-            qos = DEVICE_SENSOR_STATE_QOS;
-            retain = DEVICE_SENSOR_STATE_RETAIN;
-            snprintf(data, sizeof(data), "%.*f", dev->sensor.precision, dev->sensor.value);
-            break;
+            return snprintf(buf, size, "%.*f", dev->sensor.precision, dev->sensor.value);
         case DEV_BINARY_SENSOR:
-            qos = DEVICE_SENSOR_STATE_QOS;
-            retain = DEVICE_SENSOR_STATE_RETAIN;
-            snprintf(data, sizeof(data), "%d", dev->binary_sensor.value);
-            break;
+            return snprintf(buf, size, "%d", dev->binary_sensor.value);
         case DEV_NUMBER:
-            qos = DEVICE_EFFECTOR_STATE_QOS;
-            retain = DEVICE_EFFECTOR_STATE_RETAIN;
-            snprintf(data, sizeof(data), "%f", dev->number.value);
-            break;
+            return snprintf(buf, size, "%f", dev->number.value);
         case DEV_BINARY_SWITCH:
-            qos = DEVICE_EFFECTOR_STATE_QOS;
-            retain = DEVICE_EFFECTOR_STATE_RETAIN;
-            snprintf(data, sizeof(data), "%d", dev->binary_switch.value);
-            break;
+            return snprintf(buf, size, "%d", dev->binary_switch.value);
     }
+    return 0;
+}
+
+float device_value(const device_t *dev)
+{
+    switch (dev->type)
+    {
+        case DEV_SENSOR:
+            return dev->sensor.value;
+        case DEV_BINARY_SENSOR:
+            return dev->binary_sensor.value;
+        case DEV_NUMBER:
+            return dev->number.value;
+        case DEV_BINARY_SWITCH:
+            return dev->binary_switch.value;
+    }
+    return NAN;
+}
+
+time_t device_update_time(const device_t *dev)
+{
+    time_t now = time(NULL);
+    if (!dev->update.timestamp)
+        return now;
+    return now - (time_t)((esp_timer_get_time() - dev->update.timestamp) / 1000000);
+}
+
+bool device_report_due(device_t *dev, int64_t now)
+{
+    if (dev->type != DEV_SENSOR)
+        return true;
+
+    float value = dev->sensor.value;
+    bool due = !dev->update.published
+        || dev->sensor.max_silence <= 0
+        || isnan(value) != isnan(dev->update.last_value)
+        || fabsf(value - dev->update.last_value) > dev->sensor.deadband
+        || now - dev->update.last_time >= (int64_t)dev->sensor.max_silence * 1000;
+    if (due)
+    {
+        dev->update.published = true;
+        dev->update.last_value = value;
+        dev->update.last_time = now;
+    }
+
+    return due;
+}
+
+void device_publish_state(device_t *dev)
+{
+    char data[32] = { 0 };
+    int qos = DEVICE_SENSOR_STATE_QOS;
+    int retain = DEVICE_SENSOR_STATE_RETAIN;
+    if (!device_is_sensor(dev))
+    {
+        qos = DEVICE_EFFECTOR_STATE_QOS;
+        retain = DEVICE_EFFECTOR_STATE_RETAIN;
+    }
+    device_format_state(dev, data, sizeof(data));
 
     char topic[MQTT_MAX_TOPIC_LEN] = { 0 };
     mqtt_publish(device_state_topic(dev, topic, sizeof(topic)), data, (int)strlen(data), qos, retain);
     ESP_LOGV(TAG, "Publish state to %s: %s", topic, data);
 }
 
-void device_publish_discovery(device_t *dev)
+void device_publish_batch_state(const char *group, const char *data, size_t len)
+{
+    char topic[MQTT_MAX_TOPIC_LEN] = { 0 };
+    mqtt_publish(device_batch_state_topic(group, topic, sizeof(topic)), data, (int)len,
+        DEVICE_SENSOR_STATE_QOS, DEVICE_SENSOR_STATE_RETAIN);
+    ESP_LOGV(TAG, "Publish batch state to %s: %.*s", topic, (int)len, data);
+}
+
+bool device_publish_discovery(device_t *dev, const char *group)
 {
     char topic[MQTT_MAX_TOPIC_LEN] = { 0 };
     if (!device_discovery_topic(dev, topic, sizeof(topic)))
-        return;
+        return false;
+
+    char data[DEVICE_DESCRIPTOR_SIZE];
+    if (device_descriptor(dev, group, data, sizeof(data)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Discovery data for device '%s' is too big", dev->uid);
+        return false;
+    }
+
+    size_t len = strlen(data);
+    uint32_t topic_hash = hash(topic, strlen(topic));
+    uint32_t data_hash = hash(data, len);
+    if (cache_contains(topic_hash, data_hash))
+        return false;
 
-    cJSON *json = device_descriptor(dev);
-    mqtt_publish_json(topic, json, DEVICE_DISCOVERY_QOS, DEVICE_DISCOVERY_RETAIN);
-    cJSON_Delete(json);
+    // only queued yet, cached when the broker acknowledges it
+    int msg_id = mqtt_publish(topic, data, (int)len, DEVICE_DISCOVERY_QOS, DEVICE_DISCOVERY_RETAIN);
+    if (msg_id < 0)
+        return false;
+    if (msg_id > 0)
+        cache_add_pending(msg_id, topic_hash, data_hash);
     ESP_LOGI(TAG, "Published discovery data for device '%s'", dev->uid);
+    return true;
 }
 
 void device_unpublish_discovery(device_t *dev)
@@ -179,10 +542,32 @@ void device_unpublish_discovery(device_t *dev)
     char topic[MQTT_MAX_TOPIC_LEN] = { 0 };
     if (!device_discovery_topic(dev, topic, sizeof(topic)))
         return;
+    cache_remove(hash(topic, strlen(topic)));
     mqtt_publish(topic, "", 0, DEVICE_DISCOVERY_QOS, DEVICE_DISCOVERY_RETAIN);
     ESP_LOGI(TAG, "Removed discovery data for device '%s'", dev->uid);
 }
 
+void device_init_discovery_cache()
+{
+    // RTC memory is garbage after power loss, checked once instead of on every lookup
+    portENTER_CRITICAL(&cache_lock);
+    bool valid = cache_valid();
+    if (!valid)
+        cache_clear();
+    portEXIT_CRITICAL(&cache_lock);
+    if (valid)
+        ESP_LOGI(TAG, "Discovery cache restored, %" PRIu32 " descriptors", discovery_cache.count);
+
+    mqtt_set_published_callback(on_published);
+}
+
+void device_reset_discovery_cache()
+{
+    portENTER_CRITICAL(&cache_lock);
+    cache_clear();
+    portEXIT_CRITICAL(&cache_lock);
+}
+
 void device_subscribe(device_t *dev)
 {
     char topic[MQTT_MAX_TOPIC_LEN] = { 0 };
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <time.h>
+#include "config.h"
 
 typedef enum {
     DEV_SENSOR = 0,
@@ -12,6 +14,20 @@ typedef enum {
     DEV_NUMBER,
 } device_type_t;
 
+// Immutable device metadata, used only for discovery. Interned: equal metadata
+// gives the same pointer. Entries live until reboot, copies of devices in queues
+// keep pointers to them after their driver is reinitialized. Each distinct name,
+// e.g. a new label of a probe, adds one entry.
+typedef struct device_info device_info_t;
+struct device_info
+{
+    device_info_t *next;
+    uint32_t hash;                // of name
+    const char *device_class;     // static string or NULL
+    const char *measurement_unit; // static string or NULL
+    char name[];                  // without node name
+};
+
 typedef struct device device_t;
 
 typedef void (*switch_write_cb_t)(device_t *dev, bool value);
@@ -19,24 +35,30 @@ typedef void (*output_write_cb_t)(device_t *dev, float value);
 
 struct device
 {
-    char uid[32];
-    char name[96];
+    char uid[DEVICE_UID_SIZE];
     device_type_t type;
-    char type_name[16];
-    char device_class[32];
-    void *internal[8];
+    const device_info_t *info;
+    void *internal;
+    struct {
+        bool queued;       // update record is waiting in the node queue
+        bool dirty;        // changed since last batch state publication
+        bool published;    // last_value and last_time are valid
+        float last_value;  // last published sensor value
+        int64_t timestamp; // time of the last update, us
+        int64_t last_time; // time of the last publication, us
+    } update;
     union {
         struct {
-            char measurement_unit[16];
             float value;
             int precision;
             int update_period;
+            float deadband;  // minimal change of value to publish it
+            int max_silence; // ms, republish unchanged value at least this often, 0 - publish every update
         } sensor;
         struct {
             bool value;
         } binary_sensor;
         struct {
-            char measurement_unit[16];
             float min;
             float max;
             float step;
@@ -50,9 +72,53 @@ struct device
     };
 };
 
+/**
+ * Get interned device metadata. `device_class` and `measurement_unit` must be
+ * static strings, name is formatted by `name_fmt` and prefixed with node name
+ * on publication. Returns NULL if out of memory
+ */
+const device_info_t *device_info(const char *device_class, const char *measurement_unit, const char *name_fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static inline const char *device_name(const device_t *dev)
+{
+    return dev->info ? dev->info->name : "";
+}
+
+static inline const char *device_class(const device_t *dev)
+{
+    return dev->info && dev->info->device_class ? dev->info->device_class : "";
+}
+
+static inline const char *device_measurement_unit(const device_t *dev)
+{
+    return dev->info && dev->info->measurement_unit ? dev->info->measurement_unit : "";
+}
+
+// Sensor states can be published in batch, effectors always use own state topic
+static inline bool device_is_sensor(const device_t *dev)
+{
+    return dev->type == DEV_SENSOR || dev->type == DEV_BINARY_SENSOR;
+}
+
+int device_format_state(const device_t *dev, char *buf, size_t size);
+// State as number, binary states are 0 or 1
+float device_value(const device_t *dev);
+// Wall clock time of the last update
+time_t device_update_time(const device_t *dev);
+// Report-by-exception filter, remembers value as published if returns true
+bool device_report_due(device_t *dev, int64_t now);
+
 void device_publish_state(device_t *dev);
-void device_publish_discovery(device_t *dev);
+void device_publish_batch_state(const char *group, const char *data, size_t len);
+// Sensors of the `group` use batch state topic, NULL to use own state topic.
+// Returns false if descriptor is unchanged since the last publication
+bool device_publish_discovery(device_t *dev, const char *group);
 void device_unpublish_discovery(device_t *dev);
+// Validate descriptor hashes kept over soft resets, called once at boot
+void device_init_discovery_cache();
+// Forget published descriptors, next device_publish_discovery() sends them all
+void device_reset_discovery_cache();
 
 void device_subscribe(device_t *dev);
 void device_unsubscribe(device_t *dev);
@@ -1,12 +1,57 @@
 #include "driver.h"
+#include <math.h>
+#include <esp_timer.h>
+#include <esp_intr_alloc.h>
 #include "common.h"
 #include "node.h"
+#include "scheduler.h"
 #include "std_strings.h"
 
 #define ERR_INVALID_STATE "[%s] Driver in invalid state"
 
 #define DRIVER_TIMEOUT 1000
 
+static portMUX_TYPE update_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void read_report_config(driver_t *drv, device_t *dev)
+{
+    cJSON *report = cJSON_GetObjectItem(drv->config, OPT_REPORT);
+    cJSON *custom = cJSON_GetObjectItem(cJSON_GetObjectItem(report, OPT_DEVICES), dev->uid);
+
+    float deadband = driver_config_get_float(cJSON_GetObjectItem(report, OPT_DEADBAND),
+        0.5f * powf(10.0f, (float)-dev->sensor.precision));
+    int max_silence = driver_config_get_int(cJSON_GetObjectItem(report, OPT_MAX_SILENCE), DEVICE_DEFAULT_MAX_SILENCE);
+
+    dev->sensor.deadband = driver_config_get_float(cJSON_GetObjectItem(custom, OPT_DEADBAND), deadband);
+    dev->sensor.max_silence = driver_config_get_int(cJSON_GetObjectItem(custom, OPT_MAX_SILENCE), max_silence);
+}
+
+static inline bool scheduled(const driver_t *drv)
+{
+    return DRIVER_SCHEDULER_WORKERS > 0 && !drv->task && drv->sample;
+}
+
+// Own task loop of periodic driver when shared scheduler is disabled
+static void sample_loop(driver_t *self)
+{
+    while (true)
+    {
+        TickType_t start = xTaskGetTickCount();
+        self->sample(self);
+        while (self->sched.step)
+        {
+            TickType_t step = pdMS_TO_TICKS(self->sched.step);
+            self->sched.step = 0;
+            EventBits_t bits = xEventGroupWaitBits(self->eg, DRIVER_BIT_STOP, pdFALSE, pdTRUE, step ? step : 1);
+            if (bits & DRIVER_BIT_STOP)
+                return;
+            self->sample(self);
+        }
+        if (!driver_wait_period(self, start, pdMS_TO_TICKS(self->period)))
+            return;
+    }
+}
+
 static void driver_task(void *arg)
 {
     driver_t *self = (driver_t *)arg;
@@ -16,7 +61,9 @@ static void driver_task(void *arg)
 
     if (self->on_init)
     {
+        driver_lock_devices(self);
         r = self->on_init(self);
+        driver_unlock_devices(self);
         if (r != ESP_OK)
         {
             self->state = DRIVER_INVALID;
@@ -44,7 +91,10 @@ static void driver_task(void *arg)
     xEventGroupSetBits(self->eg, DRIVER_BIT_RUNNING);
     vTaskDelay(1);
 
-    self->task(self);
+    if (self->task)
+        self->task(self);
+    else
+        sample_loop(self);
 
     if (self->on_stop)
     {
@@ -101,6 +151,22 @@ esp_err_t driver_init(driver_t *drv, const char *config, size_t cfg_len)
         cJSON_free(buf);
     }
 
+    drv->batch_state = driver_config_get_bool(cJSON_GetObjectItem(drv->config, OPT_BATCH_STATE), false);
+    drv->batch_pending = false;
+    drv->phase = driver_config_get_int(cJSON_GetObjectItem(drv->config, OPT_PHASE), -1);
+
+    if (!drv->lock)
+    {
+        drv->lock = xSemaphoreCreateMutex();
+        if (!drv->lock)
+        {
+            ESP_LOGE(TAG, "[%s] Error creating devices lock for driver", drv->name);
+            r = ESP_ERR_NO_MEM;
+            goto exit;
+        }
+    }
+    memset(&drv->stats, 0, sizeof(drv->stats));
+
     if (drv->eg)
         vEventGroupDelete(drv->eg);
 
@@ -111,9 +177,21 @@ esp_err_t driver_init(driver_t *drv, const char *config, size_t cfg_len)
         r = ESP_ERR_NO_MEM;
         goto exit;
     }
-    xEventGroupClearBits(drv->eg, DRIVER_BIT_INITIALIZED | DRIVER_BIT_RUNNING | DRIVER_BIT_START);
+    xEventGroupClearBits(drv->eg, DRIVER_BIT_INITIALIZED | DRIVER_BIT_RUNNING | DRIVER_BIT_START | DRIVER_BIT_STOP);
 
 
+    if (scheduled(drv))
+    {
+        // no own task, sample callback will be run by scheduler
+        if (drv->on_init)
+        {
+            driver_lock_devices(drv);
+            r = drv->on_init(drv);
+            driver_unlock_devices(drv);
+        }
+        goto exit;
+    }
+
     if (drv->handle)
     {
         eTaskState state = eTaskGetState(drv->handle);
@@ -164,8 +242,26 @@ esp_err_t driver_start(driver_t *drv)
         return ESP_ERR_INVALID_STATE;
     }
 
+    xEventGroupClearBits(drv->eg, DRIVER_BIT_STOP);
     xEventGroupSetBits(drv->eg, DRIVER_BIT_START);
 
+    if (scheduled(drv))
+    {
+        esp_err_t r = drv->on_start ? drv->on_start(drv) : ESP_OK;
+        if (r == ESP_OK)
+            r = scheduler_add(drv);
+        if (r != ESP_OK)
+        {
+            drv->state = DRIVER_INVALID;
+            ESP_LOGE(TAG, "[%s] Error starting driver: %d (%s)", drv->name, r, esp_err_to_name(r));
+            return r;
+        }
+        drv->state = DRIVER_RUNNING;
+        xEventGroupSetBits(drv->eg, DRIVER_BIT_RUNNING);
+        ESP_LOGI(TAG, "[%s] Driver started", drv->name);
+        return ESP_OK;
+    }
+
     EventBits_t bits = xEventGroupWaitBits(drv->eg, DRIVER_BIT_RUNNING, pdFALSE, pdTRUE, pdMS_TO_TICKS(DRIVER_TIMEOUT));
     if (!(bits & DRIVER_BIT_RUNNING))
     {
@@ -189,6 +285,26 @@ esp_err_t driver_stop(driver_t *drv)
     }
 
     xEventGroupClearBits(drv->eg, DRIVER_BIT_START);
+    xEventGroupSetBits(drv->eg, DRIVER_BIT_STOP);
+
+    if (scheduled(drv))
+    {
+        scheduler_remove(drv);
+        esp_err_t r = drv->on_stop && drv->state == DRIVER_RUNNING ? drv->on_stop(drv) : ESP_OK;
+        if (r != ESP_OK)
+        {
+            drv->state = DRIVER_INVALID;
+            ESP_LOGE(TAG, "[%s] Error stopping driver: %d (%s)", drv->name, r, esp_err_to_name(r));
+            return r;
+        }
+        drv->state = DRIVER_FINISHED;
+        xEventGroupSetBits(drv->eg, DRIVER_BIT_STOPPED);
+        goto stopped;
+    }
+
+    // wake up driver task if it's waiting for notification
+    if (drv->handle)
+        xTaskNotifyGive(drv->handle);
 
     EventBits_t bits = xEventGroupWaitBits(drv->eg, DRIVER_BIT_STOPPED, pdFALSE, pdTRUE, pdMS_TO_TICKS(DRIVER_TIMEOUT));
     if (!(bits & DRIVER_BIT_STOPPED))
@@ -199,19 +315,156 @@ esp_err_t driver_stop(driver_t *drv)
 
     drv->handle = NULL;
 
-    ESP_LOGI(TAG, "[%s] Driver stopped", drv->name);
+stopped:
+    ESP_LOGI(TAG, "[%s] Driver stopped, updates: %" PRIu32 ", coalesced: %" PRIu32 ", dropped: %" PRIu32
+        ", overruns: %" PRIu32 ", over budget: %" PRIu32, drv->name, drv->stats.updates, drv->stats.coalesced,
+        drv->stats.dropped, drv->stats.overruns, drv->stats.over_budget);
 
     return ESP_OK;
 }
 
-void driver_send_device_update(driver_t *drv, const device_t *dev)
+bool driver_stop_requested(driver_t *self)
 {
-    driver_event_t e = {
-        .type = DRV_EVENT_DEVICE_UPDATED,
+    return xEventGroupGetBits(self->eg) & DRIVER_BIT_STOP;
+}
+
+bool driver_wait_period(driver_t *self, TickType_t start, TickType_t period)
+{
+    driver_flush_updates(self);
+
+    TickType_t elapsed = xTaskGetTickCount() - start;
+    TickType_t timeout = elapsed < period ? period - elapsed : 0;
+
+    EventBits_t bits = xEventGroupWaitBits(self->eg, DRIVER_BIT_STOP, pdFALSE, pdTRUE, timeout);
+    return !(bits & DRIVER_BIT_STOP);
+}
+
+void driver_sample_after(driver_t *self, uint32_t ms)
+{
+    self->sched.step = ms ? ms : 1;
+}
+
+device_t *driver_add_device(driver_t *drv, const device_t *dev)
+{
+    cvector_push_back(drv->devices, *dev);
+    device_t *res = &drv->devices[cvector_size(drv->devices) - 1];
+
+    if (res->type == DEV_SENSOR)
+        read_report_config(drv, res);
+
+    return res;
+}
+
+bool driver_remove_device(driver_t *drv, size_t index)
+{
+    size_t last = cvector_size(drv->devices) - 1;
+    bool resend = false;
+    if (index != last)
+    {
+        portENTER_CRITICAL(&update_lock);
+        drv->devices[index] = drv->devices[last];
+        // update queued for the old slot would never be fetched
+        resend = drv->devices[index].update.queued;
+        drv->devices[index].update.queued = false;
+        portEXIT_CRITICAL(&update_lock);
+    }
+    cvector_pop_back(drv->devices);
+
+    return resend;
+}
+
+esp_err_t driver_install_gpio_isr_service()
+{
+    // the first caller sets the flags of the shared service, so all drivers use the same.
+    // Handlers are IRAM_ATTR and keep running while flash cache is disabled
+    esp_err_t r = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    return r == ESP_ERR_INVALID_STATE ? ESP_OK : r;
+}
+
+void driver_lock_devices(driver_t *drv)
+{
+    xSemaphoreTake(drv->lock, portMAX_DELAY);
+}
+
+void driver_unlock_devices(driver_t *drv)
+{
+    xSemaphoreGive(drv->lock);
+}
+
+void driver_send_device_update(driver_t *drv, device_t *dev)
+{
+    driver_send_device_update_at(drv, dev, esp_timer_get_time());
+}
+
+void driver_send_device_update_at(driver_t *drv, device_t *dev, int64_t timestamp)
+{
+    driver_update_t u = {
         .sender = drv,
-        .dev = *dev
+        .index = dev - drv->devices
     };
-    xQueueSend(drv->event_queue, &e, 0);
+
+    if (drv->batch_state && device_is_sensor(dev))
+    {
+        // will be published by driver_flush_updates()
+        portENTER_CRITICAL(&update_lock);
+        if (dev->update.dirty)
+            drv->stats.coalesced++;
+        dev->update.dirty = true;
+        dev->update.timestamp = timestamp;
+        drv->batch_pending = true;
+        drv->stats.updates++;
+        portEXIT_CRITICAL(&update_lock);
+        return;
+    }
+
+    portENTER_CRITICAL(&update_lock);
+    bool queued = dev->update.queued;
+    dev->update.queued = true;
+    dev->update.timestamp = timestamp;
+    drv->stats.updates++;
+    if (queued)
+        drv->stats.coalesced++;
+    portEXIT_CRITICAL(&update_lock);
+
+    // previous update is not published yet, it will pick up the new value
+    if (queued)
+        return;
+
+    if (xQueueSend(drv->update_queue, &u, 0) != pdPASS)
+    {
+        portENTER_CRITICAL(&update_lock);
+        dev->update.queued = false;
+        drv->stats.dropped++;
+        portEXIT_CRITICAL(&update_lock);
+        ESP_LOGD(TAG, "[%s] Update queue is full, dropping update of '%s'", drv->name, dev->uid);
+    }
+}
+
+void driver_flush_updates(driver_t *drv)
+{
+    if (!drv->batch_state)
+        return;
+
+    portENTER_CRITICAL(&update_lock);
+    bool pending = drv->batch_pending;
+    drv->batch_pending = false;
+    portEXIT_CRITICAL(&update_lock);
+    if (!pending)
+        return;
+
+    driver_update_t u = {
+        .sender = drv,
+        .index = DRIVER_UPDATE_FLUSH
+    };
+    if (xQueueSend(drv->update_queue, &u, 0) != pdPASS)
+    {
+        // retry on next flush, dirty devices are still marked
+        portENTER_CRITICAL(&update_lock);
+        drv->batch_pending = true;
+        drv->stats.dropped++;
+        portEXIT_CRITICAL(&update_lock);
+        ESP_LOGD(TAG, "[%s] Update queue is full, delaying batch state", drv->name);
+    }
 }
 
 void driver_send_device_add(driver_t *drv, const device_t *dev)
@@ -221,7 +474,8 @@ void driver_send_device_add(driver_t *drv, const device_t *dev)
         .sender = drv,
         .dev = *dev
     };
-    xQueueSend(drv->event_queue, &e, 0);
+    if (xQueueSend(drv->event_queue, &e, pdMS_TO_TICKS(DRIVER_TIMEOUT)) != pdPASS)
+        ESP_LOGE(TAG, "[%s] Timeout while sending device '%s' add event", drv->name, dev->uid);
 }
 
 void driver_send_device_remove(driver_t *drv, const device_t *dev)
@@ -231,7 +485,45 @@ void driver_send_device_remove(driver_t *drv, const device_t *dev)
         .sender = drv,
         .dev = *dev
     };
-    xQueueSend(drv->event_queue, &e, 0);
+    if (xQueueSend(drv->event_queue, &e, pdMS_TO_TICKS(DRIVER_TIMEOUT)) != pdPASS)
+        ESP_LOGE(TAG, "[%s] Timeout while sending device '%s' remove event", drv->name, dev->uid);
+}
+
+bool driver_fetch_device_update(const driver_update_t *u, device_t *dev, bool *report)
+{
+    driver_t *drv = u->sender;
+    bool res = false;
+
+    *report = false;
+    driver_lock_devices(drv);
+    // devices could be recreated after update was sent
+    if (u->index < cvector_size(drv->devices))
+    {
+        device_t *src = &drv->devices[u->index];
+        int64_t now = esp_timer_get_time();
+        portENTER_CRITICAL(&update_lock);
+        res = src->update.queued;
+        src->update.queued = false;
+        if (res)
+        {
+            *report = device_report_due(src, now);
+            *dev = *src;
+        }
+        portEXIT_CRITICAL(&update_lock);
+    }
+    driver_unlock_devices(drv);
+
+    return res;
+}
+
+bool driver_fetch_batch_update(device_t *dev)
+{
+    portENTER_CRITICAL(&update_lock);
+    bool res = dev->update.dirty;
+    dev->update.dirty = false;
+    portEXIT_CRITICAL(&update_lock);
+
+    return res;
 }
 
 int driver_config_get_int(cJSON *item, int def)
@@ -239,6 +531,11 @@ int driver_config_get_int(cJSON *item, int def)
     return cJSON_IsNumber(item) ? (int)cJSON_GetNumberValue(item) : def;
 }
 
+float driver_config_get_float(cJSON *item, float def)
+{
+    return cJSON_IsNumber(item) ? (float)cJSON_GetNumberValue(item) : def;
+}
+
 gpio_num_t driver_config_get_gpio(cJSON *item, gpio_num_t def)
 {
     int res = driver_config_get_int(item, def);
@@ -250,45 +547,148 @@ bool driver_config_get_bool(cJSON *item, bool def)
     return cJSON_IsBool(item) ? cJSON_IsTrue(item) : def;
 }
 
-esp_err_t driver_config_read_calibration(const char *tag, cJSON *item, calibration_handle_t *c,
+static const char *lut_methods[] = {
+    [LUT_LINEAR] = "linear",
+    [LUT_CUBIC] = "cubic",
+    [LUT_POLYNOMIAL] = "polynomial",
+};
+
+esp_err_t driver_config_read_calibration(const char *tag, cJSON *item, lut_t *c,
     const calibration_point_t *def, size_t def_points)
 {
     CHECK_ARG(c && def && def_points >= 2);
 
-    memset(c, 0, sizeof(calibration_handle_t));
+    memset(c, 0, sizeof(lut_t));
+
+    // either array of points or { "method": "polynomial", "degree": 2, "points": [...] }
+    lut_method_t method = LUT_LINEAR;
+    int degree = LUT_DEFAULT_DEGREE;
+    cJSON *points = item;
+    if (cJSON_IsObject(item))
+    {
+        points = cJSON_GetObjectItem(item, OPT_POINTS);
+        degree = driver_config_get_int(cJSON_GetObjectItem(item, OPT_DEGREE), LUT_DEFAULT_DEGREE);
+        const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(item, OPT_METHOD));
+        if (name)
+        {
+            size_t m = 0;
+            while (m < sizeof(lut_methods) / sizeof(lut_methods[0]) && strcmp(name, lut_methods[m]))
+                m++;
+            if (m < sizeof(lut_methods) / sizeof(lut_methods[0]))
+                method = m;
+            else
+                ESP_LOGW(tag, "Unknown calibration method '%s', using linear", name);
+        }
+    }
 
-    if (!item || !cJSON_IsArray(item) || cJSON_GetArraySize(item) < 2)
+    if (!points || !cJSON_IsArray(points) || cJSON_GetArraySize(points) < 2)
     {
         ESP_LOGW(tag, "Invalid calibration data, using default");
-        ESP_RETURN_ON_ERROR(
-            calibration_init(c, def_points, CALIBRATION_LINEAR),
-            tag, "Error initializing calibration handler: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-        );
-        ESP_RETURN_ON_ERROR(
-            calibration_add_points(c, def, def_points),
-            tag, "Error adding default calibration points: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-        );
+        goto defaults;
     }
-    else
+
+    ESP_LOGI(tag, "Loading %s calibration data from '%s'", lut_methods[method], item->string);
+    size_t num_points = cJSON_GetArraySize(points);
+    if (method == LUT_POLYNOMIAL && (degree < 1 || degree > LUT_MAX_DEGREE || (size_t)degree >= num_points))
+        ESP_LOGW(tag, "Polynomial degree %d must be 1..%d and lower than the number of points, clamped",
+            degree, LUT_MAX_DEGREE);
+    calibration_point_t *buf = malloc(sizeof(calibration_point_t) * num_points);
+    if (!buf)
+        return ESP_ERR_NO_MEM;
+    bool valid = true;
+    for (size_t i = 0; i < num_points; i++)
     {
-        ESP_LOGI(tag, "Loading calibration data from '%s'", item->string);
-        int num_points = cJSON_GetArraySize(item);
-        ESP_RETURN_ON_ERROR(
-            calibration_init(c, num_points, CALIBRATION_LINEAR),
-            tag, "Error initializing calibration handler: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-        );
-        for (int i = 0; i < num_points; i++)
+        cJSON *obj = cJSON_GetArrayItem(points, i);
+        buf[i].code = (float)cJSON_GetNumberValue(cJSON_GetObjectItem(obj, OPT_VOLTAGE));
+        buf[i].value = (float)cJSON_GetNumberValue(cJSON_GetObjectItem(obj, OPT_VALUE));
+        ESP_LOGI(tag, "Calibration point: %.4f Volts ~ %.4f", buf[i].code, buf[i].value);
+        valid = valid && isfinite(buf[i].code) && isfinite(buf[i].value);
+    }
+    esp_err_t r = valid ? lut_init(c, buf, num_points, method, degree, DRIVER_CALIBRATION_LUT_SIZE) : ESP_ERR_INVALID_ARG;
+    free(buf);
+    if (r == ESP_OK || r == ESP_ERR_NO_MEM)
+        return r;
+    // missing fields, duplicate codes or singular fit
+    ESP_LOGW(tag, "Error building calibration table: %d (%s), using default", r, esp_err_to_name(r));
+
+defaults:
+    ESP_RETURN_ON_ERROR(
+        lut_init(c, def, def_points, LUT_LINEAR, 0, DRIVER_CALIBRATION_LUT_SIZE),
+        tag, "Error building default calibration table: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+    return ESP_OK;
+}
+
+static const char *filter_names[] = {
+    [FILTER_NONE] = "none",
+    [FILTER_AVERAGE] = "average",
+    [FILTER_MEDIAN] = "median",
+    [FILTER_EMA] = "ema",
+    [FILTER_LOWPASS] = "lowpass",
+};
+
+static esp_err_t parse_filter(const char *tag, cJSON *item, filter_config_t *cfg, float interval)
+{
+    const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(item, OPT_TYPE));
+    if (!type)
+        return ESP_ERR_INVALID_ARG;
+
+    size_t i = 0;
+    while (i < sizeof(filter_names) / sizeof(filter_names[0]) && strcmp(type, filter_names[i]))
+        i++;
+
+    memset(cfg, 0, sizeof(filter_config_t));
+    cfg->type = i;
+
+    switch (cfg->type)
+    {
+        case FILTER_NONE:
+            return ESP_OK;
+        case FILTER_AVERAGE:
+        case FILTER_MEDIAN:
+            cfg->window = driver_config_get_int(cJSON_GetObjectItem(item, OPT_WINDOW), 5);
+            return ESP_OK;
+        case FILTER_EMA:
         {
-            cJSON *obj = cJSON_GetArrayItem(item, i);
-            float code = (float)cJSON_GetNumberValue(cJSON_GetObjectItem(obj, OPT_VOLTAGE));
-            float value = (float)cJSON_GetNumberValue(cJSON_GetObjectItem(obj, OPT_VALUE));
-            ESP_LOGI(tag, "Calibration point: %.4f Volts ~ %.4f", code, value);
-            ESP_RETURN_ON_ERROR(
-                calibration_add_point(c, code, value),
-                tag, "Error adding calibration point: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-            );
+            float tau = driver_config_get_float(cJSON_GetObjectItem(item, OPT_TAU), 0);
+            if (tau > 0 && interval > 0)
+                cfg->alpha = interval / (interval + tau);
+            else
+                cfg->alpha = driver_config_get_float(cJSON_GetObjectItem(item, OPT_ALPHA), 0);
+            return ESP_OK;
         }
+        case FILTER_LOWPASS:
+            if (interval <= 0)
+            {
+                ESP_LOGE(tag, "Low-pass filter requires known sample interval");
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+            // cutoff in Hz, interval in ms
+            cfg->cutoff = driver_config_get_float(cJSON_GetObjectItem(item, OPT_CUTOFF), 0) * interval / 1000.0f;
+            return ESP_OK;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+}
+
+esp_err_t driver_config_read_filter(const char *tag, cJSON *item, filter_t *f,
+    const filter_config_t *def, float interval)
+{
+    CHECK_ARG(f && def);
+
+    filter_config_t cfg;
+    if (item && parse_filter(tag, item, &cfg, interval) == ESP_OK && filter_init(f, &cfg) == ESP_OK)
+    {
+        ESP_LOGI(tag, "Using %s filter from '%s'", filter_names[cfg.type], item->string ? item->string : OPT_FILTER);
+        return ESP_OK;
     }
 
+    if (item)
+        ESP_LOGW(tag, "Invalid filter config, using default");
+    ESP_RETURN_ON_ERROR(
+        filter_init(f, def),
+        tag, "Error initializing filter: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+
     return ESP_OK;
 }
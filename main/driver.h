@@ -7,15 +7,38 @@
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <cJSON.h>
 #include <device.h>
 #include <cvector.h>
 #include <calibration.h>
+#include <filter.h>
+#include <lut.h>
 
 #define DRIVER_BIT_INITIALIZED BIT(0)
 #define DRIVER_BIT_RUNNING     BIT(1)
 #define DRIVER_BIT_STOPPED     BIT(2)
 #define DRIVER_BIT_START       BIT(3)
+#define DRIVER_BIT_STOP        BIT(4)
+#define DRIVER_BIT_IDLE        BIT(5) // scheduled driver is not sampling
+
+// driver_update_t index of the batch flush record
+#define DRIVER_UPDATE_FLUSH UINT32_MAX
+
+/*
+ Common driver options:
+{
+  "batch_state": false,   // optional, publish changed sensor values in one message per driver cycle
+  "phase": 0,             // optional, ms, delay of the first sample of scheduled driver, default is staggered
+  "report": {             // optional, report-by-exception for sensors
+    "deadband": 0.05,     // minimal change of value to publish, default is half of the printed precision step
+    "max_silence": 60000, // ms, republish unchanged value at least this often, 0 - publish every update
+    "devices": {          // optional per-device overrides
+      "rht0_t": { "deadband": 0.1, "max_silence": 30000 }
+    }
+  }
+}
+*/
 
 typedef enum {
     DRIVER_NEW = 0,
@@ -38,10 +61,22 @@ struct driver
     uint32_t stack_size;
     UBaseType_t priority;
     cJSON *config;
+    bool batch_state;
+    bool batch_pending;
     driver_state_t state;
     QueueHandle_t event_queue;
+    QueueHandle_t update_queue;
 
     cvector_vector_type(device_t) devices;
+    SemaphoreHandle_t lock; // guards devices vector against readers from other tasks
+
+    struct {
+        uint32_t updates;
+        uint32_t coalesced;
+        uint32_t dropped;
+        uint32_t overruns;
+        uint32_t over_budget; // samples longer than DRIVER_SCHEDULER_BUDGET_MS
+    } stats;
 
     TaskHandle_t handle;
     EventGroupHandle_t eg;
@@ -53,12 +88,27 @@ struct driver
     driver_write_cb_t on_write;
 
     driver_loop_cb_t task;
+
+    // Periodic drivers may set `sample` instead of `task` to share scheduler workers.
+    // `sample` is called every `period` ms and must return within DRIVER_SCHEDULER_BUDGET_MS.
+    // Long operations are split into steps with driver_sample_after()
+    driver_loop_cb_t sample;
+    uint32_t period; // ms, set in on_init
+    int phase;       // ms, negative for automatic staggering
+    struct {
+        int64_t deadline; // us
+        int64_t anchor;   // us, deadline of the current period
+        uint32_t step;    // ms, set by driver_sample_after()
+        size_t index;     // position in scheduler heap
+        bool active;
+    } sched;
 };
 
 typedef enum {
     DRV_EVENT_DEVICE_UPDATED = 0,
     DRV_EVENT_DEVICE_ADDED,
     DRV_EVENT_DEVICE_REMOVED,
+    DRV_EVENT_REPUBLISH, // sent by node to itself, republish devices of all drivers
 } driver_event_type_t;
 
 typedef struct {
@@ -67,18 +117,63 @@ typedef struct {
     device_t dev; // copy
 } driver_event_t;
 
+// Device update record, latest value is taken from the device itself
+typedef struct {
+    driver_t *sender;
+    uint32_t index; // index in sender->devices or DRIVER_UPDATE_FLUSH
+} driver_update_t;
+
 esp_err_t driver_init(driver_t *drv, const char *config, size_t cfg_len);
 esp_err_t driver_start(driver_t *drv);
 esp_err_t driver_stop(driver_t *drv);
 
-void driver_send_device_update(driver_t *drv, const device_t *dev);
+// Check if driver stop has been requested, for use in driver task
+bool driver_stop_requested(driver_t *self);
+// Block until `start + period` or until driver stop is requested. Returns false if driver must stop
+bool driver_wait_period(driver_t *self, TickType_t start, TickType_t period);
+// Call `sample` again after `ms` within the current period instead of at the next one,
+// for use in sample callback. Updates are flushed when the period ends
+void driver_sample_after(driver_t *self, uint32_t ms);
+
+// Append device to driver devices and apply common device options, for use in on_init
+device_t *driver_add_device(driver_t *drv, const device_t *dev);
+// Remove device, the last device takes its slot. Call with devices locked.
+// Returns true if the moved device had an unpublished update: queued updates
+// refer to slot index, so it must be sent again after unlocking
+bool driver_remove_device(driver_t *drv, size_t index);
+
+// Install shared GPIO ISR service if not yet installed, handlers added to it must be IRAM_ATTR
+esp_err_t driver_install_gpio_isr_service();
+
+void driver_lock_devices(driver_t *drv);
+void driver_unlock_devices(driver_t *drv);
+
+void driver_send_device_update(driver_t *drv, device_t *dev);
+// Same with the time of the change (esp_timer, us) when it is known better than now
+void driver_send_device_update_at(driver_t *drv, device_t *dev, int64_t timestamp);
+// End of driver cycle, publish batch state of changed sensors. Called by driver_wait_period()
+void driver_flush_updates(driver_t *drv);
 void driver_send_device_add(driver_t *drv, const device_t *dev);
 void driver_send_device_remove(driver_t *drv, const device_t *dev);
 
+// Copy latest state of updated device, returns false if there is no update.
+// `report` is set if the new state passes report filter and must be published
+bool driver_fetch_device_update(const driver_update_t *u, device_t *dev, bool *report);
+// Check and reset batch state flag of the device, devices must be locked
+bool driver_fetch_batch_update(device_t *dev);
+
 int driver_config_get_int(cJSON *item, int def);
+float driver_config_get_float(cJSON *item, float def);
 gpio_num_t driver_config_get_gpio(cJSON *item, gpio_num_t def);
 bool driver_config_get_bool(cJSON *item, bool def);
-esp_err_t driver_config_read_calibration(const char *tag, cJSON *item, calibration_handle_t *c,
+// Build calibration table from config, default points are used if config is invalid.
+// Polynomial "degree" is 2 by default and must be lower than the number of points.
+// Table previously built into `c` must be freed with lut_free() first
+esp_err_t driver_config_read_calibration(const char *tag, cJSON *item, lut_t *c,
     const calibration_point_t *def, size_t def_points);
+// Read filter config, `interval` is the sample interval in ms used to convert "tau" and "cutoff",
+// 0 if unknown
+esp_err_t driver_config_read_filter(const char *tag, cJSON *item, filter_t *f,
+    const filter_config_t *def, float interval);
 
 #endif // ESP_IOT_NODE_PLUS_DRIVER_H_
@@ -3,38 +3,254 @@
 #ifdef DRIVER_DHTXX
 
 #include "driver.h"
-#include "settings.h"
 #include <dht.h>
+#include <driver/rmt_rx.h>
 
 #define FMT_HUMIDITY_SENSOR_ID      "dht%d_rh"
 #define FMT_TEMPERATURE_SENSOR_ID   "dht%d_t"
 
-#define FMT_HUMIDITY_SENSOR_NAME    "%s humidity (DHT %d)"
-#define FMT_TEMPERATURE_SENSOR_NAME "%s temperature (DHT %d)"
+#define FMT_HUMIDITY_SENSOR_NAME    "humidity (DHT %d)"
+#define FMT_TEMPERATURE_SENSOR_NAME "temperature (DHT %d)"
+
+#define OPT_RETRIES "retries"
+
+#define RMT_RESOLUTION_HZ 1000000 // 1 us ticks
+#define RMT_SYMBOLS       64      // one memory block, frame takes 43 symbols
+#define RMT_GLITCH_NS     1000
+#define RMT_IDLE_NS       200000  // line is idle after the frame
+
+#define FRAME_BITS       40
+#define BIT_ONE_US       50  // high pulse of 0 lasts 26..28 us, of 1 - 70 us
+#define START_DHT11_MS   20  // start signal, at least 18 ms for DHT11
+#define START_MS         2   // at least 1 ms for DHT22, 500 us for Si7021
+#define FRAME_TIMEOUT_MS 20
+#define RETRY_DELAY_MS   2000 // sensors do not measure more often
 
 typedef struct
 {
     gpio_num_t gpio;
     dht_sensor_type_t type;
+    rmt_channel_handle_t rx; // NULL if no RMT channel left, bit-banged then
+    SemaphoreHandle_t done;
+    size_t received;         // symbols, set by ISR
+    bool armed;
+    bool pending;            // not read in this period yet
+    rmt_symbol_word_t symbols[RMT_SYMBOLS];
 } sensor_t;
 
 static cvector_vector_type(sensor_t) sensors = NULL;
 
 static int update_period;
+static int retries;
+static int attempt; // of the current period, retries are rescheduled
+
+static bool IRAM_ATTR on_recv_done(rmt_channel_handle_t rx, const rmt_rx_done_event_data_t *ev, void *arg)
+{
+    (void)rx;
+    sensor_t *s = (sensor_t *)arg;
+    BaseType_t hp_task = pdFALSE;
+    s->received = ev->num_symbols;
+    xSemaphoreGiveFromISR(s->done, &hp_task);
+    return hp_task == pdTRUE;
+}
+
+static void free_rx(sensor_t *s)
+{
+    if (s->rx)
+    {
+        rmt_disable(s->rx);
+        rmt_del_channel(s->rx);
+        s->rx = NULL;
+    }
+    if (s->done)
+    {
+        vSemaphoreDelete(s->done);
+        s->done = NULL;
+    }
+}
+
+static esp_err_t init_rx(sensor_t *s)
+{
+    rmt_rx_channel_config_t cfg = {
+        .gpio_num = s->gpio,
+        .clk_src = RMT_CLK_SRC_DEFAULT,
+        .resolution_hz = RMT_RESOLUTION_HZ,
+        .mem_block_symbols = RMT_SYMBOLS,
+    };
+    CHECK(rmt_new_rx_channel(&cfg, &s->rx));
+
+    s->done = xSemaphoreCreateBinary();
+    if (!s->done)
+        return ESP_ERR_NO_MEM;
+
+    rmt_rx_event_callbacks_t cbs = { .on_recv_done = on_recv_done };
+    CHECK(rmt_rx_register_event_callbacks(s->rx, &cbs, s));
+    CHECK(rmt_enable(s->rx));
+
+    // RMT routes the pin as input, start signal goes through the open drain output
+    CHECK(gpio_set_direction(s->gpio, GPIO_MODE_INPUT_OUTPUT_OD));
+    CHECK(gpio_set_level(s->gpio, 1));
+
+    return ESP_OK;
+}
+
+static void free_sensors()
+{
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+        free_rx(&sensors[i]);
+    cvector_free(sensors);
+}
+
+// Data bits are the last 40 high pulses of the capture
+static esp_err_t decode(const sensor_t *s, float *rh, float *t)
+{
+    uint16_t highs[RMT_SYMBOLS * 2];
+    size_t count = 0;
+    for (size_t i = 0; i < s->received; i++)
+    {
+        const rmt_symbol_word_t *sym = &s->symbols[i];
+        if (sym->level0 && sym->duration0)
+            highs[count++] = sym->duration0;
+        if (sym->level1 && sym->duration1)
+            highs[count++] = sym->duration1;
+    }
+    if (count < FRAME_BITS)
+        return ESP_ERR_INVALID_SIZE;
+
+    uint8_t data[FRAME_BITS / 8] = { 0 };
+    for (size_t i = 0; i < FRAME_BITS; i++)
+        if (highs[count - FRAME_BITS + i] > BIT_ONE_US)
+            data[i / 8] |= 0x80 >> (i % 8);
+
+    if (((data[0] + data[1] + data[2] + data[3]) & 0xff) != data[4])
+        return ESP_ERR_INVALID_CRC;
+
+    if (s->type == DHT_TYPE_DHT11)
+    {
+        *rh = data[0] + data[1] * 0.1f;
+        *t = (data[2] & 0x7f) + data[3] * 0.1f;
+    }
+    else
+    {
+        *rh = ((data[0] << 8) | data[1]) * 0.1f;
+        *t = (((data[2] & 0x7f) << 8) | data[3]) * 0.1f;
+    }
+    if (data[2] & 0x80)
+        *t = -*t;
+
+    return ESP_OK;
+}
+
+static void publish(driver_t *self, size_t i, float rh, float t)
+{
+    sensors[i].pending = false;
+
+    device_t *dev = &self->devices[i * 2];
+    dev->sensor.value = rh;
+    driver_send_device_update(self, dev);
+    dev = &self->devices[i * 2 + 1];
+    dev->sensor.value = t;
+    driver_send_device_update(self, dev);
+}
+
+// Starts all RMT sensors at once, frames are captured in hardware
+static void start_frames(driver_t *self)
+{
+    bool started = false;
+    bool dht11 = false;
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+    {
+        sensor_t *s = &sensors[i];
+        s->armed = false;
+        if (!s->pending || !s->rx)
+            continue;
+        gpio_set_level(s->gpio, 0);
+        started = true;
+        dht11 |= s->type == DHT_TYPE_DHT11;
+    }
+    if (!started)
+        return;
+
+    vTaskDelay(pdMS_TO_TICKS(dht11 ? START_DHT11_MS : START_MS) + 1);
+
+    rmt_receive_config_t rc = {
+        .signal_range_min_ns = RMT_GLITCH_NS,
+        .signal_range_max_ns = RMT_IDLE_NS,
+    };
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+    {
+        sensor_t *s = &sensors[i];
+        if (!s->pending || !s->rx)
+            continue;
+        xSemaphoreTake(s->done, 0);
+        esp_err_t r = rmt_receive(s->rx, s->symbols, sizeof(s->symbols), &rc);
+        gpio_set_level(s->gpio, 1);
+        if (r != ESP_OK)
+            ESP_LOGW(self->name, "Error starting capture on device %d: %d (%s)", i, r, esp_err_to_name(r));
+        s->armed = r == ESP_OK;
+    }
+}
+
+static void read_pending(driver_t *self)
+{
+    start_frames(self);
+
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+    {
+        sensor_t *s = &sensors[i];
+        if (!s->armed)
+            continue;
+
+        float t = 0, rh = 0;
+        esp_err_t r = ESP_ERR_TIMEOUT;
+        if (xSemaphoreTake(s->done, pdMS_TO_TICKS(FRAME_TIMEOUT_MS) + 1) == pdTRUE)
+            r = decode(s, &rh, &t);
+        else
+        {
+            // no response, reset the channel to stop receiving
+            rmt_disable(s->rx);
+            rmt_enable(s->rx);
+        }
+        if (r != ESP_OK)
+        {
+            ESP_LOGW(self->name, "Error reading device %d: %d (%s)", i, r, esp_err_to_name(r));
+            continue;
+        }
+        publish(self, i, rh, t);
+    }
+
+    // sensors without RMT channel
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+    {
+        if (!sensors[i].pending || sensors[i].rx)
+            continue;
+        float t = 0, rh = 0;
+        esp_err_t r = dht_read_float_data(sensors[i].type, sensors[i].gpio, &rh, &t);
+        if (r != ESP_OK)
+        {
+            ESP_LOGW(self->name, "Error reading device %d: %d (%s)", i, r, esp_err_to_name(r));
+            continue;
+        }
+        publish(self, i, rh, t);
+    }
+}
 
 static esp_err_t on_init(driver_t *self)
 {
     cvector_free(self->devices);
-    cvector_free(sensors);
+    free_sensors();
 
     update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
+    self->period = update_period;
+    retries = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_RETRIES), 1);
+    attempt = 0;
 
     // Init devices
     cJSON *sensors_j = cJSON_GetObjectItem(self->config, OPT_SENSORS);
     for (int i = 0; i < cJSON_GetArraySize(sensors_j); i++)
     {
         cJSON *sensor_j = cJSON_GetArrayItem(sensors_j, i);
-        sensor_t s;
+        sensor_t s = { 0 };
         s.gpio = driver_config_get_gpio(cJSON_GetObjectItem(sensor_j, OPT_GPIO), GPIO_NUM_NC);
         if (s.gpio == GPIO_NUM_NC)
         {
@@ -57,60 +273,61 @@ static esp_err_t on_init(driver_t *self)
         device_t dev = { 0 };
         snprintf(dev.uid, sizeof(dev.uid), FMT_HUMIDITY_SENSOR_ID, i);
         dev.type = DEV_SENSOR;
-        snprintf(dev.name, sizeof(dev.name), FMT_HUMIDITY_SENSOR_NAME, settings.system.name, i);
-        strncpy(dev.device_class, DEV_CLASS_HUMIDITY, sizeof(dev.device_class));
-        strncpy(dev.sensor.measurement_unit, DEV_MU_HUMIDITY, sizeof(dev.sensor.measurement_unit));
+        dev.info = device_info(DEV_CLASS_HUMIDITY, DEV_MU_HUMIDITY, FMT_HUMIDITY_SENSOR_NAME, i);
         dev.sensor.precision = 1;
         dev.sensor.update_period = update_period;
-        cvector_push_back(self->devices, dev);
+        driver_add_device(self, &dev);
 
         memset(&dev, 0, sizeof(device_t));
         snprintf(dev.uid, sizeof(dev.uid), FMT_TEMPERATURE_SENSOR_ID, i);
         dev.type = DEV_SENSOR;
-        snprintf(dev.name, sizeof(dev.name), FMT_TEMPERATURE_SENSOR_NAME, settings.system.name, i);
-        strncpy(dev.device_class, DEV_CLASS_TEMPERATURE, sizeof(dev.device_class));
-        strncpy(dev.sensor.measurement_unit, DEV_MU_TEMPERATURE, sizeof(dev.sensor.measurement_unit));
+        dev.info = device_info(DEV_CLASS_TEMPERATURE, DEV_MU_TEMPERATURE, FMT_TEMPERATURE_SENSOR_NAME, i);
         dev.sensor.precision = 1;
         dev.sensor.update_period = update_period;
-        cvector_push_back(self->devices, dev);
+        driver_add_device(self, &dev);
+    }
+
+    // vector does not move anymore, ISR gets pointers to its items
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+    {
+        esp_err_t r = init_rx(&sensors[i]);
+        if (r == ESP_OK)
+            continue;
+        ESP_LOGW(self->name, "No RMT channel for device %d, using bit-banging: %d (%s)", i, r, esp_err_to_name(r));
+        free_rx(&sensors[i]);
+        gpio_set_direction(sensors[i].gpio, GPIO_MODE_INPUT);
     }
 
     return ESP_OK;
 }
 
-static void task(driver_t *self)
+static void sample(driver_t *self)
 {
-    TickType_t period = pdMS_TO_TICKS(update_period);
+    if (!attempt)
+        for (size_t i = 0; i < cvector_size(sensors); i++)
+            sensors[i].pending = true;
 
-    while (true)
+    read_pending(self);
+
+    bool pending = false;
+    for (size_t i = 0; i < cvector_size(sensors); i++)
+        pending |= sensors[i].pending;
+    if (pending && attempt < retries && !driver_stop_requested(self))
     {
-        TickType_t start = xTaskGetTickCount();
+        // retry without blocking the worker
+        attempt++;
+        driver_sample_after(self, RETRY_DELAY_MS);
+        return;
+    }
+    attempt = 0;
+}
 
-        for (size_t i = 0; i < cvector_size(sensors); i++)
-        {
-            float t = 0, rh = 0;
-            esp_err_t r = dht_read_float_data(sensors[i].type, sensors[i].gpio, &rh, &t);
-            if (r != ESP_OK)
-            {
-                ESP_LOGW(self->name, "Error reading device %d: %d (%s)", i, r, esp_err_to_name(r));
-                continue;
-            }
-
-            device_t *dev = &self->devices[i * 2];
-            dev->sensor.value = rh;
-            driver_send_device_update(self, dev);
-            dev = &self->devices[i * 2 + 1];
-            dev->sensor.value = t;
-            driver_send_device_update(self, dev);
-        }
+static esp_err_t on_stop(driver_t *self)
+{
+    free_sensors();
+    attempt = 0;
 
-        while (xTaskGetTickCount() - start < period)
-        {
-            if (!(xEventGroupGetBits(self->eg) & DRIVER_BIT_START))
-                return;
-            vTaskDelay(1);
-        }
-    }
+    return ESP_OK;
 }
 
 driver_t drv_dht = {
@@ -122,16 +339,19 @@ driver_t drv_dht = {
     .config = NULL,
     .state = DRIVER_NEW,
     .event_queue = NULL,
+    .update_queue = NULL,
 
     .devices = NULL,
+    .lock = NULL,
     .handle = NULL,
     .eg = NULL,
 
     .on_init = on_init,
     .on_start = NULL,
-    .on_stop = NULL,
+    .on_stop = on_stop,
 
-    .task = task
+    .task = NULL,
+    .sample = sample
 };
 
 #endif
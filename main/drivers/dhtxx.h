@@ -8,6 +8,7 @@
 /*
 {
   "period": 5000,            // ms
+  "retries": 1,              // repeated reads of failed sensors, 2 s apart
   "sensors": [
     {
         "gpio": 21,          // GPIO number
@@ -16,6 +17,9 @@
     }
   ]
 }
+
+Frames are captured by RMT, all sensors are read at once. Sensors left without
+RMT channel are bit-banged by the dht component.
 */
 #include "driver.h"
 #include "std_strings.h"
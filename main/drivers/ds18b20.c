@@ -2,146 +2,606 @@
 
 #ifdef DRIVER_DS18B20
 
+#include <stdlib.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_rom_sys.h>
+#include <nvs.h>
 #include <ds18x20.h>
-#include "settings.h"
+#include <onewire.h>
 
 #define SENSOR_ADDR_FMT "%08lX%08lX"
 #define SENSOR_ADDR(addr) (uint32_t)(addr >> 32), (uint32_t)addr
 
 #define SENSOR_UID_FMT SENSOR_ADDR_FMT
-#define SENSOR_NAME_FMT "%s temperature (DS18x20 " SENSOR_ADDR_FMT ")"
+#define SENSOR_NAME_FMT "temperature (DS18x20 " SENSOR_ADDR_FMT ")"
+#define SENSOR_LABEL_NAME_FMT "temperature (%s)"
+
+#define OPT_SCAN_INTERVAL "scan_interval"
+#define OPT_RESOLUTION    "resolution"
+#define OPT_PROBES        "probes"
+#define OPT_LABEL         "label"
+#define OPT_OFFSET        "offset"
+
+#define REGISTRY_MAGIC_KEY "ds18b20_magic"
+#define REGISTRY_DATA_KEY  "ds18b20_reg"
+#define REGISTRY_MAGIC_VAL 0xD5180001
+#define LABEL_SIZE 32
+
+#define CMD_SEARCH_ROM   0xf0
+#define CMD_ALARM_SEARCH 0xec
+
+#define FAMILY_DS18S20 0x10
+#define FAMILY_DS1822  0x22
+#define FAMILY_DS18B20 0x28
+
+// configured probes never raise alarm, so alarm search finds only new or power cycled ones
+#define ALARM_TH 125
+#define ALARM_TL -55
+
+#define MAX_CONV_TIME_MS 750 // 12 bit
+#define MAX_MISSES 3         // failed reads before probe is removed
+
+typedef struct {
+    ds18x20_addr_t addr;
+    size_t slot;      // index in self->devices
+    uint8_t resolution;
+    uint8_t misses;
+    float offset;     // calibration, added to readings
+} probe_t;
+
+// Known probe, persisted in NVS
+typedef struct {
+    ds18x20_addr_t addr;
+    float offset;
+    uint8_t resolution;
+    bool present;     // was on the bus when registry was saved
+    char label[LABEL_SIZE];
+} record_t;
+
+typedef struct {
+    uint64_t rom;
+    int last_discrepancy;
+    bool last_device;
+} search_t;
 
 static size_t scan_interval;
+static int update_period;
+static uint8_t def_resolution;
+
+// sorted by address
+static probe_t probes[DRIVER_DS18B20_MAX_SENSORS];
+static size_t probes_count = 0;
+// address of each device slot
+static ds18x20_addr_t slots[DRIVER_DS18B20_MAX_SENSORS];
+
+// probes ever seen, absent ones keep their settings until evicted
+static record_t registry[DRIVER_DS18B20_MAX_SENSORS];
+static size_t registry_count = 0;
+static bool registry_dirty = false;
 
-static ds18x20_addr_t sensors[DRIVER_DS18B20_MAX_SENSORS] = { 0 };
-static float results[DRIVER_DS18B20_MAX_SENSORS] = { 0 };
+static portMUX_TYPE ow_lock = portMUX_INITIALIZER_UNLOCKED;
 
-static size_t sensors_count = 0;
 static size_t loop_no = 0;
+static int64_t conv_done = 0; // us, 0 if no conversion pending
+static bool scan_pending = false;
+static bool restoring = false; // restored probes not read yet
 
-static int update_period;
+static inline uint8_t family(ds18x20_addr_t addr)
+{
+    return addr & 0xff;
+}
 
-static esp_err_t on_init(driver_t *self)
+static inline uint8_t clamp_resolution(int res)
 {
-    cvector_free(self->devices);
-    memset(sensors, 0, sizeof(sensors));
-    sensors_count = 0;
-    loop_no = 0;
+    return res < 9 ? 9 : res > 12 ? 12 : res;
+}
 
-    update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
-    scan_interval = driver_config_get_int(cJSON_GetObjectItem(self->config, "scan_interval"), 1);
+static int compare_probes(const void *key, const void *item)
+{
+    ds18x20_addr_t a = *(const ds18x20_addr_t *)key;
+    ds18x20_addr_t b = ((const probe_t *)item)->addr;
 
-    ESP_LOGI(self->name, "Configured to use GPIO %d with scan_interval %d", DRIVER_DS18B20_GPIO, scan_interval);
+    return (a > b) - (a < b);
+}
 
-    esp_err_t r = gpio_reset_pin(DRIVER_DS18B20_GPIO);
-    if (r != ESP_OK)
-        ESP_LOGE(self->name, "Error reset GPIO pin %d: %d (%s)", DRIVER_DS18B20_GPIO, r, esp_err_to_name(r));
+static probe_t *find_probe(ds18x20_addr_t addr)
+{
+    return bsearch(&addr, probes, probes_count, sizeof(probe_t), compare_probes);
+}
 
-    return r;
+////////////////////////////////////////////////////////////////////////////////
+
+// onewire component has no public bit I/O, search slots are timed here
+
+static bool ow_read_bit()
+{
+    portENTER_CRITICAL(&ow_lock);
+    gpio_set_level(DRIVER_DS18B20_GPIO, 0);
+    esp_rom_delay_us(2);
+    gpio_set_level(DRIVER_DS18B20_GPIO, 1);
+    esp_rom_delay_us(11);
+    bool res = gpio_get_level(DRIVER_DS18B20_GPIO);
+    portEXIT_CRITICAL(&ow_lock);
+    esp_rom_delay_us(48);
+
+    return res;
 }
 
-static void scan(driver_t *self)
+static void ow_write_bit(bool v)
 {
-    esp_err_t r;
+    portENTER_CRITICAL(&ow_lock);
+    gpio_set_level(DRIVER_DS18B20_GPIO, 0);
+    esp_rom_delay_us(v ? 6 : 60);
+    gpio_set_level(DRIVER_DS18B20_GPIO, 1);
+    portEXIT_CRITICAL(&ow_lock);
+    esp_rom_delay_us(v ? 64 : 10);
+}
+
+// Maxim search algorithm with arbitrary search command. Returns ESP_ERR_NOT_FOUND when
+// there are no more devices, other errors mean the search failed and must be restarted
+static esp_err_t search_next(search_t *s, uint8_t cmd, ds18x20_addr_t *addr)
+{
+    if (s->last_device || !onewire_reset(DRIVER_DS18B20_GPIO))
+        return ESP_ERR_NOT_FOUND;
+    onewire_write(DRIVER_DS18B20_GPIO, cmd);
+    gpio_set_direction(DRIVER_DS18B20_GPIO, GPIO_MODE_INPUT_OUTPUT_OD);
+
+    uint64_t rom = s->rom;
+    int last_zero = -1;
+    for (int i = 0; i < 64; i++)
+    {
+        bool id = ow_read_bit();
+        bool cmp_id = ow_read_bit();
+        if (id && cmp_id)
+        {
+            // nobody answers: no alarmed devices or a device left the bus during the search
+            return i == 0 && cmd != CMD_SEARCH_ROM ? ESP_ERR_NOT_FOUND : ESP_ERR_INVALID_RESPONSE;
+        }
+        bool dir;
+        if (id != cmp_id)
+            dir = id;
+        else
+        {
+            dir = i < s->last_discrepancy ? (rom >> i) & 1 : i == s->last_discrepancy;
+            if (!dir)
+                last_zero = i;
+        }
+        rom = dir ? rom | (1ULL << i) : rom & ~(1ULL << i);
+        ow_write_bit(dir);
+    }
 
-    size_t result_count = 0;
-    ds18x20_addr_t scan_result[DRIVER_DS18B20_MAX_SENSORS] = { 0 };
+    s->rom = rom;
+    s->last_discrepancy = last_zero;
+    s->last_device = last_zero < 0;
 
-    r = ds18x20_scan_devices(DRIVER_DS18B20_GPIO, scan_result, DRIVER_DS18B20_MAX_SENSORS, &result_count);
+    uint8_t bytes[8];
+    for (size_t i = 0; i < 8; i++)
+        bytes[i] = rom >> (i * 8);
+    if (onewire_crc8(bytes, 7) != bytes[7])
+        return ESP_ERR_INVALID_CRC;
+
+    *addr = rom;
+    return ESP_OK;
+}
+
+static inline void search_start(search_t *s)
+{
+    memset(s, 0, sizeof(search_t));
+    s->last_discrepancy = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static record_t *find_record(ds18x20_addr_t addr)
+{
+    for (size_t i = 0; i < registry_count; i++)
+        if (registry[i].addr == addr)
+            return &registry[i];
+    return NULL;
+}
+
+static void registry_load(driver_t *self)
+{
+    registry_count = 0;
+    registry_dirty = false;
+
+    nvs_handle_t nvs;
+    esp_err_t r = nvs_open(SETTINGS_PARTITION, NVS_READONLY, &nvs);
+    if (r != ESP_OK)
+        return;
+
+    uint32_t magic = 0;
+    size_t size = sizeof(registry);
+    r = nvs_get_u32(nvs, REGISTRY_MAGIC_KEY, &magic);
+    if (r == ESP_OK && magic != REGISTRY_MAGIC_VAL)
+        r = ESP_ERR_INVALID_VERSION;
+    if (r == ESP_OK)
+        r = nvs_get_blob(nvs, REGISTRY_DATA_KEY, registry, &size);
+    if (r == ESP_OK && size % sizeof(record_t))
+        r = ESP_ERR_INVALID_SIZE;
+    nvs_close(nvs);
+
+    if (r == ESP_OK)
+        registry_count = size / sizeof(record_t);
+    else if (r != ESP_ERR_NVS_NOT_FOUND)
+        ESP_LOGW(self->name, "Error loading probe registry: %d (%s)", r, esp_err_to_name(r));
+    ESP_LOGI(self->name, "%u probes in registry", registry_count);
+}
+
+// Writes registry only if it has changed, to spare the flash
+static void registry_save(driver_t *self)
+{
+    if (!registry_dirty)
+        return;
+
+    nvs_handle_t nvs;
+    esp_err_t r = nvs_open(SETTINGS_PARTITION, NVS_READWRITE, &nvs);
+    if (r == ESP_OK)
+    {
+        r = nvs_set_u32(nvs, REGISTRY_MAGIC_KEY, REGISTRY_MAGIC_VAL);
+        if (r == ESP_OK)
+            r = nvs_set_blob(nvs, REGISTRY_DATA_KEY, registry, registry_count * sizeof(record_t));
+        if (r == ESP_OK)
+            r = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
     if (r != ESP_OK)
     {
-        ESP_LOGW(self->name, "Error scanning bus: %d (%s)", r, esp_err_to_name(r));
+        ESP_LOGW(self->name, "Error saving probe registry: %d (%s)", r, esp_err_to_name(r));
         return;
     }
-    if (!result_count)
+    registry_dirty = false;
+}
+
+static void registry_put(const record_t *rec)
+{
+    record_t *dst = find_record(rec->addr);
+    if (!dst)
     {
-        ESP_LOGW(self->name, "Sensors not found");
+        if (registry_count < DRIVER_DS18B20_MAX_SENSORS)
+            dst = &registry[registry_count++];
+        else
+        {
+            // evict the first absent probe, present ones are never more than the table
+            for (size_t i = 0; i < registry_count && !dst; i++)
+                if (!registry[i].present)
+                    dst = &registry[i];
+            if (!dst)
+                return;
+        }
+    }
+    else if (!memcmp(dst, rec, sizeof(record_t)))
         return;
+
+    memcpy(dst, rec, sizeof(record_t));
+    registry_dirty = true;
+}
+
+static void registry_set_present(ds18x20_addr_t addr, bool present)
+{
+    record_t *rec = find_record(addr);
+    if (rec && rec->present != present)
+    {
+        rec->present = present;
+        registry_dirty = true;
+    }
+}
+
+// Probe settings: per probe config, then registry, then defaults
+static void probe_settings(driver_t *self, ds18x20_addr_t addr, record_t *rec)
+{
+    const record_t *known = find_record(addr);
+
+    memset(rec, 0, sizeof(record_t));
+    rec->addr = addr;
+    rec->present = true;
+    rec->resolution = known ? known->resolution : def_resolution;
+    rec->offset = known ? known->offset : 0;
+    if (known)
+        memcpy(rec->label, known->label, LABEL_SIZE);
+
+    char uid[DEVICE_UID_SIZE];
+    snprintf(uid, sizeof(uid), SENSOR_UID_FMT, SENSOR_ADDR(addr));
+    cJSON *custom = cJSON_GetObjectItem(cJSON_GetObjectItem(self->config, OPT_PROBES), uid);
+
+    rec->resolution = family(addr) == FAMILY_DS18S20
+        ? 9
+        : clamp_resolution(driver_config_get_int(cJSON_GetObjectItem(custom, OPT_RESOLUTION), rec->resolution));
+    rec->offset = driver_config_get_float(cJSON_GetObjectItem(custom, OPT_OFFSET), rec->offset);
+    const char *label = cJSON_GetStringValue(cJSON_GetObjectItem(custom, OPT_LABEL));
+    if (label)
+    {
+        memset(rec->label, 0, LABEL_SIZE);
+        strncpy(rec->label, label, LABEL_SIZE - 1);
     }
+}
+
+// Set resolution and disable alarm, scratchpad only, probe forgets it after power cycle
+static esp_err_t configure_probe(probe_t *p)
+{
+    uint8_t data[3] = { (uint8_t)ALARM_TH, (uint8_t)ALARM_TL, ((p->resolution - 9) << 5) | 0x1f };
+
+    return ds18x20_write_scratchpad(DRIVER_DS18B20_GPIO, p->addr, data);
+}
 
-    if (memcmp(sensors, scan_result, sizeof(sensors)) == 0)
+static void add_probe(driver_t *self, ds18x20_addr_t addr)
+{
+    if (probes_count == DRIVER_DS18B20_MAX_SENSORS)
+    {
+        ESP_LOGW(self->name, "Too many sensors, ignoring " SENSOR_ADDR_FMT, SENSOR_ADDR(addr));
         return;
+    }
+
+    // insert keeping the table sorted
+    size_t pos = 0;
+    while (pos < probes_count && probes[pos].addr < addr)
+        pos++;
+    memmove(&probes[pos + 1], &probes[pos], (probes_count - pos) * sizeof(probe_t));
+    probes_count++;
+
+    record_t rec;
+    probe_settings(self, addr, &rec);
+    registry_put(&rec);
+
+    probe_t *p = &probes[pos];
+    p->addr = addr;
+    p->resolution = rec.resolution;
+    p->offset = rec.offset;
+    p->misses = 0;
 
-    // something changed
-    // 1. remove disconnected
-    for (size_t i = 0; i < sensors_count; i++)
+    device_t dev = { 0 };
+    dev.type = DEV_SENSOR;
+    snprintf(dev.uid, sizeof(dev.uid), SENSOR_UID_FMT, SENSOR_ADDR(addr));
+    dev.info = rec.label[0]
+        ? device_info(DEV_CLASS_TEMPERATURE, DEV_MU_TEMPERATURE, SENSOR_LABEL_NAME_FMT, rec.label)
+        : device_info(DEV_CLASS_TEMPERATURE, DEV_MU_TEMPERATURE, SENSOR_NAME_FMT, SENSOR_ADDR(addr));
+    dev.sensor.precision = 2;
+    dev.sensor.update_period = update_period;
+
+    // new devices are appended, existing slots do not move
+    driver_lock_devices(self);
+    p->slot = cvector_size(self->devices);
+    slots[p->slot] = addr;
+    dev = *driver_add_device(self, &dev);
+    driver_unlock_devices(self);
+
+    esp_err_t r = configure_probe(p);
+    if (r != ESP_OK)
+        ESP_LOGW(self->name, "Error configuring " SENSOR_ADDR_FMT ": %d (%s)", SENSOR_ADDR(addr), r, esp_err_to_name(r));
+
+    ESP_LOGI(self->name, "Added " SENSOR_ADDR_FMT ", %d bit", SENSOR_ADDR(addr), p->resolution);
+    driver_send_device_add(self, &dev);
+}
+
+static void remove_probe(driver_t *self, probe_t *p)
+{
+    ESP_LOGI(self->name, "Removed " SENSOR_ADDR_FMT, SENSOR_ADDR(p->addr));
+    registry_set_present(p->addr, false);
+
+    // the last device takes the freed slot
+    driver_lock_devices(self);
+    size_t last = cvector_size(self->devices) - 1;
+    device_t dev = self->devices[p->slot];
+    bool resend = driver_remove_device(self, p->slot);
+    if (p->slot != last)
     {
-        bool found = false;
-        for (size_t c = 0; c < result_count; c++)
-            if (sensors[i] == scan_result[c])
-            {
-                found = true;
-                break;
-            }
-        if (!found)
-        {
-            ESP_LOGI(self->name, "Removed " SENSOR_ADDR_FMT, SENSOR_ADDR(sensors[i]));
-            driver_send_device_remove(self, &self->devices[i]);
-        }
+        slots[p->slot] = slots[last];
+        find_probe(slots[p->slot])->slot = p->slot;
     }
-    // 2. recreate devices
-    cvector_free(self->devices);
-    for (size_t i = 0; i < result_count; i++)
+    driver_unlock_devices(self);
+    if (resend)
+        driver_send_device_update(self, &self->devices[p->slot]);
+
+    size_t pos = p - probes;
+    memmove(&probes[pos], &probes[pos + 1], (probes_count - pos - 1) * sizeof(probe_t));
+    probes_count--;
+
+    driver_send_device_remove(self, &dev);
+}
+
+// Full search, adds new probes and removes missing ones
+static void scan(driver_t *self)
+{
+    bool seen[DRIVER_DS18B20_MAX_SENSORS] = { 0 };
+    ds18x20_addr_t found[DRIVER_DS18B20_MAX_SENSORS];
+    size_t found_count = 0;
+
+    search_t s;
+    search_start(&s);
+    ds18x20_addr_t addr;
+    esp_err_t r = ESP_OK;
+    while (found_count < DRIVER_DS18B20_MAX_SENSORS && (r = search_next(&s, CMD_SEARCH_ROM, &addr)) == ESP_OK)
+    {
+        uint8_t f = family(addr);
+        if (f != FAMILY_DS18S20 && f != FAMILY_DS1822 && f != FAMILY_DS18B20)
+            continue;
+        probe_t *p = find_probe(addr);
+        if (p)
+            seen[p - probes] = true;
+        else
+            found[found_count++] = addr;
+    }
+
+    // probes not enumerated by an interrupted search may still be on the bus
+    if (r == ESP_ERR_NOT_FOUND)
     {
-        device_t dev = { 0 };
-        dev.type = DEV_SENSOR;
-        snprintf(dev.uid, sizeof(dev.uid), SENSOR_UID_FMT, SENSOR_ADDR(scan_result[i]));
-        snprintf(dev.name, sizeof(dev.name), SENSOR_NAME_FMT, settings.system.name, SENSOR_ADDR(scan_result[i]));
-        strncpy(dev.device_class, DEV_CLASS_TEMPERATURE, sizeof(dev.device_class));
-        strncpy(dev.sensor.measurement_unit, DEV_MU_TEMPERATURE, sizeof(dev.sensor.measurement_unit));
-        dev.sensor.precision = 2;
-        dev.sensor.update_period = update_period;
-        cvector_push_back(self->devices, dev);
+        // remove from the end, so indices of unvisited probes stay valid
+        for (size_t i = probes_count; i > 0; i--)
+            if (!seen[i - 1])
+                remove_probe(self, &probes[i - 1]);
     }
-    // 3. add connected
-    for (size_t i = 0; i < result_count; i++)
+    else if (r != ESP_OK)
+        ESP_LOGW(self->name, "Search failed, keeping probes: %d (%s)", r, esp_err_to_name(r));
+    for (size_t i = 0; i < found_count; i++)
+        add_probe(self, found[i]);
+
+    if (!probes_count)
+        ESP_LOGW(self->name, "Sensors not found");
+}
+
+// Alarm search after conversion, finds probes with default alarm thresholds
+static void alarm_scan(driver_t *self)
+{
+    search_t s;
+    search_start(&s);
+    ds18x20_addr_t addr;
+    esp_err_t r;
+    while ((r = search_next(&s, CMD_ALARM_SEARCH, &addr)) == ESP_OK)
+    {
+        probe_t *p = find_probe(addr);
+        if (!p)
+        {
+            uint8_t f = family(addr);
+            if (f == FAMILY_DS18S20 || f == FAMILY_DS1822 || f == FAMILY_DS18B20)
+                add_probe(self, addr);
+            continue;
+        }
+        // power cycled, configuration is lost
+        ESP_LOGI(self->name, "Reconfiguring " SENSOR_ADDR_FMT, SENSOR_ADDR(addr));
+        esp_err_t err = configure_probe(p);
+        if (err != ESP_OK)
+            ESP_LOGW(self->name, "Error configuring " SENSOR_ADDR_FMT ": %d (%s)", SENSOR_ADDR(addr), err, esp_err_to_name(err));
+    }
+    if (r != ESP_ERR_NOT_FOUND)
+        ESP_LOGD(self->name, "Alarm search failed: %d (%s)", r, esp_err_to_name(r));
+}
+
+static void read_results(driver_t *self)
+{
+    // remove from the end, so indices of unvisited probes stay valid
+    for (size_t i = probes_count; i > 0; i--)
     {
-        bool found = false;
-        for (size_t c = 0; c < sensors_count; c++)
-            if (scan_result[i] == sensors[c])
-            {
-                found = true;
-                break;
-            }
-        if (!found)
+        probe_t *p = &probes[i - 1];
+        float t;
+        esp_err_t r = ds18x20_read_temperature(DRIVER_DS18B20_GPIO, p->addr, &t);
+        if (r != ESP_OK)
         {
-            ESP_LOGI(self->name, "Added " SENSOR_ADDR_FMT, SENSOR_ADDR(scan_result[i]));
-            driver_send_device_add(self, &self->devices[i]);
+            ESP_LOGW(self->name, "Error reading " SENSOR_ADDR_FMT ": %d (%s)", SENSOR_ADDR(p->addr), r, esp_err_to_name(r));
+            if (++p->misses >= MAX_MISSES)
+                remove_probe(self, p);
+            continue;
         }
+        p->misses = 0;
+        self->devices[p->slot].sensor.value = t + p->offset;
+        driver_send_device_update(self, &self->devices[p->slot]);
     }
-    // copy
-    memcpy(sensors, scan_result, sizeof(sensors));
-    sensors_count = result_count;
+}
+
+// Creates devices of the probes present at the last save, they are measured before the first search
+static void restore(driver_t *self)
+{
+    registry_load(self);
+    for (size_t i = 0; i < registry_count; i++)
+        if (registry[i].present)
+            add_probe(self, registry[i].addr);
+    restoring = probes_count > 0;
+    registry_save(self);
+}
+
+// DS18S20 reports 9 bits but always converts for 750 ms
+static uint32_t conversion_ms(const probe_t *p)
+{
+    return family(p->addr) == FAMILY_DS18S20 ? MAX_CONV_TIME_MS : MAX_CONV_TIME_MS >> (12 - p->resolution);
+}
+
+static esp_err_t start_conversion()
+{
+    uint32_t ms = MAX_CONV_TIME_MS >> 3;
+    for (size_t i = 0; i < probes_count; i++)
+        if (conversion_ms(&probes[i]) > ms)
+            ms = conversion_ms(&probes[i]);
+
+    CHECK(ds18x20_measure(DRIVER_DS18B20_GPIO, DS18X20_ANY, false));
+    conv_done = esp_timer_get_time() + (int64_t)ms * 1000;
+
+    return ESP_OK;
+}
+
+// Waits for the pending conversion and reads it
+static void collect(driver_t *self)
+{
+    int64_t wait = conv_done - esp_timer_get_time();
+    if (wait > 0)
+        vTaskDelay(pdMS_TO_TICKS(wait / 1000) + 1);
+    read_results(self);
+    alarm_scan(self);
+    conv_done = 0;
+    restoring = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t on_init(driver_t *self)
+{
+    cvector_free(self->devices);
+    probes_count = 0;
+    loop_no = 0;
+    conv_done = 0;
+    scan_pending = false;
+    restoring = false;
+
+    update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
+    scan_interval = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_SCAN_INTERVAL), 1);
+    if (!scan_interval)
+        scan_interval = 1;
+    def_resolution = clamp_resolution(driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_RESOLUTION), 12));
+
+    ESP_LOGI(self->name, "Configured to use GPIO %d with scan_interval %d", DRIVER_DS18B20_GPIO, scan_interval);
+
+    esp_err_t r = gpio_reset_pin(DRIVER_DS18B20_GPIO);
+    if (r != ESP_OK)
+        ESP_LOGE(self->name, "Error reset GPIO pin %d: %d (%s)", DRIVER_DS18B20_GPIO, r, esp_err_to_name(r));
+
+    return r;
 }
 
 static void task(driver_t *self)
 {
     TickType_t period = pdMS_TO_TICKS(update_period);
 
+    restore(self);
+    // restored probes are published right away, not a period later
+    if (restoring)
+    {
+        esp_err_t r = start_conversion();
+        if (r == ESP_OK)
+            collect(self);
+        else
+            ESP_LOGW(self->name, "Error starting conversion: %d (%s)", r, esp_err_to_name(r));
+    }
+
     while (true)
     {
         TickType_t start = xTaskGetTickCount();
 
-        if (!(loop_no++ % scan_interval) || !sensors_count)
-            scan(self);
+        // results of the conversion started in the previous period
+        if (conv_done)
+            collect(self);
 
-        esp_err_t r = ds18x20_measure_and_read_multi(DRIVER_DS18B20_GPIO, sensors, sensors_count, results);
-        if (r == ESP_OK)
-            for (size_t i = 0; i < sensors_count; i++)
-            {
-                self->devices[i].sensor.value = results[i];
-                driver_send_device_update(self, &self->devices[i]);
-            }
-        else
-            ESP_LOGW(self->name, "Error measuring: %d (%s)", r, esp_err_to_name(r));
+        if (!(loop_no++ % scan_interval))
+            scan_pending = true;
+        // search reconciles the registry after restored probes are read once
+        if (!probes_count || (scan_pending && !restoring))
+        {
+            scan(self);
+            scan_pending = false;
+        }
 
-        while (xTaskGetTickCount() - start < period)
+        // convert while waiting for the next period
+        if (probes_count)
         {
-            if (!(xEventGroupGetBits(self->eg) & DRIVER_BIT_START))
-                return;
-            vTaskDelay(1);
+            esp_err_t r = start_conversion();
+            if (r != ESP_OK)
+                ESP_LOGW(self->name, "Error starting conversion: %d (%s)", r, esp_err_to_name(r));
         }
+
+        registry_save(self);
+
+        if (xTaskGetTickCount() - start > period)
+            self->stats.overruns++;
+        if (!driver_wait_period(self, start, period))
+            return;
     }
 }
 
@@ -149,13 +609,15 @@ driver_t drv_ds18b20 = {
     .name = "ds18b20",
     .stack_size = DRIVER_DS18B20_STACK_SIZE,
     .priority = tskIDLE_PRIORITY + 1,
-    .defconfig = "{ \"" OPT_PERIOD "\": 5000, \"scan_interval\": 10 }",
+    .defconfig = "{ \"" OPT_PERIOD "\": 5000, \"" OPT_SCAN_INTERVAL "\": 10, \"" OPT_RESOLUTION "\": 12 }",
 
     .config = NULL,
     .state = DRIVER_NEW,
     .event_queue = NULL,
+    .update_queue = NULL,
 
     .devices = NULL,
+    .lock = NULL,
     .handle = NULL,
     .eg = NULL,
 
@@ -163,7 +625,8 @@ driver_t drv_ds18b20 = {
     .on_start = NULL,
     .on_stop = NULL,
 
-    .task = task
+    .task = task,
+    .sample = NULL
 };
 
 #endif
@@ -5,6 +5,24 @@
 
 #ifdef DRIVER_DS18B20
 
+/*
+{
+  "period": 5000,        // ms
+  "scan_interval": 10,   // full bus search every N periods, new probes are found by alarm search in between
+  "resolution": 12,      // bits, 9..12, conversion takes 94..750 ms
+  "probes": {            // optional, per probe settings
+    "28FF4A5B6C7D8E01": {
+      "resolution": 10,
+      "label": "boiler",   // device name
+      "offset": -0.25      // calibration offset, C
+    }
+  }
+}
+
+Known probes and their settings are kept in NVS, at boot they are measured
+right away and the bus is searched after the first readings.
+*/
+
 #include "driver.h"
 #include "std_strings.h"
 
@@ -4,25 +4,41 @@
 
 #include <esp_log.h>
 #include <esp_adc/adc_oneshot.h>
+#include <esp_adc/adc_continuous.h>
+#include <soc/soc_caps.h>
 #include <esp_adc/adc_cali_scheme.h>
-#include <calibration.h>
-#include "settings.h"
 
 #define FMT_ADC_SENSOR_ID        "ain%d"
 #define FMT_MOISTURE_SENSOR_ID   "ain%d_moisture"
 #define FMT_TDS_RAW_SENSOR_ID    "tds0_raw"
 #define FMT_TDS_SENSOR_ID        "tds0"
 
-#define FMT_ADC_SENSOR_NAME      "%s analog input %d"
-#define FMT_MOISTURE_SENSOR_NAME "%s moisture sensor on AIN%d"
-#define FMT_TDS_RAW_SENSOR_NAME  "%s TDS input 0 raw voltage"
-#define FMT_TDS_SENSOR_NAME      "%s TDS input 0"
+#define FMT_ADC_SENSOR_NAME      "analog input %d"
+#define FMT_MOISTURE_SENSOR_NAME "moisture sensor on AIN%d"
+#define FMT_TDS_RAW_SENSOR_NAME  "TDS input 0 raw voltage"
+#define FMT_TDS_SENSOR_NAME      "TDS input 0"
 
 #define ADC_WIDTH ADC_BITWIDTH_12
 #define AIN_COUNT 4
 #define TDS_CHANNEL ADC_CHANNEL_3
 
+#ifdef DRIVER_GH_ADC_TDS_ENABLE
+#define CHANNEL_COUNT (AIN_COUNT + 1)
+#else
+#define CHANNEL_COUNT AIN_COUNT
+#endif
+#define TDS_INDEX AIN_COUNT
+
+#define FRAME_CONVERSIONS 32
+#define FRAME_SIZE (CHANNEL_COUNT * FRAME_CONVERSIONS * SOC_ADC_DIGI_RESULT_BYTES)
+#define STORE_BUF_SIZE (FRAME_SIZE * 4)
+#define READ_TIMEOUT_MS 100
+
+// raw codes are filtered in Q8 to keep sub-LSB resolution
+#define RAW_FRAC_BITS 8
+
 static adc_oneshot_unit_handle_t adc_handle = NULL;
+static adc_continuous_handle_t cont_handle = NULL;
 static const adc_oneshot_unit_init_cfg_t unit_cfg = {
     .unit_id = ADC_UNIT_1,
     .ulp_mode = ADC_ULP_MODE_DISABLE,
@@ -37,9 +53,14 @@ static const adc_channel_t ain_channels[AIN_COUNT] = {
 static size_t samples;
 static int update_period;
 static bool moisture_enabled;
+static bool continuous;
+
+static filter_t filters[CHANNEL_COUNT] = { 0 };
+static int32_t *blocks = NULL; // CHANNEL_COUNT blocks of `samples` raw codes
+static const filter_config_t def_filter = { .type = FILTER_NONE };
 
 static adc_cali_handle_t adc_cal_handle = NULL;
-static calibration_handle_t moisture_calib = { 0 };
+static lut_t moisture_calib = { 0 };
 static const calibration_point_t def_moisture_calib[]= {
     { .code = 2.2f, .value = 0.0f },
     { .code = 0.9f, .value = 100.0f, },
@@ -48,7 +69,7 @@ static const size_t def_moisture_calib_points = sizeof(def_moisture_calib) / siz
 
 #ifdef DRIVER_GH_ADC_TDS_ENABLE
 static adc_cali_handle_t tds_cal_handle = NULL;
-static calibration_handle_t tds_calib = { 0 };
+static lut_t tds_calib = { 0 };
 static const calibration_point_t def_tds_calib[]= {
     { .code = 0.0f, .value = 0.0f },
     { .code = 1.0f, .value = 1.0f, },
@@ -70,14 +91,130 @@ static esp_err_t create_adc_cali_scheme(adc_atten_t atten, adc_cali_handle_t *ca
     return adc_cali_create_scheme_line_fitting(&cal_cfg, cal_handle);
 }
 
+static esp_err_t init_oneshot(driver_t *self, adc_atten_t atten)
+{
+    ESP_RETURN_ON_ERROR(
+        adc_oneshot_new_unit(&unit_cfg, &adc_handle),
+        self->name, "Error initializing ADC UNIT 1: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+
+    // configure four ADC channels
+    adc_oneshot_chan_cfg_t chan_cfg = {
+        .atten = atten,
+        .bitwidth = ADC_WIDTH,
+    };
+    for (size_t c = 0; c < AIN_COUNT; c++)
+        ESP_RETURN_ON_ERROR(
+            adc_oneshot_config_channel(adc_handle, ain_channels[c], &chan_cfg),
+            self->name, "Error configuring ADC channel: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+        );
+
+#ifdef DRIVER_GH_ADC_TDS_ENABLE
+    // configure TDS measure channel
+    chan_cfg.atten = DRIVER_GH_ADC_TDS_ATTEN;
+    ESP_RETURN_ON_ERROR(
+        adc_oneshot_config_channel(adc_handle, TDS_CHANNEL, &chan_cfg),
+        self->name, "Error configuring ADC channel: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+#endif
+
+    return ESP_OK;
+}
+
+static esp_err_t init_continuous(driver_t *self, adc_atten_t atten, uint32_t sample_rate)
+{
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = STORE_BUF_SIZE,
+        .conv_frame_size = FRAME_SIZE,
+    };
+    ESP_RETURN_ON_ERROR(
+        adc_continuous_new_handle(&handle_cfg, &cont_handle),
+        self->name, "Error initializing continuous ADC: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+
+    // interleaved conversions of all channels
+    adc_digi_pattern_config_t pattern[CHANNEL_COUNT] = { 0 };
+    for (size_t c = 0; c < AIN_COUNT; c++)
+    {
+        pattern[c].atten = atten;
+        pattern[c].channel = ain_channels[c];
+        pattern[c].unit = unit_cfg.unit_id;
+        pattern[c].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+#ifdef DRIVER_GH_ADC_TDS_ENABLE
+    pattern[TDS_INDEX].atten = DRIVER_GH_ADC_TDS_ATTEN;
+    pattern[TDS_INDEX].channel = TDS_CHANNEL;
+    pattern[TDS_INDEX].unit = unit_cfg.unit_id;
+    pattern[TDS_INDEX].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+#endif
+
+    adc_continuous_config_t cfg = {
+        .pattern_num = CHANNEL_COUNT,
+        .adc_pattern = pattern,
+        .sample_freq_hz = sample_rate,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    ESP_RETURN_ON_ERROR(
+        adc_continuous_config(cont_handle, &cfg),
+        self->name, "Error configuring continuous ADC: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+
+    return ESP_OK;
+}
+
+static esp_err_t init_filters(driver_t *self, float interval)
+{
+    cJSON *common = cJSON_GetObjectItem(self->config, OPT_FILTER);
+    cJSON *custom = cJSON_GetObjectItem(self->config, OPT_FILTERS);
+    char uid[DEVICE_UID_SIZE];
+
+    for (size_t c = 0; c < CHANNEL_COUNT; c++)
+    {
+        if (c == TDS_INDEX)
+            strncpy(uid, FMT_TDS_RAW_SENSOR_ID, sizeof(uid));
+        else
+            snprintf(uid, sizeof(uid), FMT_ADC_SENSOR_ID, c);
+        cJSON *item = cJSON_GetObjectItem(custom, uid);
+        CHECK(driver_config_read_filter(self->name, item ? item : common, &filters[c], &def_filter, interval));
+    }
+
+    blocks = malloc(sizeof(int32_t) * CHANNEL_COUNT * samples);
+    if (!blocks)
+    {
+        ESP_LOGE(self->name, "Not enough memory for sample blocks");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+static void free_filters()
+{
+    for (size_t c = 0; c < CHANNEL_COUNT; c++)
+        filter_free(&filters[c]);
+    free(blocks);
+    blocks = NULL;
+}
+
 static esp_err_t on_init(driver_t *self)
 {
     cvector_free(self->devices);
+    free_filters();
+    lut_free(&moisture_calib);
+#ifdef DRIVER_GH_ADC_TDS_ENABLE
+    lut_free(&tds_calib);
+#endif
     if (adc_handle)
     {
         adc_oneshot_del_unit(adc_handle);
         adc_handle = NULL;
     }
+    if (cont_handle)
+    {
+        adc_continuous_deinit(cont_handle);
+        cont_handle = NULL;
+    }
     if (adc_cal_handle)
     {
         adc_cali_delete_scheme_line_fitting(adc_cal_handle);
@@ -92,8 +229,22 @@ static esp_err_t on_init(driver_t *self)
 #endif
     adc_atten_t atten = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_ATTEN), ADC_ATTEN_DB_11);
     samples = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_SAMPLES), 64);
+    if (!samples)
+        samples = 1;
     update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
+    self->period = update_period;
     moisture_enabled = driver_config_get_bool(cJSON_GetObjectItem(self->config, OPT_MOISTURE), false);
+    continuous = driver_config_get_bool(cJSON_GetObjectItem(self->config, OPT_CONTINUOUS), true);
+    uint32_t sample_rate = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_SAMPLE_RATE),
+        SOC_ADC_SAMPLE_FREQ_THRES_LOW);
+    if (sample_rate < SOC_ADC_SAMPLE_FREQ_THRES_LOW || sample_rate > SOC_ADC_SAMPLE_FREQ_THRES_HIGH)
+    {
+        ESP_LOGW(self->name, "Invalid sample rate %" PRIu32 ", using %d Hz", sample_rate, SOC_ADC_SAMPLE_FREQ_THRES_LOW);
+        sample_rate = SOC_ADC_SAMPLE_FREQ_THRES_LOW;
+    }
+
+    // per channel sample interval is known only for DMA sampling
+    CHECK(init_filters(self, continuous ? 1000.0f * CHANNEL_COUNT / (float)sample_rate : 0));
 
     if (moisture_enabled)
         CHECK(driver_config_read_calibration(self->name, cJSON_GetObjectItem(self->config, OPT_MOISTURE_CALIBRATION),
@@ -104,21 +255,11 @@ static esp_err_t on_init(driver_t *self)
         &tds_calib, def_tds_calib, def_tds_calib_points));
 #endif
 
-    ESP_RETURN_ON_ERROR(
-        adc_oneshot_new_unit(&unit_cfg, &adc_handle),
-        self->name, "Error initializing ADC UNIT 1: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-    );
+    if (continuous)
+        CHECK(init_continuous(self, atten, sample_rate));
+    else
+        CHECK(init_oneshot(self, atten));
 
-    // configure four ADC channels
-    adc_oneshot_chan_cfg_t chan_cfg = {
-        .atten = atten,
-        .bitwidth = ADC_WIDTH,
-    };
-    for (size_t c = 0; c < AIN_COUNT; c++)
-        ESP_RETURN_ON_ERROR(
-            adc_oneshot_config_channel(adc_handle, ain_channels[c], &chan_cfg),
-            self->name, "Error configuring ADC channel: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-        );
     // ADC calibration
     ESP_RETURN_ON_ERROR(
         create_adc_cali_scheme(atten, &adc_cal_handle),
@@ -126,12 +267,6 @@ static esp_err_t on_init(driver_t *self)
     );
 
 #ifdef DRIVER_GH_ADC_TDS_ENABLE
-    // configure TDS measure channel
-    chan_cfg.atten = DRIVER_GH_ADC_TDS_ATTEN;
-    ESP_RETURN_ON_ERROR(
-        adc_oneshot_config_channel(adc_handle, TDS_CHANNEL, &chan_cfg),
-        self->name, "Error configuring ADC channel: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-    );
     // TDS calibration
     ESP_RETURN_ON_ERROR(
         create_adc_cali_scheme(DRIVER_GH_ADC_TDS_ATTEN, &tds_cal_handle),
@@ -146,11 +281,9 @@ static esp_err_t on_init(driver_t *self)
         dev.type = DEV_SENSOR;
         dev.sensor.precision = 3;
         dev.sensor.update_period = update_period;
-        strncpy(dev.sensor.measurement_unit, DEV_MU_VOLTAGE, sizeof(dev.sensor.measurement_unit));
-        strncpy(dev.device_class, DEV_CLASS_VOLTAGE, sizeof(dev.device_class));
         snprintf(dev.uid, sizeof(dev.uid), FMT_ADC_SENSOR_ID, c);
-        snprintf(dev.name, sizeof(dev.name), FMT_ADC_SENSOR_NAME, settings.system.name, c);
-        cvector_push_back(self->devices, dev);
+        dev.info = device_info(DEV_CLASS_VOLTAGE, DEV_MU_VOLTAGE, FMT_ADC_SENSOR_NAME, c);
+        driver_add_device(self, &dev);
     }
 
     if (moisture_enabled)
@@ -160,11 +293,9 @@ static esp_err_t on_init(driver_t *self)
             dev.type = DEV_SENSOR;
             dev.sensor.precision = 1;
             dev.sensor.update_period = update_period;
-            strncpy(dev.sensor.measurement_unit, DEV_MU_MOISTURE, sizeof(dev.sensor.measurement_unit));
-            strncpy(dev.device_class, DEV_CLASS_MOISTURE, sizeof(dev.device_class));
             snprintf(dev.uid, sizeof(dev.uid), FMT_MOISTURE_SENSOR_ID, c);
-            snprintf(dev.name, sizeof(dev.name), FMT_MOISTURE_SENSOR_NAME, settings.system.name, c);
-            cvector_push_back(self->devices, dev);
+            dev.info = device_info(DEV_CLASS_MOISTURE, DEV_MU_MOISTURE, FMT_MOISTURE_SENSOR_NAME, c);
+            driver_add_device(self, &dev);
         }
 
 #ifdef DRIVER_GH_ADC_TDS_ENABLE
@@ -172,138 +303,189 @@ static esp_err_t on_init(driver_t *self)
     dev.type = DEV_SENSOR;
     dev.sensor.precision = 3;
     dev.sensor.update_period = update_period;
-    strncpy(dev.sensor.measurement_unit, DEV_MU_VOLTAGE, sizeof(dev.sensor.measurement_unit));
-    strncpy(dev.device_class, DEV_CLASS_VOLTAGE, sizeof(dev.device_class));
     strncpy(dev.uid, FMT_TDS_RAW_SENSOR_ID, sizeof(dev.uid));
-    snprintf(dev.name, sizeof(dev.name), FMT_TDS_RAW_SENSOR_NAME, settings.system.name);
-    cvector_push_back(self->devices, dev);
+    dev.info = device_info(DEV_CLASS_VOLTAGE, DEV_MU_VOLTAGE, FMT_TDS_RAW_SENSOR_NAME);
+    driver_add_device(self, &dev);
 
     memset(&dev, 0, sizeof(dev));
     dev.type = DEV_SENSOR;
     dev.sensor.precision = 1;
     dev.sensor.update_period = update_period;
-    strncpy(dev.sensor.measurement_unit, DEV_MU_TDS, sizeof(dev.sensor.measurement_unit));
     strncpy(dev.uid, FMT_TDS_SENSOR_ID, sizeof(dev.uid));
-    snprintf(dev.name, sizeof(dev.name), FMT_TDS_SENSOR_NAME, settings.system.name);
-    cvector_push_back(self->devices, dev);
+    dev.info = device_info(NULL, DEV_MU_TDS, FMT_TDS_SENSOR_NAME);
+    driver_add_device(self, &dev);
 #endif
 
     return ESP_OK;
 }
 
-static int adc_read_voltage(driver_t *self, adc_channel_t channel, adc_cali_handle_t cal_handle)
+static int adc_read_raw(driver_t *self, adc_channel_t channel)
 {
-    int raw, res;
+    int raw;
     esp_err_t r = adc_oneshot_read(adc_handle, channel, &raw);
     if (r != ESP_OK)
     {
         ESP_LOGE(self->name, "Error reading ADC1 channel %d: %d (%s)", channel, r, esp_err_to_name(r));
         return 0;
     }
-    r = adc_cali_raw_to_voltage(cal_handle, raw, &res);
+
+    return raw;
+}
+
+// Convert averaged raw value to mV, interpolating between neighbour codes to keep sub-LSB resolution
+static float adc_raw_to_voltage(driver_t *self, float raw, adc_cali_handle_t cal_handle)
+{
+    int code = (int)raw, v0, v1;
+    esp_err_t r = adc_cali_raw_to_voltage(cal_handle, code, &v0);
+    if (r == ESP_OK)
+        r = adc_cali_raw_to_voltage(cal_handle, code + 1, &v1);
     if (r != ESP_OK)
     {
         ESP_LOGE(self->name, "Error converting raw ADC value to voltage: %d (%s)", r, esp_err_to_name(r));
         return 0;
     }
 
-    return res;
+    return (float)v0 + (float)(v1 - v0) * (raw - (float)code);
 }
 
-static void task(driver_t *self)
+static void read_oneshot(driver_t *self)
 {
-    int ain_voltages[AIN_COUNT];
-    int tds_voltage;
-    esp_err_t r;
-
-    TickType_t period = pdMS_TO_TICKS(update_period);
-
-    while (true)
+    for (size_t i = 0; i < samples; i++)
     {
-        TickType_t start = xTaskGetTickCount();
+        for (size_t c = 0; c < AIN_COUNT; c++)
+            blocks[c * samples + i] = adc_read_raw(self, ain_channels[c]) << RAW_FRAC_BITS;
 
-        memset(ain_voltages, 0, sizeof(ain_voltages));
 #ifdef DRIVER_GH_ADC_TDS_ENABLE
-        tds_voltage = 0;
+        blocks[TDS_INDEX * samples + i] = adc_read_raw(self, TDS_CHANNEL) << RAW_FRAC_BITS;
 #endif
+    }
+}
 
-        // Read raw ADC values
-        for (size_t i = 0; i < samples; i++)
-        {
-            for (size_t c = 0; c < AIN_COUNT; c++)
-                ain_voltages[c] += adc_read_voltage(self, ain_channels[c], adc_cal_handle);
+static esp_err_t read_continuous(driver_t *self)
+{
+    size_t counts[CHANNEL_COUNT] = { 0 };
+    int8_t index[SOC_ADC_MAX_CHANNEL_NUM];
+    uint8_t frame[FRAME_SIZE];
+    uint32_t len;
 
+    memset(index, -1, sizeof(index));
+    for (size_t c = 0; c < AIN_COUNT; c++)
+        index[ain_channels[c]] = (int8_t)c;
 #ifdef DRIVER_GH_ADC_TDS_ENABLE
-            tds_voltage += adc_read_voltage(self, TDS_CHANNEL, tds_cal_handle);
+    index[TDS_CHANNEL] = TDS_INDEX;
 #endif
-        }
 
-        // Write raw ADC values
-        for (size_t c = 0; c < AIN_COUNT; c++)
-        {
-            float voltage = (float)ain_voltages[c] / (float)samples / 1000.0f;
-            self->devices[c].sensor.value = voltage;
-            driver_send_device_update(self, &self->devices[c]);
-        }
+    ESP_RETURN_ON_ERROR(
+        adc_continuous_start(cont_handle),
+        self->name, "Error starting continuous ADC: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
 
-        device_t *dev;
-
-        // Calculate and write moisture values
-        if (moisture_enabled)
-            for (size_t c = 0; c < AIN_COUNT; c++)
-            {
-                float moisture;
-                r = calibration_get_value(&moisture_calib, self->devices[c].sensor.value, &moisture);
-                if (r != ESP_OK)
-                {
-                    ESP_LOGE(self->name, "Error getting calibrated moisture value: %d (%s)", r, esp_err_to_name(r));
-                    goto next;
-                }
-                dev = &self->devices[c + AIN_COUNT];
-                dev->sensor.value = moisture;
-                driver_send_device_update(self, dev);
-            }
+    // drop frames left from the previous period
+    while (adc_continuous_read(cont_handle, frame, sizeof(frame), &len, 0) == ESP_OK)
+        ;
 
-#ifdef DRIVER_GH_ADC_TDS_ENABLE
-        // Write raw TDS voltage
-        float tds_raw = (float)tds_voltage / (float)samples / 1000.0f;
-        dev = &self->devices[cvector_size(self->devices) - 2];
-        dev->sensor.value = tds_raw;
-        driver_send_device_update(self, dev);
-
-        // Calculate and write TDS
-        float tds;
-        r = calibration_get_value(&tds_calib, tds_raw, &tds);
+    // collect raw codes until every channel has enough samples
+    esp_err_t r = ESP_OK;
+    size_t done = 0;
+    while (done < CHANNEL_COUNT)
+    {
+        r = adc_continuous_read(cont_handle, frame, sizeof(frame), &len, READ_TIMEOUT_MS);
         if (r != ESP_OK)
         {
-            ESP_LOGE(self->name, "Error getting calibrated TDS value: %d (%s)", r, esp_err_to_name(r));
-            goto next;
+            ESP_LOGE(self->name, "Error reading continuous ADC: %d (%s)", r, esp_err_to_name(r));
+            break;
         }
-        dev = &self->devices[cvector_size(self->devices) - 1];
-        dev->sensor.value = tds;
-        driver_send_device_update(self, dev);
+        for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= len; i += SOC_ADC_DIGI_RESULT_BYTES)
+        {
+            const adc_digi_output_data_t *d = (const adc_digi_output_data_t *)&frame[i];
+            if (d->type1.channel >= SOC_ADC_MAX_CHANNEL_NUM || index[d->type1.channel] < 0)
+                continue;
+            size_t c = index[d->type1.channel];
+            if (counts[c] == samples)
+                continue;
+            blocks[c * samples + counts[c]] = (int32_t)d->type1.data << RAW_FRAC_BITS;
+            if (++counts[c] == samples)
+                done++;
+        }
+    }
+
+    adc_continuous_stop(cont_handle);
+
+    return r;
+}
+
+// Filter block of channel raw codes and average it
+static float filter_block(size_t c)
+{
+    int32_t *block = &blocks[c * samples];
+    filter_apply_block(&filters[c], block, samples);
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < samples; i++)
+        sum += block[i];
+
+    return (float)sum / (float)(samples << RAW_FRAC_BITS);
+}
+
+static void sample(driver_t *self)
+{
+    float voltages[CHANNEL_COUNT];
+
+    // Read raw codes
+    if (continuous)
+    {
+        if (read_continuous(self) != ESP_OK)
+            return;
+    }
+    else
+        read_oneshot(self);
+
+    // Filter, average and calibrate once per channel, mV
+    for (size_t c = 0; c < AIN_COUNT; c++)
+        voltages[c] = adc_raw_to_voltage(self, filter_block(c), adc_cal_handle);
+#ifdef DRIVER_GH_ADC_TDS_ENABLE
+    voltages[TDS_INDEX] = adc_raw_to_voltage(self, filter_block(TDS_INDEX), tds_cal_handle);
 #endif
 
-    next:
-        while (xTaskGetTickCount() - start < period)
+    // Write raw ADC values
+    for (size_t c = 0; c < AIN_COUNT; c++)
+    {
+        self->devices[c].sensor.value = voltages[c] / 1000.0f;
+        driver_send_device_update(self, &self->devices[c]);
+    }
+
+    device_t *dev;
+
+    // Calculate and write moisture values
+    if (moisture_enabled)
+        for (size_t c = 0; c < AIN_COUNT; c++)
         {
-            if (!(xEventGroupGetBits(self->eg) & DRIVER_BIT_START))
-                return;
-            vTaskDelay(1);
+            dev = &self->devices[c + AIN_COUNT];
+            dev->sensor.value = lut_get(&moisture_calib, self->devices[c].sensor.value);
+            driver_send_device_update(self, dev);
         }
-    }
+
+#ifdef DRIVER_GH_ADC_TDS_ENABLE
+    // Write raw TDS voltage
+    float tds_raw = voltages[TDS_INDEX] / 1000.0f;
+    dev = &self->devices[cvector_size(self->devices) - 2];
+    dev->sensor.value = tds_raw;
+    driver_send_device_update(self, dev);
+
+    // Calculate and write TDS
+    dev = &self->devices[cvector_size(self->devices) - 1];
+    dev->sensor.value = lut_get(&tds_calib, tds_raw);
+    driver_send_device_update(self, dev);
+#endif
 }
 
 static esp_err_t on_stop(driver_t *self)
 {
-    esp_err_t r = calibration_free(&moisture_calib);
-    if (r != ESP_OK)
-        ESP_LOGW(self->name, "Moisture calibration data free error: %d (%s)", r, esp_err_to_name(r));
+    lut_free(&moisture_calib);
 #ifdef DRIVER_GH_ADC_TDS_ENABLE
-    r = calibration_free(&tds_calib);
-    if (r != ESP_OK)
-        ESP_LOGW(self->name, "TDS calibration data free error: %d (%s)", r, esp_err_to_name(r));
+    lut_free(&tds_calib);
 #endif
+    free_filters();
 
     return ESP_OK;
 }
@@ -329,8 +511,10 @@ driver_t drv_gh_adc = {
     .config = NULL,
     .state = DRIVER_NEW,
     .event_queue = NULL,
+    .update_queue = NULL,
 
     .devices = NULL,
+    .lock = NULL,
     .handle = NULL,
     .eg = NULL,
 
@@ -338,7 +522,8 @@ driver_t drv_gh_adc = {
     .on_start = NULL,
     .on_stop = on_stop,
 
-    .task = task
+    .task = NULL,
+    .sample = sample
 };
 
 #endif
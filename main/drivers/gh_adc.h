@@ -8,11 +8,22 @@
 /*
 {
   "period": 2000,           // ms
-  "samples": 64,
+  "samples": 64,            // per channel
+  "continuous": true,       // optional, DMA sampling of all channels, false - sequential oneshot reads
+  "sample_rate": 20000,     // optional, Hz, total conversion rate in continuous mode
   "attenuation": 3,         // 0 - no attenuation (100 mV ~ 950 mV), 1 - 2.5 dB (100 mV ~ 1250 mV),
                             // 2 - 6 dB (150 mV ~ 1750 mV), 3 - 12 dB (150 mV ~ 2450 mV)
+  "filter": {              // optional, filter of raw samples of each channel before averaging
+    "type": "median",       // "none", "average", "median", "ema" or "lowpass"
+    "window": 5             // samples, average and median only
+  },                        // ema: "alpha": 0..1 or "tau": ms; lowpass: "cutoff": Hz (continuous mode only)
+  "filters": {              // optional, per channel filters, same format
+    "ain0": { "type": "ema", "alpha": 0.1 }
+  },
   "moisture": true,         // enable/disable soil moisture sensors
-  "moisture_calibration": [ // optional if soil moisture sensors are disabled
+  "moisture_calibration": [ // optional if soil moisture sensors are disabled, calibrations may also be
+                            // { "method": "linear" | "cubic" | "polynomial", "degree": 2, "points": [...] },
+                            // polynomial degree is 1..5, 2 by default, lower than the number of points
     {
       "voltage": 2.2,
       "moisture": 0
@@ -0,0 +1,278 @@
+#include "gh_dimmer.h"
+
+#ifdef DRIVER_GH_DIMMER
+
+#include <math.h>
+#include <esp_log.h>
+#include <esp_check.h>
+#include <driver/gptimer.h>
+#include "phase.h"
+
+#define DIMMER_ID   "dimmer"
+#define DIMMER_NAME "dimmer"
+#define FREQ_ID     "mains_frequency"
+#define FREQ_NAME   "mains frequency"
+
+#define OPT_CURVE       "curve"
+#define OPT_GAMMA       "gamma"
+#define OPT_MIN_LEVEL   "min_level"
+#define OPT_MAX_LEVEL   "max_level"
+#define OPT_ZERO_OFFSET "zero_offset"
+#define OPT_GATE_PULSE  "gate_pulse"
+
+#define CURVE_LINEAR "linear"
+#define CURVE_POWER  "power"
+
+#define TIMER_RESOLUTION_HZ 1000000 // 1 us ticks
+#define LEVELS              101     // 0..100 %
+
+#define MIN_HALF_PERIOD_US 7000  // 71 Hz, shorter intervals are detector noise
+#define MAX_HALF_PERIOD_US 12500 // 40 Hz, longer intervals are missed crossings
+#define DEF_HALF_PERIOD_US 10000
+
+static gptimer_handle_t timer = NULL;
+static portMUX_TYPE isr_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// firing delay for each level, Q16 fraction of half period
+static uint32_t fire_table[LEVELS];
+static volatile uint32_t fire = PHASE_FIRE_OFF;
+
+static int32_t zero_offset; // us
+static uint32_t gate_pulse; // us
+
+// updated by zero cross ISR
+static uint64_t last_zero = 0;
+static uint32_t half_period = DEF_HALF_PERIOD_US;
+static uint64_t period_sum = 0;
+static uint32_t period_count = 0;
+static bool gate_on = false;
+
+static int update_period;
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool IRAM_ATTR on_alarm(gptimer_handle_t t, const gptimer_alarm_event_data_t *ev, void *ctx)
+{
+    (void)ctx;
+
+    if (gate_on)
+    {
+        // triac latched, release the gate
+        gpio_set_level(DRIVER_GH_DIMMER_CTRL_GPIO, 0);
+        gate_on = false;
+        return false;
+    }
+
+    gpio_set_level(DRIVER_GH_DIMMER_CTRL_GPIO, 1);
+    gate_on = true;
+    gptimer_alarm_config_t alarm = { .alarm_count = ev->alarm_value + gate_pulse };
+    gptimer_set_alarm_action(t, &alarm);
+
+    return false;
+}
+
+static void IRAM_ATTR on_zero_cross(void *arg)
+{
+    (void)arg;
+
+    uint64_t now;
+    gptimer_get_raw_count(timer, &now);
+    uint32_t dt = (uint32_t)(now - last_zero);
+    if (dt < MIN_HALF_PERIOD_US)
+        return;
+    last_zero = now;
+
+    portENTER_CRITICAL_ISR(&isr_lock);
+    if (dt <= MAX_HALF_PERIOD_US)
+    {
+        half_period = (half_period * 7 + dt) / 8;
+        period_sum += dt;
+        period_count++;
+    }
+    uint32_t half = half_period;
+    portEXIT_CRITICAL_ISR(&isr_lock);
+
+    // gate must not stay on across zero crossing
+    if (gate_on)
+    {
+        gpio_set_level(DRIVER_GH_DIMMER_CTRL_GPIO, 0);
+        gate_on = false;
+    }
+
+    uint32_t f = fire;
+    if (f == PHASE_FIRE_OFF)
+        return;
+    gptimer_alarm_config_t alarm = { .alarm_count = now + phase_fire_delay(f, half, zero_offset, gate_pulse) };
+    gptimer_set_alarm_action(timer, &alarm);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void set_level(float value)
+{
+    int level = (int)lroundf(value);
+    if (level < 0)
+        level = 0;
+    if (level >= LEVELS)
+        level = LEVELS - 1;
+    fire = fire_table[level];
+}
+
+static void on_level_write(device_t *dev, float value)
+{
+    if (value < dev->number.min)
+        value = dev->number.min;
+    if (value > dev->number.max)
+        value = dev->number.max;
+
+    set_level(value);
+    dev->number.value = value;
+    driver_send_device_update(&drv_gh_dimmer, dev);
+}
+
+static esp_err_t init_timer(driver_t *self)
+{
+    gptimer_config_t cfg = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = TIMER_RESOLUTION_HZ,
+    };
+    ESP_RETURN_ON_ERROR(gptimer_new_timer(&cfg, &timer),
+        self->name, "Error creating timer: %d (%s)", err_rc_, esp_err_to_name(err_rc_));
+    gptimer_event_callbacks_t cbs = { .on_alarm = on_alarm };
+    ESP_RETURN_ON_ERROR(gptimer_register_event_callbacks(timer, &cbs, NULL),
+        self->name, "Error registering timer callback: %d (%s)", err_rc_, esp_err_to_name(err_rc_));
+    ESP_RETURN_ON_ERROR(gptimer_enable(timer),
+        self->name, "Error enabling timer: %d (%s)", err_rc_, esp_err_to_name(err_rc_));
+
+    return ESP_OK;
+}
+
+static esp_err_t on_init(driver_t *self)
+{
+    cvector_free(self->devices);
+
+    update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 10000);
+    self->period = update_period;
+
+    const char *curve = cJSON_GetStringValue(cJSON_GetObjectItem(self->config, OPT_CURVE));
+    bool power_curve = !curve || !strcmp(curve, CURVE_POWER);
+    if (curve && !power_curve && strcmp(curve, CURVE_LINEAR))
+        ESP_LOGW(self->name, "Unknown curve '%s', using " CURVE_LINEAR, curve);
+    float gamma = driver_config_get_float(cJSON_GetObjectItem(self->config, OPT_GAMMA), 1.0f);
+    if (gamma <= 0)
+        gamma = 1.0f;
+    float min_level = driver_config_get_float(cJSON_GetObjectItem(self->config, OPT_MIN_LEVEL), 0) / 100.0f;
+    float max_level = driver_config_get_float(cJSON_GetObjectItem(self->config, OPT_MAX_LEVEL), 100) / 100.0f;
+    zero_offset = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_ZERO_OFFSET), 0);
+    gate_pulse = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_GATE_PULSE), 100);
+
+    fire = PHASE_FIRE_OFF;
+    phase_build_table(fire_table, LEVELS, power_curve, gamma, min_level, max_level);
+
+    ESP_RETURN_ON_ERROR(gpio_reset_pin(DRIVER_GH_DIMMER_CTRL_GPIO),
+        self->name, "Error reset CTRL GPIO %d: %d (%s)", DRIVER_GH_DIMMER_CTRL_GPIO, err_rc_, esp_err_to_name(err_rc_));
+    gpio_set_direction(DRIVER_GH_DIMMER_CTRL_GPIO, GPIO_MODE_OUTPUT);
+    gpio_set_level(DRIVER_GH_DIMMER_CTRL_GPIO, 0);
+    gate_on = false;
+
+    ESP_RETURN_ON_ERROR(gpio_reset_pin(DRIVER_GH_DIMMER_ZERO_GPIO),
+        self->name, "Error reset ZERO GPIO %d: %d (%s)", DRIVER_GH_DIMMER_ZERO_GPIO, err_rc_, esp_err_to_name(err_rc_));
+    gpio_set_direction(DRIVER_GH_DIMMER_ZERO_GPIO, GPIO_MODE_INPUT);
+    gpio_set_intr_type(DRIVER_GH_DIMMER_ZERO_GPIO, GPIO_INTR_POSEDGE);
+
+    if (!timer)
+        ESP_RETURN_ON_ERROR(init_timer(self), self->name, "Error initializing timer");
+
+    device_t dev = { 0 };
+    dev.type = DEV_NUMBER;
+    strncpy(dev.uid, DIMMER_ID, sizeof(dev.uid) - 1);
+    dev.info = device_info(NULL, DEV_MU_PERCENT, DIMMER_NAME);
+    dev.number.min = 0;
+    dev.number.max = LEVELS - 1;
+    dev.number.step = 1;
+    dev.number.on_write = on_level_write;
+    driver_add_device(self, &dev);
+
+    memset(&dev, 0, sizeof(dev));
+    dev.type = DEV_SENSOR;
+    strncpy(dev.uid, FREQ_ID, sizeof(dev.uid) - 1);
+    dev.info = device_info(DEV_CLASS_FREQUENCY, DEV_MU_FREQUENCY, FREQ_NAME);
+    dev.sensor.precision = 2;
+    dev.sensor.update_period = update_period;
+    driver_add_device(self, &dev);
+
+    ESP_LOGI(self->name, "Configured: ZERO=%d, CTRL=%d, curve=%s, gamma=%.2f, gate pulse %" PRIu32 " us",
+        DRIVER_GH_DIMMER_ZERO_GPIO, DRIVER_GH_DIMMER_CTRL_GPIO, power_curve ? CURVE_POWER : CURVE_LINEAR,
+        gamma, gate_pulse);
+
+    return ESP_OK;
+}
+
+static esp_err_t on_start(driver_t *self)
+{
+    last_zero = 0;
+    half_period = DEF_HALF_PERIOD_US;
+    period_sum = 0;
+    period_count = 0;
+
+    ESP_RETURN_ON_ERROR(gptimer_start(timer),
+        self->name, "Error starting timer: %d (%s)", err_rc_, esp_err_to_name(err_rc_));
+    ESP_RETURN_ON_ERROR(driver_install_gpio_isr_service(),
+        self->name, "Error installing GPIO ISR service: %d (%s)", err_rc_, esp_err_to_name(err_rc_));
+    ESP_RETURN_ON_ERROR(gpio_isr_handler_add(DRIVER_GH_DIMMER_ZERO_GPIO, on_zero_cross, NULL),
+        self->name, "Error adding zero cross handler: %d (%s)", err_rc_, esp_err_to_name(err_rc_));
+
+    return ESP_OK;
+}
+
+static void sample(driver_t *self)
+{
+    portENTER_CRITICAL(&isr_lock);
+    uint64_t sum = period_sum;
+    uint32_t count = period_count;
+    period_sum = 0;
+    period_count = 0;
+    portEXIT_CRITICAL(&isr_lock);
+
+    // no zero crossings - no mains
+    self->devices[1].sensor.value = count ? (float)count * TIMER_RESOLUTION_HZ / 2.0f / (float)sum : 0;
+    driver_send_device_update(self, &self->devices[1]);
+}
+
+static esp_err_t on_stop(driver_t *self)
+{
+    fire = PHASE_FIRE_OFF;
+    gpio_isr_handler_remove(DRIVER_GH_DIMMER_ZERO_GPIO);
+    gptimer_stop(timer);
+    gpio_set_level(DRIVER_GH_DIMMER_CTRL_GPIO, 0);
+    gate_on = false;
+
+    return ESP_OK;
+}
+
+driver_t drv_gh_dimmer = {
+    .name = "gh_dimmer",
+    .stack_size = DRIVER_GH_DIMMER_STACK_SIZE,
+    .priority = tskIDLE_PRIORITY + 1,
+    .defconfig = "{ \"" OPT_PERIOD "\": 10000, \"" OPT_CURVE "\": \"" CURVE_POWER "\", \"" OPT_GATE_PULSE "\": 100 }",
+
+    .config = NULL,
+    .state = DRIVER_NEW,
+    .event_queue = NULL,
+    .update_queue = NULL,
+
+    .devices = NULL,
+    .lock = NULL,
+    .handle = NULL,
+    .eg = NULL,
+
+    .on_init = on_init,
+    .on_start = on_start,
+    .on_stop = on_stop,
+
+    .task = NULL,
+    .sample = sample
+};
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef ESP_IOT_NODE_PLUS_DRV_GH_DIMMER_H_
+#define ESP_IOT_NODE_PLUS_DRV_GH_DIMMER_H_
+
+#include "common.h"
+
+#ifdef DRIVER_GH_DIMMER
+
+/*
+{
+  "period": 10000,     // ms, mains frequency report period
+  "curve": "power",    // "linear" - firing angle proportional to level, "power" - RMS power proportional to level
+  "gamma": 1.0,        // level is raised to this power before the curve, ~2.2 for perceived brightness of lamps
+  "min_level": 0,      // %, output at level 1, for loads that flicker at low power
+  "max_level": 100,    // %, output at level 100
+  "zero_offset": 0,    // us, delay of the actual zero crossing after the detector pulse, could be negative
+  "gate_pulse": 100    // us, width of triac gate pulse
+}
+
+Firing is timed by the hardware timer from the zero cross interrupt, driver
+task only reports mains frequency.
+*/
+
+#include "driver.h"
+#include "std_strings.h"
+
+extern driver_t drv_gh_dimmer;
+
+#endif
+
+#endif // ESP_IOT_NODE_PLUS_DRV_GH_DIMMER_H_
@@ -2,43 +2,92 @@
 
 #ifdef DRIVER_GH_IO
 
+#include <math.h>
 #include <esp_log.h>
 #include <esp_check.h>
-#include "settings.h"
+#include <esp_timer.h>
 #include <tca95x5.h>
+#include "i2c_bus.h"
 
 #define FMT_RELAY_ID    "relay%d"
 #define FMT_INPUT_ID    "input%d"
 #define FMT_SWITCH_ID   "switch%d"
 #define FMT_LED_ID      "led%d"
-
-#define FMT_RELAY_NAME  "%s relay %d"
-#define FMT_INPUT_NAME  "%s isolated input %d"
-#define FMT_SWITCH_NAME "%s input switch %d"
-#define FMT_LED_NAME    "%s LED %d"
+#define FMT_COUNTER_ID  "counter%d"
+#define FMT_FREQ_ID     "frequency%d"
+
+#define FMT_RELAY_NAME  "relay %d"
+#define FMT_INPUT_NAME  "isolated input %d"
+#define FMT_SWITCH_NAME "input switch %d"
+#define FMT_LED_NAME    "LED %d"
+#define FMT_COUNTER_NAME "pulses (isolated input %d)"
+#define FMT_FREQ_NAME   "frequency (isolated input %d)"
+
+#define OPT_DEBOUNCE "debounce"
+#define OPT_SETTLE   "settle"
+#define OPT_INPUTS   "inputs"
+#define OPT_SWITCHES "switches"
+#define OPT_COUNTER  "counter"
 
 #define SWITCHES_COUNT 4
 #define INPUTS_COUNT 4
+#define LINES_COUNT (INPUTS_COUNT + SWITCHES_COUNT)
 #define PORT_MODE 0xff00 // low 8 bits = input, high 8 bits = output
+#define INPUTS_BIT 8
+#define SWITCHES_BIT 12
 
-#define CHANGED_BITS BIT(0)
+// Debounced input line, isolated input or input switch
+typedef struct
+{
+    size_t dev;          // index of the device, counter is followed by the frequency device
+    uint8_t bit;         // port bit
+    bool inverted;
+    bool counter;        // counts debounced rising edges instead of reporting state
+    int64_t debounce;    // us
+    bool raw;            // last read state
+    bool stable;         // debounced state
+    bool changed;        // stable state is not sent yet
+    int64_t raw_since;   // us, edge time of the raw state
+    int64_t stable_at;   // us, edge time of the stable state
+    uint32_t pulses;
+    uint32_t window_pulses; // intervals between pulses ending in this window
+    int64_t last_pulse;  // us
+    int64_t ref_time;    // us, last pulse of a previous window, 0 before the first pulse
+    bool measured;       // an interval has been bounded by two pulses
+} line_t;
 
 static i2c_dev_t expander = { 0 };
-static EventGroupHandle_t port_event = NULL;
-static device_t *switches;
-static device_t *inputs;
+static TaskHandle_t task_handle = NULL;
+static line_t lines[LINES_COUNT];
+static bool has_counters;
+static int64_t settle;        // us
+static int64_t report_period; // us
+
+static portMUX_TYPE edge_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t edge_time = 0; // us, first interrupt since the last port read
 
 static void IRAM_ATTR on_port_change(void *arg)
 {
     (void)arg;
-    BaseType_t hp_task;
-    if (xEventGroupSetBitsFromISR(port_event, CHANGED_BITS, &hp_task) != pdFAIL)
-        portYIELD_FROM_ISR(hp_task);
+    portENTER_CRITICAL_ISR(&edge_lock);
+    if (!edge_time)
+        edge_time = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&edge_lock);
+
+    BaseType_t hp_task = pdFALSE;
+    vTaskNotifyGiveFromISR(task_handle, &hp_task);
+    portYIELD_FROM_ISR(hp_task);
 }
 
 static void on_relay_command(device_t *dev, bool value)
 {
-    esp_err_t r = tca95x5_set_level(&expander, (uint32_t)(dev->internal[0]), value);
+    // read-modify-write of the port in one bus session
+    esp_err_t r = i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_URGENT, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS));
+    if (r == ESP_OK)
+    {
+        r = tca95x5_set_level(&expander, (uint32_t)(dev->internal), value);
+        i2c_bus_release(HW_INTERNAL_PORT);
+    }
     if (r != ESP_OK)
     {
         ESP_LOGE(drv_gh_io.name, "Cannot set port value: %d (%s)", r, esp_err_to_name(r));
@@ -53,17 +102,8 @@ static esp_err_t on_init(driver_t *self)
 {
     cvector_free(self->devices);
 
-    if (port_event)
-    {
-        vEventGroupDelete(port_event);
-        port_event = NULL;
-    }
-    port_event = xEventGroupCreate();
-    if (!port_event)
-    {
-        ESP_LOGE(self->name, "Error creating event group");
-        return ESP_ERR_NO_MEM;
-    }
+    // on_init is called from the driver task
+    task_handle = xTaskGetCurrentTaskHandle();
 
     memset(&expander, 0, sizeof(expander));
     ESP_RETURN_ON_ERROR(
@@ -91,8 +131,14 @@ static esp_err_t on_init(driver_t *self)
     );
     gpio_set_direction(DRIVER_GH_IO_INTR_GPIO, GPIO_MODE_INPUT);
     gpio_set_intr_type(DRIVER_GH_IO_INTR_GPIO, GPIO_INTR_NEGEDGE);
-    gpio_install_isr_service(0);
-    gpio_isr_handler_add(DRIVER_GH_IO_INTR_GPIO, on_port_change, NULL);
+    ESP_RETURN_ON_ERROR(
+        driver_install_gpio_isr_service(),
+        self->name, "Error installing GPIO ISR service: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+    ESP_RETURN_ON_ERROR(
+        gpio_isr_handler_add(DRIVER_GH_IO_INTR_GPIO, on_port_change, NULL),
+        self->name, "Error adding INTR handler: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
 
     device_t dev;
 
@@ -100,106 +146,260 @@ static esp_err_t on_init(driver_t *self)
     {
         memset(&dev, 0, sizeof(dev));
         dev.type = DEV_BINARY_SWITCH;
-        dev.internal[0] = (void *)i;
+        dev.internal = (void *)i;
         dev.binary_switch.on_write = on_relay_command;
         snprintf(dev.uid, sizeof(dev.uid), FMT_RELAY_ID, (int)i);
-        snprintf(dev.name, sizeof(dev.name), FMT_RELAY_NAME, settings.system.name, (int)i);
-        cvector_push_back(self->devices, dev);
+        dev.info = device_info(NULL, NULL, FMT_RELAY_NAME, (int)i);
+        driver_add_device(self, &dev);
     }
 
-    inputs = self->devices + DRIVER_GH_IO_RELAY_COUNT;
-    for (int i = 0; i < INPUTS_COUNT; i++)
-    {
-        memset(&dev, 0, sizeof(dev));
-        dev.type = DEV_BINARY_SENSOR;
-        snprintf(dev.uid, sizeof(dev.uid), FMT_INPUT_ID, i);
-        snprintf(dev.name, sizeof(dev.name), FMT_INPUT_NAME, settings.system.name, i);
-        cvector_push_back(self->devices, dev);
-    }
+    int def_debounce = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_DEBOUNCE), 20);
+    settle = (int64_t)driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_SETTLE), 50) * 1000;
+    report_period = (int64_t)driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 10000) * 1000;
+    has_counters = false;
 
-    switches = inputs + INPUTS_COUNT;
-    for (int i = 0; i < SWITCHES_COUNT; i++)
+    memset(lines, 0, sizeof(lines));
+    for (int i = 0; i < LINES_COUNT; i++)
     {
+        line_t *l = &lines[i];
+        bool is_input = i < INPUTS_COUNT;
+        int n = is_input ? i : i - INPUTS_COUNT;
+        cJSON *line_j = cJSON_GetArrayItem(cJSON_GetObjectItem(self->config, is_input ? OPT_INPUTS : OPT_SWITCHES), n);
+
+        l->bit = is_input ? INPUTS_BIT + n : SWITCHES_BIT + n;
+        l->inverted = !is_input;
+        l->counter = is_input && driver_config_get_bool(cJSON_GetObjectItem(line_j, OPT_COUNTER), false);
+        l->debounce = (int64_t)driver_config_get_int(cJSON_GetObjectItem(line_j, OPT_DEBOUNCE), def_debounce) * 1000;
+        l->dev = cvector_size(self->devices);
+        has_counters |= l->counter;
+
         memset(&dev, 0, sizeof(dev));
+        if (l->counter)
+        {
+            dev.type = DEV_SENSOR;
+            snprintf(dev.uid, sizeof(dev.uid), FMT_COUNTER_ID, n);
+            dev.info = device_info(NULL, NULL, FMT_COUNTER_NAME, n);
+            dev.sensor.update_period = (int)(report_period / 1000);
+            driver_add_device(self, &dev);
+
+            memset(&dev, 0, sizeof(dev));
+            dev.type = DEV_SENSOR;
+            snprintf(dev.uid, sizeof(dev.uid), FMT_FREQ_ID, n);
+            dev.info = device_info(DEV_CLASS_FREQUENCY, DEV_MU_FREQUENCY, FMT_FREQ_NAME, n);
+            dev.sensor.precision = 2;
+            dev.sensor.update_period = (int)(report_period / 1000);
+            driver_add_device(self, &dev);
+            continue;
+        }
+
         dev.type = DEV_BINARY_SENSOR;
-        snprintf(dev.uid, sizeof(dev.uid), FMT_SWITCH_ID, i);
-        snprintf(dev.name, sizeof(dev.name), FMT_SWITCH_NAME, settings.system.name, i);
-        cvector_push_back(self->devices, dev);
+        snprintf(dev.uid, sizeof(dev.uid), is_input ? FMT_INPUT_ID : FMT_SWITCH_ID, n);
+        dev.info = device_info(NULL, NULL, is_input ? FMT_INPUT_NAME : FMT_SWITCH_NAME, n);
+        driver_add_device(self, &dev);
     }
 
 #if DRIVER_GH_IO_LED0_PIN
     memset(&dev, 0, sizeof(dev));
     dev.type = DEV_BINARY_SWITCH;
-    dev.internal[0] = (void *)DRIVER_GH_IO_LED0_PIN;
+    dev.internal = (void *)DRIVER_GH_IO_LED0_PIN;
     dev.binary_switch.on_write = on_relay_command;
     snprintf(dev.uid, sizeof(dev.uid), FMT_LED_ID, 0);
-    snprintf(dev.name, sizeof(dev.name), FMT_LED_NAME, settings.system.name, 0);
-    cvector_push_back(self->devices, dev);
+    dev.info = device_info(NULL, NULL, FMT_LED_NAME, 0);
+    driver_add_device(self, &dev);
 #endif
 
 #if DRIVER_GH_IO_LED1_PIN
     memset(&dev, 0, sizeof(dev));
     dev.type = DEV_BINARY_SWITCH;
-    dev.internal[0] = (void *)DRIVER_GH_IO_LED1_PIN;
+    dev.internal = (void *)DRIVER_GH_IO_LED1_PIN;
     dev.binary_switch.on_write = on_relay_command;
     snprintf(dev.uid, sizeof(dev.uid), FMT_LED_ID, 1);
-    snprintf(dev.name, sizeof(dev.name), FMT_LED_NAME, settings.system.name, 1);
-    cvector_push_back(self->devices, dev);
+    dev.info = device_info(NULL, NULL, FMT_LED_NAME, 1);
+    driver_add_device(self, &dev);
 #endif
 
     return ESP_OK;
 }
 
-static void task(driver_t *self)
+static esp_err_t read_port(uint16_t *val)
 {
-    while (true)
+    esp_err_t r = i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_URGENT, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS));
+    if (r != ESP_OK)
+        return r;
+    r = tca95x5_port_read(&expander, val);
+    i2c_bus_release(HW_INTERNAL_PORT);
+
+    return r;
+}
+
+// Returns true if the stable state of a state line has changed
+static bool update_line(line_t *l, bool bit, int64_t edge, int64_t now)
+{
+    if (bit != l->raw)
+    {
+        l->raw = bit;
+        l->raw_since = edge;
+    }
+    if (l->raw == l->stable || now - l->raw_since < l->debounce)
+        return false;
+
+    l->stable = l->raw;
+    l->stable_at = l->raw_since;
+    if (!l->counter)
+        return l->changed = true;
+
+    if (l->stable)
+    {
+        l->pulses++;
+        // the first pulse only starts the interval
+        if (l->ref_time)
+            l->window_pulses++;
+        else
+            l->ref_time = l->stable_at;
+        l->last_pulse = l->stable_at;
+    }
+    return false;
+}
+
+static void send_changes(driver_t *self)
+{
+    for (size_t i = 0; i < LINES_COUNT; i++)
     {
-        while (!(xEventGroupGetBits(port_event) & CHANGED_BITS))
+        line_t *l = &lines[i];
+        if (!l->changed)
+            continue;
+        l->changed = false;
+        device_t *dev = &self->devices[l->dev];
+        dev->binary_sensor.value = l->stable;
+        driver_send_device_update_at(self, dev, l->stable_at);
+    }
+    driver_flush_updates(self);
+}
+
+static void report_counters(driver_t *self)
+{
+    for (size_t i = 0; i < LINES_COUNT; i++)
+    {
+        line_t *l = &lines[i];
+        if (!l->counter)
+            continue;
+
+        // intervals over the time between the last pulses of two windows,
+        // unknown until two pulses are seen, reference stays at the last pulse across empty windows
+        float freq = l->measured ? 0 : NAN;
+        if (l->window_pulses && l->last_pulse > l->ref_time)
         {
-            if (!(xEventGroupGetBits(self->eg) & DRIVER_BIT_START))
-                return;
-            vTaskDelay(1);
+            freq = (float)l->window_pulses * 1000000.0f / (float)(l->last_pulse - l->ref_time);
+            l->ref_time = l->last_pulse;
+            l->measured = true;
         }
+        l->window_pulses = 0;
+
+        device_t *dev = &self->devices[l->dev];
+        dev->sensor.value = (float)l->pulses;
+        driver_send_device_update(self, dev);
+        dev++;
+        dev->sensor.value = freq;
+        driver_send_device_update(self, dev);
+    }
+    driver_flush_updates(self);
+}
+
+static void task(driver_t *self)
+{
+    int64_t settle_at = 0; // 0 - nothing to send
+    int64_t report_at = esp_timer_get_time() + report_period;
+    bool first = true;
+    bool notified = true;
 
-        xEventGroupClearBits(port_event, CHANGED_BITS);
+    edge_time = 0;
+    for (size_t i = 0; i < LINES_COUNT; i++)
+    {
+        lines[i].ref_time = 0;
+        lines[i].window_pulses = 0;
+        lines[i].measured = false;
+    }
 
-        uint16_t val = 0;
-        esp_err_t r = tca95x5_port_read(&expander, &val);
-        if (r != ESP_OK)
+    while (true)
+    {
+        int64_t now = esp_timer_get_time();
+        bool changed = false;
+
+        if (notified)
         {
-            ESP_LOGE(self->name, "Cannot read port value: %d (%s)", r, esp_err_to_name(r));
-            continue;
+            portENTER_CRITICAL(&edge_lock);
+            int64_t edge = edge_time ? edge_time : now;
+            edge_time = 0;
+            portEXIT_CRITICAL(&edge_lock);
+
+            uint16_t val = 0;
+            esp_err_t r = read_port(&val);
+            if (r != ESP_OK)
+                ESP_LOGE(self->name, "Cannot read port value: %d (%s)", r, esp_err_to_name(r));
+            else
+                for (size_t i = 0; i < LINES_COUNT; i++)
+                {
+                    line_t *l = &lines[i];
+                    bool bit = ((val >> l->bit) & 1) ^ l->inverted;
+                    if (first)
+                    {
+                        // initial state is sent without debouncing
+                        l->raw = l->stable = bit;
+                        l->raw_since = l->stable_at = now;
+                        changed |= l->changed = !l->counter;
+                    }
+                    else
+                        changed |= update_line(l, bit, edge, now);
+                }
+            first = first && r != ESP_OK;
         }
-
-        uint8_t bits = (val >> 8) & 0x0f;
-        for (int i = 0; i < 4; i++)
+        else
+            // debounce timeouts, the port has not changed since the last read
+            for (size_t i = 0; i < LINES_COUNT; i++)
+                changed |= update_line(&lines[i], lines[i].raw, lines[i].raw_since, now);
+
+        if (changed && !settle_at)
+            settle_at = now + settle;
+        if (settle_at && now >= settle_at)
+        {
+            send_changes(self);
+            settle_at = 0;
+        }
+        if (has_counters && now >= report_at)
         {
-            bool bit = (bits >> i) & 1;
-            if (inputs[i].binary_sensor.value != bit)
-            {
-                inputs[i].binary_sensor.value = bit;
-                driver_send_device_update(self, &inputs[i]);
-            }
+            report_counters(self);
+            report_at += report_period;
+            if (report_at <= now)
+                report_at = now + report_period;
         }
 
-        bits = (~val >> 12) & 0x0f;
-        for (int i = 0; i < 4; i++)
+        // sleep until interrupt, stop request or the nearest deadline
+        int64_t next = has_counters ? report_at : INT64_MAX;
+        if (settle_at && settle_at < next)
+            next = settle_at;
+        for (size_t i = 0; i < LINES_COUNT; i++)
+            if (lines[i].raw != lines[i].stable && lines[i].raw_since + lines[i].debounce < next)
+                next = lines[i].raw_since + lines[i].debounce;
+        TickType_t timeout = portMAX_DELAY;
+        if (next != INT64_MAX)
         {
-            bool bit = (bits >> i) & 1;
-            if (switches[i].binary_sensor.value != bit)
-            {
-                switches[i].binary_sensor.value = bit;
-                driver_send_device_update(self, &switches[i]);
-            }
+            int64_t wait = next - esp_timer_get_time();
+            timeout = wait > 0 ? pdMS_TO_TICKS((wait + 999) / 1000) : 0;
+            if (wait > 0 && !timeout)
+                timeout = 1;
         }
+        // initial read failed, retry
+        if (first && timeout > pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS))
+            timeout = pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS);
+        notified = ulTaskNotifyTake(pdTRUE, timeout) > 0 || first;
+        if (driver_stop_requested(self))
+            return;
     }
 }
 
 static esp_err_t on_stop(driver_t *self)
 {
     gpio_isr_handler_remove(DRIVER_GH_IO_INTR_GPIO);
-    vEventGroupDelete(port_event);
-    port_event = NULL;
     esp_err_t r = tca95x5_free_desc(&expander);
     if (r != ESP_OK)
         ESP_LOGW(self->name, "Device descriptor free error: %d (%s)", r, esp_err_to_name(r));
@@ -211,13 +411,15 @@ driver_t drv_gh_io = {
     .name = "gh_io",
     .stack_size = DRIVER_GH_IO_STACK_SIZE,
     .priority = tskIDLE_PRIORITY + 1,
-    .defconfig = NULL,
+    .defconfig = "{ \"" OPT_DEBOUNCE "\": 20, \"" OPT_SETTLE "\": 50, \"" OPT_PERIOD "\": 10000 }",
 
     .config = NULL,
     .state = DRIVER_NEW,
     .event_queue = NULL,
+    .update_queue = NULL,
 
     .devices = NULL,
+    .lock = NULL,
     .handle = NULL,
     .eg = NULL,
 
@@ -225,7 +427,8 @@ driver_t drv_gh_io = {
     .on_start = NULL,
     .on_stop = on_stop,
 
-    .task = task
+    .task = task,
+    .sample = NULL
 };
 
 #endif
@@ -5,6 +5,27 @@
 
 #ifdef DRIVER_GH_IO
 
+/*
+{
+  "debounce": 20,       // ms, default for all inputs
+  "settle": 50,         // ms, state changes within this window are sent as one batch
+  "period": 10000,      // ms, report period of pulse counters
+  "inputs": [           // optional, isolated inputs 0..3
+    {
+      "debounce": 2,
+      "counter": true   // count pulses and measure frequency instead of reporting state
+    }
+  ],
+  "switches": [         // optional, input switches 0..3
+    { "debounce": 100 }
+  ]
+}
+
+Edges are seen through port reads on expander interrupt, so pulse counting
+is limited to a few hundred Hz. Frequency is measured between pulses, it is
+unknown (NaN) until two pulses are seen and 0 for a period without pulses.
+*/
+
 #include "driver.h"
 #include "std_strings.h"
 
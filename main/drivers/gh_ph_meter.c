@@ -2,29 +2,53 @@
 
 #ifdef DRIVER_GH_PH_METER
 
+#include <math.h>
 #include <esp_check.h>
 #include <esp_timer.h>
 #include <ads111x.h>
-#include <calibration.h>
-#include "settings.h"
+#include "i2c_bus.h"
 
 #define GAIN ADS111X_GAIN_0V512
 
 #define PH_METER_ID  "ph0"
 #define PH_RAW_ID    "ph0_raw"
 
-#define FMT_PH_METER_NAME "%s pH 0"
-#define FMT_PH_RAW_NAME   "%s pH 0 raw voltage"
+#define FMT_PH_METER_NAME "pH 0"
+#define FMT_PH_RAW_NAME   "pH 0 raw voltage"
 
 #define MU_PH_METER "pH"
 
+// raw codes are filtered in Q8 to keep sub-LSB resolution
+#define RAW_FRAC_BITS 8
+
+#define DEF_DATA_RATE ADS111X_DATA_RATE_128
+
 static i2c_dev_t adc = { 0 };
 static int samples;
 static float gain;
-static float ph;
-static calibration_handle_t calib = { 0 };
-static uint32_t last_update_time;
+static lut_t calib = { 0 };
+static filter_t filter = { 0 };
 static int update_period;
+static gpio_num_t rdy_gpio;
+static SemaphoreHandle_t rdy = NULL;
+static uint32_t conv_ms; // conversion time rounded up
+static uint32_t margin_ms; // data rate of the internal oscillator is within 10 %
+// conversions of current period, sample() is rescheduled for each one
+static bool collecting;
+static int taken;
+static int32_t sum;
+static int64_t waiting_since; // us
+
+static const int data_rates[] = {
+    [ADS111X_DATA_RATE_8] = 8,
+    [ADS111X_DATA_RATE_16] = 16,
+    [ADS111X_DATA_RATE_32] = 32,
+    [ADS111X_DATA_RATE_64] = 64,
+    [ADS111X_DATA_RATE_128] = 128,
+    [ADS111X_DATA_RATE_250] = 250,
+    [ADS111X_DATA_RATE_475] = 475,
+    [ADS111X_DATA_RATE_860] = 860,
+};
 
 static const calibration_point_t def_calibration[]= {
     { .code = 0.0f, .value = 7.0f },
@@ -32,13 +56,118 @@ static const calibration_point_t def_calibration[]= {
 };
 static const size_t def_calibration_points = sizeof(def_calibration) / sizeof(calibration_point_t);
 
+static void IRAM_ATTR on_conversion_ready(void *arg)
+{
+    (void)arg;
+    BaseType_t hp_task = pdFALSE;
+    xSemaphoreGiveFromISR(rdy, &hp_task);
+    portYIELD_FROM_ISR(hp_task);
+}
+
+static ads111x_data_rate_t get_data_rate(driver_t *self)
+{
+    int sps = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_DATA_RATE), data_rates[DEF_DATA_RATE]);
+    for (size_t i = 0; i < sizeof(data_rates) / sizeof(data_rates[0]); i++)
+        if (data_rates[i] == sps)
+            return i;
+
+    ESP_LOGW(self->name, "Invalid data rate %d, using %d SPS", sps, data_rates[DEF_DATA_RATE]);
+    return DEF_DATA_RATE;
+}
+
+// Register setup, called within bus session
+static esp_err_t setup_adc(driver_t *self, ads111x_data_rate_t rate)
+{
+    ESP_RETURN_ON_ERROR(
+        ads111x_set_gain(&adc, GAIN),
+        self->name, "Error setting gain: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+    ESP_RETURN_ON_ERROR(
+        ads111x_set_input_mux(&adc, ADS111X_MUX_0_1),
+        self->name, "Error setting input MUX: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+    ESP_RETURN_ON_ERROR(
+        ads111x_set_data_rate(&adc, rate),
+        self->name, "Error setting data rate: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+    if (rdy_gpio >= 0)
+    {
+        // ALERT/RDY pulses low after each conversion when Hi_thresh MSB = 1 and Lo_thresh MSB = 0
+        ESP_RETURN_ON_ERROR(
+            ads111x_set_comp_high_thresh(&adc, INT16_MIN),
+            self->name, "Error setting comparator threshold: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+        );
+        ESP_RETURN_ON_ERROR(
+            ads111x_set_comp_low_thresh(&adc, 0),
+            self->name, "Error setting comparator threshold: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+        );
+        ESP_RETURN_ON_ERROR(
+            ads111x_set_comp_polarity(&adc, ADS111X_COMP_POLARITY_LOW),
+            self->name, "Error setting comparator polarity: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+        );
+        ESP_RETURN_ON_ERROR(
+            ads111x_set_comp_queue(&adc, ADS111X_COMP_QUEUE_1),
+            self->name, "Error enabling comparator: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+        );
+    }
+    // conversions are streamed, sample() only reads results
+    ESP_RETURN_ON_ERROR(
+        ads111x_set_mode(&adc, ADS111X_MODE_CONTINUOUS),
+        self->name, "Error setting mode: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+
+    return ESP_OK;
+}
+
+static esp_err_t init_rdy(driver_t *self)
+{
+    if (!rdy)
+        rdy = xSemaphoreCreateBinary();
+    if (!rdy)
+        return ESP_ERR_NO_MEM;
+
+    ESP_RETURN_ON_ERROR(
+        gpio_reset_pin(rdy_gpio),
+        self->name, "Error reset RDY GPIO %d: %d (%s)", rdy_gpio, err_rc_, esp_err_to_name(err_rc_)
+    );
+    gpio_set_direction(rdy_gpio, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(rdy_gpio, GPIO_PULLUP_ONLY);
+    gpio_set_intr_type(rdy_gpio, GPIO_INTR_NEGEDGE);
+    ESP_RETURN_ON_ERROR(
+        driver_install_gpio_isr_service(),
+        self->name, "Error installing GPIO ISR service: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+    ESP_RETURN_ON_ERROR(
+        gpio_isr_handler_add(rdy_gpio, on_conversion_ready, NULL),
+        self->name, "Error adding RDY handler: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
+    );
+
+    return ESP_OK;
+}
+
 static esp_err_t on_init(driver_t *self)
 {
     cvector_free(self->devices);
 
     samples = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_SAMPLES), 32);
     update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
-
+    self->period = update_period;
+    rdy_gpio = driver_config_get_gpio(cJSON_GetObjectItem(self->config, OPT_GPIO), GPIO_NUM_NC);
+    ads111x_data_rate_t rate = get_data_rate(self);
+    conv_ms = (1000 + data_rates[rate] - 1) / data_rates[rate];
+    margin_ms = conv_ms / 10 + 1;
+    collecting = false;
+
+    // filter is applied to the averaged value of each period, default is EMA with time constant of 2 s
+    filter_config_t def = {
+        .type = FILTER_EMA,
+        .alpha = (float)update_period / ((float)update_period + 2000.0f),
+    };
+    filter_free(&filter);
+    CHECK(driver_config_read_filter(self->name, cJSON_GetObjectItem(self->config, OPT_FILTER),
+        &filter, &def, update_period));
+
+    lut_free(&calib);
     CHECK(driver_config_read_calibration(self->name, cJSON_GetObjectItem(self->config, OPT_CALIBRATION),
         &calib, def_calibration, def_calibration_points));
 
@@ -52,131 +181,130 @@ static esp_err_t on_init(driver_t *self)
 #if (DRIVER_GH_PH_METER_FREQUENCY)
     adc.cfg.master.clk_speed = DRIVER_GH_PH_METER_FREQUENCY;
 #endif
-    ESP_RETURN_ON_ERROR(
-        ads111x_set_gain(&adc, GAIN),
-        self->name, "Error setting gain: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-    );
-    ESP_RETURN_ON_ERROR(
-        ads111x_set_input_mux(&adc, ADS111X_MUX_0_1),
-        self->name, "Error setting input MUX: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-    );
-    ESP_RETURN_ON_ERROR(
-        ads111x_set_mode(&adc, ADS111X_MODE_SINGLE_SHOT),
-        self->name, "Error setting mode: %d (%s)", err_rc_, esp_err_to_name(err_rc_)
-    );
+    // register writes are arbitrated like reads, other devices share the port
+    CHECK(i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_NORMAL, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS)));
+    esp_err_t r = setup_adc(self, rate);
+    i2c_bus_release(HW_INTERNAL_PORT);
+    CHECK(r);
+    if (rdy_gpio >= 0)
+        CHECK(init_rdy(self));
+    ESP_LOGI(self->name, "Continuous conversions at %d SPS, %s", data_rates[rate],
+        rdy_gpio >= 0 ? "ALERT/RDY interrupt" : "timed reads");
 
     device_t dev = { 0 };
     strncpy(dev.uid, PH_METER_ID, sizeof(dev.uid));
     dev.type = DEV_SENSOR;
-    snprintf(dev.name, sizeof(dev.name), FMT_PH_METER_NAME, settings.system.name);
-    strncpy(dev.device_class, DEV_CLASS_PH, sizeof(dev.device_class));
-    strncpy(dev.sensor.measurement_unit, MU_PH_METER, sizeof(dev.sensor.measurement_unit));
+    dev.info = device_info(DEV_CLASS_PH, MU_PH_METER, FMT_PH_METER_NAME);
     dev.sensor.precision = 2;
     dev.sensor.update_period = update_period;
-    cvector_push_back(self->devices, dev);
+    driver_add_device(self, &dev);
 
     memset(&dev, 0, sizeof(dev));
     strncpy(dev.uid, PH_RAW_ID, sizeof(dev.uid));
     dev.type = DEV_SENSOR;
-    snprintf(dev.name, sizeof(dev.name), FMT_PH_RAW_NAME, settings.system.name);
-    strncpy(dev.device_class, DEV_CLASS_VOLTAGE, sizeof(dev.device_class));
-    strncpy(dev.sensor.measurement_unit, DEV_MU_VOLTAGE, sizeof(dev.sensor.measurement_unit));
+    dev.info = device_info(DEV_CLASS_VOLTAGE, DEV_MU_VOLTAGE, FMT_PH_RAW_NAME);
     dev.sensor.precision = 4;
     dev.sensor.update_period = update_period;
-    cvector_push_back(self->devices, dev);
+    driver_add_device(self, &dev);
 
     return ESP_OK;
 }
 
-static inline bool wait_adc_busy(driver_t *self)
+// Time until the next conversion is done: RDY is checked once it's due, timed reads wait for a slow oscillator
+static uint32_t conversion_time()
 {
-    bool busy;
-    do
-    {
-        esp_err_t r = ads111x_is_busy(&adc, &busy);
-        if (r != ESP_OK)
-        {
-            ESP_LOGE(self->name, "Device is not responding: %d (%s)", r, esp_err_to_name(r));
-            return false;
-        }
-        if (busy)
-            vTaskDelay(1);
-    }
-    while (busy);
-
-    return true;
+    return rdy_gpio >= 0 ? conv_ms : conv_ms + margin_ms;
 }
 
-static void task(driver_t *self)
+static void sample(driver_t *self)
 {
-    TickType_t period = pdMS_TO_TICKS(update_period);
     esp_err_t r;
+    int64_t now = esp_timer_get_time();
 
-    while (true)
+    if (!collecting)
     {
-        TickType_t start = xTaskGetTickCount();
-
-        uint32_t interval = (esp_timer_get_time() / 1000) - last_update_time;
-        last_update_time += interval;
-
-        float voltage = 0;
-        for (int i = 0; i < samples; i++)
-        {
-            r = ads111x_start_conversion(&adc);
-            if (r != ESP_OK)
-            {
-                ESP_LOGE(self->name, "Error starting conversion: %d (%s)", r, esp_err_to_name(r));
-                goto next;
-            }
-            if (!wait_adc_busy(self))
-                goto next;
-
-            int16_t v;
-            r = ads111x_get_value(&adc, &v);
-            if (r != ESP_OK)
-            {
-                ESP_LOGE(self->name, "Error reading ADC value: %d (%s)", r, esp_err_to_name(r));
-                goto next;
-            }
-
-            voltage += gain * (float)v;
-        }
-        voltage /= (float)samples;
+        // drop RDY pulse of a conversion finished before this period
+        if (rdy_gpio >= 0)
+            xSemaphoreTake(rdy, 0);
+        collecting = true;
+        taken = 0;
+        sum = 0;
+        waiting_since = now;
+        driver_sample_after(self, conversion_time());
+        return;
+    }
+    if (driver_stop_requested(self))
+    {
+        collecting = false;
+        return;
+    }
 
-        float dt = (float)interval / 1000.0f;
-        float alpha = 1.0f - dt / (dt + 2.0f);
-        float new_ph = 0;
-        r = calibration_get_value(&calib, voltage, &new_ph);
-        if (r != ESP_OK)
+    if (rdy_gpio >= 0 && xSemaphoreTake(rdy, 0) != pdTRUE)
+    {
+        // RDY timeout is two conversions
+        if (now - waiting_since > (int64_t)conv_ms * 2000)
         {
-            ESP_LOGE(self->name, "Error getting calibrated pH value: %d (%s)", r, esp_err_to_name(r));
-            goto next;
+            ESP_LOGE(self->name, "Timeout waiting for conversion");
+            collecting = false;
+            return;
         }
-        ph = alpha * ph + (1.0f - alpha) * new_ph;
+        // conversion is late, check again after the oscillator tolerance
+        driver_sample_after(self, margin_ms);
+        return;
+    }
 
-        self->devices[0].sensor.value = ph;
-        driver_send_device_update(self, &self->devices[0]);
-        self->devices[1].sensor.value = voltage;
-        driver_send_device_update(self, &self->devices[1]);
+    int16_t v;
+    r = i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_BULK, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS));
+    if (r == ESP_OK)
+    {
+        r = ads111x_get_value(&adc, &v);
+        i2c_bus_release(HW_INTERNAL_PORT);
+    }
+    if (r != ESP_OK)
+    {
+        ESP_LOGE(self->name, "Error reading ADC value: %d (%s)", r, esp_err_to_name(r));
+        collecting = false;
+        return;
+    }
+    sum += v;
 
-    next:
-        while (xTaskGetTickCount() - start < period)
-        {
-            if (!(xEventGroupGetBits(self->eg) & DRIVER_BIT_START))
-                return;
-            vTaskDelay(1);
-        }
+    if (++taken < samples)
+    {
+        // next conversion, worker is free meanwhile
+        waiting_since = now;
+        driver_sample_after(self, conversion_time());
+        return;
     }
+    collecting = false;
+
+    float voltage = gain * (float)sum / (float)samples;
+
+    int32_t code = filter_apply(&filter, (int32_t)lroundf((float)sum * (1 << RAW_FRAC_BITS) / (float)samples));
+    self->devices[0].sensor.value = lut_get(&calib, gain * (float)code / (float)(1 << RAW_FRAC_BITS));
+    driver_send_device_update(self, &self->devices[0]);
+    self->devices[1].sensor.value = voltage;
+    driver_send_device_update(self, &self->devices[1]);
 }
 
 static esp_err_t on_stop(driver_t *self)
 {
-    esp_err_t r = ads111x_free_desc(&adc);
+    collecting = false;
+    if (rdy_gpio >= 0)
+        gpio_isr_handler_remove(rdy_gpio);
+    // back to power-down between conversions
+    esp_err_t r = i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_NORMAL, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS));
+    if (r == ESP_OK)
+    {
+        r = ads111x_set_mode(&adc, ADS111X_MODE_SINGLE_SHOT);
+        i2c_bus_release(HW_INTERNAL_PORT);
+    }
     if (r != ESP_OK)
-        ESP_LOGW(self->name, "Device descriptor free error: %d (%s)", r, esp_err_to_name(r));
-    r = calibration_free(&calib);
+        ESP_LOGW(self->name, "Error setting mode: %d (%s)", r, esp_err_to_name(r));
+    r = ads111x_free_desc(&adc);
     if (r != ESP_OK)
-        ESP_LOGW(self->name, "Calibration data free error: %d (%s)", r, esp_err_to_name(r));
+        ESP_LOGW(self->name, "Device descriptor free error: %d (%s)", r, esp_err_to_name(r));
+    lut_free(&calib);
+    filter_free(&filter);
 
     return ESP_OK;
 }
@@ -185,14 +313,16 @@ driver_t drv_ph_meter = {
     .name = "gh_ph_meter",
     .stack_size = DRIVER_GH_PH_METER_STACK_SIZE,
     .priority = tskIDLE_PRIORITY + 1,
-    .defconfig = "{ \"" OPT_PERIOD "\": 5000, \"" OPT_SAMPLES "\": 32, \"" OPT_CALIBRATION "\": " \
+    .defconfig = "{ \"" OPT_PERIOD "\": 5000, \"" OPT_SAMPLES "\": 32, \"" OPT_DATA_RATE "\": 128, \"" OPT_CALIBRATION "\": " \
         "[{\"" OPT_VOLTAGE "\": 0, \"" OPT_VALUE "\": 7}, {\"" OPT_VOLTAGE "\": 0.17143, \"" OPT_VALUE "\": 4.01}] }",
 
     .config = NULL,
     .state = DRIVER_NEW,
     .event_queue = NULL,
+    .update_queue = NULL,
 
     .devices = NULL,
+    .lock = NULL,
     .handle = NULL,
     .eg = NULL,
 
@@ -200,7 +330,8 @@ driver_t drv_ph_meter = {
     .on_start = NULL,
     .on_stop = on_stop,
 
-    .task = task
+    .task = NULL,
+    .sample = sample
 };
 
 #endif
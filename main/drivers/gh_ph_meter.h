@@ -9,7 +9,15 @@
 {
   "period": 5000,         // ms
   "samples": 32,
-  "calibration": [
+  "data_rate": 128,       // SPS: 8, 16, 32, 64, 128, 250, 475 or 860
+  "gpio": 4,              // optional, GPIO connected to ALERT/RDY pin, timed reads if not set
+  "filter": {             // optional, filter of averaged values, EMA with tau of 2000 ms by default
+    "type": "ema",        // "none", "average", "median", "ema" or "lowpass"
+    "tau": 2000           // ms, or "alpha": 0..1; "window": N for average/median, "cutoff": Hz for lowpass
+  },
+  "calibration": [        // or { "method": "cubic", "points": [...] }, methods: "linear", "cubic",
+                          // "polynomial" (with optional "degree": 1..5, 2 by default, lower than
+                          // the number of points)
     {
       "voltage": 0,
       "ph": 7
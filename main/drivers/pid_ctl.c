@@ -0,0 +1,333 @@
+#include "pid_ctl.h"
+
+#ifdef DRIVER_PID
+
+#include <math.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "pid.h"
+#include "node.h"
+
+#define FMT_SETPOINT_ID   "pid%d_sp"
+#define FMT_OUTPUT_ID     "pid%d_out"
+#define FMT_ENABLED_ID    "pid%d_on"
+
+#define FMT_SETPOINT_NAME "setpoint (PID %d)"
+#define FMT_OUTPUT_NAME   "output (PID %d)"
+#define FMT_ENABLED_NAME  "enabled (PID %d)"
+
+#define OPT_CONTROLLERS "controllers"
+#define OPT_INPUT       "input"
+#define OPT_OUTPUT      "output"
+#define OPT_SETPOINT    "setpoint"
+#define OPT_MIN         "min"
+#define OPT_MAX         "max"
+#define OPT_KP          "kp"
+#define OPT_KI          "ki"
+#define OPT_KD          "kd"
+#define OPT_OUT_MIN     "out_min"
+#define OPT_OUT_MAX     "out_max"
+#define OPT_BIAS        "bias"
+#define OPT_REVERSE     "reverse"
+#define OPT_CYCLE       "cycle"
+#define OPT_INPUT_TIMEOUT "input_timeout"
+
+#define DEF_INPUT_TIMEOUT 60000
+
+typedef struct
+{
+    char input[DEVICE_UID_SIZE];
+    char output[DEVICE_UID_SIZE];
+    pid_ctl_t pid;
+    size_t dev;          // setpoint device, followed by output and enable devices
+    volatile float setpoint;
+    volatile bool enabled;
+    volatile bool reset; // enable state changed
+    int cycle;           // ms, time-proportioned switch output if > 0
+    int64_t cycle_start; // us
+    int64_t updated;     // us, time of the previous PID update, 0 after reset
+    int input_timeout;   // ms, output is turned off when input is missing longer, 0 to hold it
+    int64_t input_lost;  // us, time the input went missing, 0 if present
+    bool failsafe;       // output is off until input is back
+    float duty;          // 0..1, fixed for the current cycle
+    float written;       // last value written to output
+    bool has_written;
+    bool warned;
+} controller_t;
+
+static cvector_vector_type(controller_t) controllers = NULL;
+
+static int update_period;
+
+static inline controller_t *device_controller(device_t *dev)
+{
+    return &controllers[(size_t)dev->internal];
+}
+
+// Called from MQTT or rules, output is written by sample()
+static void on_setpoint_write(device_t *dev, float value)
+{
+    if (value < dev->number.min)
+        value = dev->number.min;
+    if (value > dev->number.max)
+        value = dev->number.max;
+
+    device_controller(dev)->setpoint = value;
+    dev->number.value = value;
+    driver_send_device_update(&drv_pid, dev);
+}
+
+static void on_enable_write(device_t *dev, bool value)
+{
+    controller_t *c = device_controller(dev);
+    if (c->enabled != value)
+    {
+        c->enabled = value;
+        c->reset = true;
+    }
+    dev->binary_switch.value = value;
+    driver_send_device_update(&drv_pid, dev);
+}
+
+static void write_output(driver_t *self, controller_t *c, float value)
+{
+    if (c->has_written && fabsf(value - c->written) < 1e-3f)
+        return;
+
+    esp_err_t r = node_write_device(c->output, value);
+    if (r != ESP_OK)
+    {
+        if (!c->warned)
+            ESP_LOGW(self->name, "Error writing output '%s': %d (%s)", c->output, r, esp_err_to_name(r));
+        c->warned = true;
+        return;
+    }
+    c->written = value;
+    c->has_written = true;
+}
+
+static void apply_output(driver_t *self, controller_t *c, float u, int64_t now)
+{
+    if (c->cycle <= 0)
+    {
+        write_output(self, c, u);
+        return;
+    }
+
+    // duty is taken at the start of each cycle
+    const pid_config_t *cfg = &c->pid.cfg;
+    if (now - c->cycle_start >= (int64_t)c->cycle * 1000)
+    {
+        c->cycle_start = now;
+        c->duty = cfg->out_max > cfg->out_min ? (u - cfg->out_min) / (cfg->out_max - cfg->out_min) : 0;
+    }
+    bool on = now - c->cycle_start < (int64_t)(c->duty * (float)c->cycle * 1000.0f);
+    write_output(self, c, on);
+}
+
+static inline float output_off(const controller_t *c)
+{
+    return c->cycle > 0 ? 0 : c->pid.cfg.out_min;
+}
+
+static void restart(controller_t *c)
+{
+    pid_reset(&c->pid);
+    c->cycle_start = 0;
+    c->updated = 0;
+}
+
+static void control(driver_t *self, controller_t *c, int64_t now)
+{
+    if (c->reset)
+    {
+        c->reset = false;
+        restart(c);
+        c->has_written = false;
+        c->input_lost = 0;
+        c->failsafe = false;
+        // disabled controller leaves output off
+        if (!c->enabled)
+            write_output(self, c, output_off(c));
+    }
+    if (!c->enabled)
+        return;
+
+    float pv;
+    esp_err_t r = node_read_device(c->input, &pv);
+    if (r != ESP_OK || !isfinite(pv))
+    {
+        // hold the output until process variable is back, turn it off if it takes too long
+        if (!c->warned)
+            ESP_LOGW(self->name, "No value of input '%s'", c->input);
+        c->warned = true;
+        if (!c->input_lost)
+            c->input_lost = now;
+        if (c->input_timeout > 0 && !c->failsafe && now - c->input_lost >= (int64_t)c->input_timeout * 1000)
+        {
+            ESP_LOGW(self->name, "Input '%s' missing for %d ms, output '%s' turned off", c->input,
+                c->input_timeout, c->output);
+            c->failsafe = true;
+            restart(c);
+            write_output(self, c, output_off(c));
+
+            device_t *dev = &self->devices[c->dev + 1];
+            dev->sensor.value = output_off(c);
+            driver_send_device_update(self, dev);
+        }
+        return;
+    }
+    c->warned = false;
+    c->input_lost = 0;
+    if (c->failsafe)
+    {
+        ESP_LOGI(self->name, "Input '%s' is back, control resumed", c->input);
+        c->failsafe = false;
+    }
+
+    // actual interval, the task may be delayed by higher priority work
+    float dt = c->updated ? (float)(now - c->updated) / 1e6f : (float)update_period / 1000.0f;
+    c->updated = now;
+    float u = pid_update(&c->pid, c->setpoint, pv, dt);
+    apply_output(self, c, u, now);
+
+    device_t *dev = &self->devices[c->dev + 1];
+    dev->sensor.value = u;
+    driver_send_device_update(self, dev);
+}
+
+static esp_err_t on_init(driver_t *self)
+{
+    cvector_free(self->devices);
+    cvector_free(controllers);
+
+    update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
+    self->period = update_period;
+
+    cJSON *items = cJSON_GetObjectItem(self->config, OPT_CONTROLLERS);
+    for (int i = 0; i < cJSON_GetArraySize(items); i++)
+    {
+        cJSON *item = cJSON_GetArrayItem(items, i);
+        controller_t c = { 0 };
+
+        const char *input = cJSON_GetStringValue(cJSON_GetObjectItem(item, OPT_INPUT));
+        const char *output = cJSON_GetStringValue(cJSON_GetObjectItem(item, OPT_OUTPUT));
+        if (!input || !output || strlen(input) >= DEVICE_UID_SIZE || strlen(output) >= DEVICE_UID_SIZE)
+        {
+            ESP_LOGW(self->name, "Controller %d: invalid input or output", i);
+            continue;
+        }
+        strcpy(c.input, input);
+        strcpy(c.output, output);
+
+        pid_config_t cfg = {
+            .kp = driver_config_get_float(cJSON_GetObjectItem(item, OPT_KP), 1),
+            .ki = driver_config_get_float(cJSON_GetObjectItem(item, OPT_KI), 0),
+            .kd = driver_config_get_float(cJSON_GetObjectItem(item, OPT_KD), 0),
+            .out_min = driver_config_get_float(cJSON_GetObjectItem(item, OPT_OUT_MIN), 0),
+            .out_max = driver_config_get_float(cJSON_GetObjectItem(item, OPT_OUT_MAX), 100),
+            .bias = driver_config_get_float(cJSON_GetObjectItem(item, OPT_BIAS), 0),
+            .reverse = driver_config_get_bool(cJSON_GetObjectItem(item, OPT_REVERSE), false),
+        };
+        if (cfg.out_max <= cfg.out_min)
+        {
+            ESP_LOGW(self->name, "Controller %d: invalid output range", i);
+            continue;
+        }
+        pid_init(&c.pid, &cfg);
+        c.cycle = driver_config_get_int(cJSON_GetObjectItem(item, OPT_CYCLE), 0);
+        c.enabled = driver_config_get_bool(cJSON_GetObjectItem(item, OPT_ENABLED), true);
+        c.input_timeout = driver_config_get_int(cJSON_GetObjectItem(item, OPT_INPUT_TIMEOUT), DEF_INPUT_TIMEOUT);
+        c.reset = true;
+        c.dev = cvector_size(self->devices);
+        size_t index = cvector_size(controllers);
+
+        device_t dev = { 0 };
+        dev.type = DEV_NUMBER;
+        dev.internal = (void *)index;
+        snprintf(dev.uid, sizeof(dev.uid), FMT_SETPOINT_ID, i);
+        dev.info = device_info(NULL, NULL, FMT_SETPOINT_NAME, i);
+        dev.number.min = driver_config_get_float(cJSON_GetObjectItem(item, OPT_MIN), 0);
+        dev.number.max = driver_config_get_float(cJSON_GetObjectItem(item, OPT_MAX), 100);
+        dev.number.step = 0.1f;
+        dev.number.value = driver_config_get_float(cJSON_GetObjectItem(item, OPT_SETPOINT), dev.number.min);
+        dev.number.on_write = on_setpoint_write;
+        c.setpoint = dev.number.value;
+        driver_add_device(self, &dev);
+
+        memset(&dev, 0, sizeof(dev));
+        dev.type = DEV_SENSOR;
+        snprintf(dev.uid, sizeof(dev.uid), FMT_OUTPUT_ID, i);
+        dev.info = device_info(NULL, NULL, FMT_OUTPUT_NAME, i);
+        dev.sensor.precision = 1;
+        dev.sensor.update_period = update_period;
+        dev.sensor.value = NAN;
+        driver_add_device(self, &dev);
+
+        memset(&dev, 0, sizeof(dev));
+        dev.type = DEV_BINARY_SWITCH;
+        dev.internal = (void *)index;
+        snprintf(dev.uid, sizeof(dev.uid), FMT_ENABLED_ID, i);
+        dev.info = device_info(NULL, NULL, FMT_ENABLED_NAME, i);
+        dev.binary_switch.value = c.enabled;
+        dev.binary_switch.on_write = on_enable_write;
+        driver_add_device(self, &dev);
+
+        cvector_push_back(controllers, c);
+
+        ESP_LOGI(self->name, "Controller %d: %s -> %s, kp=%.3f ki=%.3f kd=%.3f%s", i, c.input, c.output,
+            cfg.kp, cfg.ki, cfg.kd, c.cycle > 0 ? ", time-proportioned" : "");
+    }
+
+    return ESP_OK;
+}
+
+// Own task, control loop must not wait behind sensor sampling in scheduler workers
+static void task(driver_t *self)
+{
+    TickType_t start = xTaskGetTickCount();
+    TickType_t period = pdMS_TO_TICKS(update_period);
+    while (true)
+    {
+        int64_t now = esp_timer_get_time();
+        for (size_t i = 0; i < cvector_size(controllers); i++)
+            control(self, &controllers[i], now);
+
+        // fixed grid of periods, not drifting with the loop time
+        if (!driver_wait_period(self, start, period))
+            return;
+        start += period;
+        if (xTaskGetTickCount() - start >= period)
+        {
+            // overrun, skip missed periods
+            self->stats.overruns++;
+            start = xTaskGetTickCount();
+        }
+    }
+}
+
+driver_t drv_pid = {
+    .name = "pid",
+    .stack_size = DRIVER_PID_STACK_SIZE,
+    .priority = tskIDLE_PRIORITY + 2,
+    .defconfig = "{ \"" OPT_PERIOD "\": 1000, \"" OPT_CONTROLLERS "\": [] }",
+
+    .config = NULL,
+    .state = DRIVER_NEW,
+    .event_queue = NULL,
+    .update_queue = NULL,
+
+    .devices = NULL,
+    .lock = NULL,
+    .handle = NULL,
+    .eg = NULL,
+
+    .on_init = on_init,
+    .on_start = NULL,
+    .on_stop = NULL,
+
+    .task = task,
+    .sample = NULL
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef ESP_IOT_NODE_PLUS_DRV_PID_CTL_H_
+#define ESP_IOT_NODE_PLUS_DRV_PID_CTL_H_
+
+#include "common.h"
+
+#ifdef DRIVER_PID
+
+/*
+{
+  "period": 1000,            // ms, control step of all controllers
+  "controllers": [
+    {
+      "input": "dht0_rh",    // process variable, uid of any sensor
+      "output": "dimmer",    // uid of number device or binary switch
+      "setpoint": 60,        // initial setpoint
+      "min": 0,              // setpoint limits
+      "max": 100,
+      "kp": 2.0,
+      "ki": 0.1,             // 1/s
+      "kd": 0,               // s
+      "out_min": 0,
+      "out_max": 100,
+      "bias": 0,             // feed-forward, added to the output
+      "reverse": false,      // output increase lowers process variable, e.g. dehumidifier
+      "cycle": 60000,        // ms, optional, time-proportioned output to binary switch
+      "input_timeout": 60000, // ms, output is turned off when input is missing longer, 0 holds it
+      "enabled": true
+    }
+  ]
+}
+
+Each controller exposes setpoint number, output sensor and enable switch.
+Switch output duty is quantized to the period. Controllers run in own task
+above sensor sampling, the integral and derivative use the measured interval.
+While the input is missing the output is held, after `input_timeout` it is set
+to out_min or switched off until the input is back.
+*/
+
+#include "driver.h"
+#include "std_strings.h"
+
+extern driver_t drv_pid;
+
+#endif
+
+#endif // ESP_IOT_NODE_PLUS_DRV_PID_CTL_H_
@@ -3,20 +3,30 @@
 #ifdef DRIVER_RHT
 
 #include "driver.h"
-#include "settings.h"
 #include <aht.h>
 #include <si7021.h>
+#include <esp_timer.h>
+#include "i2c_bus.h"
 
 #define PROBE_FREQUENCY 100000
 
 #define FMT_HUMIDITY_SENSOR_ID      "rht%d_rh"
 #define FMT_TEMPERATURE_SENSOR_ID   "rht%d_t"
 
-#define FMT_HUMIDITY_SENSOR_NAME    "%s humidity %d (%s)"
-#define FMT_TEMPERATURE_SENSOR_NAME "%s temperature %d (%s)"
+#define FMT_HUMIDITY_SENSOR_NAME    "humidity %d (%s)"
+#define FMT_TEMPERATURE_SENSOR_NAME "temperature %d (%s)"
 
 #define OPT_THRESHOLD               "temp_bad_threshold"
 
+#define AHT_CONV_MS           80
+#define AHT_STATUS_BUSY       BIT(7)
+#define SI7021_CMD_MEASURE_T  0xf3 // no hold master
+#define SI7021_CMD_MEASURE_RH 0xf5 // no hold master
+#define SI7021_CONV_T_MS      11
+#define SI7021_CONV_RH_MS     13
+#define POLL_MS               5  // retry interval while sensor is still converting
+#define CONV_TIMEOUT_MS       200
+
 typedef enum {
     SENSOR_AHT1X = 0,
     SENSOR_AHT20,
@@ -29,6 +39,12 @@ static const char *sensor_types[] = {
     [SENSOR_SI7021] = "Si70xx/HTU2xD",
 };
 
+typedef enum {
+    STAGE_AHT = 0,     // combined temperature and humidity
+    STAGE_SI7021_T,
+    STAGE_SI7021_RH,
+} stage_t;
+
 typedef struct {
     sensor_type_t type;
     union
@@ -36,6 +52,15 @@ typedef struct {
         aht_t aht;
         i2c_dev_t i2c_dev;
     } dev;
+    // measurement state within a period
+    stage_t stage;
+    int64_t started;  // us, conversion trigger time
+    int64_t ready_at; // us, time to read the result
+    bool running;     // samples of this period are not done yet
+    int attempts;
+    int real_samples;
+    float t, rh;
+    float t_sum, rh_sum;
 } handle_t;
 
 static cvector_vector_type(handle_t) sensors = NULL;
@@ -43,6 +68,7 @@ static cvector_vector_type(handle_t) sensors = NULL;
 static int update_period;
 static int samples;
 static int threshold;
+static bool collecting; // period is in progress, sample() is rescheduled until all sensors are done
 
 static esp_err_t on_init(driver_t *self)
 {
@@ -50,8 +76,10 @@ static esp_err_t on_init(driver_t *self)
     cvector_free(sensors);
 
     update_period = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_PERIOD), 1000);
+    self->period = update_period;
     samples = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_SAMPLES), 8);
     threshold = driver_config_get_int(cJSON_GetObjectItem(self->config, OPT_THRESHOLD), 120);
+    collecting = false;
 
 //    i2c_dev_t probe = { 0 };
 //    probe.port = HW_EXTERNAL_PORT;
@@ -120,22 +148,18 @@ static esp_err_t on_init(driver_t *self)
         device_t dev = { 0 };
         snprintf(dev.uid, sizeof(dev.uid), FMT_HUMIDITY_SENSOR_ID, i);
         dev.type = DEV_SENSOR;
-        snprintf(dev.name, sizeof(dev.name), FMT_HUMIDITY_SENSOR_NAME, settings.system.name, i, sensor_types[sensor_type]);
-        strncpy(dev.device_class, DEV_CLASS_HUMIDITY, sizeof(dev.device_class));
-        strncpy(dev.sensor.measurement_unit, DEV_MU_HUMIDITY, sizeof(dev.sensor.measurement_unit));
+        dev.info = device_info(DEV_CLASS_HUMIDITY, DEV_MU_HUMIDITY, FMT_HUMIDITY_SENSOR_NAME, i, sensor_types[sensor_type]);
         dev.sensor.precision = 2;
         dev.sensor.update_period = update_period;
-        cvector_push_back(self->devices, dev);
+        driver_add_device(self, &dev);
 
         memset(&dev, 0, sizeof(device_t));
         snprintf(dev.uid, sizeof(dev.uid), FMT_TEMPERATURE_SENSOR_ID, i);
         dev.type = DEV_SENSOR;
-        snprintf(dev.name, sizeof(dev.name), FMT_TEMPERATURE_SENSOR_NAME, settings.system.name, i, sensor_types[sensor_type]);
-        strncpy(dev.device_class, DEV_CLASS_TEMPERATURE, sizeof(dev.device_class));
-        strncpy(dev.sensor.measurement_unit, DEV_MU_TEMPERATURE, sizeof(dev.sensor.measurement_unit));
+        dev.info = device_info(DEV_CLASS_TEMPERATURE, DEV_MU_TEMPERATURE, FMT_TEMPERATURE_SENSOR_NAME, i, sensor_types[sensor_type]);
         dev.sensor.precision = 2;
         dev.sensor.update_period = update_period;
-        cvector_push_back(self->devices, dev);
+        driver_add_device(self, &dev);
 
         ESP_LOGI(self->name, "Initialized device %d: %s (ADDR=0x%02x, PORT=%d, SDA=%d, SCL=%d)",
             i, sensor_types[sensor_type], addr, HW_EXTERNAL_PORT, HW_EXTERNAL_SDA_GPIO, HW_EXTERNAL_SCL_GPIO);
@@ -144,77 +168,212 @@ static esp_err_t on_init(driver_t *self)
     return ESP_OK;
 }
 
-static void task(driver_t *self)
+static i2c_dev_t *sensor_i2c(handle_t *sensor)
+{
+    return sensor->type == SENSOR_SI7021 ? &sensor->dev.i2c_dev : &sensor->dev.aht.i2c_dev;
+}
+
+// Single transaction in own bus session, so conversions of other sensors overlap with it
+static esp_err_t transfer(i2c_dev_t *dev, const uint8_t *out, size_t out_len, uint8_t *in, size_t in_len)
+{
+    CHECK(i2c_bus_acquire(HW_EXTERNAL_PORT, I2C_BUS_PRIO_BULK, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS)));
+    esp_err_t r = i2c_dev_take_mutex(dev);
+    if (r == ESP_OK)
+    {
+        r = in ? i2c_dev_read(dev, NULL, 0, in, in_len) : i2c_dev_write(dev, NULL, 0, out, out_len);
+        i2c_dev_give_mutex(dev);
+    }
+    i2c_bus_release(HW_EXTERNAL_PORT);
+
+    return r;
+}
+
+static esp_err_t trigger(handle_t *sensor, stage_t stage)
+{
+    static const uint8_t aht_cmd[] = { 0xac, 0x33, 0x00 };
+    uint8_t cmd;
+    int conv_ms;
+
+    switch (stage)
+    {
+        case STAGE_SI7021_T:
+            cmd = SI7021_CMD_MEASURE_T;
+            conv_ms = SI7021_CONV_T_MS;
+            CHECK(transfer(sensor_i2c(sensor), &cmd, 1, NULL, 0));
+            break;
+        case STAGE_SI7021_RH:
+            cmd = SI7021_CMD_MEASURE_RH;
+            conv_ms = SI7021_CONV_RH_MS;
+            CHECK(transfer(sensor_i2c(sensor), &cmd, 1, NULL, 0));
+            break;
+        default:
+            conv_ms = AHT_CONV_MS;
+            CHECK(transfer(sensor_i2c(sensor), aht_cmd, sizeof(aht_cmd), NULL, 0));
+    }
+    sensor->stage = stage;
+    sensor->started = esp_timer_get_time();
+    sensor->ready_at = sensor->started + conv_ms * 1000;
+
+    return ESP_OK;
+}
+
+// Read result of current stage, ESP_ERR_NOT_FINISHED if sensor is still converting
+static esp_err_t collect(handle_t *sensor)
+{
+    uint8_t buf[6];
+    esp_err_t r;
+
+    if (sensor->stage == STAGE_AHT)
+    {
+        CHECK(transfer(sensor_i2c(sensor), NULL, 0, buf, 6));
+        if (buf[0] & AHT_STATUS_BUSY)
+            return ESP_ERR_NOT_FINISHED;
+        uint32_t raw_rh = ((uint32_t)buf[1] << 12) | ((uint32_t)buf[2] << 4) | (buf[3] >> 4);
+        uint32_t raw_t = ((uint32_t)(buf[3] & 0x0f) << 16) | ((uint32_t)buf[4] << 8) | buf[5];
+        sensor->rh = (float)raw_rh * 100.0f / 1048576.0f;
+        sensor->t = (float)raw_t * 200.0f / 1048576.0f - 50.0f;
+        return ESP_OK;
+    }
+
+    // Si70xx NACKs reads until conversion is done
+    r = transfer(sensor_i2c(sensor), NULL, 0, buf, 2);
+    if (r != ESP_OK)
+        return esp_timer_get_time() - sensor->started < CONV_TIMEOUT_MS * 1000 ? ESP_ERR_NOT_FINISHED : r;
+    uint16_t raw = (((uint16_t)buf[0] << 8) | buf[1]) & 0xfffc;
+    if (sensor->stage == STAGE_SI7021_T)
+        sensor->t = 175.72f * (float)raw / 65536.0f - 46.85f;
+    else
+        sensor->rh = 125.0f * (float)raw / 65536.0f - 6.0f;
+
+    return ESP_OK;
+}
+
+static inline stage_t first_stage(handle_t *sensor)
+{
+    return sensor->type == SENSOR_SI7021 ? STAGE_SI7021_T : STAGE_AHT;
+}
+
+// Start next sample, returns false when sensor is done for this period
+static bool next_sample(driver_t *self, size_t i)
+{
+    handle_t *sensor = &sensors[i];
+    while (sensor->attempts < samples)
+    {
+        sensor->attempts++;
+        esp_err_t r = trigger(sensor, first_stage(sensor));
+        if (r == ESP_OK)
+            return true;
+        ESP_LOGW(self->name, "Error starting measurement with %s device %d: %d (%s)",
+            sensor_types[sensor->type], i, r, esp_err_to_name(r));
+    }
+    return false;
+}
+
+// Handle ready sensor, returns false when sensor is done for this period
+static bool step(driver_t *self, size_t i)
 {
-    TickType_t period = pdMS_TO_TICKS(update_period);
+    handle_t *sensor = &sensors[i];
 
-    while (true)
+    esp_err_t r = collect(sensor);
+    if (r == ESP_ERR_NOT_FINISHED)
+    {
+        sensor->ready_at = esp_timer_get_time() + POLL_MS * 1000;
+        return true;
+    }
+    if (r != ESP_OK)
     {
-        TickType_t start = xTaskGetTickCount();
+        ESP_LOGW(self->name, "Error reading %s device %d: %d (%s)", sensor_types[sensor->type], i, r, esp_err_to_name(r));
+        return next_sample(self, i);
+    }
+
+    if (sensor->stage == STAGE_SI7021_T)
+    {
+        r = trigger(sensor, STAGE_SI7021_RH);
+        if (r == ESP_OK)
+            return true;
+        ESP_LOGW(self->name, "Error starting measurement with %s device %d: %d (%s)",
+            sensor_types[sensor->type], i, r, esp_err_to_name(r));
+        return next_sample(self, i);
+    }
 
-        for (size_t i = 0; i < cvector_size(sensors); i++)
+    if (sensor->t >= (float)threshold)
+        ESP_LOGW(self->name, "Bad temperature value: %.2f >= %d, dropping", sensor->t, threshold);
+    else
+    {
+        sensor->t_sum += sensor->t;
+        sensor->rh_sum += sensor->rh;
+        sensor->real_samples++;
+    }
+
+    return next_sample(self, i);
+}
+
+static void sample(driver_t *self)
+{
+    size_t count = cvector_size(sensors);
+    if (!count)
+        return;
+
+    if (!collecting)
+    {
+        // trigger conversions on all sensors first
+        for (size_t i = 0; i < count; i++)
         {
-            float t_sum = 0, rh_sum = 0;
-            int real_samples = 0;
-            for (int c = 0; c < samples; c++)
-            {
-                float t = 0, rh = 0;
-                esp_err_t r;
-
-                if (sensors[i].type == SENSOR_SI7021)
-                {
-                    r = si7021_measure_temperature(&sensors[i].dev.i2c_dev, &t);
-                    if (r != ESP_OK)
-                    {
-                        ESP_LOGW(self->name, "Error measuring temperature with Si70xx/HTU2xD device %d: %d (%s)", i, r, esp_err_to_name(r));
-                        continue;
-                    }
-                    r = si7021_measure_humidity(&sensors[i].dev.i2c_dev, &rh);
-                    if (r != ESP_OK)
-                    {
-                        ESP_LOGW(self->name, "Error measuring humidity with Si70xx/HTU2xD device %d: %d (%s)", i, r, esp_err_to_name(r));
-                        continue;
-                    }
-                }
-                else
-                {
-                    r = aht_get_data(&sensors[i].dev.aht, &t, &rh);
-                    if (r != ESP_OK)
-                    {
-                        ESP_LOGW(self->name, "Error reading AHTxx device %d: %d (%s)", i, r, esp_err_to_name(r));
-                        continue;
-                    }
-                }
-                if (t >= (float)threshold)
-                {
-                    ESP_LOGW(self->name, "Bad temperature value: %.2f >= %d, dropping", t, threshold);
-                    continue;
-                }
-                t_sum += t;
-                rh_sum += rh;
-                real_samples++;
-                vTaskDelay(1);
-            }
-
-            device_t *dev = &self->devices[i * 2];
-            dev->sensor.value = rh_sum / (float)real_samples;
-            driver_send_device_update(self, dev);
-            dev = &self->devices[i * 2 + 1];
-            dev->sensor.value = t_sum / (float)real_samples;
-            driver_send_device_update(self, dev);
+            sensors[i].attempts = 0;
+            sensors[i].real_samples = 0;
+            sensors[i].t_sum = 0;
+            sensors[i].rh_sum = 0;
+            sensors[i].running = next_sample(self, i);
         }
+        collecting = true;
+    }
+    else
+    {
+        // then collect results in order of readiness
+        int64_t now = esp_timer_get_time();
+        for (size_t i = 0; i < count; i++)
+            if (sensors[i].running && sensors[i].ready_at <= now)
+                sensors[i].running = step(self, i);
+    }
+
+    if (driver_stop_requested(self))
+    {
+        collecting = false;
+        return;
+    }
 
-        while (xTaskGetTickCount() - start < period)
+    int64_t next = INT64_MAX;
+    for (size_t i = 0; i < count; i++)
+        if (sensors[i].running && sensors[i].ready_at < next)
+            next = sensors[i].ready_at;
+    if (next != INT64_MAX)
+    {
+        // wait for the nearest conversion without blocking the worker
+        int64_t wait = next - esp_timer_get_time();
+        driver_sample_after(self, wait > 0 ? (uint32_t)((wait + 999) / 1000) : 0);
+        return;
+    }
+    collecting = false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!sensors[i].real_samples)
         {
-            if (!(xEventGroupGetBits(self->eg) & DRIVER_BIT_START))
-                return;
-            vTaskDelay(1);
+            ESP_LOGE(self->name, "No valid samples from %s device %d", sensor_types[sensors[i].type], i);
+            continue;
         }
+        device_t *dev = &self->devices[i * 2];
+        dev->sensor.value = sensors[i].rh_sum / (float)sensors[i].real_samples;
+        driver_send_device_update(self, dev);
+        dev = &self->devices[i * 2 + 1];
+        dev->sensor.value = sensors[i].t_sum / (float)sensors[i].real_samples;
+        driver_send_device_update(self, dev);
     }
 }
 
 static esp_err_t on_stop(driver_t *self)
 {
+    collecting = false;
     for (size_t i = 0; i < cvector_size(sensors); i++)
     {
         esp_err_t r;
@@ -239,8 +398,10 @@ driver_t drv_rht = {
     .config = NULL,
     .state = DRIVER_NEW,
     .event_queue = NULL,
+    .update_queue = NULL,
 
     .devices = NULL,
+    .lock = NULL,
     .handle = NULL,
     .eg = NULL,
 
@@ -248,7 +409,8 @@ driver_t drv_rht = {
     .on_start = NULL,
     .on_stop = on_stop,
 
-    .task = task
+    .task = NULL,
+    .sample = sample
 };
 
 #endif
@@ -0,0 +1,213 @@
+#include "filter.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "common.h"
+
+#define Q15_ONE (1 << 15)
+#define Q30_ONE (1 << 30)
+
+static inline int32_t div_round(int64_t a, int64_t b)
+{
+    return (int32_t)((a >= 0 ? a + b / 2 : a - b / 2) / b);
+}
+
+static inline int32_t to_q30(double v)
+{
+    return (int32_t)lround(v * Q30_ONE);
+}
+
+static void init_lowpass(filter_t *f, float cutoff)
+{
+    // RBJ cookbook low-pass, Q = 1/sqrt(2)
+    double w0 = 2.0 * M_PI * cutoff;
+    double cw = cos(w0);
+    double alpha = sin(w0) / M_SQRT2;
+    double a0 = 1.0 + alpha;
+
+    f->iir.b0 = to_q30((1.0 - cw) / 2.0 / a0);
+    f->iir.b2 = f->iir.b0;
+    f->iir.a1 = to_q30(-2.0 * cw / a0);
+    f->iir.a2 = to_q30((1.0 - alpha) / a0);
+    // keep DC gain exactly 1 after rounding: b0 + b1 + b2 == 1 + a1 + a2
+    f->iir.b1 = (int32_t)((int64_t)Q30_ONE + f->iir.a1 + f->iir.a2 - f->iir.b0 - f->iir.b2);
+}
+
+esp_err_t filter_init(filter_t *f, const filter_config_t *cfg)
+{
+    CHECK_ARG(f && cfg);
+
+    memset(f, 0, sizeof(filter_t));
+    f->type = cfg->type;
+
+    switch (cfg->type)
+    {
+        case FILTER_NONE:
+            break;
+        case FILTER_AVERAGE:
+        case FILTER_MEDIAN:
+            CHECK_ARG(cfg->window >= 1 && cfg->window <= FILTER_MAX_WINDOW);
+            f->win.size = cfg->window;
+            f->win.ring = malloc(sizeof(int32_t) * cfg->window * (cfg->type == FILTER_MEDIAN ? 2 : 1));
+            if (!f->win.ring)
+                return ESP_ERR_NO_MEM;
+            if (cfg->type == FILTER_MEDIAN)
+                f->win.sorted = f->win.ring + cfg->window;
+            break;
+        case FILTER_EMA:
+            CHECK_ARG(cfg->alpha > 0 && cfg->alpha <= 1.0f);
+            f->ema.alpha = (int32_t)lroundf(cfg->alpha * Q15_ONE);
+            if (!f->ema.alpha)
+                f->ema.alpha = 1;
+            break;
+        case FILTER_LOWPASS:
+            CHECK_ARG(cfg->cutoff > 0 && cfg->cutoff < 0.5f);
+            init_lowpass(f, cfg->cutoff);
+            break;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t filter_free(filter_t *f)
+{
+    CHECK_ARG(f);
+
+    if (f->type == FILTER_AVERAGE || f->type == FILTER_MEDIAN)
+        free(f->win.ring);
+    memset(f, 0, sizeof(filter_t));
+
+    return ESP_OK;
+}
+
+void filter_reset(filter_t *f)
+{
+    f->primed = false;
+    if (f->type == FILTER_AVERAGE || f->type == FILTER_MEDIAN)
+    {
+        f->win.pos = 0;
+        f->win.count = 0;
+        f->win.sum = 0;
+    }
+}
+
+static inline int32_t apply_average(filter_t *f, int32_t x)
+{
+    if (f->win.count == f->win.size)
+        f->win.sum -= f->win.ring[f->win.pos];
+    else
+        f->win.count++;
+    f->win.ring[f->win.pos] = x;
+    f->win.sum += x;
+    if (++f->win.pos == f->win.size)
+        f->win.pos = 0;
+
+    return div_round(f->win.sum, f->win.count);
+}
+
+static inline int32_t apply_median(filter_t *f, int32_t x)
+{
+    int32_t *s = f->win.sorted;
+    size_t n = f->win.count;
+
+    // drop the oldest sample from the sorted window
+    if (n == f->win.size)
+    {
+        int32_t old = f->win.ring[f->win.pos];
+        size_t i = 0;
+        while (s[i] != old)
+            i++;
+        memmove(&s[i], &s[i + 1], (n - i - 1) * sizeof(int32_t));
+        n--;
+    }
+
+    // insert the new one
+    size_t i = n;
+    while (i && s[i - 1] > x)
+    {
+        s[i] = s[i - 1];
+        i--;
+    }
+    s[i] = x;
+    f->win.count = ++n;
+
+    f->win.ring[f->win.pos] = x;
+    if (++f->win.pos == f->win.size)
+        f->win.pos = 0;
+
+    return n & 1 ? s[n / 2] : div_round((int64_t)s[n / 2 - 1] + s[n / 2], 2);
+}
+
+static inline void prime(filter_t *f, int32_t x)
+{
+    f->primed = true;
+    if (f->type == FILTER_EMA)
+        f->ema.y = x;
+    else if (f->type == FILTER_LOWPASS)
+        f->iir.x1 = f->iir.x2 = f->iir.y1 = f->iir.y2 = x;
+}
+
+int32_t filter_apply(filter_t *f, int32_t x)
+{
+    filter_apply_block(f, &x, 1);
+    return x;
+}
+
+void filter_apply_block(filter_t *f, int32_t *data, size_t len)
+{
+    if (!len)
+        return;
+    if (!f->primed)
+        prime(f, data[0]);
+
+    switch (f->type)
+    {
+        case FILTER_AVERAGE:
+            for (size_t i = 0; i < len; i++)
+                data[i] = apply_average(f, data[i]);
+            break;
+        case FILTER_MEDIAN:
+            for (size_t i = 0; i < len; i++)
+                data[i] = apply_median(f, data[i]);
+            break;
+        case FILTER_EMA:
+        {
+            // keep state in registers for the whole block
+            int32_t y = f->ema.y;
+            const int32_t alpha = f->ema.alpha;
+            for (size_t i = 0; i < len; i++)
+            {
+                y += (int32_t)(((int64_t)alpha * (data[i] - y) + (Q15_ONE >> 1)) >> 15);
+                data[i] = y;
+            }
+            f->ema.y = y;
+            break;
+        }
+        case FILTER_LOWPASS:
+        {
+            const int32_t b0 = f->iir.b0, b1 = f->iir.b1, b2 = f->iir.b2, a1 = f->iir.a1, a2 = f->iir.a2;
+            int32_t x1 = f->iir.x1, x2 = f->iir.x2, y1 = f->iir.y1, y2 = f->iir.y2;
+            for (size_t i = 0; i < len; i++)
+            {
+                int32_t x = data[i];
+                int64_t acc = (int64_t)b0 * x + (int64_t)b1 * x1 + (int64_t)b2 * x2
+                    - (int64_t)a1 * y1 - (int64_t)a2 * y2;
+                int32_t y = (int32_t)((acc + (Q30_ONE >> 1)) >> 30);
+                x2 = x1;
+                x1 = x;
+                y2 = y1;
+                y1 = y;
+                data[i] = y;
+            }
+            f->iir.x1 = x1;
+            f->iir.x2 = x2;
+            f->iir.y1 = y1;
+            f->iir.y2 = y2;
+            break;
+        }
+        default:
+            break;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef ESP_IOT_NODE_PLUS_FILTER_H_
+#define ESP_IOT_NODE_PLUS_FILTER_H_
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILTER_MAX_WINDOW 32
+
+/*
+ * Fixed-point filters of sample streams. Samples are int32, callers keep
+ * their magnitude below 2^24 (e.g. 12-bit ADC code << 8) to leave headroom
+ * for Q15 / Q30 arithmetic. EMA and low-pass start from the first sample
+ * to avoid the start-up transient.
+ */
+typedef enum {
+    FILTER_NONE = 0,
+    FILTER_AVERAGE, // moving average of `window` samples
+    FILTER_MEDIAN,  // median of `window` samples, spike rejection
+    FILTER_EMA,     // exponential moving average
+    FILTER_LOWPASS, // 2nd order Butterworth low-pass
+} filter_type_t;
+
+typedef struct
+{
+    filter_type_t type;
+    size_t window; // average, median
+    float alpha;   // EMA, weight of a new sample, 0..1
+    float cutoff;  // low-pass, fraction of the sample rate, 0..0.5
+} filter_config_t;
+
+typedef struct
+{
+    filter_type_t type;
+    bool primed;
+    union {
+        struct {
+            int32_t *ring;
+            int32_t *sorted;
+            size_t size;
+            size_t pos;
+            size_t count;
+            int64_t sum;
+        } win;
+        struct {
+            int32_t alpha; // Q15
+            int32_t y;
+        } ema;
+        struct {
+            int32_t b0, b1, b2, a1, a2; // Q30
+            int32_t x1, x2, y1, y2;
+        } iir;
+    };
+} filter_t;
+
+esp_err_t filter_init(filter_t *f, const filter_config_t *cfg);
+esp_err_t filter_free(filter_t *f);
+void filter_reset(filter_t *f);
+
+int32_t filter_apply(filter_t *f, int32_t x);
+// Filter block of consecutive samples in place
+void filter_apply_block(filter_t *f, int32_t *data, size_t len);
+
+#endif // ESP_IOT_NODE_PLUS_FILTER_H_
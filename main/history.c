@@ -0,0 +1,510 @@
+#include "history.h"
+#include <math.h>
+#include <time.h>
+#include <freertos/semphr.h>
+#include "common.h"
+#include "system_clock.h"
+
+#define TIERS 3
+#define MAX_VALUES 3 // min, avg, max
+#define NO_BLOCK -1
+#define NO_WINDOW 0xff
+#define POINT_MAX_BITS (4 + 32 + MAX_VALUES * (2 + 5 + 5 + 32)) // worst case of a compressed point
+
+typedef struct
+{
+    uint32_t step;      // s, 0 - raw samples
+    uint32_t retention; // s
+} tier_config_t;
+
+static const tier_config_t tier_configs[TIERS] = {
+    { 0, 60 * 60 },
+    { 60, 24 * 60 * 60 },
+    { 15 * 60, 7 * 24 * 60 * 60 },
+};
+
+typedef struct
+{
+    int16_t next;    // next block of the tier
+    uint16_t count;  // points
+    uint16_t bits;   // used bits of data
+    uint32_t serial; // allocation order
+    uint32_t first;  // time of the first point
+    uint32_t last;   // time of the last point
+    uint8_t data[HISTORY_BLOCK_SIZE];
+} block_t;
+
+// Gorilla encoder or decoder state
+typedef struct
+{
+    uint32_t time;
+    int32_t delta;
+    uint32_t value[MAX_VALUES];
+    uint8_t leading[MAX_VALUES];
+    uint8_t trailing[MAX_VALUES];
+} codec_t;
+
+// Open bucket of a rollup tier
+typedef struct
+{
+    uint32_t bucket; // start time
+    uint32_t count;
+    float min;
+    float max;
+    float sum;
+} rollup_t;
+
+typedef struct
+{
+    int16_t first;
+    int16_t last;
+    uint16_t blocks;
+    codec_t codec;
+    rollup_t rollup;
+} tier_t;
+
+typedef struct
+{
+    char uid[DEVICE_UID_SIZE];
+    tier_t tiers[TIERS];
+} series_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    size_t pos; // bits
+} reader_t;
+
+static SemaphoreHandle_t lock = NULL;
+static block_t *pool = NULL;
+static int16_t free_list = NO_BLOCK;
+static uint32_t serial = 0;
+static series_t series[HISTORY_MAX_SERIES];
+static size_t series_count = 0;
+
+static inline size_t tier_values(size_t tier)
+{
+    return tier_configs[tier].step ? MAX_VALUES : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Compression
+
+static void put_bits(block_t *b, uint32_t value, int n)
+{
+    while (n--)
+    {
+        if ((value >> n) & 1)
+            b->data[b->bits >> 3] |= 0x80 >> (b->bits & 7);
+        b->bits++;
+    }
+}
+
+static uint32_t get_bits(reader_t *r, int n)
+{
+    uint32_t value = 0;
+    while (n--)
+    {
+        value = (value << 1) | ((r->data[r->pos >> 3] >> (7 - (r->pos & 7))) & 1);
+        r->pos++;
+    }
+    return value;
+}
+
+static void encode_time(block_t *b, codec_t *c, uint32_t time)
+{
+    int32_t delta = (int32_t)(time - c->time);
+    int32_t dod = delta - c->delta;
+    if (!dod)
+        put_bits(b, 0, 1);
+    else if (dod >= -63 && dod <= 64)
+    {
+        put_bits(b, 0x2, 2);
+        put_bits(b, dod + 63, 7);
+    }
+    else if (dod >= -255 && dod <= 256)
+    {
+        put_bits(b, 0x6, 3);
+        put_bits(b, dod + 255, 9);
+    }
+    else if (dod >= -2047 && dod <= 2048)
+    {
+        put_bits(b, 0xe, 4);
+        put_bits(b, dod + 2047, 12);
+    }
+    else
+    {
+        put_bits(b, 0xf, 4);
+        put_bits(b, (uint32_t)dod, 32);
+    }
+    c->time = time;
+    c->delta = delta;
+}
+
+static uint32_t decode_time(reader_t *r, codec_t *c)
+{
+    int32_t dod;
+    if (!get_bits(r, 1))
+        dod = 0;
+    else if (!get_bits(r, 1))
+        dod = (int32_t)get_bits(r, 7) - 63;
+    else if (!get_bits(r, 1))
+        dod = (int32_t)get_bits(r, 9) - 255;
+    else if (!get_bits(r, 1))
+        dod = (int32_t)get_bits(r, 12) - 2047;
+    else
+        dod = (int32_t)get_bits(r, 32);
+    c->delta += dod;
+    c->time += c->delta;
+    return c->time;
+}
+
+static void encode_value(block_t *b, codec_t *c, size_t i, float value)
+{
+    uint32_t v;
+    memcpy(&v, &value, sizeof(v));
+    uint32_t x = v ^ c->value[i];
+    c->value[i] = v;
+    if (!x)
+    {
+        put_bits(b, 0, 1);
+        return;
+    }
+
+    int leading = __builtin_clz(x);
+    int trailing = __builtin_ctz(x);
+    if (c->leading[i] != NO_WINDOW && leading >= c->leading[i] && trailing >= c->trailing[i])
+    {
+        // meaningful bits fit into the previous window
+        put_bits(b, 0x2, 2);
+        put_bits(b, x >> c->trailing[i], 32 - c->leading[i] - c->trailing[i]);
+        return;
+    }
+    put_bits(b, 0x3, 2);
+    put_bits(b, leading, 5);
+    put_bits(b, 31 - leading - trailing, 5); // length - 1
+    put_bits(b, x >> trailing, 32 - leading - trailing);
+    c->leading[i] = leading;
+    c->trailing[i] = trailing;
+}
+
+static float decode_value(reader_t *r, codec_t *c, size_t i)
+{
+    if (get_bits(r, 1))
+    {
+        if (get_bits(r, 1))
+        {
+            c->leading[i] = get_bits(r, 5);
+            c->trailing[i] = 32 - c->leading[i] - (get_bits(r, 5) + 1);
+        }
+        c->value[i] ^= get_bits(r, 32 - c->leading[i] - c->trailing[i]) << c->trailing[i];
+    }
+    float value;
+    memcpy(&value, &c->value[i], sizeof(value));
+    return value;
+}
+
+static void encode_point(block_t *b, codec_t *c, uint32_t time, const float *values, size_t n)
+{
+    if (!b->count)
+    {
+        // block starts with uncompressed point, so it can be decoded alone
+        put_bits(b, time, 32);
+        c->time = time;
+        c->delta = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            memcpy(&c->value[i], &values[i], sizeof(uint32_t));
+            put_bits(b, c->value[i], 32);
+            c->leading[i] = NO_WINDOW;
+        }
+        b->first = time;
+    }
+    else
+    {
+        encode_time(b, c, time);
+        for (size_t i = 0; i < n; i++)
+            encode_value(b, c, i, values[i]);
+    }
+    b->last = time;
+    b->count++;
+}
+
+static uint32_t decode_point(reader_t *r, codec_t *c, bool first, float *values, size_t n)
+{
+    if (!first)
+    {
+        uint32_t time = decode_time(r, c);
+        for (size_t i = 0; i < n; i++)
+            values[i] = decode_value(r, c, i);
+        return time;
+    }
+
+    c->time = get_bits(r, 32);
+    c->delta = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        c->value[i] = get_bits(r, 32);
+        memcpy(&values[i], &c->value[i], sizeof(float));
+    }
+    return c->time;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+/// Storage
+
+static void drop_first_block(tier_t *t)
+{
+    int16_t b = t->first;
+    t->first = pool[b].next;
+    if (t->first == NO_BLOCK)
+        t->last = NO_BLOCK;
+    t->blocks--;
+    pool[b].next = free_list;
+    free_list = b;
+}
+
+static block_t *new_block(tier_t *t, size_t tier, uint32_t now)
+{
+    while (t->first != NO_BLOCK && pool[t->first].last + tier_configs[tier].retention < now)
+        drop_first_block(t);
+
+    if (free_list == NO_BLOCK)
+    {
+        // pool is exhausted, take the oldest block of the longest tier,
+        // finer tiers count more, so raw samples are given up first.
+        // Open blocks of other tiers are kept
+        tier_t *victim = NULL;
+        size_t max_score = 0;
+        for (size_t s = 0; s < series_count; s++)
+            for (size_t k = 0; k < TIERS; k++)
+            {
+                tier_t *c = &series[s].tiers[k];
+                size_t score = (size_t)c->blocks << (TIERS - 1 - k);
+                if (c->blocks && (c == t || c->blocks > 1) && score > max_score)
+                {
+                    max_score = score;
+                    victim = c;
+                }
+            }
+        if (!victim)
+            return NULL;
+        drop_first_block(victim);
+    }
+
+    int16_t b = free_list;
+    free_list = pool[b].next;
+    memset(&pool[b], 0, sizeof(block_t));
+    pool[b].next = NO_BLOCK;
+    pool[b].serial = ++serial;
+
+    if (t->last != NO_BLOCK)
+        pool[t->last].next = b;
+    else
+        t->first = b;
+    t->last = b;
+    t->blocks++;
+    return &pool[b];
+}
+
+static void append_point(tier_t *t, size_t tier, uint32_t time, const float *values)
+{
+    block_t *b = t->last != NO_BLOCK ? &pool[t->last] : NULL;
+    if (!b || b->bits + POINT_MAX_BITS > HISTORY_BLOCK_SIZE * 8)
+        b = new_block(t, tier, time);
+    if (b)
+        encode_point(b, &t->codec, time, values, tier_values(tier));
+}
+
+static void append_rollup(tier_t *t, size_t tier, uint32_t time, float value)
+{
+    rollup_t *r = &t->rollup;
+    uint32_t bucket = time - time % tier_configs[tier].step;
+    if (r->count && bucket != r->bucket)
+    {
+        float values[MAX_VALUES] = { r->min, r->sum / (float)r->count, r->max };
+        append_point(t, tier, r->bucket, values);
+        r->count = 0;
+    }
+    if (!r->count)
+    {
+        r->bucket = bucket;
+        r->min = r->max = value;
+        r->sum = 0;
+    }
+    if (value < r->min)
+        r->min = value;
+    if (value > r->max)
+        r->max = value;
+    r->sum += value;
+    r->count++;
+}
+
+static series_t *find_series(const char *uid, bool create)
+{
+    for (size_t s = 0; s < series_count; s++)
+        if (!strcmp(series[s].uid, uid))
+            return &series[s];
+
+    if (!create || series_count >= HISTORY_MAX_SERIES)
+        return NULL;
+
+    series_t *s = &series[series_count++];
+    memset(s, 0, sizeof(series_t));
+    strncpy(s->uid, uid, sizeof(s->uid) - 1);
+    for (size_t k = 0; k < TIERS; k++)
+        s->tiers[k].first = s->tiers[k].last = NO_BLOCK;
+    return s;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t history_init()
+{
+    lock = xSemaphoreCreateMutex();
+    pool = malloc(sizeof(block_t) * HISTORY_BLOCKS);
+    if (!lock || !pool)
+    {
+        ESP_LOGE(TAG, "Not enough memory for history");
+        free(pool);
+        pool = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int16_t i = 0; i < HISTORY_BLOCKS; i++)
+        pool[i].next = i + 1 < HISTORY_BLOCKS ? i + 1 : NO_BLOCK;
+    free_list = 0;
+
+    ESP_LOGI(TAG, "History: %u blocks, %u bytes", HISTORY_BLOCKS, sizeof(block_t) * HISTORY_BLOCKS);
+    return ESP_OK;
+}
+
+void history_append(const device_t *dev)
+{
+    if (!pool || dev->type != DEV_SENSOR || !isfinite(dev->sensor.value) || !system_clock_is_set())
+        return;
+
+    uint32_t time = (uint32_t)device_update_time(dev);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    series_t *s = find_series(dev->uid, true);
+    if (s)
+    {
+        append_point(&s->tiers[0], 0, time, &dev->sensor.value);
+        for (size_t k = 1; k < TIERS; k++)
+            append_rollup(&s->tiers[k], k, time, dev->sensor.value);
+    }
+    xSemaphoreGive(lock);
+}
+
+static int format_point(char *buf, size_t size, bool first, uint32_t time, const float *values, size_t n)
+{
+    int len = snprintf(buf, size, "%s[%" PRIu32, first ? "" : ",", time);
+    for (size_t i = 0; i < n; i++)
+        len += snprintf(buf + len, size - len, ",%.6g", values[i]);
+    len += snprintf(buf + len, size - len, "]");
+    return len;
+}
+
+esp_err_t history_query(const char *uid, uint32_t from, uint32_t to, history_write_cb_t write, void *ctx)
+{
+    if (!pool)
+        return ESP_ERR_INVALID_STATE;
+
+    // tiers are usually cut by the pool size before their retention,
+    // so the finest one is chosen by the data it actually holds
+    uint32_t now = (uint32_t)time(NULL);
+    size_t tier = TIERS - 1;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    series_t *s = find_series(uid, false);
+    if (s)
+    {
+        uint32_t oldest = now;
+        for (size_t k = TIERS; k-- > 0;)
+        {
+            tier_t *t = &s->tiers[k];
+            uint32_t start = t->first != NO_BLOCK ? pool[t->first].first : now;
+            if (start <= from || start < oldest)
+            {
+                tier = k;
+                oldest = start;
+            }
+        }
+    }
+    xSemaphoreGive(lock);
+    if (!s)
+        return ESP_ERR_NOT_FOUND;
+    tier_t *t = &s->tiers[tier];
+    size_t n = tier_values(tier);
+
+    esp_err_t res = ESP_OK;
+    block_t *b = malloc(sizeof(block_t));
+    char *buf = malloc(HISTORY_CHUNK_SIZE);
+    if (!b || !buf)
+    {
+        res = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+
+    size_t len = snprintf(buf, HISTORY_CHUNK_SIZE, "{\"uid\":\"%s\",\"step\":%" PRIu32 ",\"points\":[",
+        s->uid, tier_configs[tier].step);
+    bool first = true;
+    uint32_t last_serial = 0;
+    float values[MAX_VALUES];
+    while (true)
+    {
+        // copy the next block, so lock is not held while sending
+        bool found = false;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        for (int16_t i = t->first; i != NO_BLOCK && !found; i = pool[i].next)
+            if (pool[i].serial > last_serial && pool[i].last >= from)
+            {
+                memcpy(b, &pool[i], sizeof(block_t));
+                found = true;
+            }
+        xSemaphoreGive(lock);
+        if (!found || b->first > to)
+            break;
+        last_serial = b->serial;
+
+        reader_t r = { .data = b->data, .pos = 0 };
+        codec_t c;
+        for (uint16_t p = 0; p < b->count; p++)
+        {
+            uint32_t time = decode_point(&r, &c, !p, values, n);
+            if (time < from || time > to)
+                continue;
+            len += format_point(buf + len, HISTORY_CHUNK_SIZE - len, first, time, values, n);
+            first = false;
+            if (len + 128 > HISTORY_CHUNK_SIZE)
+            {
+                res = write(buf, len, ctx);
+                if (res != ESP_OK)
+                    goto exit;
+                len = 0;
+            }
+        }
+    }
+
+    if (tier)
+    {
+        // bucket in progress
+        xSemaphoreTake(lock, portMAX_DELAY);
+        rollup_t r = t->rollup;
+        xSemaphoreGive(lock);
+        if (r.count && r.bucket >= from && r.bucket <= to)
+        {
+            values[0] = r.min;
+            values[1] = r.sum / (float)r.count;
+            values[2] = r.max;
+            len += format_point(buf + len, HISTORY_CHUNK_SIZE - len, first, r.bucket, values, n);
+        }
+    }
+    len += snprintf(buf + len, HISTORY_CHUNK_SIZE - len, "]}");
+    res = write(buf, len, ctx);
+
+exit:
+    free(b);
+    free(buf);
+    return res;
+}
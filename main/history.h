@@ -0,0 +1,48 @@
+#ifndef ESP_IOT_NODE_PLUS_HISTORY_H_
+#define ESP_IOT_NODE_PLUS_HISTORY_H_
+
+#include <stdint.h>
+#include <esp_err.h>
+#include "device.h"
+
+/*
+ * In-memory time series of sensor values, available when network is down.
+ *
+ * Every sensor gets three tiers, kept at most for:
+ *   raw samples, 1 hour,
+ *   1 minute min/avg/max, 24 hours,
+ *   15 minutes min/avg/max, 7 days.
+ * Rollups are updated on each sample. Points are compressed Gorilla-style
+ * (delta-of-delta timestamps, XOR of floats) into blocks of a shared pool,
+ * when the pool is exhausted the oldest block of the longest tier is reused,
+ * raw samples are given up first.
+ *
+ * The pool is much smaller than the limits above. A sensor sampled every 10 s
+ * fills about 5 blocks with an hour of raw samples, 38 blocks with a day of
+ * 1 minute rollups and 4 blocks per day of 15 minute rollups, so the default
+ * HISTORY_BLOCKS hold the full tiers of a single sensor. Real retention with
+ * 10 s sampling:
+ *   sensors  raw     1 minute  15 minutes
+ *   1        1 h     24 h      7 d
+ *   4        40 min  4 h       3.5 d
+ *   8        10 min  2 h       1.8 d
+ *   16       5 min   40 min    13 h
+ * Queries use the finest tier which holds data of `from`.
+ *
+ * Query result, `step` is 0 for raw samples:
+ * {"uid":"dht0_t","step":60,"points":[[1760000000,21.1,21.3,21.5],...]}
+ */
+
+// Called with consecutive parts of query result
+typedef esp_err_t (*history_write_cb_t)(const char *data, size_t len, void *ctx);
+
+esp_err_t history_init();
+
+// New sensor value, ignored until the clock is set
+void history_append(const device_t *dev);
+
+// Stream points of [from, to] unix time range from the finest tier holding `from`, or the one reaching furthest back.
+// Returns ESP_ERR_NOT_FOUND before writing anything if there is no such series
+esp_err_t history_query(const char *uid, uint32_t from, uint32_t to, history_write_cb_t write, void *ctx);
+
+#endif // ESP_IOT_NODE_PLUS_HISTORY_H_
@@ -4,6 +4,7 @@
 #include "common.h"
 #include <sys/time.h>
 #include <ds3231.h>
+#include "i2c_bus.h"
 
 static i2c_dev_t dev = { 0 };
 
@@ -11,7 +12,11 @@ static inline esp_err_t hw_rtc_get_time(struct tm *time)
 {
     CHECK_ARG(time);
 
-    return ds3231_get_time(&dev, time);
+    CHECK(i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_NORMAL, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS)));
+    esp_err_t r = ds3231_get_time(&dev, time);
+    i2c_bus_release(HW_INTERNAL_PORT);
+
+    return r;
 }
 
 static inline esp_err_t hw_rtc_init(struct tm *time)
@@ -25,7 +30,11 @@ static inline esp_err_t hw_rtc_set_time(const struct tm *time)
 {
     CHECK_ARG(time);
 
-    return ds3231_set_time(&dev, (struct tm *)time);
+    CHECK(i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_NORMAL, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS)));
+    esp_err_t r = ds3231_set_time(&dev, (struct tm *)time);
+    i2c_bus_release(HW_INTERNAL_PORT);
+
+    return r;
 }
 
 #endif /* __RTC_DS3231_H__ */
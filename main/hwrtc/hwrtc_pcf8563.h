@@ -4,6 +4,7 @@
 #include "common.h"
 #include <sys/time.h>
 #include <pcf8563.h>
+#include "i2c_bus.h"
 
 static i2c_dev_t dev = { 0 };
 
@@ -12,7 +13,10 @@ static esp_err_t hw_rtc_get_time(struct tm *time)
     CHECK_ARG(time);
 
     bool valid;
-    CHECK(pcf8563_get_time(&dev, time, &valid));
+    CHECK(i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_NORMAL, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS)));
+    esp_err_t r = pcf8563_get_time(&dev, time, &valid);
+    i2c_bus_release(HW_INTERNAL_PORT);
+    CHECK(r);
     if (!valid)
     {
         ESP_LOGW(TAG, "RTC time is invalid, please reset");
@@ -33,7 +37,11 @@ static inline esp_err_t hw_rtc_set_time(const struct tm *time)
 {
     CHECK_ARG(time);
 
-    return pcf8563_set_time(&dev, (struct tm *)time);
+    CHECK(i2c_bus_acquire(HW_INTERNAL_PORT, I2C_BUS_PRIO_NORMAL, pdMS_TO_TICKS(I2C_BUS_TIMEOUT_MS)));
+    esp_err_t r = pcf8563_set_time(&dev, (struct tm *)time);
+    i2c_bus_release(HW_INTERNAL_PORT);
+
+    return r;
 }
 
 #endif /* __RTC_PCF8574_H__ */
@@ -0,0 +1,125 @@
+#include "i2c_bus.h"
+#include <esp_timer.h>
+#include "common.h"
+
+typedef struct
+{
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t grant[I2C_BUS_PRIO_COUNT]; // counting, one per waiter
+    size_t waiting[I2C_BUS_PRIO_COUNT];
+    bool busy;
+    int64_t held_since;
+    i2c_bus_stats_t stats;
+} bus_port_t;
+
+static bus_port_t ports[I2C_BUS_PORTS] = { 0 };
+
+esp_err_t i2c_bus_init()
+{
+    for (size_t p = 0; p < I2C_BUS_PORTS; p++)
+    {
+        ports[p].lock = xSemaphoreCreateMutex();
+        if (!ports[p].lock)
+            return ESP_ERR_NO_MEM;
+        for (size_t i = 0; i < I2C_BUS_PRIO_COUNT; i++)
+        {
+            ports[p].grant[i] = xSemaphoreCreateCounting(I2C_BUS_MAX_WAITERS, 0);
+            if (!ports[p].grant[i])
+                return ESP_ERR_NO_MEM;
+        }
+    }
+
+    return ESP_OK;
+}
+
+static void granted(bus_port_t *bp, i2c_bus_prio_t prio, int64_t start)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t wait = (uint32_t)(now - start);
+
+    bp->held_since = now;
+    bp->stats.sessions[prio]++;
+    bp->stats.total_wait_us[prio] += wait;
+    if (wait > bp->stats.max_wait_us[prio])
+        bp->stats.max_wait_us[prio] = wait;
+}
+
+esp_err_t i2c_bus_acquire(i2c_port_t port, i2c_bus_prio_t prio, TickType_t timeout)
+{
+    CHECK_ARG(port >= 0 && port < I2C_BUS_PORTS && prio < I2C_BUS_PRIO_COUNT);
+
+    bus_port_t *bp = &ports[port];
+    int64_t start = esp_timer_get_time();
+
+    xSemaphoreTake(bp->lock, portMAX_DELAY);
+    if (!bp->busy)
+    {
+        bp->busy = true;
+        granted(bp, prio, start);
+        xSemaphoreGive(bp->lock);
+        return ESP_OK;
+    }
+    bp->waiting[prio]++;
+    xSemaphoreGive(bp->lock);
+
+    if (xSemaphoreTake(bp->grant[prio], timeout) != pdTRUE)
+    {
+        xSemaphoreTake(bp->lock, portMAX_DELAY);
+        // port could be handed over right after the timeout
+        if (xSemaphoreTake(bp->grant[prio], 0) != pdTRUE)
+        {
+            bp->waiting[prio]--;
+            bp->stats.timeouts++;
+            xSemaphoreGive(bp->lock);
+            return ESP_ERR_TIMEOUT;
+        }
+        xSemaphoreGive(bp->lock);
+    }
+
+    // release() has kept the port busy for us
+    xSemaphoreTake(bp->lock, portMAX_DELAY);
+    granted(bp, prio, start);
+    xSemaphoreGive(bp->lock);
+
+    return ESP_OK;
+}
+
+void i2c_bus_release(i2c_port_t port)
+{
+    if (port < 0 || port >= I2C_BUS_PORTS)
+        return;
+
+    bus_port_t *bp = &ports[port];
+
+    xSemaphoreTake(bp->lock, portMAX_DELAY);
+
+    uint32_t hold = (uint32_t)(esp_timer_get_time() - bp->held_since);
+    bp->stats.busy_us += hold;
+    if (hold > bp->stats.max_hold_us)
+        bp->stats.max_hold_us = hold;
+
+    // hand the port over to the highest priority waiter
+    bp->busy = false;
+    for (int prio = I2C_BUS_PRIO_COUNT - 1; prio >= 0; prio--)
+        if (bp->waiting[prio])
+        {
+            bp->waiting[prio]--;
+            bp->busy = true;
+            xSemaphoreGive(bp->grant[prio]);
+            break;
+        }
+
+    xSemaphoreGive(bp->lock);
+}
+
+esp_err_t i2c_bus_get_stats(i2c_port_t port, i2c_bus_stats_t *stats)
+{
+    CHECK_ARG(port >= 0 && port < I2C_BUS_PORTS && stats);
+
+    bus_port_t *bp = &ports[port];
+    xSemaphoreTake(bp->lock, portMAX_DELAY);
+    *stats = bp->stats;
+    xSemaphoreGive(bp->lock);
+
+    return ESP_OK;
+}
@@ -0,0 +1,40 @@
+#ifndef ESP_IOT_NODE_PLUS_I2C_BUS_H_
+#define ESP_IOT_NODE_PLUS_I2C_BUS_H_
+
+#include <esp_err.h>
+#include <i2cdev.h>
+#include <freertos/FreeRTOS.h>
+
+/*
+ * Priority arbiter of shared I2C ports. A session groups back-to-back
+ * transactions of one driver, i2cdev still locks each transaction.
+ * When a session ends, the port is handed to the highest priority waiter,
+ * so interrupt driven I/O does not queue behind bulk sensor sampling.
+ * Bulk users should keep sessions to a single device operation.
+ */
+typedef enum {
+    I2C_BUS_PRIO_BULK = 0, // periodic sensor sampling
+    I2C_BUS_PRIO_NORMAL,   // configuration, RTC
+    I2C_BUS_PRIO_URGENT,   // relay writes, port change reads
+    I2C_BUS_PRIO_COUNT
+} i2c_bus_prio_t;
+
+typedef struct
+{
+    uint32_t sessions[I2C_BUS_PRIO_COUNT];
+    uint64_t total_wait_us[I2C_BUS_PRIO_COUNT];
+    uint32_t max_wait_us[I2C_BUS_PRIO_COUNT];
+    uint32_t timeouts;
+    uint64_t busy_us;      // total time the port was held
+    uint32_t max_hold_us;  // longest session
+} i2c_bus_stats_t;
+
+esp_err_t i2c_bus_init();
+
+// Returns ESP_ERR_TIMEOUT if port was not granted within `timeout`
+esp_err_t i2c_bus_acquire(i2c_port_t port, i2c_bus_prio_t prio, TickType_t timeout);
+void i2c_bus_release(i2c_port_t port);
+
+esp_err_t i2c_bus_get_stats(i2c_port_t port, i2c_bus_stats_t *stats);
+
+#endif // ESP_IOT_NODE_PLUS_I2C_BUS_H_
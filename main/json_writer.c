@@ -0,0 +1,203 @@
+#include "json_writer.h"
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static void put(json_writer_t *w, const char *data, size_t len)
+{
+    if (w->overflow || w->len + len >= w->size)
+    {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static inline void put_char(json_writer_t *w, char c)
+{
+    put(w, &c, 1);
+}
+
+static void put_tabs(json_writer_t *w, int count)
+{
+    for (int i = 0; i < count; i++)
+        put_char(w, '\t');
+}
+
+static void put_string(json_writer_t *w, const char *s)
+{
+    put_char(w, '"');
+    for (const char *p = s ? s : ""; *p; p++)
+    {
+        const char *esc = NULL;
+        switch (*p)
+        {
+            case '"': esc = "\\\""; break;
+            case '\\': esc = "\\\\"; break;
+            case '\b': esc = "\\b"; break;
+            case '\f': esc = "\\f"; break;
+            case '\n': esc = "\\n"; break;
+            case '\r': esc = "\\r"; break;
+            case '\t': esc = "\\t"; break;
+            default:
+                break;
+        }
+        if (esc)
+            put(w, esc, 2);
+        else if ((unsigned char)*p < 32)
+        {
+            char buf[8];
+            put(w, buf, snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)*p));
+        }
+        else
+            put_char(w, *p);
+    }
+    put_char(w, '"');
+}
+
+// Separator, indentation and key of the next value
+static void begin_value(json_writer_t *w, const char *key)
+{
+    if (!w->depth)
+        return;
+
+    bool array = w->stack[w->depth - 1].array;
+    if (!w->stack[w->depth - 1].empty)
+    {
+        put_char(w, ',');
+        if (w->formatted)
+            put_char(w, array ? ' ' : '\n');
+    }
+    w->stack[w->depth - 1].empty = false;
+    if (array)
+        return;
+
+    if (w->formatted)
+        put_tabs(w, w->depth);
+    put_string(w, key);
+    put_char(w, ':');
+    if (w->formatted)
+        put_char(w, '\t');
+}
+
+static void start(json_writer_t *w, const char *key, bool array)
+{
+    begin_value(w, key);
+    put_char(w, array ? '[' : '{');
+    if (w->depth == JSON_WRITER_MAX_DEPTH)
+    {
+        w->overflow = true;
+        return;
+    }
+    w->stack[w->depth].array = array;
+    w->stack[w->depth].empty = true;
+    w->depth++;
+    if (w->formatted && !array)
+        put_char(w, '\n');
+}
+
+static void end(json_writer_t *w, bool array)
+{
+    if (!w->depth || w->stack[w->depth - 1].array != array)
+    {
+        w->overflow = true;
+        return;
+    }
+    if (w->formatted && !array)
+    {
+        if (!w->stack[w->depth - 1].empty)
+            put_char(w, '\n');
+        put_tabs(w, w->depth - 1);
+    }
+    put_char(w, array ? ']' : '}');
+    w->depth--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size, bool formatted)
+{
+    memset(w, 0, sizeof(json_writer_t));
+    w->buf = buf;
+    w->size = size;
+    w->formatted = formatted;
+    if (size)
+        buf[0] = 0;
+}
+
+esp_err_t json_writer_finish(json_writer_t *w)
+{
+    if (w->size)
+        w->buf[w->len] = 0;
+    return w->overflow || w->depth ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+void json_object_start(json_writer_t *w, const char *key)
+{
+    start(w, key, false);
+}
+
+void json_object_end(json_writer_t *w)
+{
+    end(w, false);
+}
+
+void json_array_start(json_writer_t *w, const char *key)
+{
+    start(w, key, true);
+}
+
+void json_array_end(json_writer_t *w)
+{
+    end(w, true);
+}
+
+void json_add_string(json_writer_t *w, const char *key, const char *value)
+{
+    begin_value(w, key);
+    put_string(w, value);
+}
+
+void json_add_number(json_writer_t *w, const char *key, double value)
+{
+    begin_value(w, key);
+
+    if (isnan(value) || isinf(value))
+    {
+        put(w, "null", 4);
+        return;
+    }
+
+    // same as cJSON print_number()
+    int ivalue = value >= INT_MAX ? INT_MAX : value <= (double)INT_MIN ? INT_MIN : (int)value;
+    char buf[26];
+    int len;
+    if (value == (double)ivalue)
+        len = snprintf(buf, sizeof(buf), "%d", ivalue);
+    else
+    {
+        len = snprintf(buf, sizeof(buf), "%1.15g", value);
+        double test = 0;
+        if (sscanf(buf, "%lg", &test) != 1 || fabs(test - value) > fmax(fabs(test), fabs(value)) * DBL_EPSILON)
+            len = snprintf(buf, sizeof(buf), "%1.17g", value);
+    }
+    put(w, buf, len);
+}
+
+void json_add_bool(json_writer_t *w, const char *key, bool value)
+{
+    begin_value(w, key);
+    if (value)
+        put(w, "true", 4);
+    else
+        put(w, "false", 5);
+}
+
+void json_add_null(json_writer_t *w, const char *key)
+{
+    begin_value(w, key);
+    put(w, "null", 4);
+}
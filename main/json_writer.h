@@ -0,0 +1,43 @@
+#ifndef ESP_IOT_NODE_PLUS_JSON_WRITER_H_
+#define ESP_IOT_NODE_PLUS_JSON_WRITER_H_
+
+#include <esp_err.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define JSON_WRITER_MAX_DEPTH 8
+
+/*
+ * Streaming JSON writer into a fixed buffer, no allocations.
+ * Output is the same as cJSON_PrintUnformatted() / cJSON_Print() of the
+ * equivalent tree. `key` is ignored for array items and the root value.
+ */
+typedef struct
+{
+    char *buf;
+    size_t size;
+    size_t len;
+    bool formatted;
+    bool overflow;
+    int depth;
+    struct {
+        bool array;
+        bool empty;
+    } stack[JSON_WRITER_MAX_DEPTH];
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, char *buf, size_t size, bool formatted);
+// Returns ESP_ERR_NO_MEM if output was truncated
+esp_err_t json_writer_finish(json_writer_t *w);
+
+void json_object_start(json_writer_t *w, const char *key);
+void json_object_end(json_writer_t *w);
+void json_array_start(json_writer_t *w, const char *key);
+void json_array_end(json_writer_t *w);
+
+void json_add_string(json_writer_t *w, const char *key, const char *value);
+void json_add_number(json_writer_t *w, const char *key, double value);
+void json_add_bool(json_writer_t *w, const char *key, bool value);
+void json_add_null(json_writer_t *w, const char *key);
+
+#endif // ESP_IOT_NODE_PLUS_JSON_WRITER_H_
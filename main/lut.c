@@ -0,0 +1,219 @@
+#include "lut.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include "common.h"
+
+static int compare_points(const void *a, const void *b)
+{
+    float ca = ((const calibration_point_t *)a)->code;
+    float cb = ((const calibration_point_t *)b)->code;
+
+    return (ca > cb) - (ca < cb);
+}
+
+static void fill_linear(lut_t *lut, const calibration_point_t *p, size_t count)
+{
+    size_t k = 0;
+    for (size_t i = 0; i < lut->size; i++)
+    {
+        double x = lut->x0 + (double)i / lut->scale;
+        while (k < count - 2 && x > p[k + 1].code)
+            k++;
+        double t = (x - p[k].code) / (p[k + 1].code - p[k].code);
+        lut->table[i] = (float)(p[k].value + t * (p[k + 1].value - p[k].value));
+    }
+}
+
+static esp_err_t fill_cubic(lut_t *lut, const calibration_point_t *p, size_t count)
+{
+    // tangents and secants
+    double *m = malloc(sizeof(double) * count * 2);
+    if (!m)
+        return ESP_ERR_NO_MEM;
+    double *d = m + count;
+
+    for (size_t k = 0; k < count - 1; k++)
+        d[k] = (p[k + 1].value - p[k].value) / (p[k + 1].code - p[k].code);
+    m[0] = d[0];
+    m[count - 1] = d[count - 2];
+    for (size_t k = 1; k < count - 1; k++)
+        m[k] = d[k - 1] * d[k] <= 0 ? 0 : (d[k - 1] + d[k]) / 2;
+
+    // Fritsch-Carlson limits to keep the curve monotone between points
+    for (size_t k = 0; k < count - 1; k++)
+    {
+        if (d[k] == 0)
+        {
+            m[k] = m[k + 1] = 0;
+            continue;
+        }
+        double a = m[k] / d[k];
+        double b = m[k + 1] / d[k];
+        double s = a * a + b * b;
+        if (s > 9)
+        {
+            double t = 3 / sqrt(s);
+            m[k] = t * a * d[k];
+            m[k + 1] = t * b * d[k];
+        }
+    }
+
+    size_t k = 0;
+    for (size_t i = 0; i < lut->size; i++)
+    {
+        double x = lut->x0 + (double)i / lut->scale;
+        while (k < count - 2 && x > p[k + 1].code)
+            k++;
+        double h = p[k + 1].code - p[k].code;
+        double t = (x - p[k].code) / h;
+        double t2 = t * t;
+        double t3 = t2 * t;
+        lut->table[i] = (float)(
+            (2 * t3 - 3 * t2 + 1) * p[k].value +
+            (t3 - 2 * t2 + t) * h * m[k] +
+            (-2 * t3 + 3 * t2) * p[k + 1].value +
+            (t3 - t2) * h * m[k + 1]);
+    }
+
+    free(m);
+    return ESP_OK;
+}
+
+static esp_err_t fill_polynomial(lut_t *lut, const calibration_point_t *p, size_t count, int degree)
+{
+    if (degree < 1)
+        degree = 1;
+    if (degree > LUT_MAX_DEGREE)
+        degree = LUT_MAX_DEGREE;
+    if ((size_t)degree > count - 1)
+        degree = count - 1;
+    size_t n = degree + 1;
+
+    // normalize codes to [-1, 1] for conditioning
+    double mid = (p[0].code + p[count - 1].code) / 2.0;
+    double half = (p[count - 1].code - p[0].code) / 2.0;
+
+    // normal equations, augmented matrix
+    double a[LUT_MAX_DEGREE + 1][LUT_MAX_DEGREE + 2] = { 0 };
+    for (size_t k = 0; k < count; k++)
+    {
+        double u = (p[k].code - mid) / half;
+        double pw[2 * LUT_MAX_DEGREE + 1];
+        pw[0] = 1;
+        for (size_t j = 1; j < 2 * n - 1; j++)
+            pw[j] = pw[j - 1] * u;
+        for (size_t r = 0; r < n; r++)
+        {
+            for (size_t c = 0; c < n; c++)
+                a[r][c] += pw[r + c];
+            a[r][n] += pw[r] * p[k].value;
+        }
+    }
+
+    // Gaussian elimination with partial pivoting
+    for (size_t c = 0; c < n; c++)
+    {
+        size_t pivot = c;
+        for (size_t r = c + 1; r < n; r++)
+            if (fabs(a[r][c]) > fabs(a[pivot][c]))
+                pivot = r;
+        if (fabs(a[pivot][c]) < 1e-12)
+            return ESP_ERR_INVALID_ARG;
+        if (pivot != c)
+            for (size_t j = 0; j <= n; j++)
+            {
+                double tmp = a[c][j];
+                a[c][j] = a[pivot][j];
+                a[pivot][j] = tmp;
+            }
+        for (size_t r = 0; r < n; r++)
+        {
+            if (r == c)
+                continue;
+            double f = a[r][c] / a[c][c];
+            for (size_t j = c; j <= n; j++)
+                a[r][j] -= f * a[c][j];
+        }
+    }
+
+    for (size_t i = 0; i < lut->size; i++)
+    {
+        double u = (lut->x0 + (double)i / lut->scale - mid) / half;
+        double v = 0;
+        for (size_t c = n; c > 0; c--)
+            v = v * u + a[c - 1][n] / a[c - 1][c - 1];
+        lut->table[i] = (float)v;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t lut_init(lut_t *lut, const calibration_point_t *points, size_t count, lut_method_t method,
+    int degree, size_t size)
+{
+    CHECK_ARG(lut && points && count >= 2 && size >= 2);
+
+    memset(lut, 0, sizeof(lut_t));
+
+    calibration_point_t *p = malloc(sizeof(calibration_point_t) * count);
+    if (!p)
+        return ESP_ERR_NO_MEM;
+    memcpy(p, points, sizeof(calibration_point_t) * count);
+    qsort(p, count, sizeof(calibration_point_t), compare_points);
+
+    esp_err_t r = ESP_OK;
+    for (size_t k = 0; k < count - 1; k++)
+        if (p[k + 1].code == p[k].code)
+        {
+            r = ESP_ERR_INVALID_ARG;
+            goto exit;
+        }
+
+    lut->table = malloc(sizeof(float) * size);
+    if (!lut->table)
+    {
+        r = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    lut->size = size;
+    lut->x0 = p[0].code;
+    lut->scale = (float)(size - 1) / (p[count - 1].code - p[0].code);
+
+    switch (method)
+    {
+        case LUT_LINEAR:
+            fill_linear(lut, p, count);
+            break;
+        case LUT_CUBIC:
+            r = fill_cubic(lut, p, count);
+            break;
+        case LUT_POLYNOMIAL:
+            r = fill_polynomial(lut, p, count, degree);
+            break;
+        default:
+            r = ESP_ERR_INVALID_ARG;
+    }
+    if (r != ESP_OK)
+    {
+        lut_free(lut);
+        goto exit;
+    }
+
+    lut->lo_slope = lut->table[1] - lut->table[0];
+    lut->hi_slope = lut->table[size - 1] - lut->table[size - 2];
+
+exit:
+    free(p);
+    return r;
+}
+
+esp_err_t lut_free(lut_t *lut)
+{
+    CHECK_ARG(lut);
+
+    free(lut->table);
+    memset(lut, 0, sizeof(lut_t));
+
+    return ESP_OK;
+}
@@ -0,0 +1,56 @@
+#ifndef ESP_IOT_NODE_PLUS_LUT_H_
+#define ESP_IOT_NODE_PLUS_LUT_H_
+
+#include <esp_err.h>
+#include <stddef.h>
+#include <math.h>
+#include <calibration.h>
+
+#define LUT_MAX_DEGREE 5
+#define LUT_DEFAULT_DEGREE 2 // higher degrees oscillate between few calibration points
+
+/*
+ * Calibration curve compiled into a uniformly spaced table over the range
+ * of calibration points. Lookup cost does not depend on the number of points.
+ * Outside of the range values are extrapolated with the slope of the edge cells.
+ */
+typedef enum {
+    LUT_LINEAR = 0,  // piecewise linear, same as CALIBRATION_LINEAR
+    LUT_CUBIC,       // monotone cubic (Fritsch-Carlson), no overshoot between points
+    LUT_POLYNOMIAL,  // least squares polynomial fit
+} lut_method_t;
+
+typedef struct
+{
+    float x0;       // code of the first entry
+    float scale;    // entries per code unit
+    float lo_slope; // value per entry below the table
+    float hi_slope; // value per entry above the table
+    size_t size;
+    float *table;
+} lut_t;
+
+// `degree` is used by LUT_POLYNOMIAL only, clamped to number of points - 1
+esp_err_t lut_init(lut_t *lut, const calibration_point_t *points, size_t count, lut_method_t method,
+    int degree, size_t size);
+esp_err_t lut_free(lut_t *lut);
+
+static inline float lut_get(const lut_t *lut, float code)
+{
+    float pos = (code - lut->x0) * lut->scale;
+    size_t last = lut->size - 1;
+
+    // failed reads are NaN, must not reach the index conversion
+    if (!isfinite(pos))
+        return NAN;
+
+    if (pos <= 0)
+        return lut->table[0] + pos * lut->lo_slope;
+    if (pos >= (float)last)
+        return lut->table[last] + (pos - (float)last) * lut->hi_slope;
+
+    size_t i = (size_t)pos;
+    return lut->table[i] + (lut->table[i + 1] - lut->table[i]) * (pos - (float)i);
+}
+
+#endif // ESP_IOT_NODE_PLUS_LUT_H_
@@ -1,5 +1,6 @@
 #include <i2cdev.h>
 #include "common.h"
+#include "i2c_bus.h"
 #include "system_clock.h"
 #include "system.h"
 #include "settings.h"
@@ -11,6 +12,7 @@
 void app_main()
 {
     ESP_ERROR_CHECK(i2cdev_init());
+    ESP_ERROR_CHECK(i2c_bus_init());
     // Init basic system
     ESP_ERROR_CHECK(system_init());
 
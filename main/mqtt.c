@@ -8,79 +8,370 @@
 static bool connected = false;
 static bool started = false;
 static esp_mqtt_client_handle_t handle = NULL;
+static mqtt_published_callback_t published_cb = NULL;
 
-static char *msg_data = NULL;
-static size_t msg_data_size = 0;
-static char *msg_topic = NULL;
-
-typedef struct
+// Reassembly arena for fragmented messages, used only from MQTT task
+static struct
 {
     char topic[MQTT_MAX_TOPIC_LEN];
-    int qos;
-    mqtt_callback_t callback;
+    size_t topic_len;
+    char data[MQTT_BUFFER_SIZE];
+    size_t total;
+    size_t received;
+    bool active;
+} msg = { 0 };
+
+typedef struct subscription subscription_t;
+struct subscription
+{
+    subscription_t *next;
+    mqtt_callback_t callback; // NULL if removed during dispatch
     void *ctx;
-} subscription_t;
+};
 
-static cvector_vector_type(subscription_t) subs = NULL;
+typedef struct topic topic_t;
+struct topic
+{
+    topic_t *next;         // list of all subscribed topics
+    topic_t *prev;
+    subscription_t *subs;  // callbacks
+    uint32_t hash;
+    int qos;
+    bool wildcard;
+    char name[];
+};
 
-static void on_data(esp_mqtt_event_handle_t event)
+// Level of wildcard subscription filter
+typedef struct trie_node trie_node_t;
+struct trie_node
 {
-    if (event->current_data_offset == 0)
+    trie_node_t *next;     // sibling
+    trie_node_t *children;
+    topic_t *topic;        // filter ending at this level
+    size_t len;
+    char level[];
+};
+
+static SemaphoreHandle_t subs_lock = NULL;
+static topic_t *topics = NULL;
+static trie_node_t *wildcards = NULL;
+
+// Callbacks may unsubscribe, so memory is freed only after dispatch ends
+static int dispatching = 0;
+static cvector_vector_type(void *) released = NULL;
+
+// Open addressing hash table of topics without wildcards
+static topic_t **slots = NULL;
+static size_t slots_capacity = 0;
+static size_t slots_used = 0; // topics and tombstones
+static size_t slots_live = 0; // topics
+static topic_t tombstone;
+
+#define TOMBSTONE (&tombstone)
+
+static inline uint32_t topic_hash(const char *topic, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)topic[i]) * 16777619u;
+    return hash;
+}
+
+static inline bool is_wildcard(const char *topic)
+{
+    return strpbrk(topic, "+#") != NULL;
+}
+
+static topic_t *table_find(const char *topic, size_t len, uint32_t hash)
+{
+    if (!slots_capacity)
+        return NULL;
+
+    size_t mask = slots_capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
     {
-        // head event
-        // save topic
-        msg_topic = malloc(event->topic_len + 1);
-        memcpy(msg_topic, event->topic, event->topic_len);
-        msg_topic[event->topic_len] = 0;
+        topic_t *t = slots[i];
+        if (!t)
+            return NULL;
+        if (t != TOMBSTONE && t->hash == hash && !strncmp(t->name, topic, len) && !t->name[len])
+            return t;
+    }
+}
 
-        // save data
-        msg_data = malloc(event->total_data_len + 1);
-        memcpy(msg_data, event->data, event->data_len);
-        msg_data[event->total_data_len] = 0;
+// Returns true if a tombstone was reused
+static bool table_put(topic_t **table, size_t capacity, topic_t *t)
+{
+    size_t mask = capacity - 1;
+    size_t i = t->hash & mask;
+    while (table[i] && table[i] != TOMBSTONE)
+        i = (i + 1) & mask;
+    bool reused = table[i] == TOMBSTONE;
+    table[i] = t;
+    return reused;
+}
 
-        msg_data_size = event->data_len;
+static esp_err_t table_insert(topic_t *t)
+{
+    // keep load factor with tombstones below 3/4
+    if ((slots_used + 1) * 4 >= slots_capacity * 3)
+    {
+        // sized by live topics to at most half full, so the same size when mostly tombstones
+        size_t capacity = MQTT_TOPIC_TABLE_MIN_SIZE;
+        while ((slots_live + 1) * 2 > capacity)
+            capacity *= 2;
+        topic_t **table = calloc(capacity, sizeof(topic_t *));
+        if (!table)
+            return ESP_ERR_NO_MEM;
+        for (size_t i = 0; i < slots_capacity; i++)
+            if (slots[i] && slots[i] != TOMBSTONE)
+                table_put(table, capacity, slots[i]);
+        free(slots);
+        slots = table;
+        slots_capacity = capacity;
+        slots_used = slots_live;
     }
+
+    if (!table_put(slots, slots_capacity, t))
+        slots_used++;
+    slots_live++;
+
+    return ESP_OK;
+}
+
+static void table_remove(topic_t *t)
+{
+    size_t mask = slots_capacity - 1;
+    for (size_t i = t->hash & mask; slots[i]; i = (i + 1) & mask)
+        if (slots[i] == t)
+        {
+            slots[i] = TOMBSTONE;
+            slots_live--;
+            return;
+        }
+}
+
+// Free now or when the running dispatch ends, called with subs_lock taken
+static void release(void *p)
+{
+    if (dispatching)
+        cvector_push_back(released, p);
     else
+        free(p);
+}
+
+static esp_err_t trie_insert(topic_t *t)
+{
+    trie_node_t **list = &wildcards;
+    trie_node_t *node = NULL;
+    const char *level = t->name;
+    while (true)
     {
-        // tail event, append data
-        memcpy(msg_data + msg_data_size, msg_data, event->data_len);
-        msg_data_size += event->data_len;
+        const char *sep = strchr(level, '/');
+        size_t len = sep ? (size_t)(sep - level) : strlen(level);
+
+        for (node = *list; node; node = node->next)
+            if (node->len == len && !memcmp(node->level, level, len))
+                break;
+        if (!node)
+        {
+            node = calloc(1, sizeof(trie_node_t) + len + 1);
+            if (!node)
+                return ESP_ERR_NO_MEM;
+            memcpy(node->level, level, len);
+            node->len = len;
+            node->next = *list;
+            *list = node;
+        }
+
+        if (!sep)
+            break;
+        list = &node->children;
+        level = sep + 1;
     }
+    node->topic = t;
+
+    return ESP_OK;
+}
+
+// Removes filter from trie, pruning unused levels
+static void trie_remove(trie_node_t **list, const char *level)
+{
+    const char *sep = strchr(level, '/');
+    size_t len = sep ? (size_t)(sep - level) : strlen(level);
 
-    if (msg_data_size >= event->data_len)
+    for (trie_node_t **p = list; *p; p = &(*p)->next)
     {
-        // time to callback
-        for (size_t i = 0; i < cvector_size(subs); i++)
-            if (!strncmp(msg_topic, subs[i].topic, MQTT_MAX_TOPIC_LEN - 1))
-                subs[i].callback(msg_topic, msg_data, msg_data_size + 1, subs[i].ctx);
+        trie_node_t *node = *p;
+        if (node->len != len || memcmp(node->level, level, len))
+            continue;
+
+        if (sep)
+            trie_remove(&node->children, sep + 1);
+        else
+            node->topic = NULL;
 
-        // free memory
-        free(msg_data);
-        free(msg_topic);
+        // prune unused levels, `next` stays valid for running dispatch
+        if (!node->topic && !node->children)
+        {
+            *p = node->next;
+            release(node);
+        }
+        return;
     }
 }
 
-inline static bool find_topic(const char *topic, cvector_vector_type(const char *) topics)
+static topic_t *trie_find(const char *topic, size_t len)
 {
-    for (size_t i = 0; i < cvector_size(topics); i++)
-        if (!strncmp(topic, topics[i], MQTT_MAX_TOPIC_LEN - 1))
-            return true;
-    return false;
+    const trie_node_t *list = wildcards;
+    const char *level = topic, *end = topic + len;
+    while (true)
+    {
+        const char *sep = memchr(level, '/', end - level);
+        size_t level_len = (sep ? sep : end) - level;
+
+        const trie_node_t *node = list;
+        while (node && (node->len != level_len || memcmp(node->level, level, level_len)))
+            node = node->next;
+        if (!node)
+            return NULL;
+        if (!sep)
+            return node->topic;
+        list = node->children;
+        level = sep + 1;
+    }
 }
 
-static void resubscribe()
+static inline topic_t *find_topic(const char *topic, size_t len, uint32_t hash)
 {
-    cvector_vector_type(const char *) topics = NULL;
-    for (size_t i = 0; i < cvector_size(subs); i++)
+    return is_wildcard(topic) ? trie_find(topic, len) : table_find(topic, len, hash);
+}
+
+static void notify(const topic_t *t, const char *topic, const char *data, size_t data_len)
+{
+    if (!t)
+        return;
+    for (subscription_t *s = t->subs, *next; s; s = next)
     {
-        if (find_topic(subs[i].topic, topics))
+        next = s->next;
+        if (s->callback)
+            s->callback(topic, data, data_len, s->ctx);
+    }
+}
+
+static void trie_match(const trie_node_t *list, const char *level, const char *end,
+    const char *topic, const char *data, size_t data_len)
+{
+    const char *sep = memchr(level, '/', end - level);
+    size_t len = (sep ? sep : end) - level;
+    // wildcards at the first level don't match system topics
+    bool system = level == topic && *level == '$';
+
+    for (const trie_node_t *node = list; node; node = node->next)
+    {
+        if (node->len == 1 && node->level[0] == '#')
+        {
+            if (!system)
+                notify(node->topic, topic, data, data_len);
             continue;
-        ESP_LOGI(TAG, "Resubscribing to %s", subs[i].topic);
-        esp_mqtt_client_subscribe(handle, subs[i].topic, subs[i].qos);
-        cvector_push_back(topics, subs[i].topic);
+        }
+        bool plus = node->len == 1 && node->level[0] == '+';
+        if ((plus && system) || (!plus && (node->len != len || memcmp(node->level, level, len))))
+            continue;
+
+        if (sep)
+        {
+            trie_match(node->children, sep + 1, end, topic, data, data_len);
+            continue;
+        }
+        notify(node->topic, topic, data, data_len);
+        // "a/#" also matches "a"
+        for (const trie_node_t *child = node->children; child; child = child->next)
+            if (child->len == 1 && child->level[0] == '#')
+                notify(child->topic, topic, data, data_len);
+    }
+}
+
+static void dispatch(const char *topic, size_t topic_len, const char *data, size_t data_len)
+{
+    xSemaphoreTakeRecursive(subs_lock, portMAX_DELAY);
+    dispatching++;
+
+    notify(table_find(topic, topic_len, topic_hash(topic, topic_len)), topic, data, data_len);
+    if (wildcards)
+        trie_match(wildcards, topic, topic + topic_len, topic, data, data_len);
+
+    if (!--dispatching)
+    {
+        for (size_t i = 0; i < cvector_size(released); i++)
+            free(released[i]);
+        if (released)
+            cvector_set_size(released, 0);
+    }
+    xSemaphoreGiveRecursive(subs_lock);
+}
+
+static void on_data(esp_mqtt_event_handle_t event)
+{
+    if (event->current_data_offset == 0)
+    {
+        // head event
+        msg.active = false;
+        if (event->topic_len <= 0 || event->topic_len >= (int)sizeof(msg.topic))
+        {
+            ESP_LOGE(TAG, "Invalid topic length: %d", event->topic_len);
+            return;
+        }
+        memcpy(msg.topic, event->topic, event->topic_len);
+        msg.topic[event->topic_len] = 0;
+        msg.topic_len = event->topic_len;
+
+        if (event->data_len == event->total_data_len)
+        {
+            // not fragmented, pass data as is
+            dispatch(msg.topic, msg.topic_len, event->data, event->data_len);
+            return;
+        }
+        if (event->total_data_len > (int)sizeof(msg.data))
+        {
+            ESP_LOGE(TAG, "Message to %s is too big: %d", msg.topic, event->total_data_len);
+            return;
+        }
+        msg.total = event->total_data_len;
+        msg.received = 0;
+        msg.active = true;
+    }
+    else if (!msg.active)
+        // rest of rejected message
+        return;
+
+    if (event->current_data_offset != (int)msg.received || msg.received + event->data_len > msg.total)
+    {
+        ESP_LOGE(TAG, "Unexpected fragment of message to %s at offset %d", msg.topic, event->current_data_offset);
+        msg.active = false;
+        return;
+    }
+    memcpy(msg.data + msg.received, event->data, event->data_len);
+    msg.received += event->data_len;
+
+    if (msg.received == msg.total)
+    {
+        msg.active = false;
+        dispatch(msg.topic, msg.topic_len, msg.data, msg.total);
     }
 }
 
+static void resubscribe()
+{
+    xSemaphoreTakeRecursive(subs_lock, portMAX_DELAY);
+    for (topic_t *t = topics; t; t = t->next)
+    {
+        ESP_LOGI(TAG, "Resubscribing to %s", t->name);
+        esp_mqtt_client_subscribe(handle, t->name, t->qos);
+    }
+    xSemaphoreGiveRecursive(subs_lock);
+}
+
 static void handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data)
 {
     switch ((esp_mqtt_event_id_t)event_id)
@@ -96,6 +387,10 @@ static void handler(void *arg, esp_event_base_t event_base, int32_t event_id, vo
             ESP_LOGI(TAG, "Disconnected from MQTT broker");
             bus_send_event(MQTT_DISCONNECTED, NULL, 0);
             break;
+        case MQTT_EVENT_PUBLISHED:
+            if (published_cb)
+                published_cb(((esp_mqtt_event_handle_t)event_data)->msg_id);
+            break;
         case MQTT_EVENT_DATA:
             on_data((esp_mqtt_event_handle_t)event_data);
         default:
@@ -119,6 +414,13 @@ esp_err_t mqtt_init()
 {
     ESP_LOGI(TAG, "Initializing MQTT client with ID: '%s', username: '%s'", SYSTEM_ID, settings.mqtt.username);
 
+    subs_lock = xSemaphoreCreateRecursiveMutex();
+    if (!subs_lock)
+    {
+        ESP_LOGE(TAG, "Error creating subscriptions lock");
+        return ESP_ERR_NO_MEM;
+    }
+
     esp_mqtt_client_config_t config;
     memset(&config, 0, sizeof(config));
 
@@ -175,6 +477,11 @@ int mqtt_publish(const char *topic, const char *data, int len, int qos, int reta
     return esp_mqtt_client_publish(handle, topic, data, len, qos, retain);
 }
 
+void mqtt_set_published_callback(mqtt_published_callback_t cb)
+{
+    published_cb = cb;
+}
+
 int mqtt_publish_json(const char *topic, const cJSON *json, int qos, int retain)
 {
     char *buf = cJSON_PrintUnformatted(json);
@@ -202,25 +509,73 @@ int mqtt_publish_json_subtopic(const char *subtopic, const cJSON *json, int qos,
 
 int mqtt_subscribe(const char *topic, mqtt_callback_t cb, int qos, void *ctx)
 {
-    bool subscribed = false;
-    for (size_t i = 0; i < cvector_size(subs); i++)
-        if (!strncmp(topic, subs[i].topic, MQTT_MAX_TOPIC_LEN - 1))
-        {
-            if (cb == subs[i].callback)
-                return -1;
-            subscribed = true;
-        }
+    size_t len = strnlen(topic, MQTT_MAX_TOPIC_LEN - 1);
+    uint32_t hash = topic_hash(topic, len);
+    int res = 0;
+
+    xSemaphoreTakeRecursive(subs_lock, portMAX_DELAY);
+
+    topic_t *t = find_topic(topic, len, hash);
+    if (t)
+    {
+        for (subscription_t *s = t->subs; s; s = s->next)
+            if (s->callback == cb)
+            {
+                res = -1;
+                goto exit;
+            }
+    }
 
-    subscription_t s = {
-        .topic = { 0 },
-        .callback = cb,
-        .qos = qos,
-        .ctx = ctx
-    };
-    strncpy(s.topic, topic, sizeof(s.topic) - 1);
-    cvector_push_back(subs, s);
+    subscription_t *s = calloc(1, sizeof(subscription_t));
+    if (!s)
+    {
+        res = -1;
+        goto exit;
+    }
+    s->callback = cb;
+    s->ctx = ctx;
 
-    return subscribed ? 0 : esp_mqtt_client_subscribe(handle, (char *)topic, qos);
+    if (t)
+    {
+        // already subscribed
+        s->next = t->subs;
+        t->subs = s;
+        goto exit;
+    }
+
+    t = calloc(1, sizeof(topic_t) + len + 1);
+    if (!t)
+    {
+        free(s);
+        res = -1;
+        goto exit;
+    }
+    memcpy(t->name, topic, len);
+    t->hash = hash;
+    t->qos = qos;
+    t->wildcard = is_wildcard(t->name);
+    t->subs = s;
+
+    if ((t->wildcard ? trie_insert(t) : table_insert(t)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Out of memory while subscribing to %s", t->name);
+        if (t->wildcard)
+            trie_remove(&wildcards, t->name);
+        free(s);
+        free(t);
+        res = -1;
+        goto exit;
+    }
+    t->next = topics;
+    if (topics)
+        topics->prev = t;
+    topics = t;
+
+    res = esp_mqtt_client_subscribe(handle, t->name, qos);
+
+exit:
+    xSemaphoreGiveRecursive(subs_lock);
+    return res;
 }
 
 int mqtt_subscribe_subtopic(const char *subtopic, mqtt_callback_t cb, int qos, void *ctx)
@@ -233,12 +588,46 @@ int mqtt_subscribe_subtopic(const char *subtopic, mqtt_callback_t cb, int qos, v
 
 void mqtt_unsubscribe(const char *topic, mqtt_callback_t cb, void *ctx)
 {
-    for (size_t i = 0; i < cvector_size(subs); i++)
-        if (!strncmp(topic, subs[i].topic, MQTT_MAX_TOPIC_LEN - 1) && cb == subs[i].callback && ctx == subs[i].ctx)
+    size_t len = strnlen(topic, MQTT_MAX_TOPIC_LEN - 1);
+
+    xSemaphoreTakeRecursive(subs_lock, portMAX_DELAY);
+
+    topic_t *t = find_topic(topic, len, topic_hash(topic, len));
+    if (!t)
+        goto exit;
+
+    for (subscription_t **ps = &t->subs; *ps; ps = &(*ps)->next)
+    {
+        subscription_t *s = *ps;
+        if (s->callback == cb && s->ctx == ctx)
         {
-            cvector_erase(subs, i);
-            return;
+            // running dispatch may hold it as the next one
+            *ps = s->next;
+            s->callback = NULL;
+            release(s);
+            break;
         }
+    }
+    if (t->subs)
+        goto exit;
+
+    // last callback removed
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        topics = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    if (t->wildcard)
+        trie_remove(&wildcards, t->name);
+    else
+        table_remove(t);
+    if (connected)
+        esp_mqtt_client_unsubscribe(handle, t->name);
+    release(t);
+
+exit:
+    xSemaphoreGiveRecursive(subs_lock);
 }
 
 void mqtt_unsubscribe_subtopic(const char *subtopic, mqtt_callback_t cb, void *ctx)
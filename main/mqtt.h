@@ -5,8 +5,15 @@
 #include <mqtt_client.h>
 #include <cJSON.h>
 
+/**
+ * Subscription callback. `data` is a view of the message payload valid only
+ * during the call, it is not NUL-terminated.
+ */
 typedef void (*mqtt_callback_t)(const char *topic, const char *data, size_t data_len, void *ctx);
 
+// Called from MQTT task when the broker acknowledged message `msg_id` of QoS > 0
+typedef void (*mqtt_published_callback_t)(int msg_id);
+
 esp_mqtt_client_handle_t mqtt_client();
 
 esp_err_t mqtt_init();
@@ -15,6 +22,7 @@ esp_err_t mqtt_disconnect();
 bool mqtt_connected();
 
 int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain);
+void mqtt_set_published_callback(mqtt_published_callback_t cb);
 int mqtt_publish_json(const char *topic, const cJSON *json, int qos, int retain);
 
 int mqtt_publish_subtopic(const char *subtopic, const char *data, int len, int qos, int retain);
@@ -1,10 +1,16 @@
 #include "node.h"
+#include <math.h>
+#include <esp_timer.h>
 #include "common.h"
 #include "settings.h"
 #include "system.h"
 #include "cvector.h"
 #include "driver.h"
 #include "mqtt.h"
+#include "scheduler.h"
+#include "rules.h"
+#include "backlog.h"
+#include "history.h"
 
 #ifdef DRIVER_GH_IO
 #include "drivers/gh_io.h"
@@ -24,9 +30,18 @@
 #ifdef DRIVER_DHTXX
 #include "drivers/dhtxx.h"
 #endif
+#ifdef DRIVER_GH_DIMMER
+#include "drivers/gh_dimmer.h"
+#endif
+#ifdef DRIVER_PID
+#include "drivers/pid_ctl.h"
+#endif
 
 static char buf[DRIVER_MAX_CONFIG_LEN];
+static char batch[NODE_BATCH_STATE_SIZE];
 static QueueHandle_t node_queue = NULL;
+static QueueHandle_t update_queue = NULL;
+static QueueSetHandle_t queue_set = NULL;
 static cvector_vector_type(driver_t *) drivers = NULL;
 
 static void publish_driver(const driver_t *drv)
@@ -40,19 +55,98 @@ static void publish_driver(const driver_t *drv)
     vTaskDelay(1);
 }
 
+static inline const char *batch_group(const driver_t *drv)
+{
+    return drv->batch_state ? drv->name : NULL;
+}
+
+// Devices are copied under the lock and published from the copy, drivers like ds18b20
+// reallocate the vector. Command subscriptions keep the device pointer, effectors are
+// created in on_init and never moved while the driver runs
 static void on_driver_start(driver_t *driver)
 {
     if (driver->state != DRIVER_RUNNING)
         return;
-    for (size_t d = 0; d < cvector_size(driver->devices); d++)
+    const char *group = batch_group(driver);
+    for (size_t d = 0;; d++)
     {
-        device_subscribe(&driver->devices[d]);
-        vTaskDelay(1);
-        device_publish_discovery(&driver->devices[d]);
-        vTaskDelay(1);
-        device_publish_state(&driver->devices[d]);
+        driver_lock_devices(driver);
+        if (d >= cvector_size(driver->devices))
+        {
+            driver_unlock_devices(driver);
+            break;
+        }
+        device_t *dev = &driver->devices[d];
+        // publish full state after reconnect
+        dev->update.published = false;
+        device_t copy = *dev;
+        bool batched = group && device_is_sensor(dev);
+        // will be published in full batch below
+        if (batched)
+            driver_send_device_update(driver, dev);
+        driver_unlock_devices(driver);
+
+        if (!device_is_sensor(&copy))
+            device_subscribe(dev);
+        // unchanged descriptors are not republished
+        if (device_publish_discovery(&copy, group))
+            vTaskDelay(1);
+        if (batched)
+            continue;
+        device_publish_state(&copy);
         vTaskDelay(1);
     }
+    driver_flush_updates(driver);
+}
+
+// Feed changed sensors to rules and history, publish them if `online` is set or log them otherwise
+static void process_batch_state(driver_t *drv, bool online)
+{
+    char value[32];
+    size_t len = 0;
+    int64_t now = esp_timer_get_time();
+
+    driver_lock_devices(drv);
+    for (size_t d = 0; d < cvector_size(drv->devices); d++)
+    {
+        device_t *dev = &drv->devices[d];
+        if (!driver_fetch_batch_update(dev))
+            continue;
+        rules_on_update(dev);
+        history_append(dev);
+        if (!device_report_due(dev, now))
+            continue;
+        if (!online)
+        {
+            backlog_append(dev);
+            continue;
+        }
+
+        if (dev->type == DEV_SENSOR && !isfinite(dev->sensor.value))
+            strcpy(value, "null");
+        else
+            device_format_state(dev, value, sizeof(value));
+
+        // ,"uid":value}
+        char entry[DEVICE_UID_SIZE + sizeof(value) + 3];
+        size_t entry_len = snprintf(entry, sizeof(entry), "\"%s\":%s", dev->uid, value);
+        if (len && len + entry_len + 3 > sizeof(batch))
+        {
+            // MQTT client is not called with the lock held
+            driver_unlock_devices(drv);
+            batch[len++] = '}';
+            device_publish_batch_state(drv->name, batch, len);
+            len = 0;
+            driver_lock_devices(drv);
+        }
+        len += snprintf(batch + len, sizeof(batch) - len, "%c%s", len ? ',' : '{', entry);
+    }
+    driver_unlock_devices(drv);
+
+    if (!len)
+        return;
+    batch[len++] = '}';
+    device_publish_batch_state(drv->name, batch, len);
 }
 
 static void on_set_config(const char *topic, const char *data, size_t data_len, void *ctx)
@@ -89,12 +183,12 @@ static void on_set_config(const char *topic, const char *data, size_t data_len,
     if (r != ESP_OK)
         ESP_LOGW(TAG, "Error initializing driver %s: %d (%s)", drv->name, r, esp_err_to_name(r));
 
+    r = driver_start(drv);
+    if (r != ESP_OK)
+        ESP_LOGW(TAG, "Error starting driver %s: %d (%s)", drv->name, r, esp_err_to_name(r));
+
     if (system_mode() == MODE_ONLINE)
     {
-        r = driver_start(drv);
-        if (r != ESP_OK)
-            ESP_LOGW(TAG, "Error initializing driver %s: %d (%s)", drv->name, r, esp_err_to_name(r));
-
         // publish driver config
         publish_driver(drv);
 
@@ -103,45 +197,185 @@ static void on_set_config(const char *topic, const char *data, size_t data_len,
     }
 }
 
+static void on_discovery_status(const char *topic, const char *data, size_t data_len, void *ctx)
+{
+    (void)topic;
+    (void)ctx;
+
+    static bool restarted = false;
+
+    if (data_len == 7 && !strncmp(data, "offline", data_len))
+    {
+        restarted = true;
+        return;
+    }
+    if (!restarted || data_len != 6 || strncmp(data, "online", data_len))
+        return;
+
+    // Home Assistant is back, its retained discovery data may be lost.
+    // Devices are republished by node task, where batch updates are processed
+    ESP_LOGI(TAG, "Home Assistant restarted, republishing discovery data");
+    restarted = false;
+    device_reset_discovery_cache();
+    static driver_event_t e = { .type = DRV_EVENT_REPUBLISH, .sender = NULL };
+    if (xQueueSend(node_queue, &e, 0) != pdTRUE)
+        ESP_LOGW(TAG, "Node queue is full, discovery data not republished");
+}
+
 static void node_task(void *arg)
 {
     (void)arg;
 
     driver_event_t e;
+    driver_update_t u;
+    bool report;
     while (true)
     {
-        if (!xQueueReceive(node_queue, &e, portMAX_DELAY))
+        // rule actions and backlog writes are run here, outside of device locks
+        TickType_t timeout = rules_process();
+        TickType_t forward = backlog_process();
+        QueueSetMemberHandle_t q = xQueueSelectFromSet(queue_set, forward < timeout ? forward : timeout);
+        if (!q)
+            continue;
+
+        if (q == update_queue)
+        {
+            if (!xQueueReceive(update_queue, &u, 0))
+                continue;
+            if (u.index == DRIVER_UPDATE_FLUSH)
+            {
+                process_batch_state(u.sender, system_mode() == MODE_ONLINE);
+                continue;
+            }
+            // always fetch to release the update slot
+            if (!driver_fetch_device_update(&u, &e.dev, &report))
+                continue;
+            rules_on_update(&e.dev);
+            history_append(&e.dev);
+            if (!report)
+                continue;
+            if (system_mode() == MODE_ONLINE)
+                device_publish_state(&e.dev);
+            else
+                backlog_append(&e.dev);
+            continue;
+        }
+
+        if (!xQueueReceive(node_queue, &e, 0))
             continue;
+        if (e.type == DRV_EVENT_DEVICE_UPDATED)
+        {
+            rules_on_update(&e.dev);
+            history_append(&e.dev);
+        }
         if (system_mode() != MODE_ONLINE)
+        {
+            if (e.type == DRV_EVENT_DEVICE_UPDATED)
+                backlog_append(&e.dev);
             continue;
+        }
         switch (e.type)
         {
             case DRV_EVENT_DEVICE_UPDATED:
                 device_publish_state(&e.dev);
                 break;
             case DRV_EVENT_DEVICE_ADDED:
-                device_publish_discovery(&e.dev);
+                device_publish_discovery(&e.dev, batch_group(e.sender));
                 break;
             case DRV_EVENT_DEVICE_REMOVED:
                 device_unsubscribe(&e.dev);
                 device_unpublish_discovery(&e.dev);
                 break;
+            case DRV_EVENT_REPUBLISH:
+                for (size_t i = 0; i < cvector_size(drivers); i++)
+                    on_driver_start(drivers[i]);
+                break;
         }
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
+esp_err_t node_write_device(const char *uid, float value)
+{
+    for (size_t i = 0; i < cvector_size(drivers); i++)
+    {
+        driver_t *drv = drivers[i];
+        if (drv->state != DRIVER_RUNNING)
+            continue;
+
+        esp_err_t r = ESP_ERR_NOT_FOUND;
+        driver_lock_devices(drv);
+        for (size_t d = 0; d < cvector_size(drv->devices); d++)
+        {
+            device_t *dev = &drv->devices[d];
+            if (strcmp(dev->uid, uid))
+                continue;
+            r = ESP_ERR_NOT_SUPPORTED;
+            if (dev->type == DEV_BINARY_SWITCH && dev->binary_switch.on_write)
+            {
+                dev->binary_switch.on_write(dev, value != 0);
+                r = ESP_OK;
+            }
+            else if (dev->type == DEV_NUMBER && dev->number.on_write)
+            {
+                dev->number.on_write(dev, value);
+                r = ESP_OK;
+            }
+            break;
+        }
+        driver_unlock_devices(drv);
+        if (r != ESP_ERR_NOT_FOUND)
+            return r;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t node_read_device(const char *uid, float *value)
+{
+    for (size_t i = 0; i < cvector_size(drivers); i++)
+    {
+        driver_t *drv = drivers[i];
+        if (drv->state != DRIVER_RUNNING)
+            continue;
+
+        bool found = false;
+        driver_lock_devices(drv);
+        for (size_t d = 0; d < cvector_size(drv->devices) && !found; d++)
+            if (!strcmp(drv->devices[d].uid, uid))
+            {
+                *value = device_value(&drv->devices[d]);
+                found = true;
+            }
+        driver_unlock_devices(drv);
+        if (found)
+            return ESP_OK;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
 esp_err_t node_init()
 {
     ESP_LOGI(TAG, "Initializing node %s...", settings.system.name);
 
     node_queue = xQueueCreate(NODE_QUEUE_SIZE, sizeof(driver_event_t));
-    if (!node_queue)
+    update_queue = xQueueCreate(NODE_UPDATE_QUEUE_SIZE, sizeof(driver_update_t));
+    queue_set = xQueueCreateSet(NODE_QUEUE_SIZE + NODE_UPDATE_QUEUE_SIZE);
+    if (!node_queue || !update_queue || !queue_set)
     {
         ESP_LOGE(TAG, "Error creating node queue");
         return ESP_ERR_NO_MEM;
     }
+    xQueueAddToSet(node_queue, queue_set);
+    xQueueAddToSet(update_queue, queue_set);
+
+    device_init_discovery_cache();
+    CHECK(scheduler_init());
+    CHECK(rules_init());
+    CHECK_LOGW(backlog_init(), "Error initializing backlog");
+    CHECK_LOGW(history_init(), "Error initializing history");
 
     if (xTaskCreatePinnedToCore(node_task, "node_task", NODE_TASK_STACK_SIZE, NULL, NODE_TASK_PRIORITY, NULL, APP_CPU_NUM) != pdPASS)
     {
@@ -167,6 +401,12 @@ esp_err_t node_init()
 #ifdef DRIVER_DHTXX
     cvector_push_back(drivers, &drv_dht);
 #endif
+#ifdef DRIVER_GH_DIMMER
+    cvector_push_back(drivers, &drv_gh_dimmer);
+#endif
+#ifdef DRIVER_PID
+    cvector_push_back(drivers, &drv_pid);
+#endif
 
     system_set_mode(MODE_OFFLINE);
 
@@ -174,6 +414,7 @@ esp_err_t node_init()
     for (size_t i = 0; i < cvector_size(drivers); i++)
     {
         drivers[i]->event_queue = node_queue;
+        drivers[i]->update_queue = update_queue;
         if (drivers[i]->defconfig)
         {
             r = settings_load_driver_config(drivers[i]->name, buf, sizeof(buf));
@@ -193,6 +434,17 @@ esp_err_t node_init()
             ESP_LOGW(TAG, "Error initializing driver %s: %d (%s)", drivers[i]->name, r, esp_err_to_name(r));
     }
 
+    // drivers run whatever the network state is, so rules, PID, history and backlog work from boot
+    for (size_t i = 0; i < cvector_size(drivers); i++)
+    {
+        if (drivers[i]->state != DRIVER_INITIALIZED)
+            continue;
+        r = driver_start(drivers[i]);
+        if (r != ESP_OK)
+            ESP_LOGW(TAG, "Error starting driver %s: %d (%s)", drivers[i]->name, r, esp_err_to_name(r));
+    }
+    ESP_LOGI(TAG, "Drivers started, node is offline");
+
     return ESP_OK;
 }
 
@@ -206,12 +458,6 @@ void node_online()
 
     for (size_t i = 0; i < cvector_size(drivers); i++)
     {
-        if (drivers[i]->state != DRIVER_INITIALIZED)
-            continue;
-        esp_err_t r = driver_start(drivers[i]);
-        if (r != ESP_OK)
-            ESP_LOGW(TAG, "Error starting driver %s: %d (%s)", drivers[i]->name, r, esp_err_to_name(r));
-
         publish_driver(drivers[i]);
 
         // subscribe on driver config
@@ -221,7 +467,9 @@ void node_online()
         vTaskDelay(1);
     }
 
-    // resend devices discovery and resub
+    mqtt_subscribe(DEVICE_DISCOVERY_STATUS_TOPIC, on_discovery_status, 1, NULL);
+
+    // resend changed devices discovery and resub
     for (size_t i = 0; i < cvector_size(drivers); i++)
         on_driver_start(drivers[i]);
 }
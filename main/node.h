@@ -9,4 +9,10 @@ void node_online();
 
 void node_offline();
 
+// Write value to binary switch or number device, as if it came from command topic
+esp_err_t node_write_device(const char *uid, float value);
+
+// Latest state of any device
+esp_err_t node_read_device(const char *uid, float *value);
+
 #endif // ESP_IOT_NODE_PLUS_NODE_H_
@@ -0,0 +1,37 @@
+#include "phase.h"
+#include <math.h>
+
+double phase_conduction_power(double angle)
+{
+    return 1.0 - angle / M_PI + sin(2.0 * angle) / (2.0 * M_PI);
+}
+
+// Firing delay fraction giving `power`, bisection of monotone decreasing conduction power
+static double power_to_delay(double power)
+{
+    double lo = 0, hi = M_PI;
+    for (int i = 0; i < 40; i++)
+    {
+        double mid = (lo + hi) / 2;
+        if (phase_conduction_power(mid) > power)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (lo + hi) / 2 / M_PI;
+}
+
+void phase_build_table(uint32_t *table, size_t levels, bool power_curve, float gamma, float min_level, float max_level)
+{
+    table[0] = PHASE_FIRE_OFF;
+    for (size_t i = 1; i < levels; i++)
+    {
+        double l = min_level + (max_level - min_level) * pow((double)i / (double)(levels - 1), gamma);
+        if (l < 0)
+            l = 0;
+        if (l > 1)
+            l = 1;
+        double delay = power_curve ? power_to_delay(l) : 1.0 - l;
+        table[i] = (uint32_t)lround(delay * PHASE_FIRE_ONE);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef ESP_IOT_NODE_PLUS_PHASE_H_
+#define ESP_IOT_NODE_PLUS_PHASE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Firing angles of triac phase control. Level `i` of a table is the delay
+ * after zero crossing as Q16 fraction of the half period. Power curve gives
+ * RMS power proportional to the level, linear curve gives delay proportional
+ * to it. Level 0 never fires.
+ */
+
+#define PHASE_FIRE_OFF UINT32_MAX
+#define PHASE_FIRE_ONE 65536 // Q16, whole half period
+#define PHASE_GUARD_US 150   // triac does not latch too close to zero crossing
+
+// Fraction of full RMS power delivered when firing at `angle` (0..pi) of each half period
+double phase_conduction_power(double angle);
+
+// Levels are mapped to min_level..max_level (0..1) of power or conduction with `gamma`
+void phase_build_table(uint32_t *table, size_t levels, bool power_curve, float gamma, float min_level, float max_level);
+
+// Firing delay after zero crossing, us, clamped so the gate pulse ends before the next crossing
+static inline uint32_t phase_fire_delay(uint32_t fire, uint32_t half_us, int32_t offset_us, uint32_t gate_pulse_us)
+{
+    int32_t d = (int32_t)(((uint64_t)fire * half_us) >> 16) + offset_us;
+    int32_t max = (int32_t)half_us - PHASE_GUARD_US - (int32_t)gate_pulse_us;
+    if (d > max)
+        d = max;
+    if (d < PHASE_GUARD_US)
+        d = PHASE_GUARD_US;
+
+    return d;
+}
+
+#endif // ESP_IOT_NODE_PLUS_PHASE_H_
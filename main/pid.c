@@ -0,0 +1,49 @@
+#include "pid.h"
+#include <string.h>
+
+static inline float clamp(float v, float lo, float hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+void pid_init(pid_ctl_t *pid, const pid_config_t *cfg)
+{
+    memset(pid, 0, sizeof(pid_ctl_t));
+    pid->cfg = *cfg;
+    pid_reset(pid);
+}
+
+void pid_reset(pid_ctl_t *pid)
+{
+    pid->integral = 0;
+    pid->prev_pv = 0;
+    pid->primed = false;
+    pid->output = clamp(pid->cfg.bias, pid->cfg.out_min, pid->cfg.out_max);
+}
+
+float pid_update(pid_ctl_t *pid, float setpoint, float pv, float dt)
+{
+    const pid_config_t *c = &pid->cfg;
+
+    float error = c->reverse ? pv - setpoint : setpoint - pv;
+    float d_pv = pid->primed ? pv - pid->prev_pv : 0;
+    if (c->reverse)
+        d_pv = -d_pv;
+    pid->prev_pv = pv;
+    pid->primed = true;
+
+    float p = c->kp * error;
+    float d = dt > 0 ? -c->kd * d_pv / dt : 0;
+    float integral = pid->integral + c->ki * error * (dt > 0 ? dt : 0);
+
+    float out = c->bias + p + integral + d;
+    // anti-windup: keep the integral while saturated output is pushed further
+    if ((out > c->out_max && error > 0) || (out < c->out_min && error < 0))
+        out = c->bias + p + pid->integral + d;
+    else
+        pid->integral = integral;
+
+    pid->output = clamp(out, c->out_min, c->out_max);
+
+    return pid->output;
+}
@@ -0,0 +1,37 @@
+#ifndef ESP_IOT_NODE_PLUS_PID_H_
+#define ESP_IOT_NODE_PLUS_PID_H_
+
+#include <stdbool.h>
+
+/*
+ * Discrete PID controller, the time step is measured by the caller and given
+ * with each update, so late updates are not mistaken for fast changes.
+ * Derivative is taken on the
+ * process variable, so setpoint changes do not kick the output. Integration
+ * stops while the output is saturated in the direction of the error
+ * (conditional integration anti-windup).
+ */
+typedef struct
+{
+    float kp, ki, kd;
+    float out_min, out_max;
+    float bias;    // feed-forward term added to the output
+    bool reverse;  // output increase lowers the process variable
+} pid_config_t;
+
+typedef struct
+{
+    pid_config_t cfg;
+    float integral; // output units
+    float prev_pv;
+    bool primed;
+    float output;
+} pid_ctl_t;
+
+void pid_init(pid_ctl_t *pid, const pid_config_t *cfg);
+void pid_reset(pid_ctl_t *pid);
+// Next output for the latest process variable, clamped to out_min..out_max.
+// `dt` is time since the previous update, s
+float pid_update(pid_ctl_t *pid, float setpoint, float pv, float dt);
+
+#endif // ESP_IOT_NODE_PLUS_PID_H_
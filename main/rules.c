@@ -0,0 +1,473 @@
+#include "rules.h"
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <nvs.h>
+#include <freertos/semphr.h>
+#include "common.h"
+#include "node.h"
+#include "system_clock.h"
+
+#define INDEX_SIZE (RULES_MAX * 2) // power of 2
+#define NO_RULE -1
+
+typedef enum {
+    RULE_ANY = 0, // no input, time window only
+    RULE_BELOW,
+    RULE_ABOVE,
+} rule_op_t;
+
+typedef struct
+{
+    char input[DEVICE_UID_SIZE];
+    char output[DEVICE_UID_SIZE];
+    rule_op_t op;
+    float threshold;
+    float hysteresis;
+    int from; // minutes since midnight, -1 if no window
+    int to;
+    float on_value;
+    float off_value;
+
+    float value;     // last input value
+    bool has_value;
+    bool cond;       // input condition with hysteresis
+    int8_t state;    // -1 - not evaluated yet
+    bool pending;    // output must be written
+    int next;        // next rule with the same input
+} rule_t;
+
+// input uid -> first rule, open addressing
+typedef struct
+{
+    const char *uid;
+    int first;
+} index_entry_t;
+
+typedef struct
+{
+    char output[DEVICE_UID_SIZE];
+    float value;
+} action_t;
+
+static SemaphoreHandle_t lock = NULL;
+static rule_t rules[RULES_MAX];
+static size_t rules_count = 0;
+static index_entry_t index_table[INDEX_SIZE];
+static bool has_windows = false;
+static int last_minute = -1;
+
+static uint32_t hash(const char *s)
+{
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*s)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+static index_entry_t *index_slot(const char *uid)
+{
+    for (uint32_t i = hash(uid), n = 0; n < INDEX_SIZE; i++, n++)
+    {
+        index_entry_t *e = &index_table[i & (INDEX_SIZE - 1)];
+        if (!e->uid || !strcmp(e->uid, uid))
+            return e;
+    }
+    return NULL;
+}
+
+static void build_index()
+{
+    memset(index_table, 0, sizeof(index_table));
+    has_windows = false;
+
+    // reverse order keeps chains in order of rules
+    for (size_t i = rules_count; i > 0; i--)
+    {
+        rule_t *r = &rules[i - 1];
+        has_windows |= r->from >= 0;
+        r->next = NO_RULE;
+        if (!r->input[0])
+            continue;
+        index_entry_t *e = index_slot(r->input);
+        if (!e->uid)
+        {
+            e->uid = r->input;
+            e->first = NO_RULE;
+        }
+        r->next = e->first;
+        e->first = (int)(i - 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static int parse_time(const cJSON *item)
+{
+    const char *s = cJSON_GetStringValue(item);
+    int h, m;
+    if (!s || sscanf(s, "%d:%d", &h, &m) != 2 || h < 0 || h > 23 || m < 0 || m > 59)
+        return -1;
+    return h * 60 + m;
+}
+
+static bool parse_uid(const cJSON *item, char *uid)
+{
+    const char *s = cJSON_GetStringValue(item);
+    if (!s || !*s || strlen(s) >= DEVICE_UID_SIZE)
+        return false;
+    strcpy(uid, s);
+    return true;
+}
+
+static esp_err_t parse_rule(const cJSON *json, rule_t *r, const char **msg)
+{
+    memset(r, 0, sizeof(rule_t));
+    r->state = -1;
+    r->from = r->to = -1;
+
+    if (!parse_uid(cJSON_GetObjectItem(json, "output"), r->output))
+    {
+        *msg = "Invalid or missing output";
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const cJSON *input = cJSON_GetObjectItem(json, "input");
+    if (input)
+    {
+        if (!parse_uid(input, r->input))
+        {
+            *msg = "Invalid input";
+            return ESP_ERR_INVALID_ARG;
+        }
+        const char *op = cJSON_GetStringValue(cJSON_GetObjectItem(json, "op"));
+        if (op && !strcmp(op, "<"))
+            r->op = RULE_BELOW;
+        else if (op && !strcmp(op, ">"))
+            r->op = RULE_ABOVE;
+        else
+        {
+            *msg = "Invalid op, expected \"<\" or \">\"";
+            return ESP_ERR_INVALID_ARG;
+        }
+        const cJSON *threshold = cJSON_GetObjectItem(json, "threshold");
+        if (!cJSON_IsNumber(threshold))
+        {
+            *msg = "Invalid or missing threshold";
+            return ESP_ERR_INVALID_ARG;
+        }
+        r->threshold = (float)cJSON_GetNumberValue(threshold);
+        const cJSON *hysteresis = cJSON_GetObjectItem(json, "hysteresis");
+        r->hysteresis = cJSON_IsNumber(hysteresis) ? fabsf((float)cJSON_GetNumberValue(hysteresis)) : 0;
+    }
+
+    const cJSON *from = cJSON_GetObjectItem(json, "from");
+    const cJSON *to = cJSON_GetObjectItem(json, "to");
+    if (from || to)
+    {
+        r->from = parse_time(from);
+        r->to = parse_time(to);
+        if (r->from < 0 || r->to < 0)
+        {
+            *msg = "Invalid time window, expected \"HH:MM\"";
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    if (!r->input[0] && r->from < 0)
+    {
+        *msg = "Rule needs input or time window";
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const cJSON *on = cJSON_GetObjectItem(json, "on");
+    const cJSON *off = cJSON_GetObjectItem(json, "off");
+    r->on_value = cJSON_IsNumber(on) ? (float)cJSON_GetNumberValue(on) : cJSON_IsBool(on) ? cJSON_IsTrue(on) : 1;
+    r->off_value = cJSON_IsNumber(off) ? (float)cJSON_GetNumberValue(off) : cJSON_IsBool(off) ? cJSON_IsTrue(off) : 0;
+
+    return ESP_OK;
+}
+
+// Parses into new table, current rules are not touched on error
+static esp_err_t parse_rules(const cJSON *json, rule_t **dst, size_t *count, const char **msg)
+{
+    *dst = NULL;
+    *count = 0;
+
+    if (!cJSON_IsArray(json))
+    {
+        *msg = "Rules must be an array";
+        return ESP_ERR_INVALID_ARG;
+    }
+    size_t size = cJSON_GetArraySize(json);
+    if (size > RULES_MAX)
+    {
+        *msg = "Too many rules";
+        return ESP_ERR_NO_MEM;
+    }
+    if (!size)
+        return ESP_OK;
+
+    *dst = malloc(sizeof(rule_t) * size);
+    if (!*dst)
+    {
+        *msg = "Out of memory";
+        return ESP_ERR_NO_MEM;
+    }
+
+    const cJSON *item;
+    cJSON_ArrayForEach(item, json)
+    {
+        esp_err_t r = parse_rule(item, &(*dst)[*count], msg);
+        if (r != ESP_OK)
+        {
+            free(*dst);
+            *dst = NULL;
+            *count = 0;
+            return r;
+        }
+        (*count)++;
+    }
+
+    return ESP_OK;
+}
+
+static void install(const rule_t *parsed, size_t count)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (count)
+        memcpy(rules, parsed, sizeof(rule_t) * count);
+    rules_count = count;
+    last_minute = -1;
+    build_index();
+    xSemaphoreGive(lock);
+
+    ESP_LOGI(TAG, "Loaded %u rules", count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void evaluate(rule_t *r, int minute)
+{
+    bool active = true;
+
+    if (r->from >= 0)
+    {
+        // clock is not set, keep current state
+        if (minute < 0)
+            return;
+        active = r->from <= r->to
+            ? minute >= r->from && minute < r->to
+            : minute >= r->from || minute < r->to;
+    }
+
+    if (r->input[0])
+    {
+        if (!r->has_value || !isfinite(r->value))
+            return;
+        if (r->op == RULE_BELOW)
+            r->cond = r->cond ? r->value < r->threshold + r->hysteresis : r->value < r->threshold;
+        else
+            r->cond = r->cond ? r->value > r->threshold - r->hysteresis : r->value > r->threshold;
+        active = active && r->cond;
+    }
+
+    if (r->state != active)
+    {
+        r->state = active;
+        r->pending = true;
+    }
+}
+
+void rules_on_update(const device_t *dev)
+{
+    if (!lock)
+        return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    index_entry_t *e = index_slot(dev->uid);
+    if (e && e->uid)
+    {
+        float value = device_value(dev);
+        int minute = -1;
+        bool minute_read = false;
+        for (int i = e->first; i != NO_RULE; i = rules[i].next)
+        {
+            rule_t *r = &rules[i];
+            if (r->from >= 0 && !minute_read)
+            {
+                minute = system_clock_day_minute();
+                minute_read = true;
+            }
+            r->value = value;
+            r->has_value = true;
+            evaluate(r, minute);
+        }
+    }
+    xSemaphoreGive(lock);
+}
+
+TickType_t rules_process()
+{
+    if (!lock)
+        return portMAX_DELAY;
+
+    action_t actions[RULES_MAX];
+    size_t count = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (has_windows)
+    {
+        int minute = system_clock_day_minute();
+        if (minute != last_minute)
+        {
+            last_minute = minute;
+            for (size_t i = 0; i < rules_count; i++)
+                if (rules[i].from >= 0)
+                    evaluate(&rules[i], minute);
+        }
+    }
+    for (size_t i = 0; i < rules_count; i++)
+    {
+        rule_t *r = &rules[i];
+        if (!r->pending)
+            continue;
+        r->pending = false;
+        strcpy(actions[count].output, r->output);
+        actions[count].value = r->state ? r->on_value : r->off_value;
+        count++;
+    }
+    TickType_t timeout = has_windows ? pdMS_TO_TICKS(RULES_TICK_MS) : portMAX_DELAY;
+    xSemaphoreGive(lock);
+
+    // outside of the lock, device callbacks could take long
+    for (size_t i = 0; i < count; i++)
+    {
+        ESP_LOGI(TAG, "Rule: %s = %g", actions[i].output, actions[i].value);
+        esp_err_t r = node_write_device(actions[i].output, actions[i].value);
+        if (r != ESP_OK)
+            ESP_LOGW(TAG, "Error writing rule output '%s': %d (%s)", actions[i].output, r, esp_err_to_name(r));
+    }
+
+    return timeout;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t load(char **json)
+{
+    *json = NULL;
+
+    nvs_handle_t nvs;
+    CHECK(nvs_open(SETTINGS_PARTITION, NVS_READONLY, &nvs));
+    size_t size;
+    esp_err_t r = nvs_get_blob(nvs, RULES_NVS_KEY, NULL, &size);
+    if (r == ESP_OK)
+    {
+        *json = malloc(size + 1);
+        r = *json ? nvs_get_blob(nvs, RULES_NVS_KEY, *json, &size) : ESP_ERR_NO_MEM;
+        if (r == ESP_OK)
+            (*json)[size] = 0;
+    }
+    nvs_close(nvs);
+
+    if (r != ESP_OK)
+    {
+        free(*json);
+        *json = NULL;
+    }
+    return r;
+}
+
+esp_err_t rules_init()
+{
+    if (!lock)
+        lock = xSemaphoreCreateMutex();
+    if (!lock)
+        return ESP_ERR_NO_MEM;
+
+    char *txt = NULL;
+    esp_err_t r = load(&txt);
+    if (r == ESP_ERR_NVS_NOT_FOUND)
+        return ESP_OK;
+    if (r != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Error loading rules: %d (%s)", r, esp_err_to_name(r));
+        return ESP_OK;
+    }
+
+    cJSON *json = cJSON_Parse(txt);
+    free(txt);
+    const char *msg = "Invalid JSON";
+    rule_t *parsed = NULL;
+    size_t count = 0;
+    r = json ? parse_rules(json, &parsed, &count, &msg) : ESP_ERR_INVALID_ARG;
+    cJSON_Delete(json);
+    if (r == ESP_OK)
+        install(parsed, count);
+    else
+        ESP_LOGW(TAG, "Stored rules are invalid: %s", msg);
+    free(parsed);
+
+    return ESP_OK;
+}
+
+esp_err_t rules_set(const cJSON *json, const char **msg)
+{
+    *msg = NULL;
+    if (!lock)
+    {
+        *msg = "Rules are not initialized";
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // validate before saving
+    rule_t *parsed = NULL;
+    size_t count = 0;
+    CHECK(parse_rules(json, &parsed, &count, msg));
+
+    esp_err_t r = ESP_ERR_NO_MEM;
+    char *txt = cJSON_PrintUnformatted(json);
+    *msg = "Out of memory";
+    if (!txt)
+        goto exit;
+    size_t len = strlen(txt);
+    if (len > RULES_MAX_JSON_SIZE)
+    {
+        free(txt);
+        *msg = "Rules are too big";
+        r = ESP_ERR_INVALID_SIZE;
+        goto exit;
+    }
+
+    nvs_handle_t nvs;
+    r = nvs_open(SETTINGS_PARTITION, NVS_READWRITE, &nvs);
+    if (r == ESP_OK)
+    {
+        r = nvs_set_blob(nvs, RULES_NVS_KEY, txt, len);
+        if (r == ESP_OK)
+            r = nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    free(txt);
+    *msg = r == ESP_ERR_NVS_NOT_ENOUGH_SPACE ? "Not enough space in NVS" : "Error saving rules";
+    if (r != ESP_OK)
+        goto exit;
+
+    *msg = NULL;
+    install(parsed, count);
+
+exit:
+    free(parsed);
+    return r;
+}
+
+char *rules_get()
+{
+    char *txt = NULL;
+    if (load(&txt) == ESP_OK)
+        return txt;
+
+    return strdup("[]");
+}
@@ -0,0 +1,44 @@
+#ifndef ESP_IOT_NODE_PLUS_RULES_H_
+#define ESP_IOT_NODE_PLUS_RULES_H_
+
+#include <esp_err.h>
+#include <cJSON.h>
+#include <freertos/FreeRTOS.h>
+#include "device.h"
+
+/*
+ * Local automation rules, evaluated by node task on every device update,
+ * so control loops keep working without network.
+ *
+ * [
+ *   {
+ *     "input": "dht0_rh",   // optional, uid of the device driving the rule
+ *     "op": "<",            // "<" - active below threshold, ">" - above
+ *     "threshold": 60,
+ *     "hysteresis": 5,      // active rule turns inactive beyond threshold + or - hysteresis
+ *     "from": "08:00",      // optional local time window, rule is inactive outside of it
+ *     "to": "20:00",
+ *     "output": "relay2",   // uid of binary switch or number device
+ *     "on": 1,              // written when rule turns active
+ *     "off": 0              // written when rule turns inactive
+ *   }
+ * ]
+ *
+ * Output is written only when the rule changes its state.
+ */
+
+esp_err_t rules_init();
+
+// Validate, store and apply rules, `msg` is set to error description
+esp_err_t rules_set(const cJSON *json, const char **msg);
+
+// Stored rules JSON, must be freed by caller
+char *rules_get();
+
+// New device value, rule actions are deferred to rules_process()
+void rules_on_update(const device_t *dev);
+
+// Run time windows and pending actions, returns ticks until the next call is needed
+TickType_t rules_process();
+
+#endif // ESP_IOT_NODE_PLUS_RULES_H_
@@ -0,0 +1,246 @@
+#include "scheduler.h"
+#include <esp_timer.h>
+#include "common.h"
+
+#if DRIVER_SCHEDULER_WORKERS > 0
+
+static SemaphoreHandle_t lock = NULL;
+static SemaphoreHandle_t wake = NULL;
+
+// min-heap by deadline
+static driver_t *heap[DRIVER_SCHEDULER_MAX_DRIVERS];
+static size_t heap_size = 0;
+
+static inline bool earlier(size_t a, size_t b)
+{
+    return heap[a]->sched.deadline < heap[b]->sched.deadline;
+}
+
+static inline void swap(size_t a, size_t b)
+{
+    driver_t *tmp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = tmp;
+    heap[a]->sched.index = a;
+    heap[b]->sched.index = b;
+}
+
+static void sift_up(size_t i)
+{
+    while (i && earlier(i, (i - 1) / 2))
+    {
+        swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(size_t i)
+{
+    while (true)
+    {
+        size_t l = i * 2 + 1, r = l + 1, min = i;
+        if (l < heap_size && earlier(l, min))
+            min = l;
+        if (r < heap_size && earlier(r, min))
+            min = r;
+        if (min == i)
+            return;
+        swap(i, min);
+        i = min;
+    }
+}
+
+static void heap_push(driver_t *drv)
+{
+    heap[heap_size] = drv;
+    drv->sched.index = heap_size++;
+    sift_up(drv->sched.index);
+}
+
+static void heap_remove(size_t i)
+{
+    heap_size--;
+    if (i == heap_size)
+        return;
+    heap[i] = heap[heap_size];
+    heap[i]->sched.index = i;
+    sift_down(i);
+    sift_up(i);
+}
+
+static inline bool in_heap(const driver_t *drv)
+{
+    return drv->sched.index < heap_size && heap[drv->sched.index] == drv;
+}
+
+static void worker(void *arg)
+{
+    (void)arg;
+
+    while (true)
+    {
+        driver_t *drv = NULL;
+        TickType_t timeout = portMAX_DELAY;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (heap_size)
+        {
+            int64_t now = esp_timer_get_time();
+            if (heap[0]->sched.deadline <= now)
+            {
+                drv = heap[0];
+                heap_remove(0);
+                xEventGroupClearBits(drv->eg, DRIVER_BIT_IDLE);
+            }
+            else
+            {
+                timeout = pdMS_TO_TICKS((heap[0]->sched.deadline - now + 999) / 1000);
+                if (!timeout)
+                    timeout = 1;
+            }
+        }
+        xSemaphoreGive(lock);
+
+        if (!drv)
+        {
+            // sleep until the nearest deadline or schedule change
+            xSemaphoreTake(wake, timeout);
+            continue;
+        }
+
+        int64_t started = esp_timer_get_time();
+        drv->sample(drv);
+        int64_t now = esp_timer_get_time();
+        if (now - started > DRIVER_SCHEDULER_BUDGET_MS * 1000)
+        {
+            // other drivers are delayed meanwhile
+            drv->stats.over_budget++;
+            ESP_LOGW(TAG, "[%s] Sample took %" PRIi64 " ms, budget is %d ms", drv->name,
+                (now - started) / 1000, DRIVER_SCHEDULER_BUDGET_MS);
+        }
+
+        uint32_t step = drv->sched.step;
+        drv->sched.step = 0;
+        if (!step)
+            driver_flush_updates(drv);
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (drv->sched.active)
+        {
+            if (step)
+                drv->sched.deadline = now + (int64_t)step * 1000;
+            else
+            {
+                int64_t period = (int64_t)drv->period * 1000;
+                drv->sched.anchor += period;
+                if (drv->sched.anchor <= now)
+                {
+                    // skip missed samples, keep the phase
+                    drv->sched.anchor += ((now - drv->sched.anchor) / period + 1) * period;
+                    drv->stats.overruns++;
+                }
+                drv->sched.deadline = drv->sched.anchor;
+            }
+            heap_push(drv);
+        }
+        xEventGroupSetBits(drv->eg, DRIVER_BIT_IDLE);
+        xSemaphoreGive(lock);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t scheduler_init()
+{
+    lock = xSemaphoreCreateMutex();
+    wake = xSemaphoreCreateBinary();
+    if (!lock || !wake)
+    {
+        ESP_LOGE(TAG, "Error creating scheduler semaphores");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < DRIVER_SCHEDULER_WORKERS; i++)
+    {
+        if (xTaskCreatePinnedToCore(worker, "scheduler", DRIVER_SCHEDULER_STACK_SIZE, NULL,
+                DRIVER_SCHEDULER_PRIORITY, NULL, APP_CPU_NUM) != pdPASS)
+        {
+            ESP_LOGE(TAG, "Error creating scheduler task");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t scheduler_add(driver_t *drv)
+{
+    CHECK_ARG(drv && drv->sample && drv->period);
+
+    esp_err_t res = ESP_OK;
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    if (drv->sched.active)
+    {
+        res = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+    if (heap_size == DRIVER_SCHEDULER_MAX_DRIVERS)
+    {
+        ESP_LOGE(TAG, "[%s] Too many scheduled drivers", drv->name);
+        res = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+
+    int phase = drv->phase >= 0 ? drv->phase : (int)heap_size * DRIVER_SCHEDULER_STAGGER;
+    drv->sched.deadline = drv->sched.anchor = esp_timer_get_time() + (int64_t)phase * 1000;
+    drv->sched.step = 0;
+    drv->sched.active = true;
+    xEventGroupSetBits(drv->eg, DRIVER_BIT_IDLE);
+    heap_push(drv);
+    ESP_LOGI(TAG, "[%s] Scheduled every %" PRIu32 " ms, phase %d ms", drv->name, drv->period, phase);
+
+exit:
+    xSemaphoreGive(lock);
+    if (res == ESP_OK)
+        xSemaphoreGive(wake);
+    return res;
+}
+
+esp_err_t scheduler_remove(driver_t *drv)
+{
+    CHECK_ARG(drv);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool active = drv->sched.active;
+    drv->sched.active = false;
+    if (in_heap(drv))
+        heap_remove(drv->sched.index);
+    xSemaphoreGive(lock);
+
+    if (active)
+        xEventGroupWaitBits(drv->eg, DRIVER_BIT_IDLE, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    return ESP_OK;
+}
+
+#else
+
+esp_err_t scheduler_init()
+{
+    return ESP_OK;
+}
+
+esp_err_t scheduler_add(driver_t *drv)
+{
+    (void)drv;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t scheduler_remove(driver_t *drv)
+{
+    (void)drv;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
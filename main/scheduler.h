@@ -0,0 +1,22 @@
+#ifndef ESP_IOT_NODE_PLUS_SCHEDULER_H_
+#define ESP_IOT_NODE_PLUS_SCHEDULER_H_
+
+#include <esp_err.h>
+#include "driver.h"
+
+/*
+ * Deadline scheduler of periodic drivers. Sample callbacks are run by
+ * DRIVER_SCHEDULER_WORKERS shared tasks in order of their deadlines.
+ * Callbacks must not block longer than DRIVER_SCHEDULER_BUDGET_MS, waits
+ * for conversions etc. are done by rescheduling with driver_sample_after().
+ * Samples over the budget are logged and counted in driver stats.
+ */
+
+esp_err_t scheduler_init();
+
+// Schedule driver sample callback every drv->period ms, first one after drv->phase ms
+esp_err_t scheduler_add(driver_t *drv);
+// Unschedule driver, waits for running sample callback to finish
+esp_err_t scheduler_remove(driver_t *drv);
+
+#endif // ESP_IOT_NODE_PLUS_SCHEDULER_H_
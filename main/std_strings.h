@@ -20,6 +20,24 @@
 #define OPT_MOISTURE_CALIBRATION "moisture_calibration"
 #define OPT_TDS                  "tds"
 #define OPT_VALUE                "value"
+#define OPT_BATCH_STATE          "batch_state"
+#define OPT_REPORT               "report"
+#define OPT_DEADBAND             "deadband"
+#define OPT_MAX_SILENCE          "max_silence"
+#define OPT_DEVICES              "devices"
+#define OPT_PHASE                "phase"
+#define OPT_CONTINUOUS           "continuous"
+#define OPT_SAMPLE_RATE          "sample_rate"
+#define OPT_FILTER               "filter"
+#define OPT_FILTERS              "filters"
+#define OPT_WINDOW               "window"
+#define OPT_ALPHA                "alpha"
+#define OPT_TAU                  "tau"
+#define OPT_CUTOFF               "cutoff"
+#define OPT_METHOD               "method"
+#define OPT_DEGREE               "degree"
+#define OPT_POINTS               "points"
+#define OPT_DATA_RATE            "data_rate"
 
 
 // device classes
@@ -28,6 +46,7 @@
 #define DEV_CLASS_VOLTAGE     "voltage"
 #define DEV_CLASS_PH          "ph"
 #define DEV_CLASS_MOISTURE    "moisture"
+#define DEV_CLASS_FREQUENCY   "frequency"
 
 // measurement units
 #define DEV_MU_HUMIDITY    "%"
@@ -35,5 +54,7 @@
 #define DEV_MU_VOLTAGE     "V"
 #define DEV_MU_MOISTURE    "%"
 #define DEV_MU_TDS         "mg/L"
+#define DEV_MU_FREQUENCY   "Hz"
+#define DEV_MU_PERCENT     "%"
 
 #endif // JOINT_DRV_STD_STRINGS_H_
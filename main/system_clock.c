@@ -71,6 +71,29 @@ static void update(struct timeval *tv)
     log_time();
 }
 
+bool system_clock_is_set()
+{
+    struct tm t = { 0 };
+    time_t now;
+
+    time(&now);
+    gmtime_r(&now, &t);
+    return t.tm_year + 1900 >= SYSTEM_CLOCK_MIN_YEAR;
+}
+
+int system_clock_day_minute()
+{
+    struct tm t = { 0 };
+    time_t now;
+
+    time(&now);
+    localtime_r(&now, &t);
+    if (t.tm_year + 1900 < SYSTEM_CLOCK_MIN_YEAR)
+        return -1;
+
+    return t.tm_hour * 60 + t.tm_min;
+}
+
 void system_clock_sntp_init()
 {
     if (!settings.sntp.enabled)
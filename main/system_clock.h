@@ -1,10 +1,17 @@
 #ifndef JOINT_SYSTEM_CLOCK_H_
 #define JOINT_SYSTEM_CLOCK_H_
 
+#include <stdbool.h>
 #include <esp_err.h>
 
 esp_err_t system_clock_init();
 
 void system_clock_sntp_init();
 
+// False if the clock has not been set yet
+bool system_clock_is_set();
+
+// Local time in minutes since midnight, -1 if the clock has not been set
+int system_clock_day_minute();
+
 #endif // JOINT_SYSTEM_CLOCK_H_
@@ -0,0 +1,520 @@
+// Minimal cJSON for host tests: tree building, parsing and unformatted printing
+// with the output format of cJSON 1.7, the version shipped with ESP-IDF
+#include <ctype.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <cJSON.h>
+
+static cJSON *create(int type)
+{
+    cJSON *item = calloc(1, sizeof(cJSON));
+    if (item)
+        item->type = type;
+    return item;
+}
+
+static void set_number(cJSON *item, double value)
+{
+    item->valuedouble = value;
+    if (value >= INT_MAX)
+        item->valueint = INT_MAX;
+    else if (value <= (double)INT_MIN)
+        item->valueint = INT_MIN;
+    else
+        item->valueint = (int)value;
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    while (item)
+    {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+        item = next;
+    }
+}
+
+void cJSON_free(void *p)
+{
+    free(p);
+}
+
+cJSON *cJSON_CreateObject(void)
+{
+    return create(cJSON_Object);
+}
+
+cJSON *cJSON_CreateArray(void)
+{
+    return create(cJSON_Array);
+}
+
+cJSON *cJSON_CreateNumber(double value)
+{
+    cJSON *item = create(cJSON_Number);
+    if (item)
+        set_number(item, value);
+    return item;
+}
+
+cJSON *cJSON_CreateString(const char *value)
+{
+    cJSON *item = create(cJSON_String);
+    if (item && !(item->valuestring = strdup(value)))
+    {
+        free(item);
+        return NULL;
+    }
+    return item;
+}
+
+cJSON *cJSON_CreateBool(cJSON_bool value)
+{
+    return create(value ? cJSON_True : cJSON_False);
+}
+
+cJSON *cJSON_CreateStringArray(const char *const *strings, int count)
+{
+    cJSON *array = cJSON_CreateArray();
+    for (int i = 0; array && i < count; i++)
+        if (!cJSON_AddItemToArray(array, cJSON_CreateString(strings[i])))
+        {
+            cJSON_Delete(array);
+            return NULL;
+        }
+    return array;
+}
+
+cJSON_bool cJSON_AddItemToArray(cJSON *array, cJSON *item)
+{
+    if (!array || !item)
+        return 0;
+    if (!array->child)
+    {
+        array->child = item;
+        item->prev = item;
+        return 1;
+    }
+    // child->prev points to the last item
+    cJSON *last = array->child->prev;
+    last->next = item;
+    item->prev = last;
+    array->child->prev = item;
+    return 1;
+}
+
+cJSON_bool cJSON_AddItemToObject(cJSON *object, const char *key, cJSON *item)
+{
+    if (!item || !key)
+        return 0;
+    free(item->string);
+    if (!(item->string = strdup(key)))
+        return 0;
+    return cJSON_AddItemToArray(object, item);
+}
+
+static cJSON *add(cJSON *object, const char *key, cJSON *item)
+{
+    if (cJSON_AddItemToObject(object, key, item))
+        return item;
+    cJSON_Delete(item);
+    return NULL;
+}
+
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *key, const char *value)
+{
+    return add(object, key, cJSON_CreateString(value));
+}
+
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *key, double value)
+{
+    return add(object, key, cJSON_CreateNumber(value));
+}
+
+cJSON *cJSON_AddBoolToObject(cJSON *object, const char *key, cJSON_bool value)
+{
+    return add(object, key, cJSON_CreateBool(value));
+}
+
+cJSON *cJSON_AddObjectToObject(cJSON *object, const char *key)
+{
+    return add(object, key, cJSON_CreateObject());
+}
+
+cJSON *cJSON_AddArrayToObject(cJSON *object, const char *key)
+{
+    return add(object, key, cJSON_CreateArray());
+}
+
+int cJSON_GetArraySize(const cJSON *array)
+{
+    int res = 0;
+    for (const cJSON *c = array ? array->child : NULL; c; c = c->next)
+        res++;
+    return res;
+}
+
+cJSON *cJSON_GetArrayItem(const cJSON *array, int index)
+{
+    cJSON *c = array ? array->child : NULL;
+    if (index < 0)
+        return NULL;
+    while (c && index-- > 0)
+        c = c->next;
+    return c;
+}
+
+cJSON *cJSON_GetObjectItem(const cJSON *object, const char *key)
+{
+    for (cJSON *c = object ? object->child : NULL; c; c = c->next)
+        if (c->string && !strcasecmp(c->string, key))
+            return c;
+    return NULL;
+}
+
+cJSON *cJSON_GetObjectItemCaseSensitive(const cJSON *object, const char *key)
+{
+    for (cJSON *c = object ? object->child : NULL; c; c = c->next)
+        if (c->string && !strcmp(c->string, key))
+            return c;
+    return NULL;
+}
+
+double cJSON_GetNumberValue(const cJSON *item)
+{
+    return cJSON_IsNumber(item) ? item->valuedouble : NAN;
+}
+
+char *cJSON_GetStringValue(const cJSON *item)
+{
+    return cJSON_IsString(item) ? item->valuestring : NULL;
+}
+
+cJSON_bool cJSON_IsNumber(const cJSON *item)
+{
+    return item && (item->type & 0xff) == cJSON_Number;
+}
+
+cJSON_bool cJSON_IsString(const cJSON *item)
+{
+    return item && (item->type & 0xff) == cJSON_String;
+}
+
+cJSON_bool cJSON_IsBool(const cJSON *item)
+{
+    return item && (item->type & (cJSON_True | cJSON_False));
+}
+
+cJSON_bool cJSON_IsTrue(const cJSON *item)
+{
+    return item && (item->type & 0xff) == cJSON_True;
+}
+
+cJSON_bool cJSON_IsArray(const cJSON *item)
+{
+    return item && (item->type & 0xff) == cJSON_Array;
+}
+
+cJSON_bool cJSON_IsObject(const cJSON *item)
+{
+    return item && (item->type & 0xff) == cJSON_Object;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Printing, the output grows by doubling like in cJSON
+
+typedef struct
+{
+    char *buf;
+    size_t len;
+    size_t size;
+} out_t;
+
+static int reserve(out_t *o, size_t len)
+{
+    if (o->len + len < o->size)
+        return 1;
+    size_t size = o->size;
+    while (o->len + len >= size)
+        size *= 2;
+    char *buf = realloc(o->buf, size);
+    if (!buf)
+        return 0;
+    o->buf = buf;
+    o->size = size;
+    return 1;
+}
+
+static int put(out_t *o, const char *data, size_t len)
+{
+    if (!reserve(o, len))
+        return 0;
+    memcpy(o->buf + o->len, data, len);
+    o->len += len;
+    return 1;
+}
+
+static int put_string(out_t *o, const char *s)
+{
+    int ok = put(o, "\"", 1);
+    for (const char *p = s ? s : ""; ok && *p; p++)
+    {
+        char esc[8];
+        switch (*p)
+        {
+            case '"': ok = put(o, "\\\"", 2); break;
+            case '\\': ok = put(o, "\\\\", 2); break;
+            case '\b': ok = put(o, "\\b", 2); break;
+            case '\f': ok = put(o, "\\f", 2); break;
+            case '\n': ok = put(o, "\\n", 2); break;
+            case '\r': ok = put(o, "\\r", 2); break;
+            case '\t': ok = put(o, "\\t", 2); break;
+            default:
+                if ((unsigned char)*p < 32)
+                    ok = put(o, esc, snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*p));
+                else
+                    ok = put(o, p, 1);
+        }
+    }
+    return ok && put(o, "\"", 1);
+}
+
+static int put_number(out_t *o, const cJSON *item)
+{
+    char buf[32];
+    double d = item->valuedouble;
+    int len;
+    if (isnan(d) || isinf(d))
+        len = snprintf(buf, sizeof(buf), "null");
+    else if (d == (double)item->valueint)
+        len = snprintf(buf, sizeof(buf), "%d", item->valueint);
+    else
+    {
+        // shortest of 15 or 17 digits that reads back the same
+        double test;
+        len = snprintf(buf, sizeof(buf), "%1.15g", d);
+        if (sscanf(buf, "%lg", &test) != 1 || test != d)
+            len = snprintf(buf, sizeof(buf), "%1.17g", d);
+    }
+    return put(o, buf, len);
+}
+
+static int put_value(out_t *o, const cJSON *item)
+{
+    switch (item->type & 0xff)
+    {
+        case cJSON_NULL: return put(o, "null", 4);
+        case cJSON_False: return put(o, "false", 5);
+        case cJSON_True: return put(o, "true", 4);
+        case cJSON_Number: return put_number(o, item);
+        case cJSON_String: return put_string(o, item->valuestring);
+        case cJSON_Array:
+        case cJSON_Object:
+        {
+            bool object = (item->type & 0xff) == cJSON_Object;
+            if (!put(o, object ? "{" : "[", 1))
+                return 0;
+            for (const cJSON *c = item->child; c; c = c->next)
+            {
+                if (c != item->child && !put(o, ",", 1))
+                    return 0;
+                if (object && !(put_string(o, c->string) && put(o, ":", 1)))
+                    return 0;
+                if (!put_value(o, c))
+                    return 0;
+            }
+            return put(o, object ? "}" : "]", 1);
+        }
+        default:
+            return 0;
+    }
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    out_t o = { .buf = malloc(256), .size = 256 };
+    if (!o.buf)
+        return NULL;
+    if (!item || !put_value(&o, item) || !put(&o, "", 1))
+    {
+        free(o.buf);
+        return NULL;
+    }
+    // shrink to the printed size
+    char *res = realloc(o.buf, o.len);
+    return res ? res : o.buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Parsing
+
+static const char *skip(const char *p, const char *end)
+{
+    while (p < end && isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static const char *parse_value(cJSON *item, const char *p, const char *end);
+
+static const char *parse_string(char **res, const char *p, const char *end)
+{
+    if (p >= end || *p != '"')
+        return NULL;
+    const char *start = ++p;
+    while (p < end && *p != '"')
+        p += *p == '\\' ? 2 : 1;
+    if (p >= end)
+        return NULL;
+
+    char *s = malloc(p - start + 1), *d = s;
+    if (!s)
+        return NULL;
+    for (const char *c = start; c < p; c++)
+    {
+        if (*c != '\\')
+        {
+            *d++ = *c;
+            continue;
+        }
+        switch (*++c)
+        {
+            case 'b': *d++ = '\b'; break;
+            case 'f': *d++ = '\f'; break;
+            case 'n': *d++ = '\n'; break;
+            case 'r': *d++ = '\r'; break;
+            case 't': *d++ = '\t'; break;
+            case 'u':
+            {
+                // basic multilingual plane only
+                unsigned cp;
+                if (p - c < 5 || sscanf(c + 1, "%4x", &cp) != 1)
+                {
+                    free(s);
+                    return NULL;
+                }
+                c += 4;
+                if (cp < 0x80)
+                    *d++ = (char)cp;
+                else if (cp < 0x800)
+                {
+                    *d++ = (char)(0xc0 | cp >> 6);
+                    *d++ = (char)(0x80 | (cp & 0x3f));
+                }
+                else
+                {
+                    *d++ = (char)(0xe0 | cp >> 12);
+                    *d++ = (char)(0x80 | ((cp >> 6) & 0x3f));
+                    *d++ = (char)(0x80 | (cp & 0x3f));
+                }
+                break;
+            }
+            default: *d++ = *c; break;
+        }
+    }
+    *d = 0;
+    *res = s;
+    return p + 1;
+}
+
+static const char *parse_container(cJSON *item, const char *p, const char *end, bool object)
+{
+    item->type = object ? cJSON_Object : cJSON_Array;
+    p = skip(p + 1, end);
+    if (p < end && *p == (object ? '}' : ']'))
+        return p + 1;
+    while (p < end)
+    {
+        cJSON *child = create(cJSON_Invalid);
+        if (!child)
+            return NULL;
+        cJSON_AddItemToArray(item, child);
+        if (object)
+        {
+            p = parse_string(&child->string, skip(p, end), end);
+            if (!p || (p = skip(p, end)) >= end || *p != ':')
+                return NULL;
+            p++;
+        }
+        p = parse_value(child, skip(p, end), end);
+        if (!p || (p = skip(p, end)) >= end)
+            return NULL;
+        if (*p == (object ? '}' : ']'))
+            return p + 1;
+        if (*p != ',')
+            return NULL;
+        p++;
+    }
+    return NULL;
+}
+
+static const char *parse_value(cJSON *item, const char *p, const char *end)
+{
+    if (p >= end)
+        return NULL;
+    if (end - p >= 4 && !strncmp(p, "null", 4))
+    {
+        item->type = cJSON_NULL;
+        return p + 4;
+    }
+    if (end - p >= 5 && !strncmp(p, "false", 5))
+    {
+        item->type = cJSON_False;
+        return p + 5;
+    }
+    if (end - p >= 4 && !strncmp(p, "true", 4))
+    {
+        item->type = cJSON_True;
+        item->valueint = 1;
+        return p + 4;
+    }
+    if (*p == '"')
+    {
+        item->type = cJSON_String;
+        return parse_string(&item->valuestring, p, end);
+    }
+    if (*p == '{' || *p == '[')
+        return parse_container(item, p, end, *p == '{');
+    if (*p == '-' || isdigit((unsigned char)*p))
+    {
+        char *num_end;
+        double value = strtod(p, &num_end);
+        if (num_end == p || num_end > end)
+            return NULL;
+        item->type = cJSON_Number;
+        set_number(item, value);
+        return num_end;
+    }
+    return NULL;
+}
+
+cJSON *cJSON_ParseWithLength(const char *value, size_t length)
+{
+    // strtod needs a terminated copy
+    char *copy = malloc(length + 1);
+    if (!copy)
+        return NULL;
+    memcpy(copy, value, length);
+    copy[length] = 0;
+
+    cJSON *item = create(cJSON_Invalid);
+    if (item && !parse_value(item, skip(copy, copy + length), copy + length))
+    {
+        cJSON_Delete(item);
+        item = NULL;
+    }
+    free(copy);
+    return item;
+}
+
+cJSON *cJSON_Parse(const char *value)
+{
+    return value ? cJSON_ParseWithLength(value, strlen(value)) : NULL;
+}
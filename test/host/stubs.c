@@ -0,0 +1,88 @@
+// Single threaded fakes of IDF and FreeRTOS services used by pure modules
+#include <stdio.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+const char *TAG = "test";
+const char *SYSTEM_ID = "test";
+
+static int handle;
+
+const char *esp_err_to_name(esp_err_t err)
+{
+    static char buf[16];
+    snprintf(buf, sizeof(buf), "0x%x", err);
+    return buf;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return &handle;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return &handle;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return &handle;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    (void)sem;
+    (void)timeout;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    (void)sem;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t timeout)
+{
+    (void)sem;
+    (void)timeout;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    (void)sem;
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    (void)sem;
+}
+
+// Heap calls of the test binary are routed here by the linker, see CMakeLists.txt
+size_t host_allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *p, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    host_allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    host_allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    host_allocations++;
+    return __real_realloc(p, size);
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stddef.h>
+#include <stdbool.h>
+typedef struct cJSON { struct cJSON *next, *prev, *child; int type; char *valuestring; int valueint; double valuedouble; char *string; } cJSON;
+typedef int cJSON_bool;
+#define cJSON_Invalid (0)
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+cJSON *cJSON_Parse(const char *);
+cJSON *cJSON_ParseWithLength(const char *, size_t);
+char *cJSON_Print(const cJSON *);
+char *cJSON_PrintUnformatted(const cJSON *);
+void cJSON_Delete(cJSON *);
+void cJSON_free(void *);
+int cJSON_GetArraySize(const cJSON *);
+cJSON *cJSON_GetArrayItem(const cJSON *, int);
+cJSON *cJSON_GetObjectItem(const cJSON *, const char *);
+cJSON *cJSON_GetObjectItemCaseSensitive(const cJSON *, const char *);
+double cJSON_GetNumberValue(const cJSON *);
+char *cJSON_GetStringValue(const cJSON *);
+cJSON_bool cJSON_IsNumber(const cJSON *);
+cJSON_bool cJSON_IsString(const cJSON *);
+cJSON_bool cJSON_IsBool(const cJSON *);
+cJSON_bool cJSON_IsTrue(const cJSON *);
+cJSON_bool cJSON_IsArray(const cJSON *);
+cJSON_bool cJSON_IsObject(const cJSON *);
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_CreateArray(void);
+cJSON *cJSON_CreateStringArray(const char *const *, int);
+cJSON *cJSON_AddStringToObject(cJSON *, const char *, const char *);
+cJSON *cJSON_AddNumberToObject(cJSON *, const char *, double);
+cJSON *cJSON_AddBoolToObject(cJSON *, const char *, cJSON_bool);
+cJSON *cJSON_AddObjectToObject(cJSON *, const char *);
+cJSON *cJSON_AddArrayToObject(cJSON *, const char *);
+cJSON_bool cJSON_AddItemToObject(cJSON *, const char *, cJSON *);
+cJSON_bool cJSON_AddItemToArray(cJSON *, cJSON *);
+cJSON *cJSON_CreateNumber(double);
+cJSON *cJSON_CreateString(const char *);
+cJSON *cJSON_CreateBool(cJSON_bool);
+#define cJSON_ArrayForEach(element, array) for(element = (array != NULL) ? (array)->child : NULL; element != NULL; element = element->next)
@@ -0,0 +1,10 @@
+#pragma once
+#include "esp_err.h"
+typedef enum { CALIBRATION_LINEAR = 0 } calibration_type_t;
+typedef struct { float code; float value; } calibration_point_t;
+typedef struct { calibration_type_t type; size_t count; size_t filled; calibration_point_t *points; } calibration_handle_t;
+esp_err_t calibration_init(calibration_handle_t *, size_t, calibration_type_t);
+esp_err_t calibration_free(calibration_handle_t *);
+esp_err_t calibration_add_point(calibration_handle_t *, float, float);
+esp_err_t calibration_add_points(calibration_handle_t *, const calibration_point_t *, size_t);
+esp_err_t calibration_get_value(const calibration_handle_t *, float, float *);
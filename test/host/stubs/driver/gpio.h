@@ -0,0 +1,8 @@
+#pragma once
+#include "esp_err.h"
+#include "esp_intr_alloc.h"
+typedef int gpio_num_t;
+#define GPIO_NUM_NC (-1)
+#define GPIO_NUM_MAX 40
+#define GPIO_IS_VALID_GPIO(n) ((n) >= 0 && (n) < GPIO_NUM_MAX)
+esp_err_t gpio_install_isr_service(int intr_alloc_flags);
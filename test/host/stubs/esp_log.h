@@ -0,0 +1,8 @@
+#pragma once
+#include <stdio.h>
+#include "esp_err.h"
+#define ESP_LOGE(t, f, ...) fprintf(stderr, "E (%s) " f "\n", t, ##__VA_ARGS__)
+#define ESP_LOGW(t, f, ...) fprintf(stderr, "W (%s) " f "\n", t, ##__VA_ARGS__)
+#define ESP_LOGI(t, f, ...) do { } while (0)
+#define ESP_LOGD(t, f, ...) do { } while (0)
+#define ESP_LOGV(t, f, ...) do { } while (0)
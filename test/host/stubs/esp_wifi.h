@@ -0,0 +1,5 @@
+#pragma once
+#include "esp_err.h"
+typedef enum { WIFI_AUTH_WPA2_PSK, WIFI_AUTH_WPA_WPA2_PSK } wifi_auth_mode_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; uint8_t channel; wifi_auth_mode_t authmode; uint8_t max_connection; } wifi_ap_config_t;
+typedef struct { uint8_t ssid[32]; uint8_t password[64]; struct { wifi_auth_mode_t authmode; } threshold; } wifi_sta_config_t;
@@ -0,0 +1,33 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t EventBits_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(x) ((TickType_t)(x))
+#define portTICK_PERIOD_MS 1
+#define configTICK_RATE_HZ 1000
+#define tskIDLE_PRIORITY 0
+#define APP_CPU_NUM 1
+#define PRO_CPU_NUM 0
+#define tskNO_AFFINITY 0x7fffffff
+typedef struct { int x; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(m) ((void)(m))
+#define portEXIT_CRITICAL(m) ((void)(m))
+#define portENTER_CRITICAL_ISR(m) ((void)(m))
+#define portEXIT_CRITICAL_ISR(m) ((void)(m))
+#define taskENTER_CRITICAL portENTER_CRITICAL
+#define taskEXIT_CRITICAL portEXIT_CRITICAL
+#define taskENTER_CRITICAL_ISR portENTER_CRITICAL_ISR
+#define taskEXIT_CRITICAL_ISR portEXIT_CRITICAL_ISR
+#define portYIELD_FROM_ISR(x) ((void)(x))
+#define configASSERT(x)
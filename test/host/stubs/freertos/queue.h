@@ -0,0 +1,16 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void *QueueHandle_t;
+typedef void *QueueSetHandle_t;
+typedef void *QueueSetMemberHandle_t;
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void *, TickType_t);
+BaseType_t xQueueSendToBack(QueueHandle_t, const void *, TickType_t);
+BaseType_t xQueueSendFromISR(QueueHandle_t, const void *, BaseType_t *);
+BaseType_t xQueueReceive(QueueHandle_t, void *, TickType_t);
+BaseType_t xQueueReset(QueueHandle_t);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t);
+void vQueueDelete(QueueHandle_t);
+QueueSetHandle_t xQueueCreateSet(UBaseType_t);
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t, QueueSetHandle_t);
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t, TickType_t);
@@ -0,0 +1,23 @@
+#pragma once
+#include "FreeRTOS.h"
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted, eInvalid } eTaskState;
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite } eNotifyAction;
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *, BaseType_t);
+BaseType_t xTaskCreate(TaskFunction_t, const char *, uint32_t, void *, UBaseType_t, TaskHandle_t *);
+void vTaskDelete(TaskHandle_t);
+void vTaskDelay(TickType_t);
+void vTaskDelayUntil(TickType_t *, TickType_t);
+BaseType_t xTaskDelayUntil(TickType_t *, TickType_t);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+eTaskState eTaskGetState(TaskHandle_t);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t *);
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, eNotifyAction);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t, uint32_t, eNotifyAction, BaseType_t *);
+BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t *, TickType_t);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t);
@@ -0,0 +1,17 @@
+#pragma once
+#include "esp_err.h"
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+typedef enum { MQTT_EVENT_ANY=-1, MQTT_EVENT_ERROR=0, MQTT_EVENT_CONNECTED, MQTT_EVENT_DISCONNECTED, MQTT_EVENT_SUBSCRIBED, MQTT_EVENT_UNSUBSCRIBED, MQTT_EVENT_PUBLISHED, MQTT_EVENT_DATA } esp_mqtt_event_id_t;
+typedef struct { esp_mqtt_event_id_t event_id; esp_mqtt_client_handle_t client; char *data; int data_len; int total_data_len; int current_data_offset; char *topic; int topic_len; int msg_id; } esp_mqtt_event_t;
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+typedef const char *esp_event_base_t;
+#define ESP_EVENT_ANY_ID -1
+typedef struct { struct { struct { const char *uri; } address; } broker; struct { const char *username; const char *client_id; struct { const char *password; } authentication; } credentials; struct { int size; int out_size; } buffer; struct { int timeout_ms; } network; } esp_mqtt_client_config_t;
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t, int, void (*)(void *, esp_event_base_t, int32_t, void *), void *);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t, const char *, const char *, int, int, int);
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t, const char *, const char *, int, int, int, bool);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t, const char *, int);
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t, const char *);
@@ -0,0 +1,57 @@
+#ifndef ESP_IOT_NODE_PLUS_TEST_H_
+#define ESP_IOT_NODE_PLUS_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * Minimal assertions of host tests, a failed one exits with status 1.
+ */
+
+// Number of malloc, calloc and realloc calls made by the test binary
+extern size_t host_allocations;
+
+#define TEST_ASSERT(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_INT(expected, actual) \
+    do { \
+        long long __e = (expected), __a = (actual); \
+        if (__e != __a) { \
+            fprintf(stderr, "%s:%d: expected %lld, got %lld\n", __FILE__, __LINE__, __e, __a); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_FLOAT_WITHIN(delta, expected, actual) \
+    do { \
+        double __e = (expected), __a = (actual); \
+        if (!(fabs(__e - __a) <= (delta))) { \
+            fprintf(stderr, "%s:%d: expected %g +- %g, got %g\n", __FILE__, __LINE__, __e, (double)(delta), __a); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define TEST_ASSERT_EQUAL_STRING(expected, actual) \
+    do { \
+        const char *__e = (expected), *__a = (actual); \
+        if (strcmp(__e, __a)) { \
+            fprintf(stderr, "%s:%d: expected \"%s\", got \"%s\"\n", __FILE__, __LINE__, __e, __a); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define RUN_TEST(fn) \
+    do { \
+        fn(); \
+        printf("%s: ok\n", #fn); \
+    } while (0)
+
+#endif // ESP_IOT_NODE_PLUS_TEST_H_
@@ -0,0 +1,373 @@
+#include "test.h"
+#include "../../main/backlog.c"
+
+/*
+ * Backlog partition is emulated by a NOR flash in a file: erase sets bytes to 0xff,
+ * write only clears bits. Power cut stops a write after the given number of bytes
+ * and fails everything after it until reboot.
+ */
+
+#define FLASH_SECTORS 6
+#define FLASH_SIZE (FLASH_SECTORS * SECTOR_SIZE)
+#define RECORDS_PER_SECTOR (SLOTS - 1)
+#define TIME 1760000000
+
+static FILE *flash = NULL;
+static esp_partition_t partition = { .type = ESP_PARTITION_TYPE_DATA, .size = FLASH_SIZE, .erase_size = SECTOR_SIZE };
+static long cut_after = -1; // bytes written before power is cut, -1 if not armed
+static bool powered = true;
+
+static system_mode_t mode = MODE_OFFLINE;
+static int64_t now = 0;
+static bool publish_fails = false;
+
+static int received[4096];
+static size_t received_count = 0;
+static size_t messages = 0;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    (void)type;
+    (void)subtype;
+    (void)label;
+    return &partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset, void *dst, size_t size)
+{
+    (void)p;
+    if (!powered)
+        return ESP_FAIL;
+    TEST_ASSERT(offset + size <= FLASH_SIZE);
+    fseek(flash, (long)offset, SEEK_SET);
+    TEST_ASSERT_EQUAL_INT(size, fread(dst, 1, size, flash));
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *p, size_t offset, const void *src, size_t size)
+{
+    (void)p;
+    if (!powered)
+        return ESP_FAIL;
+    TEST_ASSERT(offset + size <= FLASH_SIZE);
+
+    uint8_t old[SECTOR_SIZE];
+    TEST_ASSERT(size <= sizeof(old));
+    esp_partition_read(p, offset, old, size);
+    if (cut_after >= 0 && (size_t)cut_after < size)
+    {
+        size = cut_after;
+        powered = false;
+    }
+    for (size_t i = 0; i < size; i++)
+        old[i] &= ((const uint8_t *)src)[i];
+    fseek(flash, (long)offset, SEEK_SET);
+    TEST_ASSERT_EQUAL_INT(size, fwrite(old, 1, size, flash));
+    fflush(flash);
+    return powered ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *p, size_t offset, size_t size)
+{
+    (void)p;
+    if (!powered)
+        return ESP_FAIL;
+    TEST_ASSERT(offset % SECTOR_SIZE == 0 && size % SECTOR_SIZE == 0 && offset + size <= FLASH_SIZE);
+
+    uint8_t blank[SECTOR_SIZE];
+    memset(blank, 0xff, sizeof(blank));
+    fseek(flash, (long)offset, SEEK_SET);
+    for (size_t i = 0; i < size; i += SECTOR_SIZE)
+        fwrite(blank, 1, SECTOR_SIZE, flash);
+    fflush(flash);
+    return ESP_OK;
+}
+
+uint16_t esp_rom_crc16_le(uint16_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+    }
+    return ~crc;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++)
+            crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    }
+    return ~crc;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return now;
+}
+
+system_mode_t system_mode()
+{
+    return mode;
+}
+
+bool system_clock_is_set()
+{
+    return true;
+}
+
+float device_value(const device_t *dev)
+{
+    return dev->sensor.value;
+}
+
+time_t device_update_time(const device_t *dev)
+{
+    (void)dev;
+    return TIME;
+}
+
+int mqtt_publish_subtopic(const char *topic, const char *data, int len, int qos, int retain)
+{
+    (void)qos;
+    (void)retain;
+    TEST_ASSERT_EQUAL_STRING(BACKLOG_TOPIC, topic);
+    if (publish_fails)
+        return -1;
+
+    char msg[sizeof(payload) + 1];
+    TEST_ASSERT(len < (int)sizeof(msg));
+    memcpy(msg, data, len);
+    msg[len] = 0;
+    TEST_ASSERT(msg[0] == '[' && msg[len - 1] == ']');
+
+    // [["d0",1760000000,12],...]
+    for (const char *s = msg + 1; (s = strchr(s, '[')); s++)
+    {
+        unsigned t;
+        int value;
+        TEST_ASSERT_EQUAL_INT(2, sscanf(s, "[\"d0\",%u,%d]", &t, &value));
+        TEST_ASSERT_EQUAL_INT(TIME, t);
+        TEST_ASSERT(received_count < sizeof(received) / sizeof(received[0]));
+        received[received_count++] = value;
+    }
+    messages++;
+    return 1;
+}
+
+// Module state is lost, flash is kept
+static void reboot()
+{
+    cut_after = -1;
+    powered = true;
+    memset(&head, 0, sizeof(head));
+    memset(&tail, 0, sizeof(tail));
+    pending = 0;
+    head_seq = 0;
+    next_batch = 0;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, backlog_init());
+}
+
+static void add(int value)
+{
+    device_t dev;
+    memset(&dev, 0, sizeof(dev));
+    strcpy(dev.uid, "d0");
+    dev.type = DEV_SENSOR;
+    dev.sensor.value = value;
+    backlog_append(&dev);
+    backlog_process();
+}
+
+// Forwards everything, returns number of records received
+static size_t drain()
+{
+    received_count = 0;
+    mode = MODE_ONLINE;
+    for (int i = 0; i < 1000 && backlog_process() != portMAX_DELAY; i++)
+        now += BACKLOG_INTERVAL_MS * 1000;
+    mode = MODE_OFFLINE;
+    return received_count;
+}
+
+static void assert_sequence(size_t from, size_t count, int first)
+{
+    for (size_t i = 0; i < count; i++)
+        TEST_ASSERT_EQUAL_INT(first + (int)i, received[from + i]);
+}
+
+static void setup()
+{
+    if (flash)
+        fclose(flash);
+    flash = tmpfile();
+    TEST_ASSERT(flash);
+    uint8_t blank[SECTOR_SIZE];
+    memset(blank, 0, sizeof(blank)); // garbage, must be formatted
+    for (int i = 0; i < FLASH_SECTORS; i++)
+        fwrite(blank, 1, SECTOR_SIZE, flash);
+    publish_fails = false;
+    reboot();
+    TEST_ASSERT_EQUAL_INT(0, pending);
+}
+
+static void test_forward_after_reboot()
+{
+    setup();
+    for (int i = 0; i < 100; i++)
+        add(i);
+    reboot();
+    TEST_ASSERT_EQUAL_INT(100, pending);
+    TEST_ASSERT_EQUAL_INT(100, drain());
+    assert_sequence(0, 100, 0);
+    TEST_ASSERT_EQUAL_INT((100 + BACKLOG_BATCH - 1) / BACKLOG_BATCH, messages);
+
+    // forwarded records stay forwarded
+    reboot();
+    TEST_ASSERT_EQUAL_INT(0, pending);
+    TEST_ASSERT_EQUAL_INT(0, drain());
+}
+
+static void test_staged_until_process()
+{
+    setup();
+    device_t dev;
+    memset(&dev, 0, sizeof(dev));
+    strcpy(dev.uid, "d0");
+    dev.type = DEV_SENSOR;
+    for (int i = 0; i < 10; i++)
+    {
+        dev.sensor.value = i;
+        backlog_append(&dev);
+    }
+    // nothing is written while device locks may be held
+    TEST_ASSERT_EQUAL_INT(0, pending);
+    TEST_ASSERT_EQUAL_INT(10, drain());
+    assert_sequence(0, 10, 0);
+}
+
+static void test_wrap_around()
+{
+    setup();
+    for (int i = 0; i < 2000; i++)
+        add(i);
+    reboot();
+    size_t count = drain();
+
+    // the newest records are kept in order, at most one sector is being reused
+    TEST_ASSERT(count >= (FLASH_SECTORS - 1) * RECORDS_PER_SECTOR);
+    TEST_ASSERT(count <= FLASH_SECTORS * RECORDS_PER_SECTOR);
+    assert_sequence(0, count, 2000 - (int)count);
+
+    // log keeps working after wrapping several times
+    for (int i = 0; i < 50; i++)
+        add(i);
+    reboot();
+    TEST_ASSERT_EQUAL_INT(50, drain());
+    assert_sequence(0, 50, 0);
+}
+
+static void test_partial_forward()
+{
+    setup();
+    for (int i = 0; i < 300; i++)
+        add(i);
+
+    // one batch is forwarded, the rest is forwarded after reboot
+    mode = MODE_ONLINE;
+    received_count = 0;
+    backlog_process();
+    mode = MODE_OFFLINE;
+    TEST_ASSERT_EQUAL_INT(BACKLOG_BATCH, received_count);
+    reboot();
+    TEST_ASSERT_EQUAL_INT(300 - BACKLOG_BATCH, drain());
+    assert_sequence(0, 300 - BACKLOG_BATCH, BACKLOG_BATCH);
+}
+
+static void test_publish_failure()
+{
+    setup();
+    for (int i = 0; i < 40; i++)
+        add(i);
+    publish_fails = true;
+    drain();
+    TEST_ASSERT_EQUAL_INT(40, pending);
+    publish_fails = false;
+    TEST_ASSERT_EQUAL_INT(40, drain());
+    assert_sequence(0, 40, 0);
+}
+
+static void test_power_cut_in_record()
+{
+    for (long cut = 0; cut < SLOT_SIZE; cut += 3)
+    {
+        setup();
+        for (int i = 0; i < 50; i++)
+            add(i);
+        cut_after = cut;
+        add(999);
+        reboot();
+        for (int i = 50; i < 60; i++)
+            add(i);
+        TEST_ASSERT_EQUAL_INT(60, drain());
+        assert_sequence(0, 60, 0);
+    }
+}
+
+static void test_power_cut_in_header()
+{
+    for (long cut = 0; cut < SLOT_SIZE; cut += 3)
+    {
+        setup();
+        for (int i = 0; i < RECORDS_PER_SECTOR; i++)
+            add(i);
+        TEST_ASSERT_EQUAL_INT(SLOTS, head.slot);
+
+        // next record needs a new sector, power is lost while its header is written
+        cut_after = cut;
+        add(999);
+        reboot();
+        add(RECORDS_PER_SECTOR);
+        TEST_ASSERT_EQUAL_INT(RECORDS_PER_SECTOR + 1, drain());
+        assert_sequence(0, RECORDS_PER_SECTOR + 1, 0);
+    }
+}
+
+static void test_power_cut_in_mark()
+{
+    setup();
+    for (int i = 0; i < 100; i++)
+        add(i);
+
+    // batch is published but not marked, it is sent again after reboot
+    cut_after = 0;
+    mode = MODE_ONLINE;
+    received_count = 0;
+    backlog_process();
+    mode = MODE_OFFLINE;
+    reboot();
+    TEST_ASSERT_EQUAL_INT(100, drain());
+    assert_sequence(0, 100, 0);
+}
+
+int main()
+{
+    RUN_TEST(test_forward_after_reboot);
+    RUN_TEST(test_staged_until_process);
+    RUN_TEST(test_wrap_around);
+    RUN_TEST(test_partial_forward);
+    RUN_TEST(test_publish_failure);
+    RUN_TEST(test_power_cut_in_record);
+    RUN_TEST(test_power_cut_in_header);
+    RUN_TEST(test_power_cut_in_mark);
+    if (flash)
+        fclose(flash);
+    cvector_free(staged);
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "test.h"
+#include "../../main/device.c"
+
+settings_t settings = { .system = { .name = "greenhouse" } };
+const char *DEVICE_MANUFACTURER = "Manufacturer";
+const char *DEVICE_NAME = "Node";
+const char *DEVICE_MODEL = "Model";
+
+static mqtt_published_callback_t published_cb = NULL;
+static int last_msg_id = 0;
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    static const esp_app_desc_t desc = { .version = "1.2.3", .date = "Oct 17 2026" };
+    return &desc;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return 0;
+}
+
+int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain)
+{
+    (void)topic;
+    (void)data;
+    (void)len;
+    (void)qos;
+    (void)retain;
+    return ++last_msg_id;
+}
+
+void mqtt_set_published_callback(mqtt_published_callback_t cb)
+{
+    published_cb = cb;
+}
+
+int mqtt_subscribe(const char *topic, mqtt_callback_t cb, int qos, void *ctx)
+{
+    (void)topic;
+    (void)cb;
+    (void)qos;
+    (void)ctx;
+    return 0;
+}
+
+void mqtt_unsubscribe(const char *topic, mqtt_callback_t cb, void *ctx)
+{
+    (void)topic;
+    (void)cb;
+    (void)ctx;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define DEVICES 100
+
+static device_t devices[DEVICES];
+
+static void init_devices()
+{
+    for (int i = 0; i < DEVICES; i++)
+    {
+        devices[i] = (device_t) { .type = DEV_SENSOR, .info = device_info("temperature", "\u00b0C", "Sensor %d", i) };
+        snprintf(devices[i].uid, sizeof(devices[i].uid), "dev%d", i);
+    }
+}
+
+// Publishes the device and acknowledges it, returns false if it was cached
+static bool publish(device_t *dev)
+{
+    if (!device_publish_discovery(dev, NULL))
+        return false;
+    published_cb(last_msg_id);
+    return true;
+}
+
+static void assert_cache_consistent()
+{
+    TEST_ASSERT(cache_valid());
+    TEST_ASSERT_EQUAL_INT(cache_checksum(), discovery_cache.checksum);
+}
+
+static void test_discovery_cache()
+{
+    init_devices();
+    // RTC memory of the host is zeroed, not a valid cache
+    device_init_discovery_cache();
+    TEST_ASSERT(published_cb);
+    TEST_ASSERT_EQUAL_INT(0, discovery_cache.count);
+
+    for (int i = 0; i < DEVICES; i++)
+    {
+        TEST_ASSERT(publish(&devices[i]));
+        assert_cache_consistent();
+    }
+    TEST_ASSERT_EQUAL_INT(DEVICES, discovery_cache.count);
+    for (int i = 0; i < DEVICES; i++)
+        TEST_ASSERT(!publish(&devices[i]));
+
+    // changed descriptor replaces the cached one
+    devices[7].info = device_info("humidity", "%", "Sensor %d", 7);
+    TEST_ASSERT(publish(&devices[7]));
+    assert_cache_consistent();
+    TEST_ASSERT_EQUAL_INT(DEVICES, discovery_cache.count);
+    TEST_ASSERT(!publish(&devices[7]));
+
+    for (int i = 0; i < DEVICES; i += 3)
+    {
+        device_unpublish_discovery(&devices[i]);
+        assert_cache_consistent();
+    }
+    TEST_ASSERT_EQUAL_INT(DEVICES - (DEVICES + 2) / 3, discovery_cache.count);
+    for (int i = 0; i < DEVICES; i++)
+        TEST_ASSERT_EQUAL_INT(i % 3 == 0, publish(&devices[i]));
+    assert_cache_consistent();
+
+    // survives a soft reset
+    device_init_discovery_cache();
+    TEST_ASSERT_EQUAL_INT(DEVICES, discovery_cache.count);
+
+    // a flipped bit is detected
+    discovery_cache.items[DEVICES / 2].payload ^= 0x100;
+    TEST_ASSERT(!cache_valid());
+    device_init_discovery_cache();
+    TEST_ASSERT_EQUAL_INT(0, discovery_cache.count);
+}
+
+static void test_unacknowledged_not_cached()
+{
+    init_devices();
+    device_reset_discovery_cache();
+    TEST_ASSERT(device_publish_discovery(&devices[0], NULL));
+    TEST_ASSERT(device_publish_discovery(&devices[0], NULL));
+    TEST_ASSERT_EQUAL_INT(0, discovery_cache.count);
+    published_cb(last_msg_id);
+    TEST_ASSERT(!device_publish_discovery(&devices[0], NULL));
+}
+
+static void test_info_interned()
+{
+    const device_info_t *a = device_info("temperature", "\u00b0C", "Probe %s", "kitchen");
+    TEST_ASSERT(a);
+    TEST_ASSERT_EQUAL_STRING("Probe kitchen", a->name);
+
+    // lookup of known metadata does not allocate
+    size_t allocations = host_allocations;
+    TEST_ASSERT(a == device_info("temperature", "\u00b0C", "Probe kitchen"));
+    TEST_ASSERT_EQUAL_INT(allocations, host_allocations);
+
+    TEST_ASSERT(a != device_info("humidity", "\u00b0C", "Probe kitchen"));
+    TEST_ASSERT(a != device_info("temperature", NULL, "Probe kitchen"));
+    TEST_ASSERT(a != device_info("temperature", "\u00b0C", "Probe garden"));
+    TEST_ASSERT(device_info(NULL, NULL, "Relay") == device_info(NULL, NULL, "Relay"));
+
+    // a renamed and renamed back probe reuses its entry
+    allocations = host_allocations;
+    device_info("temperature", "\u00b0C", "Probe %s", "cellar");
+    device_info("temperature", "\u00b0C", "Probe %s", "kitchen");
+    device_info("temperature", "\u00b0C", "Probe %s", "cellar");
+    TEST_ASSERT_EQUAL_INT(allocations + 1, host_allocations);
+}
+
+int main()
+{
+    RUN_TEST(test_discovery_cache);
+    RUN_TEST(test_unacknowledged_not_cached);
+    RUN_TEST(test_info_interned);
+    return 0;
+}
@@ -0,0 +1,317 @@
+#include "test.h"
+#include "../../main/driver.c"
+
+/*
+ * Driver task is simulated on a tick clock: a blocking call either times out,
+ * moving the clock by its timeout, or is woken by a stop request scheduled
+ * at `stop_at`, which runs driver_stop() as the node task would.
+ */
+
+#define NEVER UINT32_MAX
+
+typedef struct {
+    EventBits_t bits;
+} fake_event_group_t;
+
+static TickType_t ticks = 0;
+static TickType_t stop_at = NEVER;
+static int wakeups = 0;
+static uint32_t notifications = 0;
+static int task_handle;
+
+static driver_t drv;
+
+static void dummy_task(driver_t *self)
+{
+    (void)self;
+}
+
+// Runs the stop request if it's due before `wake`, returns true if it did
+static bool run_stop(TickType_t wake)
+{
+    if (stop_at == NEVER || stop_at > wake)
+        return false;
+    ticks = stop_at;
+    stop_at = NEVER;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, driver_stop(&drv));
+    return true;
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    return calloc(1, sizeof(fake_event_group_t));
+}
+
+void vEventGroupDelete(EventGroupHandle_t eg)
+{
+    free(eg);
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t eg, EventBits_t bits)
+{
+    return ((fake_event_group_t *)eg)->bits |= bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t eg, EventBits_t bits)
+{
+    EventBits_t res = ((fake_event_group_t *)eg)->bits;
+    ((fake_event_group_t *)eg)->bits &= ~bits;
+    return res;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t eg)
+{
+    return ((fake_event_group_t *)eg)->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t eg, EventBits_t bits, BaseType_t clear, BaseType_t all, TickType_t timeout)
+{
+    (void)clear;
+    (void)all;
+    fake_event_group_t *g = eg;
+    if (bits & DRIVER_BIT_STOPPED)
+    {
+        // driver_stop() waiting for the driver task, which leaves its loop on DRIVER_BIT_STOP
+        TEST_ASSERT(g->bits & DRIVER_BIT_STOP);
+        return g->bits |= DRIVER_BIT_STOPPED;
+    }
+    if ((g->bits & bits) || !timeout)
+        return g->bits;
+
+    wakeups++;
+    if (!run_stop(ticks + timeout))
+        ticks += timeout;
+    return g->bits;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t timeout)
+{
+    if (!notifications && timeout)
+    {
+        wakeups++;
+        if (!run_stop(ticks + timeout))
+            ticks += timeout;
+    }
+    uint32_t res = notifications;
+    notifications = clear ? 0 : (notifications ? notifications - 1 : 0);
+    return res;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle)
+{
+    TEST_ASSERT(handle == &task_handle);
+    notifications++;
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t delay)
+{
+    wakeups++;
+    ticks += delay;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return ticks;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)ticks * 1000;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    (void)fn;
+    (void)name;
+    (void)stack;
+    (void)arg;
+    (void)priority;
+    (void)handle;
+    (void)core;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t handle)
+{
+    (void)handle;
+}
+
+eTaskState eTaskGetState(TaskHandle_t handle)
+{
+    (void)handle;
+    return eDeleted;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+    (void)queue;
+    (void)item;
+    (void)timeout;
+    return pdPASS;
+}
+
+bool device_report_due(device_t *dev, int64_t now)
+{
+    (void)dev;
+    (void)now;
+    return true;
+}
+
+esp_err_t gpio_install_isr_service(int flags)
+{
+    (void)flags;
+    return ESP_OK;
+}
+
+esp_err_t scheduler_add(driver_t *drv)
+{
+    (void)drv;
+    return ESP_OK;
+}
+
+esp_err_t scheduler_remove(driver_t *drv)
+{
+    (void)drv;
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static void setup()
+{
+    if (drv.eg)
+        vEventGroupDelete(drv.eg);
+    memset(&drv, 0, sizeof(drv));
+    strcpy(drv.name, "test");
+    drv.task = dummy_task;
+    drv.state = DRIVER_RUNNING;
+    drv.handle = &task_handle;
+    drv.eg = xEventGroupCreate();
+    ticks = 1000;
+    stop_at = NEVER;
+    wakeups = 0;
+    notifications = 0;
+}
+
+// Loop of drivers before driver_wait_period(), kept as the reference
+static bool poll_period(driver_t *self, TickType_t start, TickType_t period)
+{
+    while (xTaskGetTickCount() - start < period)
+    {
+        if (driver_stop_requested(self))
+            return false;
+        vTaskDelay(1);
+    }
+    return true;
+}
+
+static void test_one_wakeup_per_period()
+{
+    const TickType_t period = pdMS_TO_TICKS(1000);
+    const int periods = 10;
+
+    setup();
+    TickType_t first = ticks;
+    for (int i = 0; i < periods; i++)
+    {
+        TickType_t start = xTaskGetTickCount();
+        ticks += 30; // sampling
+        TEST_ASSERT(driver_wait_period(&drv, start, period));
+        TEST_ASSERT_EQUAL_INT(start + period, ticks);
+    }
+    TEST_ASSERT_EQUAL_INT(periods, wakeups);
+    TEST_ASSERT_EQUAL_INT(first + periods * period, ticks);
+    int waiting = wakeups;
+
+    setup();
+    for (int i = 0; i < periods; i++)
+    {
+        TickType_t start = xTaskGetTickCount();
+        ticks += 30;
+        TEST_ASSERT(poll_period(&drv, start, period));
+    }
+    TEST_ASSERT_EQUAL_INT(periods * (period - 30), wakeups);
+    printf("wakeups per %" PRIu32 " tick period: polling %d, driver_wait_period %d\n",
+        period, wakeups / periods, waiting / periods);
+}
+
+static void test_overrun_does_not_wait()
+{
+    setup();
+    TickType_t start = xTaskGetTickCount();
+    ticks += 150;
+    TEST_ASSERT(driver_wait_period(&drv, start, 100));
+    TEST_ASSERT_EQUAL_INT(0, wakeups);
+    TEST_ASSERT_EQUAL_INT(start + 150, ticks);
+}
+
+static void test_stop_wakes_period_wait()
+{
+    setup();
+    TickType_t start = xTaskGetTickCount();
+    stop_at = start + 40;
+    TEST_ASSERT(!driver_wait_period(&drv, start, 1000));
+    TEST_ASSERT_EQUAL_INT(1, wakeups);
+    TEST_ASSERT_EQUAL_INT(start + 40, ticks);
+    TEST_ASSERT(driver_stop_requested(&drv));
+
+    // stop requested before the wait returns at once
+    TEST_ASSERT(!driver_wait_period(&drv, xTaskGetTickCount(), 1000));
+    TEST_ASSERT_EQUAL_INT(1, wakeups);
+}
+
+// Drivers waiting for an ISR notification, like gh_io, are woken by driver_stop() too
+static void test_stop_wakes_notification_wait()
+{
+    setup();
+    TickType_t start = xTaskGetTickCount();
+    stop_at = start + 25;
+    TEST_ASSERT(ulTaskNotifyTake(pdTRUE, 1000) > 0);
+    TEST_ASSERT_EQUAL_INT(1, wakeups);
+    TEST_ASSERT_EQUAL_INT(start + 25, ticks);
+    TEST_ASSERT(driver_stop_requested(&drv));
+}
+
+static float calibrated(const char *config, float code)
+{
+    static const calibration_point_t def[] = { { 0, 0 }, { 1, 1 } };
+    cJSON *item = cJSON_Parse(config);
+    TEST_ASSERT(item);
+    lut_t lut;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, driver_config_read_calibration("test", item, &lut, def, 2));
+    float res = lut_get(&lut, code);
+    lut_free(&lut);
+    cJSON_Delete(item);
+    return res;
+}
+
+static void test_polynomial_default_degree()
+{
+    // a line with one outlier, quadratic by default instead of an interpolating quartic
+    const char *config = "{\"method\": \"polynomial\", \"points\": [{\"voltage\": 0, \"value\": 0}, "
+        "{\"voltage\": 1, \"value\": 1}, {\"voltage\": 2, \"value\": 2}, {\"voltage\": 3, \"value\": 3}, "
+        "{\"voltage\": 4, \"value\": 10}]}";
+    TEST_ASSERT(fabsf(calibrated(config, 4) - 10) > 0.5f);
+
+    const char *quartic = "{\"method\": \"polynomial\", \"degree\": 4, \"points\": [{\"voltage\": 0, \"value\": 0}, "
+        "{\"voltage\": 1, \"value\": 1}, {\"voltage\": 2, \"value\": 2}, {\"voltage\": 3, \"value\": 3}, "
+        "{\"voltage\": 4, \"value\": 10}]}";
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 10, calibrated(quartic, 4));
+
+    // three points on a parabola are fitted exactly
+    const char *parabola = "{\"method\": \"polynomial\", \"points\": [{\"voltage\": 0, \"value\": 0}, "
+        "{\"voltage\": 1, \"value\": 1}, {\"voltage\": 2, \"value\": 4}]}";
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 2.25, calibrated(parabola, 1.5f));
+}
+
+int main()
+{
+    RUN_TEST(test_one_wakeup_per_period);
+    RUN_TEST(test_overrun_does_not_wait);
+    RUN_TEST(test_stop_wakes_period_wait);
+    RUN_TEST(test_stop_wakes_notification_wait);
+    RUN_TEST(test_polynomial_default_degree);
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include <time.h>
+#include "test.h"
+#include "filter.h"
+
+static void run(const filter_config_t *cfg, int32_t *data, size_t len)
+{
+    filter_t f = { 0 };
+    TEST_ASSERT_EQUAL_INT(ESP_OK, filter_init(&f, cfg));
+    filter_apply_block(&f, data, len);
+    filter_free(&f);
+}
+
+static void assert_vector(const int32_t *expected, const int32_t *actual, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        TEST_ASSERT_EQUAL_INT(expected[i], actual[i]);
+}
+
+static void test_median()
+{
+    filter_config_t cfg = { .type = FILTER_MEDIAN, .window = 5 };
+    int32_t data[] = { 10, 10, 1000, 10, 11, 12, -500, 13, 14, 15 };
+    static const int32_t expected[] = { 10, 10, 10, 10, 10, 11, 11, 11, 12, 13 };
+    run(&cfg, data, 10);
+    // spikes are rejected
+    assert_vector(expected, data, 10);
+}
+
+static void test_average()
+{
+    filter_config_t cfg = { .type = FILTER_AVERAGE, .window = 3 };
+    int32_t data[] = { 3, 6, 9, 12, 15 };
+    // window is partial until filled, results are rounded
+    static const int32_t expected[] = { 3, 5, 6, 9, 12 };
+    run(&cfg, data, 5);
+    assert_vector(expected, data, 5);
+}
+
+static void test_ema()
+{
+    filter_config_t cfg = { .type = FILTER_EMA, .alpha = 0.5f };
+    int32_t data[] = { 0, 1024, 1024, 1024 };
+    static const int32_t expected[] = { 0, 512, 768, 896 };
+    run(&cfg, data, 4);
+    assert_vector(expected, data, 4);
+}
+
+static void test_lowpass_step()
+{
+    filter_config_t cfg = { .type = FILTER_LOWPASS, .cutoff = 0.01f };
+    int32_t data[400];
+    for (int i = 0; i < 400; i++)
+        data[i] = i ? 1 << 20 : 0;
+    run(&cfg, data, 400);
+
+    TEST_ASSERT(data[1] < (1 << 20) / 100);
+    // Butterworth overshoot is about 4 %, settles within 0.1 %
+    for (int i = 0; i < 400; i++)
+        TEST_ASSERT(data[i] < (1 << 20) * 105 / 100);
+    TEST_ASSERT_FLOAT_WITHIN((1 << 20) / 1000, 1 << 20, data[399]);
+}
+
+static void test_lowpass_dc()
+{
+    // starts from the first sample, full scale 12-bit code in Q8 does not overflow
+    filter_config_t cfg = { .type = FILTER_LOWPASS, .cutoff = 0.01f };
+    int32_t data[400];
+    for (int i = 0; i < 400; i++)
+        data[i] = 4095 << 8;
+    run(&cfg, data, 400);
+    for (int i = 0; i < 400; i++)
+        TEST_ASSERT_FLOAT_WITHIN(2, 4095 << 8, data[i]);
+}
+
+static void test_invalid_config()
+{
+    filter_t f = { 0 };
+    filter_config_t cfg = { .type = FILTER_MEDIAN, .window = FILTER_MAX_WINDOW + 1 };
+    TEST_ASSERT(filter_init(&f, &cfg) != ESP_OK);
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+// Float versions of the EMA and low-pass, the reference for the fixed-point cost
+static void float_ema(float *data, size_t len, float alpha)
+{
+    float y = data[0];
+    for (size_t i = 0; i < len; i++)
+    {
+        y += alpha * (data[i] - y);
+        data[i] = y;
+    }
+}
+
+static void float_lowpass(float *data, size_t len, float cutoff)
+{
+    float w0 = 2.0f * (float)M_PI * cutoff;
+    float cw = cosf(w0);
+    float alpha = sinf(w0) / (float)M_SQRT2;
+    float a0 = 1.0f + alpha;
+    float b0 = (1.0f - cw) / 2.0f / a0, b1 = 2 * b0, b2 = b0;
+    float a1 = -2.0f * cw / a0, a2 = (1.0f - alpha) / a0;
+    float x1 = data[0], x2 = data[0], y1 = data[0], y2 = data[0];
+    for (size_t i = 0; i < len; i++)
+    {
+        float x = data[i];
+        float y = b0 * x + b1 * x1 + b2 * x2 - a1 * y1 - a2 * y2;
+        x2 = x1;
+        x1 = x;
+        y2 = y1;
+        y1 = y;
+        data[i] = y;
+    }
+}
+
+#define BENCH_LEN 256
+
+static void fill(int32_t *fixed, float *fl)
+{
+    for (int i = 0; i < BENCH_LEN; i++)
+    {
+        fixed[i] = (2048 + (i * 37 % 200)) << 8;
+        fl[i] = (float)fixed[i];
+    }
+}
+
+// Not a pass/fail check, prints per sample cost of fixed-point filters and their float versions
+static void test_float_benchmark()
+{
+    const int rounds = 4000;
+    int32_t fixed[BENCH_LEN];
+    float fl[BENCH_LEN];
+    struct timespec start, end;
+
+    for (int type = FILTER_EMA; type <= FILTER_LOWPASS; type++)
+    {
+        filter_config_t cfg = { .type = type, .alpha = 0.1f, .cutoff = 0.05f };
+        filter_t f = { 0 };
+        TEST_ASSERT_EQUAL_INT(ESP_OK, filter_init(&f, &cfg));
+
+        double fixed_ns = 0, float_ns = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            fill(fixed, fl);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            filter_reset(&f);
+            filter_apply_block(&f, fixed, BENCH_LEN);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            fixed_ns += elapsed_ns(&start, &end);
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (type == FILTER_EMA)
+                float_ema(fl, BENCH_LEN, cfg.alpha);
+            else
+                float_lowpass(fl, BENCH_LEN, cfg.cutoff);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            float_ns += elapsed_ns(&start, &end);
+        }
+        // both paths compute the same output
+        for (int i = 0; i < BENCH_LEN; i++)
+            TEST_ASSERT_FLOAT_WITHIN(4, fl[i], fixed[i]);
+
+        printf("filter: %-7s fixed-point %.2f ns, float %.2f ns per sample\n",
+            type == FILTER_EMA ? "ema" : "lowpass",
+            fixed_ns / rounds / BENCH_LEN, float_ns / rounds / BENCH_LEN);
+        filter_free(&f);
+    }
+}
+
+int main()
+{
+    RUN_TEST(test_median);
+    RUN_TEST(test_average);
+    RUN_TEST(test_ema);
+    RUN_TEST(test_lowpass_step);
+    RUN_TEST(test_lowpass_dc);
+    RUN_TEST(test_invalid_config);
+    RUN_TEST(test_float_benchmark);
+    return 0;
+}
@@ -0,0 +1,233 @@
+#include "test.h"
+#include <stdint.h>
+#include <time.h>
+
+// queries take the current time from the test
+static uint32_t fake_now = 1760000000;
+#define time(t) ((time_t)fake_now)
+#include "../../main/history.c"
+#undef time
+
+static char out[1 << 16];
+static size_t out_len = 0;
+
+bool system_clock_is_set()
+{
+    return true;
+}
+
+time_t device_update_time(const device_t *dev)
+{
+    (void)dev;
+    return fake_now;
+}
+
+static esp_err_t collect(const char *data, size_t len, void *ctx)
+{
+    (void)ctx;
+    TEST_ASSERT(out_len + len < sizeof(out));
+    memcpy(out + out_len, data, len);
+    out_len += len;
+    out[out_len] = 0;
+    return ESP_OK;
+}
+
+static void reset()
+{
+    free(pool);
+    pool = NULL;
+    series_count = 0;
+    serial = 0;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, history_init());
+}
+
+static void add(const char *uid, uint32_t time, float value)
+{
+    device_t dev;
+    memset(&dev, 0, sizeof(dev));
+    strcpy(dev.uid, uid);
+    dev.type = DEV_SENSOR;
+    dev.sensor.value = value;
+    fake_now = time;
+    history_append(&dev);
+}
+
+static bool starts_with(const char *s, const char *prefix)
+{
+    return !strncmp(s, prefix, strlen(prefix));
+}
+
+static void query(const char *uid, uint32_t from, uint32_t to)
+{
+    out_len = 0;
+    TEST_ASSERT_EQUAL_INT(ESP_OK, history_query(uid, from, to, collect, NULL));
+}
+
+static size_t blocks_in_use()
+{
+    size_t used = 0;
+    for (size_t s = 0; s < series_count; s++)
+        for (size_t k = 0; k < TIERS; k++)
+            used += series[s].tiers[k].blocks;
+    return used;
+}
+
+static size_t blocks_free()
+{
+    size_t count = 0;
+    for (int16_t i = free_list; i != NO_BLOCK; i = pool[i].next)
+        count++;
+    return count;
+}
+
+// Encodes points into a block and decodes them back bit exact
+static void round_trip(const uint32_t *times, const float *values, size_t count, size_t n)
+{
+    block_t b;
+    memset(&b, 0, sizeof(b));
+    codec_t enc;
+    for (size_t p = 0; p < count; p++)
+    {
+        TEST_ASSERT(b.bits + POINT_MAX_BITS <= HISTORY_BLOCK_SIZE * 8);
+        encode_point(&b, &enc, times[p], &values[p * n], n);
+    }
+    TEST_ASSERT_EQUAL_INT(count, b.count);
+    TEST_ASSERT_EQUAL_INT(times[0], b.first);
+    TEST_ASSERT_EQUAL_INT(times[count - 1], b.last);
+
+    reader_t r = { .data = b.data, .pos = 0 };
+    codec_t dec;
+    float decoded[MAX_VALUES];
+    for (size_t p = 0; p < count; p++)
+    {
+        TEST_ASSERT_EQUAL_INT(times[p], decode_point(&r, &dec, !p, decoded, n));
+        TEST_ASSERT(!memcmp(decoded, &values[p * n], n * sizeof(float)));
+    }
+    TEST_ASSERT_EQUAL_INT(b.bits, r.pos);
+}
+
+static void test_codec_times()
+{
+    // delta-of-delta in every encoding range, both signs
+    static const int32_t deltas[] = { 10, 10, 10, 73, 10, 266, 10, 2058, 10, 100000, 10, 1, 0, 0, 65, 3, 3 };
+    uint32_t times[18];
+    float values[18];
+    times[0] = 1760000000;
+    for (size_t i = 0; i < 17; i++)
+        times[i + 1] = times[i] + deltas[i];
+    for (size_t i = 0; i < 18; i++)
+        values[i] = 21.5f;
+    round_trip(times, values, 18, 1);
+}
+
+static void test_codec_values()
+{
+    // repeated values, small and large changes, sign flips and special floats
+    static const float values[] = {
+        21.5f, 21.5f, 21.6f, 21.4f, 21.6f, -40.0f, 1e30f, 1e-30f, 0.0f, -0.0f,
+        INFINITY, -INFINITY, 1.17549435e-38f, 1.4e-45f, 100.0f, 100.0f, 3.3f, 3.3001f,
+    };
+    size_t count = sizeof(values) / sizeof(values[0]);
+    uint32_t times[sizeof(values) / sizeof(values[0])];
+    for (size_t i = 0; i < count; i++)
+        times[i] = 1760000000 + i * 10;
+    round_trip(times, values, count, 1);
+}
+
+static void test_codec_rollups()
+{
+    // min, avg and max keep separate windows
+    float values[3 * 20];
+    uint32_t times[20];
+    for (size_t p = 0; p < 20; p++)
+    {
+        times[p] = 1760000000 + p * 60;
+        values[p * 3] = 20.0f - p * 0.1f;
+        values[p * 3 + 1] = 20.0f + (p % 3) * 0.01f;
+        values[p * 3 + 2] = 20.0f + p * 1000.0f;
+    }
+    round_trip(times, values, 20, 3);
+}
+
+static void test_raw_query()
+{
+    reset();
+    // longer than a block, sampled with jitter
+    uint32_t start = 1760000000, t = start;
+    for (int i = 0; i < 300; i++, t += 10 + (i % 7 == 0))
+        add("t0", t, 20.0f + roundf(sinf(i * 0.05f) * 50) / 10);
+    TEST_ASSERT(series[0].tiers[0].blocks > 1);
+
+    query("t0", start, fake_now);
+    TEST_ASSERT(starts_with(out, "{\"uid\":\"t0\",\"step\":0,\"points\":[[1760000000,20]"));
+    const char *p = strstr(out, "[[") + 1;
+    t = start;
+    for (int i = 0; i < 300; i++, t += 10 + (i % 7 == 0))
+    {
+        unsigned time;
+        float value;
+        TEST_ASSERT(p);
+        TEST_ASSERT_EQUAL_INT(2, sscanf(p, "[%u,%f]", &time, &value));
+        TEST_ASSERT_EQUAL_INT(t, time);
+        TEST_ASSERT_FLOAT_WITHIN(1e-4, 20.0f + roundf(sinf(i * 0.05f) * 50) / 10, value);
+        p = strchr(p + 1, '[');
+    }
+    TEST_ASSERT(!p);
+    TEST_ASSERT(!strcmp(out + out_len - 2, "]}"));
+
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NOT_FOUND, history_query("t1", start, fake_now, collect, NULL));
+}
+
+static void test_rollup_query()
+{
+    reset();
+    // 3 hours at 10 s, raw hour is gone, so the minute tier is used
+    uint32_t start = 1760000400;
+    for (int i = 0; i < 3 * 360; i++)
+        add("t0", start + i * 10, (float)(i % 6));
+
+    query("t0", start, fake_now);
+    TEST_ASSERT(starts_with(out, "{\"uid\":\"t0\",\"step\":60,\"points\":[[1760000400,0,2.5,5]"));
+    // bucket in progress is included
+    char last[64];
+    snprintf(last, sizeof(last), ",[%u,0,2.5,5]]}", fake_now - fake_now % 60);
+    TEST_ASSERT_EQUAL_STRING(last, out + out_len - strlen(last));
+}
+
+static void test_pool_pressure()
+{
+    reset();
+    // more series than the pool holds full tiers of
+    uint32_t start = 1760000000;
+    for (uint32_t t = start; t < start + 2 * 86400; t += 10)
+        for (int s = 0; s < 8; s++)
+        {
+            char uid[8];
+            snprintf(uid, sizeof(uid), "s%d", s);
+            add(uid, t, s + (t % 600) * 0.01f);
+        }
+    TEST_ASSERT_EQUAL_INT(8, series_count);
+    TEST_ASSERT_EQUAL_INT(HISTORY_BLOCKS, blocks_in_use() + blocks_free());
+    for (size_t s = 0; s < series_count; s++)
+        for (size_t k = 0; k < TIERS; k++)
+            TEST_ASSERT(series[s].tiers[k].blocks > 0);
+
+    // a day back is beyond the minute tier, the coarsest one reaching furthest is used
+    query("s3", fake_now - 86400, fake_now);
+    TEST_ASSERT(starts_with(out, "{\"uid\":\"s3\",\"step\":900,\"points\":[["));
+    // last minutes are still raw
+    query("s3", fake_now - 60, fake_now);
+    TEST_ASSERT(starts_with(out, "{\"uid\":\"s3\",\"step\":0,\"points\":[["));
+}
+
+int main()
+{
+    RUN_TEST(test_codec_times);
+    RUN_TEST(test_codec_values);
+    RUN_TEST(test_codec_rollups);
+    RUN_TEST(test_raw_query);
+    RUN_TEST(test_rollup_query);
+    RUN_TEST(test_pool_pressure);
+    free(pool);
+    return 0;
+}
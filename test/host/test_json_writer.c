@@ -0,0 +1,289 @@
+#include "test.h"
+#include <time.h>
+#include "../../main/device.c"
+
+// Expected outputs are what cJSON_PrintUnformatted() / cJSON_Print() give for the same tree
+
+static void test_unformatted()
+{
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), false);
+
+    json_object_start(&w, NULL);
+    json_add_string(&w, "s", "x\"\\\n\x01");
+    json_add_number(&w, "i", 2);
+    json_add_number(&w, "neg", -17);
+    json_add_number(&w, "d", 0.1);
+    json_add_number(&w, "f", (float)0.1);
+    json_add_number(&w, "nan", NAN);
+    json_object_start(&w, "o");
+    json_array_start(&w, "a");
+    json_add_string(&w, NULL, "a");
+    json_add_bool(&w, NULL, true);
+    json_add_null(&w, NULL);
+    json_array_end(&w);
+    json_object_end(&w);
+    json_array_start(&w, "empty");
+    json_array_end(&w);
+    json_add_bool(&w, "b", false);
+    json_object_end(&w);
+
+    TEST_ASSERT_EQUAL_INT(ESP_OK, json_writer_finish(&w));
+    TEST_ASSERT_EQUAL_STRING("{\"s\":\"x\\\"\\\\\\n\\u0001\",\"i\":2,\"neg\":-17,\"d\":0.1,\"f\":0.10000000149011612,"
+        "\"nan\":null,\"o\":{\"a\":[\"a\",true,null]},\"empty\":[],\"b\":false}", buf);
+}
+
+static void test_formatted()
+{
+    char buf[256];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), true);
+
+    json_object_start(&w, NULL);
+    json_add_number(&w, "result", 0);
+    json_object_start(&w, "e");
+    json_object_end(&w);
+    json_object_start(&w, "d");
+    json_array_start(&w, "ids");
+    json_add_string(&w, NULL, "a");
+    json_add_string(&w, NULL, "b");
+    json_array_end(&w);
+    json_object_end(&w);
+    json_object_end(&w);
+
+    TEST_ASSERT_EQUAL_INT(ESP_OK, json_writer_finish(&w));
+    TEST_ASSERT_EQUAL_STRING("{\n\t\"result\":\t0,\n\t\"e\":\t{\n\t},\n\t\"d\":\t{\n\t\t\"ids\":\t[\"a\", \"b\"]\n\t}\n}", buf);
+}
+
+static void test_overflow()
+{
+    char buf[10];
+    json_writer_t w;
+    json_writer_init(&w, buf, sizeof(buf), false);
+
+    json_object_start(&w, NULL);
+    json_add_string(&w, "abcdef", "ghijk");
+    json_object_end(&w);
+
+    TEST_ASSERT_EQUAL_INT(ESP_ERR_NO_MEM, json_writer_finish(&w));
+    // output stays terminated within the buffer
+    TEST_ASSERT(strlen(buf) < sizeof(buf));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Discovery descriptors of device.c against the cJSON tree they replaced
+
+settings_t settings = { .system = { .name = "greenhouse" } };
+const char *DEVICE_MANUFACTURER = "Manufacturer";
+const char *DEVICE_NAME = "Node";
+const char *DEVICE_MODEL = "Model";
+
+const esp_app_desc_t *esp_app_get_description(void)
+{
+    static const esp_app_desc_t desc = { .version = "1.2.3", .date = "Oct 17 2026" };
+    return &desc;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return 0;
+}
+
+int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain)
+{
+    (void)topic;
+    (void)data;
+    (void)len;
+    (void)qos;
+    (void)retain;
+    return 1;
+}
+
+void mqtt_set_published_callback(mqtt_published_callback_t cb)
+{
+    (void)cb;
+}
+
+int mqtt_subscribe(const char *topic, mqtt_callback_t cb, int qos, void *ctx)
+{
+    (void)topic;
+    (void)cb;
+    (void)qos;
+    (void)ctx;
+    return 0;
+}
+
+void mqtt_unsubscribe(const char *topic, mqtt_callback_t cb, void *ctx)
+{
+    (void)topic;
+    (void)cb;
+    (void)ctx;
+}
+
+// device_descriptor() as it was built with cJSON
+static char *cjson_descriptor(const device_t *dev, const char *group)
+{
+    cJSON *res = cJSON_CreateObject();
+
+    if (strlen(device_class(dev)))
+        cJSON_AddStringToObject(res, "device_class", device_class(dev));
+
+    char uid[sizeof(dev->uid) + sizeof(settings.system.name) + 1] = { 0 };
+    snprintf(uid, sizeof(uid), "%s_%s", settings.system.name, dev->uid);
+    cJSON_AddStringToObject(res, "object_id", uid);
+    cJSON_AddStringToObject(res, "unique_id", uid);
+
+    char buf[128] = { 0 };
+    if (strlen(device_name(dev)))
+    {
+        snprintf(buf, sizeof(buf), "%s %s", settings.system.name, device_name(dev));
+        cJSON_AddStringToObject(res, "name", buf);
+    }
+    else
+        cJSON_AddStringToObject(res, "name", uid);
+
+    if (group && device_is_sensor(dev))
+    {
+        cJSON_AddStringToObject(res, "state_topic", device_batch_state_topic(group, buf, sizeof(buf)));
+        snprintf(buf, sizeof(buf), BATCH_VALUE_TEMPLATE_FMT, dev->uid, dev->uid);
+        cJSON_AddStringToObject(res, "value_template", buf);
+    }
+    else
+        cJSON_AddStringToObject(res, "state_topic", device_state_topic(dev, buf, sizeof(buf)));
+
+    switch (dev->type)
+    {
+        case DEV_SENSOR:
+            cJSON_AddStringToObject(res, "unit_of_measurement", device_measurement_unit(dev));
+            if (dev->sensor.update_period > 0)
+                cJSON_AddNumberToObject(res, "expire_after", device_expire_after(dev));
+            break;
+        case DEV_BINARY_SENSOR:
+            cJSON_AddStringToObject(res, "payload_on", "1");
+            cJSON_AddStringToObject(res, "payload_off", "0");
+            break;
+        case DEV_BINARY_SWITCH:
+            cJSON_AddStringToObject(res, "command_topic", device_command_topic(dev, buf, sizeof(buf)));
+            cJSON_AddStringToObject(res, "payload_on", "1");
+            cJSON_AddStringToObject(res, "payload_off", "0");
+            cJSON_AddStringToObject(res, "state_on", "1");
+            cJSON_AddStringToObject(res, "state_off", "0");
+            cJSON_AddBoolToObject(res, "optimistic", false);
+            cJSON_AddNumberToObject(res, "qos", 2);
+            cJSON_AddBoolToObject(res, "retain", true);
+            break;
+        case DEV_NUMBER:
+            cJSON_AddStringToObject(res, "command_topic", device_command_topic(dev, buf, sizeof(buf)));
+            cJSON_AddNumberToObject(res, "min", dev->number.min);
+            cJSON_AddNumberToObject(res, "max", dev->number.max);
+            cJSON_AddNumberToObject(res, "step", dev->number.step);
+            cJSON_AddStringToObject(res, "unit_of_measurement", device_measurement_unit(dev));
+            cJSON_AddBoolToObject(res, "optimistic", false);
+            cJSON_AddNumberToObject(res, "qos", 2);
+            cJSON_AddBoolToObject(res, "retain", true);
+            break;
+    }
+
+    cJSON *device = cJSON_AddObjectToObject(res, "device");
+    const char *ids[2] = { settings.system.name, SYSTEM_ID };
+    cJSON_AddItemToObject(device, "identifiers",
+        cJSON_CreateStringArray(ids, strncmp(settings.system.name, SYSTEM_ID, sizeof(settings.system.name)) == 0 ? 1 : 2));
+    cJSON_AddStringToObject(device, "manufacturer", DEVICE_MANUFACTURER);
+    cJSON_AddStringToObject(device, "name", DEVICE_NAME);
+    cJSON_AddStringToObject(device, "model", DEVICE_MODEL);
+    const esp_app_desc_t *app_desc = esp_app_get_description();
+    snprintf(buf, sizeof(buf), "%s (%s)", app_desc->version, app_desc->date);
+    cJSON_AddStringToObject(device, "sw_version", buf);
+
+    char *json = cJSON_PrintUnformatted(res);
+    cJSON_Delete(res);
+    return json;
+}
+
+static device_t test_devices[4];
+
+static void init_test_devices()
+{
+    test_devices[0] = (device_t) {
+        .uid = "rht0_t", .type = DEV_SENSOR,
+        .info = device_info("temperature", "\u00b0C", "Air \"%s\"", "temperature"),
+        .sensor = { .update_period = 5000, .max_silence = 60000 },
+    };
+    test_devices[1] = (device_t) {
+        .uid = "io_in0", .type = DEV_BINARY_SENSOR,
+        .info = device_info(NULL, NULL, "Input %d", 0),
+    };
+    test_devices[2] = (device_t) {
+        .uid = "io_relay0", .type = DEV_BINARY_SWITCH,
+        .info = device_info("switch", NULL, "Relay %d", 0),
+    };
+    test_devices[3] = (device_t) {
+        .uid = "pid0_sp", .type = DEV_NUMBER,
+        .info = device_info(NULL, "pH", "Setpoint"),
+        .number = { .min = 0, .max = 14, .step = 0.1f },
+    };
+}
+
+static void test_descriptors_match_cjson()
+{
+    init_test_devices();
+    const char *groups[] = { NULL, "rht" };
+    for (size_t g = 0; g < 2; g++)
+        for (size_t i = 0; i < 4; i++)
+        {
+            char data[DEVICE_DESCRIPTOR_SIZE];
+            TEST_ASSERT_EQUAL_INT(ESP_OK, device_descriptor(&test_devices[i], groups[g], data, sizeof(data)));
+            char *expected = cjson_descriptor(&test_devices[i], groups[g]);
+            TEST_ASSERT(expected);
+            TEST_ASSERT_EQUAL_STRING(expected, data);
+            free(expected);
+        }
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+// Not a pass/fail check except for allocations, prints cost of both ways per descriptor
+static void test_descriptor_benchmark()
+{
+    const int rounds = 20000;
+    struct timespec start, end;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        const device_t *dev = &test_devices[i];
+        char data[DEVICE_DESCRIPTOR_SIZE];
+
+        size_t allocations = host_allocations;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++)
+            device_descriptor(dev, NULL, data, sizeof(data));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        TEST_ASSERT_EQUAL_INT(allocations, host_allocations);
+        double writer_ns = elapsed_ns(&start, &end) / rounds;
+
+        allocations = host_allocations;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int r = 0; r < rounds; r++)
+            free(cjson_descriptor(dev, NULL));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double cjson_ns = elapsed_ns(&start, &end) / rounds;
+        double cjson_allocs = (double)(host_allocations - allocations) / rounds;
+
+        printf("descriptor %-10s %3zu bytes: json_writer %5.0f ns, 0 allocations; cJSON %5.0f ns, %.0f allocations\n",
+            dev->uid, strlen(data), writer_ns, cjson_ns, cjson_allocs);
+    }
+}
+
+int main()
+{
+    RUN_TEST(test_unformatted);
+    RUN_TEST(test_formatted);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_descriptors_match_cjson);
+    RUN_TEST(test_descriptor_benchmark);
+    return 0;
+}
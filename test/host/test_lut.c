@@ -0,0 +1,164 @@
+#include <time.h>
+#include "test.h"
+#include "lut.h"
+
+// points are given unsorted, lut_init() sorts them
+static const calibration_point_t points[] = {
+    { 1.7f, 100 }, { 0.1f, 0 }, { 2.2f, 105 }, { 0.9f, 60 }, { 0.5f, 20 },
+};
+static const calibration_point_t sorted[] = {
+    { 0.1f, 0 }, { 0.5f, 20 }, { 0.9f, 60 }, { 1.7f, 100 }, { 2.2f, 105 },
+};
+#define POINTS (sizeof(points) / sizeof(points[0]))
+
+// Piecewise linear interpolation and extrapolation, same as calibration component
+static float reference(float x)
+{
+    size_t k = 0;
+    while (k < POINTS - 2 && x > sorted[k + 1].code)
+        k++;
+    float t = (x - sorted[k].code) / (sorted[k + 1].code - sorted[k].code);
+    return sorted[k].value + t * (sorted[k + 1].value - sorted[k].value);
+}
+
+static void test_linear_accuracy()
+{
+    lut_t lut = { 0 };
+    TEST_ASSERT_EQUAL_INT(ESP_OK, lut_init(&lut, points, POINTS, LUT_LINEAR, 0, 256));
+
+    // error of 256 entries over the range is below 0.1 % of full scale
+    for (float x = -0.5f; x < 3.0f; x += 0.0013f)
+        TEST_ASSERT_FLOAT_WITHIN(0.105, reference(x), lut_get(&lut, x));
+
+    lut_free(&lut);
+}
+
+static void test_cubic_monotone()
+{
+    lut_t lut = { 0 };
+    TEST_ASSERT_EQUAL_INT(ESP_OK, lut_init(&lut, points, POINTS, LUT_CUBIC, 0, 256));
+
+    for (size_t i = 0; i < POINTS; i++)
+        TEST_ASSERT_FLOAT_WITHIN(0.01, sorted[i].value, lut_get(&lut, sorted[i].code));
+    // no overshoot between points
+    float prev = lut_get(&lut, sorted[0].code);
+    for (float x = sorted[0].code; x <= sorted[POINTS - 1].code; x += 0.001f)
+    {
+        float v = lut_get(&lut, x);
+        TEST_ASSERT(v >= prev - 1e-3f);
+        prev = v;
+    }
+
+    lut_free(&lut);
+}
+
+static void test_polynomial_line()
+{
+    // least squares line through collinear points is exact
+    static const calibration_point_t line[] = { { 0, 1 }, { 1, 3 }, { 2, 5 }, { 3, 7 } };
+    lut_t lut = { 0 };
+    TEST_ASSERT_EQUAL_INT(ESP_OK, lut_init(&lut, line, 4, LUT_POLYNOMIAL, 1, 256));
+    for (float x = -1; x < 4; x += 0.01f)
+        TEST_ASSERT_FLOAT_WITHIN(1e-3, 2 * x + 1, lut_get(&lut, x));
+
+    lut_free(&lut);
+}
+
+static void test_extrapolation()
+{
+    // decreasing curve of two points
+    static const calibration_point_t two[] = { { 2.2f, 0 }, { 0.9f, 100 } };
+    lut_t lut = { 0 };
+    TEST_ASSERT_EQUAL_INT(ESP_OK, lut_init(&lut, two, 2, LUT_LINEAR, 0, 256));
+
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, -61.53846, lut_get(&lut, 3.0f));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 50, lut_get(&lut, 1.55f));
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 169.23077, lut_get(&lut, 0));
+
+    lut_free(&lut);
+}
+
+static void test_not_finite()
+{
+    lut_t lut = { 0 };
+    TEST_ASSERT_EQUAL_INT(ESP_OK, lut_init(&lut, points, POINTS, LUT_CUBIC, 0, 256));
+
+    TEST_ASSERT(isnan(lut_get(&lut, NAN)));
+    TEST_ASSERT(isnan(lut_get(&lut, INFINITY)));
+    TEST_ASSERT(isnan(lut_get(&lut, -INFINITY)));
+    // position overflows float
+    TEST_ASSERT(isnan(lut_get(&lut, 3e38f)));
+
+    lut_free(&lut);
+}
+
+static void test_invalid()
+{
+    lut_t lut = { 0 };
+    TEST_ASSERT(lut_init(&lut, points, 1, LUT_LINEAR, 0, 256) != ESP_OK);
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+// Linear search over `count` sorted points, as calibration_get_value() does
+static float search(const calibration_point_t *p, size_t count, float x)
+{
+    size_t k = 0;
+    while (k < count - 2 && x > p[k + 1].code)
+        k++;
+    float t = (x - p[k].code) / (p[k + 1].code - p[k].code);
+    return p[k].value + t * (p[k + 1].value - p[k].value);
+}
+
+// Not a pass/fail check, prints lookup cost of table and point search by number of points
+static void test_lookup_benchmark()
+{
+    static const size_t sizes[] = { 2, 8, 32, 128 };
+    const int rounds = 1000000;
+    calibration_point_t p[128];
+    volatile float sink = 0;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t count = sizes[s];
+        for (size_t i = 0; i < count; i++)
+        {
+            p[i].code = (float)i * 3.3f / (float)(count - 1);
+            p[i].value = sqrtf(p[i].code) * 100;
+        }
+        lut_t lut = { 0 };
+        TEST_ASSERT_EQUAL_INT(ESP_OK, lut_init(&lut, p, count, LUT_LINEAR, 0, 256));
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < rounds; i++)
+            sink = lut_get(&lut, (float)(i & 1023) * (3.3f / 1023));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double table = elapsed_ns(&start, &end) / rounds;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < rounds; i++)
+            sink = search(p, count, (float)(i & 1023) * (3.3f / 1023));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("lookup: %3zu points, table %.1f ns, search %.1f ns\n", count, table,
+            elapsed_ns(&start, &end) / rounds);
+        lut_free(&lut);
+    }
+    (void)sink;
+}
+
+int main()
+{
+    RUN_TEST(test_linear_accuracy);
+    RUN_TEST(test_cubic_monotone);
+    RUN_TEST(test_polynomial_line);
+    RUN_TEST(test_extrapolation);
+    RUN_TEST(test_not_finite);
+    RUN_TEST(test_invalid);
+    RUN_TEST(test_lookup_benchmark);
+    return 0;
+}
@@ -0,0 +1,430 @@
+#include "test.h"
+#include <time.h>
+#include "../../main/mqtt.c"
+
+settings_t settings;
+
+esp_err_t bus_send_event(event_type_t type, void *data, size_t size)
+{
+    (void)type;
+    (void)data;
+    (void)size;
+    return ESP_OK;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    (void)config;
+    return NULL;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, int event,
+    void (*cb)(void *, esp_event_base_t, int32_t, void *), void *arg)
+{
+    (void)client;
+    (void)event;
+    (void)cb;
+    (void)arg;
+    return ESP_OK;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char *topic, int qos)
+{
+    (void)client;
+    (void)topic;
+    (void)qos;
+    return 1;
+}
+
+int esp_mqtt_client_unsubscribe(esp_mqtt_client_handle_t client, const char *topic)
+{
+    (void)client;
+    (void)topic;
+    return 1;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
+{
+    (void)client;
+    (void)topic;
+    (void)data;
+    (void)len;
+    (void)qos;
+    (void)retain;
+    return 1;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    (void)client;
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    (void)client;
+    return ESP_OK;
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    (void)item;
+    return NULL;
+}
+
+void cJSON_free(void *p)
+{
+    free(p);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define MAX_CALLS 16
+
+static struct
+{
+    const char *name;
+    char topic[64];
+    char data[MQTT_BUFFER_SIZE];
+    size_t len;
+} calls[MAX_CALLS];
+static size_t calls_count = 0;
+
+static void record(const char *topic, const char *data, size_t data_len, void *ctx)
+{
+    TEST_ASSERT(calls_count < MAX_CALLS);
+    calls[calls_count].name = ctx;
+    strncpy(calls[calls_count].topic, topic, sizeof(calls[calls_count].topic) - 1);
+    memcpy(calls[calls_count].data, data, data_len);
+    calls[calls_count].len = data_len;
+    calls_count++;
+}
+
+static bool called(const char *name)
+{
+    for (size_t i = 0; i < calls_count; i++)
+        if (!strcmp(calls[i].name, name))
+            return true;
+    return false;
+}
+
+// Deliver message as MQTT client does, in fragments of `fragment` bytes
+static void deliver(const char *topic, const char *data, size_t len, size_t fragment)
+{
+    size_t offset = 0;
+    do
+    {
+        size_t n = len - offset < fragment ? len - offset : fragment;
+        esp_mqtt_event_t e = {
+            .event_id = MQTT_EVENT_DATA,
+            .topic = offset ? NULL : (char *)topic,
+            .topic_len = offset ? 0 : (int)strlen(topic),
+            .data = (char *)data + offset,
+            .data_len = (int)n,
+            .total_data_len = (int)len,
+            .current_data_offset = (int)offset,
+        };
+        on_data(&e);
+        offset += n;
+    } while (offset < len);
+}
+
+static void deliver_fragment(const char *topic, const char *data, size_t len, size_t total, size_t offset)
+{
+    esp_mqtt_event_t e = {
+        .event_id = MQTT_EVENT_DATA,
+        .topic = offset ? NULL : (char *)topic,
+        .topic_len = offset ? 0 : (int)strlen(topic),
+        .data = (char *)data,
+        .data_len = (int)len,
+        .total_data_len = (int)total,
+        .current_data_offset = (int)offset,
+    };
+    on_data(&e);
+}
+
+static void reset_calls()
+{
+    calls_count = 0;
+}
+
+static void test_exact_and_wildcards()
+{
+    TEST_ASSERT(mqtt_subscribe("node/a/set", record, 0, "exact") >= 0);
+    TEST_ASSERT(mqtt_subscribe("node/+/set", record, 0, "plus") >= 0);
+    TEST_ASSERT(mqtt_subscribe("node/#", record, 0, "hash") >= 0);
+    TEST_ASSERT(mqtt_subscribe("#", record, 0, "all") >= 0);
+
+    reset_calls();
+    deliver("node/a/set", "1", 1, 1024);
+    TEST_ASSERT_EQUAL_INT(4, calls_count);
+    TEST_ASSERT(called("exact") && called("plus") && called("hash") && called("all"));
+
+    reset_calls();
+    deliver("node/b/get", "1", 1, 1024);
+    TEST_ASSERT_EQUAL_INT(2, calls_count);
+    TEST_ASSERT(called("hash") && called("all"));
+
+    // "node/#" also matches its parent level
+    reset_calls();
+    deliver("node", "1", 1, 1024);
+    TEST_ASSERT(called("hash"));
+
+    // wildcards at the first level do not match system topics
+    reset_calls();
+    deliver("$SYS/x", "1", 1, 1024);
+    TEST_ASSERT_EQUAL_INT(0, calls_count);
+
+    mqtt_unsubscribe("node/a/set", record, "exact");
+    mqtt_unsubscribe("node/+/set", record, "plus");
+    mqtt_unsubscribe("node/#", record, "hash");
+    mqtt_unsubscribe("#", record, "all");
+    TEST_ASSERT(!topics && !wildcards);
+
+    reset_calls();
+    deliver("node/a/set", "1", 1, 1024);
+    TEST_ASSERT_EQUAL_INT(0, calls_count);
+}
+
+static void test_table_growth()
+{
+    char topic[32];
+    for (int i = 0; i < 200; i++)
+    {
+        snprintf(topic, sizeof(topic), "node/dev%d/set", i);
+        TEST_ASSERT(mqtt_subscribe(topic, record, 0, "many") >= 0);
+    }
+    for (int i = 0; i < 200; i += 7)
+    {
+        reset_calls();
+        snprintf(topic, sizeof(topic), "node/dev%d/set", i);
+        deliver(topic, "x", 1, 1024);
+        TEST_ASSERT_EQUAL_INT(1, calls_count);
+        TEST_ASSERT_EQUAL_STRING(topic, calls[0].topic);
+    }
+    for (int i = 0; i < 200; i++)
+    {
+        snprintf(topic, sizeof(topic), "node/dev%d/set", i);
+        mqtt_unsubscribe(topic, record, "many");
+    }
+    TEST_ASSERT(!topics);
+}
+
+// Subscribe and unsubscribe cycles leave tombstones, they must not grow the table
+static void test_table_churn()
+{
+    char topic[32];
+    for (int i = 0; i < 10; i++)
+    {
+        snprintf(topic, sizeof(topic), "node/dev%d/set", i);
+        TEST_ASSERT(mqtt_subscribe(topic, record, 0, "kept") >= 0);
+    }
+    for (int i = 0; i < 10000; i++)
+    {
+        snprintf(topic, sizeof(topic), "node/tmp%d/set", i);
+        TEST_ASSERT(mqtt_subscribe(topic, record, 0, "tmp") >= 0);
+        mqtt_unsubscribe(topic, record, "tmp");
+        TEST_ASSERT(slots_used * 4 < slots_capacity * 3);
+    }
+    // sized by 10 live topics, left over capacity of the previous test is released
+    TEST_ASSERT_EQUAL_INT(32, slots_capacity);
+    TEST_ASSERT_EQUAL_INT(10, slots_live);
+
+    // same topic takes its tombstone back
+    snprintf(topic, sizeof(topic), "node/dev0/set");
+    mqtt_unsubscribe(topic, record, "kept");
+    size_t used = slots_used;
+    TEST_ASSERT(mqtt_subscribe(topic, record, 0, "kept") >= 0);
+    TEST_ASSERT_EQUAL_INT(used, slots_used);
+
+    for (int i = 0; i < 10; i++)
+    {
+        reset_calls();
+        snprintf(topic, sizeof(topic), "node/dev%d/set", i);
+        deliver(topic, "x", 1, 1024);
+        TEST_ASSERT_EQUAL_INT(1, calls_count);
+        mqtt_unsubscribe(topic, record, "kept");
+    }
+    TEST_ASSERT(!topics);
+    TEST_ASSERT_EQUAL_INT(0, slots_live);
+}
+
+static void test_fragments()
+{
+    static char payload[5000];
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = (char)('a' + i % 26);
+    size_t allocations = host_allocations;
+    TEST_ASSERT(mqtt_subscribe("node/cfg", record, 0, "cfg") >= 0);
+    // allocator hook is live
+    TEST_ASSERT(host_allocations > allocations);
+
+    // reassembled in order
+    reset_calls();
+    deliver("node/cfg", payload, sizeof(payload), 1024);
+    TEST_ASSERT_EQUAL_INT(1, calls_count);
+    TEST_ASSERT_EQUAL_INT(sizeof(payload), calls[0].len);
+    TEST_ASSERT(!memcmp(calls[0].data, payload, sizeof(payload)));
+
+    // replayed fragment drops the message
+    reset_calls();
+    deliver_fragment("node/cfg", payload, 1024, sizeof(payload), 0);
+    deliver_fragment("node/cfg", payload + 1024, 1024, sizeof(payload), 1024);
+    deliver_fragment("node/cfg", payload + 1024, 1024, sizeof(payload), 1024);
+    deliver_fragment("node/cfg", payload + 2048, 2952, sizeof(payload), 2048);
+    TEST_ASSERT_EQUAL_INT(0, calls_count);
+
+    // skipped fragment drops the message
+    deliver_fragment("node/cfg", payload, 1024, sizeof(payload), 0);
+    deliver_fragment("node/cfg", payload + 2048, 2952, sizeof(payload), 2048);
+    TEST_ASSERT_EQUAL_INT(0, calls_count);
+
+    // fragment beyond the announced size drops the message
+    deliver_fragment("node/cfg", payload, 1024, 2000, 0);
+    deliver_fragment("node/cfg", payload + 1024, 1024, 2000, 1024);
+    TEST_ASSERT_EQUAL_INT(0, calls_count);
+
+    // new message restarts reassembly of an unfinished one
+    deliver_fragment("node/cfg", payload, 1024, sizeof(payload), 0);
+    deliver("node/cfg", "short", 5, 1024);
+    TEST_ASSERT_EQUAL_INT(1, calls_count);
+    TEST_ASSERT_EQUAL_INT(5, calls[0].len);
+
+    // too big message is rejected with all its fragments
+    static char big[MQTT_BUFFER_SIZE + 1];
+    reset_calls();
+    deliver("node/cfg", big, sizeof(big), 1024);
+    TEST_ASSERT_EQUAL_INT(0, calls_count);
+
+    // and next message is received again
+    deliver("node/cfg", payload, sizeof(payload), 700);
+    TEST_ASSERT_EQUAL_INT(1, calls_count);
+    TEST_ASSERT(!memcmp(calls[0].data, payload, sizeof(payload)));
+
+    // steady state delivery does not touch the heap, fragmented or not
+    allocations = host_allocations;
+    for (int i = 0; i < 100; i++)
+    {
+        reset_calls();
+        deliver("node/cfg", payload, sizeof(payload), 1024);
+        deliver("node/cfg", "short", 5, 1024);
+        TEST_ASSERT_EQUAL_INT(2, calls_count);
+    }
+    TEST_ASSERT_EQUAL_INT(allocations, host_allocations);
+
+    mqtt_unsubscribe("node/cfg", record, "cfg");
+}
+
+static const char *self_topic;
+static const char *victim_topic;
+static void *victim_ctx;
+
+// Unsubscribes itself and the victim while dispatch iterates them
+static void unsubscriber(const char *topic, const char *data, size_t data_len, void *ctx)
+{
+    record(topic, data, data_len, ctx);
+    mqtt_unsubscribe(self_topic, unsubscriber, ctx);
+    mqtt_unsubscribe(victim_topic, record, victim_ctx);
+}
+
+static void test_unsubscribe_in_callback()
+{
+    // exact topic: next subscription of the same topic is removed
+    TEST_ASSERT(mqtt_subscribe("node/x", record, 0, "second") >= 0);
+    TEST_ASSERT(mqtt_subscribe("node/x", unsubscriber, 0, "first") >= 0);
+    self_topic = "node/x";
+    victim_topic = "node/x";
+    victim_ctx = "second";
+    reset_calls();
+    deliver("node/x", "1", 1, 1024);
+    TEST_ASSERT_EQUAL_INT(1, calls_count);
+    TEST_ASSERT_EQUAL_STRING("first", calls[0].name);
+    TEST_ASSERT(!topics);
+
+    // wildcards: trie nodes of both filters are pruned during matching
+    TEST_ASSERT(mqtt_subscribe("node/+/y/#", unsubscriber, 0, "plus") >= 0);
+    TEST_ASSERT(mqtt_subscribe("node/a/y/z", record, 0, "exact") >= 0);
+    TEST_ASSERT(mqtt_subscribe("node/a/+/z", record, 0, "victim") >= 0);
+    self_topic = "node/+/y/#";
+    victim_topic = "node/a/+/z";
+    victim_ctx = "victim";
+    reset_calls();
+    deliver("node/a/y/z", "1", 1, 1024);
+    TEST_ASSERT(called("plus") && called("exact"));
+    TEST_ASSERT(!wildcards);
+
+    reset_calls();
+    deliver("node/a/y/z", "1", 1, 1024);
+    TEST_ASSERT_EQUAL_INT(1, calls_count);
+    TEST_ASSERT_EQUAL_STRING("exact", calls[0].name);
+    mqtt_unsubscribe("node/a/y/z", record, "exact");
+    TEST_ASSERT(!topics);
+}
+
+static void count(const char *topic, const char *data, size_t data_len, void *ctx)
+{
+    (void)topic;
+    (void)data;
+    (void)data_len;
+    (*(int *)ctx)++;
+}
+
+static double elapsed_ns(const struct timespec *start, const struct timespec *end)
+{
+    return (double)(end->tv_sec - start->tv_sec) * 1e9 + (double)(end->tv_nsec - start->tv_nsec);
+}
+
+// Dispatch cost of `subs` subscriptions of the format, messages go to all of them in turn
+static void benchmark(const char *fmt, int subs)
+{
+    char topic[32];
+    int hits = 0;
+    for (int i = 0; i < subs; i++)
+    {
+        snprintf(topic, sizeof(topic), fmt, i);
+        TEST_ASSERT(mqtt_subscribe(topic, count, 0, &hits) >= 0);
+    }
+
+    const int rounds = 100000;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; i++)
+    {
+        snprintf(topic, sizeof(topic), "node/dev%d/set", i % subs);
+        deliver(topic, "1", 1, 1024);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TEST_ASSERT_EQUAL_INT(rounds, hits);
+    printf("dispatch: %4d %-8s subscriptions, %.0f ns per message\n", subs,
+        strchr(fmt, '+') ? "wildcard" : "exact", elapsed_ns(&start, &end) / rounds);
+
+    for (int i = 0; i < subs; i++)
+    {
+        snprintf(topic, sizeof(topic), fmt, i);
+        mqtt_unsubscribe(topic, count, &hits);
+    }
+    TEST_ASSERT(!topics);
+}
+
+// Not a pass/fail check, prints how dispatch cost scales with the number of subscriptions
+static void test_dispatch_benchmark()
+{
+    static const int sizes[] = { 10, 100, 1000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        benchmark("node/dev%d/set", sizes[i]);
+        benchmark("node/dev%d/+", sizes[i]);
+    }
+}
+
+int main()
+{
+    TEST_ASSERT_EQUAL_INT(ESP_OK, mqtt_init());
+    RUN_TEST(test_exact_and_wildcards);
+    RUN_TEST(test_table_growth);
+    RUN_TEST(test_table_churn);
+    RUN_TEST(test_fragments);
+    RUN_TEST(test_unsubscribe_in_callback);
+    RUN_TEST(test_dispatch_benchmark);
+    return 0;
+}
@@ -0,0 +1,460 @@
+#include <setjmp.h>
+#include "test.h"
+#include "../../main/node.c"
+
+/*
+ * Node is booted without network: drivers, queues and services are fakes
+ * counting calls, node task runs until its queues are drained.
+ */
+
+#define QUEUE_CAPACITY 64
+
+typedef struct {
+    size_t item_size;
+    size_t head;
+    size_t count;
+    uint8_t data[];
+} fake_queue_t;
+
+static fake_queue_t *set_members[2];
+static size_t set_size = 0;
+static jmp_buf task_exit;
+
+static system_mode_t mode = MODE_INIT;
+settings_t settings = { 0 };
+
+static int driver_inits = 0;
+static int driver_starts = 0;
+static int subscriptions = 0;
+static int rule_updates = 0;
+static int history_appends = 0;
+static int backlog_appends = 0;
+static int published_states = 0;
+static int batches = 0;
+static int batch_entries = 0;
+static bool locked = false; // devices lock of any driver, MQTT must not be called with it
+
+#define FAKE_DRIVER(var, drv_name) driver_t var = { .name = drv_name }
+
+FAKE_DRIVER(drv_gh_io, "gh_io");
+FAKE_DRIVER(drv_gh_adc, "gh_adc");
+FAKE_DRIVER(drv_ph_meter, "gh_ph_meter");
+FAKE_DRIVER(drv_rht, "rht");
+FAKE_DRIVER(drv_ds18b20, "ds18b20");
+FAKE_DRIVER(drv_dht, "dht");
+FAKE_DRIVER(drv_gh_dimmer, "gh_dimmer");
+FAKE_DRIVER(drv_pid, "pid");
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    (void)length;
+    fake_queue_t *q = calloc(1, sizeof(fake_queue_t) + QUEUE_CAPACITY * item_size);
+    q->item_size = item_size;
+    return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+    (void)timeout;
+    fake_queue_t *q = queue;
+    if (q->count == QUEUE_CAPACITY)
+        return pdFALSE;
+    memcpy(q->data + ((q->head + q->count) % QUEUE_CAPACITY) * q->item_size, item, q->item_size);
+    q->count++;
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+    (void)timeout;
+    fake_queue_t *q = queue;
+    if (!q->count)
+        return pdFALSE;
+    memcpy(item, q->data + q->head * q->item_size, q->item_size);
+    q->head = (q->head + 1) % QUEUE_CAPACITY;
+    q->count--;
+    return pdTRUE;
+}
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t length)
+{
+    (void)length;
+    return set_members;
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t member, QueueSetHandle_t set)
+{
+    (void)set;
+    set_members[set_size++] = member;
+    return pdPASS;
+}
+
+// Node task leaves its loop when there is nothing to wait for
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t set, TickType_t timeout)
+{
+    (void)set;
+    (void)timeout;
+    for (size_t i = 0; i < set_size; i++)
+        if (set_members[i]->count)
+            return set_members[i];
+    longjmp(task_exit, 1);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+    UBaseType_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+    (void)fn;
+    (void)name;
+    (void)stack;
+    (void)arg;
+    (void)priority;
+    (void)handle;
+    (void)core;
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    (void)ticks;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return 0;
+}
+
+system_mode_t system_mode()
+{
+    return mode;
+}
+
+void system_set_mode(system_mode_t m)
+{
+    mode = m;
+}
+
+esp_err_t settings_load_driver_config(const char *name, char *buf, size_t max_size)
+{
+    (void)name;
+    (void)buf;
+    (void)max_size;
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t settings_save_driver_config(const char *name, const char *config)
+{
+    (void)name;
+    (void)config;
+    return ESP_OK;
+}
+
+esp_err_t driver_init(driver_t *drv, const char *config, size_t cfg_len)
+{
+    (void)config;
+    (void)cfg_len;
+    driver_inits++;
+    drv->state = DRIVER_INITIALIZED;
+    return ESP_OK;
+}
+
+esp_err_t driver_start(driver_t *drv)
+{
+    if (drv->state != DRIVER_INITIALIZED)
+        return ESP_ERR_INVALID_STATE;
+    driver_starts++;
+    drv->state = DRIVER_RUNNING;
+    return ESP_OK;
+}
+
+esp_err_t driver_stop(driver_t *drv)
+{
+    drv->state = DRIVER_FINISHED;
+    return ESP_OK;
+}
+
+void driver_lock_devices(driver_t *drv)
+{
+    (void)drv;
+    TEST_ASSERT(!locked);
+    locked = true;
+}
+
+void driver_unlock_devices(driver_t *drv)
+{
+    (void)drv;
+    TEST_ASSERT(locked);
+    locked = false;
+}
+
+void driver_send_device_update(driver_t *drv, device_t *dev)
+{
+    (void)drv;
+    (void)dev;
+    TEST_ASSERT(locked);
+}
+
+void driver_flush_updates(driver_t *drv)
+{
+    (void)drv;
+}
+
+bool driver_fetch_device_update(const driver_update_t *u, device_t *dev, bool *report)
+{
+    *dev = u->sender->devices[u->index];
+    *report = true;
+    return true;
+}
+
+bool driver_fetch_batch_update(device_t *dev)
+{
+    bool res = dev->update.dirty;
+    dev->update.dirty = false;
+    return res;
+}
+
+void device_init_discovery_cache()
+{
+}
+
+void device_reset_discovery_cache()
+{
+}
+
+bool device_publish_discovery(device_t *dev, const char *group)
+{
+    TEST_ASSERT(!locked);
+    (void)dev;
+    (void)group;
+    return false;
+}
+
+void device_unpublish_discovery(device_t *dev)
+{
+    (void)dev;
+}
+
+void device_publish_state(device_t *dev)
+{
+    TEST_ASSERT(!locked);
+    (void)dev;
+    published_states++;
+}
+
+void device_publish_batch_state(const char *group, const char *data, size_t len)
+{
+    TEST_ASSERT(!locked);
+    (void)group;
+    TEST_ASSERT(len <= sizeof(batch));
+    TEST_ASSERT(data[0] == '{' && data[len - 1] == '}');
+    batches++;
+    for (size_t i = 0; i < len; i++)
+        batch_entries += data[i] == ':';
+}
+
+int device_format_state(const device_t *dev, char *buf, size_t size)
+{
+    return snprintf(buf, size, "%g", dev->sensor.value);
+}
+
+bool device_report_due(device_t *dev, int64_t now)
+{
+    (void)dev;
+    (void)now;
+    return true;
+}
+
+float device_value(const device_t *dev)
+{
+    return dev->sensor.value;
+}
+
+void device_subscribe(device_t *dev)
+{
+    (void)dev;
+}
+
+void device_unsubscribe(device_t *dev)
+{
+    (void)dev;
+}
+
+int mqtt_subscribe(const char *topic, mqtt_callback_t cb, int qos, void *ctx)
+{
+    TEST_ASSERT(!locked);
+    (void)topic;
+    (void)cb;
+    (void)qos;
+    (void)ctx;
+    subscriptions++;
+    return 0;
+}
+
+int mqtt_subscribe_subtopic(const char *subtopic, mqtt_callback_t cb, int qos, void *ctx)
+{
+    return mqtt_subscribe(subtopic, cb, qos, ctx);
+}
+
+int mqtt_publish_json_subtopic(const char *subtopic, const cJSON *json, int qos, int retain)
+{
+    (void)subtopic;
+    (void)json;
+    (void)qos;
+    (void)retain;
+    return 0;
+}
+
+esp_err_t scheduler_init()
+{
+    return ESP_OK;
+}
+
+esp_err_t rules_init()
+{
+    return ESP_OK;
+}
+
+void rules_on_update(const device_t *dev)
+{
+    (void)dev;
+    rule_updates++;
+}
+
+TickType_t rules_process()
+{
+    return portMAX_DELAY;
+}
+
+esp_err_t backlog_init()
+{
+    return ESP_OK;
+}
+
+void backlog_append(const device_t *dev)
+{
+    (void)dev;
+    backlog_appends++;
+}
+
+TickType_t backlog_process()
+{
+    return portMAX_DELAY;
+}
+
+esp_err_t history_init()
+{
+    return ESP_OK;
+}
+
+void history_append(const device_t *dev)
+{
+    (void)dev;
+    history_appends++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static device_t probe = { .uid = "probe", .type = DEV_SENSOR, .sensor = { .value = 21.5f } };
+
+static void send_updates(size_t count)
+{
+    drv_ds18b20.devices[0].sensor.value += 0.5f;
+    for (size_t i = 0; i < count; i++)
+    {
+        driver_update_t u = { .sender = &drv_ds18b20, .index = 0 };
+        TEST_ASSERT(xQueueSend(update_queue, &u, 0));
+    }
+}
+
+static void run_node_task()
+{
+    if (!setjmp(task_exit))
+        node_task(NULL);
+}
+
+static void reset_counters()
+{
+    rule_updates = history_appends = backlog_appends = published_states = 0;
+}
+
+static void test_offline_boot()
+{
+    TEST_ASSERT_EQUAL_INT(ESP_OK, node_init());
+    cvector_push_back(drv_ds18b20.devices, probe);
+
+    TEST_ASSERT_EQUAL_INT(MODE_OFFLINE, system_mode());
+    TEST_ASSERT_EQUAL_INT(cvector_size(drivers), driver_inits);
+    TEST_ASSERT_EQUAL_INT(cvector_size(drivers), driver_starts);
+    for (size_t i = 0; i < cvector_size(drivers); i++)
+        TEST_ASSERT_EQUAL_INT(DRIVER_RUNNING, drivers[i]->state);
+    TEST_ASSERT_EQUAL_INT(0, subscriptions);
+
+    // offline updates feed rules, history and backlog
+    send_updates(3);
+    run_node_task();
+    TEST_ASSERT_EQUAL_INT(3, rule_updates);
+    TEST_ASSERT_EQUAL_INT(3, history_appends);
+    TEST_ASSERT_EQUAL_INT(3, backlog_appends);
+    TEST_ASSERT_EQUAL_INT(0, published_states);
+}
+
+static void test_online_does_not_restart()
+{
+    reset_counters();
+    node_online();
+    TEST_ASSERT_EQUAL_INT(MODE_ONLINE, system_mode());
+    TEST_ASSERT_EQUAL_INT(cvector_size(drivers), driver_starts);
+    TEST_ASSERT(subscriptions > 0);
+
+    send_updates(2);
+    run_node_task();
+    TEST_ASSERT_EQUAL_INT(2, rule_updates);
+    TEST_ASSERT_EQUAL_INT(2, history_appends);
+    TEST_ASSERT_EQUAL_INT(0, backlog_appends);
+    // one state of the probe was published by node_online()
+    TEST_ASSERT_EQUAL_INT(3, published_states);
+
+    node_offline();
+    node_online();
+    TEST_ASSERT_EQUAL_INT(cvector_size(drivers), driver_starts);
+}
+
+static void test_set_config_offline()
+{
+    node_offline();
+    reset_counters();
+    int starts = driver_starts;
+    static const char config[] = "{}";
+    drv_pid.defconfig = "{}";
+    on_set_config("", config, sizeof(config) - 1, &drv_pid);
+    TEST_ASSERT_EQUAL_INT(starts + 1, driver_starts);
+    TEST_ASSERT_EQUAL_INT(DRIVER_RUNNING, drv_pid.state);
+    TEST_ASSERT_EQUAL_INT(0, published_states);
+}
+
+static void test_batch_split()
+{
+    node_online();
+    drv_gh_adc.batch_state = true;
+    const size_t count = 2 * NODE_BATCH_STATE_SIZE / (DEVICE_UID_SIZE + 8);
+    for (size_t i = 0; i < count; i++)
+    {
+        device_t dev = { .type = DEV_SENSOR, .sensor = { .value = i }, .update = { .dirty = true } };
+        snprintf(dev.uid, sizeof(dev.uid), "gh_adc_sensor_%05zu", i);
+        cvector_push_back(drv_gh_adc.devices, dev);
+    }
+
+    driver_update_t u = { .sender = &drv_gh_adc, .index = DRIVER_UPDATE_FLUSH };
+    TEST_ASSERT(xQueueSend(update_queue, &u, 0));
+    run_node_task();
+    TEST_ASSERT(batches > 1);
+    TEST_ASSERT_EQUAL_INT(count, batch_entries);
+}
+
+int main()
+{
+    RUN_TEST(test_offline_boot);
+    RUN_TEST(test_online_does_not_restart);
+    RUN_TEST(test_set_config_offline);
+    RUN_TEST(test_batch_split);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "test.h"
+#include "phase.h"
+
+#define LEVELS 101
+#define HALF_US 10000 // 50 Hz mains
+#define GATE_US 100
+
+static uint32_t table[LEVELS];
+
+// RMS power fraction of a half period fired after `delay_us`, numeric integral of sin^2
+static double simulate_power(uint32_t delay_us)
+{
+    const int steps = 20000;
+    double on = 0, full = 0;
+    for (int i = 0; i < steps; i++)
+    {
+        double t = (i + 0.5) / steps;
+        double p = sin(M_PI * t) * sin(M_PI * t);
+        full += p;
+        if (t * HALF_US >= delay_us)
+            on += p;
+    }
+    return on / full;
+}
+
+static void test_power_curve()
+{
+    phase_build_table(table, LEVELS, true, 1.0f, 0, 1);
+    TEST_ASSERT_EQUAL_INT(PHASE_FIRE_OFF, table[0]);
+    for (int i = 1; i < LEVELS; i++)
+    {
+        // delays decrease with level, power matches the level
+        TEST_ASSERT(i == 1 || table[i] <= table[i - 1]);
+        double angle = (double)table[i] / PHASE_FIRE_ONE * M_PI;
+        TEST_ASSERT_FLOAT_WITHIN(1e-4, i / 100.0, phase_conduction_power(angle));
+    }
+    // half power at quarter period
+    TEST_ASSERT_FLOAT_WITHIN(2, PHASE_FIRE_ONE / 2, table[50]);
+}
+
+static void test_linear_curve()
+{
+    phase_build_table(table, LEVELS, false, 1.0f, 0, 1);
+    for (int i = 1; i < LEVELS; i++)
+        TEST_ASSERT_FLOAT_WITHIN(1, (1.0 - i / 100.0) * PHASE_FIRE_ONE, table[i]);
+}
+
+static void test_level_range()
+{
+    // levels are spread over 20..80 % of power, squared
+    phase_build_table(table, LEVELS, true, 2.0f, 0.2f, 0.8f);
+    double angle = (double)table[1] / PHASE_FIRE_ONE * M_PI;
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.2 + 0.6 * 1e-4, phase_conduction_power(angle));
+    angle = (double)table[50] / PHASE_FIRE_ONE * M_PI;
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.2 + 0.6 * 0.25, phase_conduction_power(angle));
+    angle = (double)table[100] / PHASE_FIRE_ONE * M_PI;
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0.8, phase_conduction_power(angle));
+}
+
+static void test_fire_delay_clamp()
+{
+    // never closer to zero crossing than the guard, gate pulse ends before the next crossing
+    TEST_ASSERT_EQUAL_INT(PHASE_GUARD_US, phase_fire_delay(0, HALF_US, 0, GATE_US));
+    TEST_ASSERT_EQUAL_INT(HALF_US - PHASE_GUARD_US - GATE_US, phase_fire_delay(PHASE_FIRE_ONE, HALF_US, 0, GATE_US));
+    TEST_ASSERT_EQUAL_INT(HALF_US / 2, phase_fire_delay(PHASE_FIRE_ONE / 2, HALF_US, 0, GATE_US));
+    // detector offset shifts the firing point
+    TEST_ASSERT_EQUAL_INT(HALF_US / 2 - 300, phase_fire_delay(PHASE_FIRE_ONE / 2, HALF_US, -300, GATE_US));
+    TEST_ASSERT_EQUAL_INT(PHASE_GUARD_US, phase_fire_delay(100, HALF_US, -1000, GATE_US));
+}
+
+static void test_firing_simulation()
+{
+    // delivered power over mains half periods follows the level, except the clamped ends
+    phase_build_table(table, LEVELS, true, 1.0f, 0, 1);
+    for (int i = 3; i < 98; i++)
+    {
+        uint32_t delay = phase_fire_delay(table[i], HALF_US, 0, GATE_US);
+        TEST_ASSERT_FLOAT_WITHIN(2e-3, i / 100.0, simulate_power(delay));
+    }
+    // 60 Hz mains keeps the same power at the same level
+    uint32_t delay = phase_fire_delay(table[30], 8333, 0, GATE_US);
+    TEST_ASSERT_FLOAT_WITHIN(2e-3, 0.3, phase_conduction_power(M_PI * delay / 8333.0));
+}
+
+int main()
+{
+    RUN_TEST(test_power_curve);
+    RUN_TEST(test_linear_curve);
+    RUN_TEST(test_level_range);
+    RUN_TEST(test_fire_delay_clamp);
+    RUN_TEST(test_firing_simulation);
+    return 0;
+}
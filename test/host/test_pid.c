@@ -0,0 +1,110 @@
+#include "test.h"
+#include "pid.h"
+
+#define TAU 20.0f // s, time constant of the first order plant
+
+// First order plant with unit gain, returns the final process variable
+static float simulate(pid_ctl_t *pid, float setpoint, float duration, const float *steps, size_t steps_count,
+    float *peak)
+{
+    float y = 0, t = 0;
+    *peak = 0;
+    for (size_t i = 0; t < duration; i++)
+    {
+        float dt = steps[i % steps_count];
+        float u = pid_update(pid, setpoint, y, dt);
+        y += (u - y) * (1.0f - expf(-dt / TAU));
+        t += dt;
+        if (y > *peak)
+            *peak = y;
+    }
+    return y;
+}
+
+static void test_step_response()
+{
+    static const float uniform[] = { 1 };
+    pid_config_t cfg = { .kp = 2, .ki = 0.2f, .kd = 1, .out_min = 0, .out_max = 100 };
+    pid_ctl_t pid;
+    pid_init(&pid, &cfg);
+
+    float peak;
+    float y = simulate(&pid, 50, 200, uniform, 1, &peak);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 50, y);
+    // anti-windup keeps overshoot of the saturated start small
+    TEST_ASSERT(peak < 55);
+}
+
+static void test_jittered_period()
+{
+    // late and early updates with measured dt settle the same way
+    static const float uniform[] = { 1 };
+    static const float jittered[] = { 1, 1.8f, 0.4f, 1, 0.6f, 1.2f };
+    pid_config_t cfg = { .kp = 2, .ki = 0.2f, .kd = 1, .out_min = 0, .out_max = 100 };
+    pid_ctl_t a, b;
+    pid_init(&a, &cfg);
+    pid_init(&b, &cfg);
+
+    float peak_a, peak_b;
+    float ya = simulate(&a, 50, 200, uniform, 1, &peak_a);
+    float yb = simulate(&b, 50, 200, jittered, 6, &peak_b);
+    TEST_ASSERT_FLOAT_WITHIN(0.1, ya, yb);
+    TEST_ASSERT_FLOAT_WITHIN(1.5, peak_a, peak_b);
+    TEST_ASSERT_FLOAT_WITHIN(0.5, a.integral, b.integral);
+}
+
+static void test_reverse()
+{
+    // cooling: output lowers the process variable from ambient 80
+    pid_config_t cfg = { .kp = 2, .ki = 0.2f, .out_min = 0, .out_max = 100, .reverse = true };
+    pid_ctl_t pid;
+    pid_init(&pid, &cfg);
+
+    float y = 80;
+    for (int i = 0; i < 300; i++)
+    {
+        float u = pid_update(&pid, 50, y, 1);
+        y += (80 - u * 0.5f - y) / TAU;
+    }
+    TEST_ASSERT_FLOAT_WITHIN(0.1, 50, y);
+}
+
+static void test_anti_windup()
+{
+    // unreachable setpoint, integral must stop growing at saturation
+    pid_config_t cfg = { .kp = 1, .ki = 1, .out_min = 0, .out_max = 10 };
+    pid_ctl_t pid;
+    pid_init(&pid, &cfg);
+
+    for (int i = 0; i < 100; i++)
+        TEST_ASSERT(pid_update(&pid, 100, 0, 1) <= 10);
+    TEST_ASSERT(pid.integral <= 10);
+
+    // output leaves saturation as soon as the error changes sign
+    TEST_ASSERT(pid_update(&pid, 0, 20, 1) < 10);
+}
+
+static void test_bias_and_reset()
+{
+    pid_config_t cfg = { .kp = 1, .ki = 1, .out_min = 0, .out_max = 100, .bias = 30 };
+    pid_ctl_t pid;
+    pid_init(&pid, &cfg);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 30, pid.output);
+
+    pid_update(&pid, 10, 0, 1);
+    TEST_ASSERT(pid.integral > 0);
+    pid_reset(&pid);
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 0, pid.integral);
+    // zero error gives the bias, no derivative kick on the first update
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, 30, pid_update(&pid, 5, 5, 1));
+}
+
+int main()
+{
+    RUN_TEST(test_step_response);
+    RUN_TEST(test_jittered_period);
+    RUN_TEST(test_reverse);
+    RUN_TEST(test_anti_windup);
+    RUN_TEST(test_bias_and_reset);
+    return 0;
+}